@@ -61,6 +61,7 @@
 //#ifdef __CUDACC__
 #include "ewGpuNode.cuh"
 //#endif
+#include "ewCpuNode.h"
 
 CNode *gNode;
 
@@ -101,10 +102,12 @@ int main(int argc, char **argv)
 
     int      ierr, argn;
     long int elapsed;
-    int      lastProgress, lastPropagation, lastDump;
+    int      lastProgress, lastPropagation, lastDump, lastCheckpoint;
+    int      startTime;
     int      loop;
 
     double dAccumulateIOReadTime(0.0);
+    double dSourceTime(0.0);
     ////printf(HEADER);
     Err.setchannel(MSG_OUTFILE);
 
@@ -122,7 +125,19 @@ int main(int argc, char **argv)
     }
     Log.print("%s", ss.str().c_str());
 
-    gNode = new CGpuNode();
+    // Many sources over one bathymetry on the CPU, see ewEnsemble.cpp
+    if (Par.fileEnsemble) {
+        ierr = ewRunEnsemble(dAccumulateIOReadTime);
+        if (ierr)
+            return ierr;
+        LOG("Program successfully completed");
+        return 0;
+    }
+
+    if (Par.cpu)
+        gNode = new CCpuNode();
+    else
+        gNode = new CGpuNode();
     assert(gNode != nullptr);
     CNode &Node = *gNode;
 
@@ -136,17 +151,36 @@ int main(int argc, char **argv)
     if (ierr)
         return ierr;
 
-    // Init tsunami with faults or uplift-grid
-    ierr = ewSource(dAccumulateIOReadTime); // I/O (FileHandler / fread)
-    if (ierr)
-        return ierr;
-    Log.print("Read source from %s", Par.fileSource);
+    startTime       = 0;
+    lastProgress    = Par.outProgress;
+    lastPropagation = Par.outPropagation;
+    if (Par.fileRestart) {
+        // Continue from a checkpoint
+        ierr = ewLoadCheckpoint(startTime, lastProgress, lastPropagation); // I/O
+        if (ierr)
+            return ierr;
+        Log.print("Restart from %s at %s", Par.fileRestart, utlTimeSplitString(startTime));
+    } else {
+        // Init tsunami with faults or uplift-grid
+        std::chrono::steady_clock::time_point const tpSource(std::chrono::steady_clock::now());
+        ierr = ewSource(dAccumulateIOReadTime); // I/O (FileHandler / fread)
+        if (ierr)
+            return ierr;
+        dSourceTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpSource).count();
+        Log.print("Read source from %s", Par.fileSource);
+    }
 
     // Write model parameters into the log
     ewLogParams();
 
     if (Par.outPropagation) {
-        ewStart2DOutput();
+        ierr = ewStart2DOutput();
+        if (ierr)
+            return ierr;
+    }
+
+    if (Par.outCheckpoint) {
+        ewStartCheckpoints();
     }
 
     Node.copyToGPU();
@@ -164,9 +198,9 @@ int main(int argc, char **argv)
     double                                dAccumulatedIOWriteTime(0.0);
     std::chrono::steady_clock::time_point tpStart;
 
-    for (Par.time = 0, loop = 1, lastProgress = Par.outProgress, lastPropagation = Par.outPropagation, lastDump = 0;
+    for (Par.time = startTime, loop = 1, lastCheckpoint = 0, lastDump = 0;
          Par.time <= Par.timeMax;
-         loop++, Par.time += Par.dt, lastProgress += Par.dt, lastPropagation += Par.dt) {
+         loop++, Par.time += Par.dt, lastProgress += Par.dt, lastPropagation += Par.dt, lastCheckpoint += Par.dt) {
 
         /* FIXME: check if Par.poiDt can be used for those purposes */
         if (Par.filePOIs && Par.poiDt && ((Par.time / Par.poiDt) * Par.poiDt == Par.time)) { // Is this needed?
@@ -206,6 +240,16 @@ int main(int argc, char **argv)
             }
         }
 
+        if (Par.outCheckpoint) {
+            if (lastCheckpoint >= Par.outCheckpoint) {
+                Node.copyState();
+                tpStart = std::chrono::steady_clock::now();
+                ewCheckpoint(lastProgress, lastPropagation);
+                dAccumulatedIOWriteTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+                lastCheckpoint = 0;
+            }
+        }
+
         if (Par.outDump) {
             if ((elapsed - lastDump) >= Par.outDump) {
                 Node.copyIntermediate();
@@ -218,8 +262,24 @@ int main(int argc, char **argv)
     } // main loop
     LOG("Compute loop completed");
 
-    // clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_gettime(CLOCK_MONOTONIC, &end);
     Log.print("Finishing main loop");
+    Log.print("Source generation: %.3f sec, propagation: %.3f sec", dSourceTime, diff(start, end));
+    LOG("Source generation time: " << dSourceTime << " s, propagation time: " << diff(start, end) << " s");
+
+    // wait for the queued propagation snapshots
+    if (Par.outPropagation) {
+        tpStart = std::chrono::steady_clock::now();
+        ewStop2DOutput();
+        dAccumulatedIOWriteTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+    }
+
+    // wait for the last checkpoint
+    if (Par.outCheckpoint) {
+        tpStart = std::chrono::steady_clock::now();
+        ewStopCheckpoints();
+        dAccumulatedIOWriteTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+    }
 
     /* TODO: check if theses calls can be combined */
     Node.copyIntermediate();
@@ -231,7 +291,8 @@ int main(int argc, char **argv)
     ewDump2D();
 
     Node.freeMem();
-    reinterpret_cast<CGpuNode *>(gNode)->PrintTimingStats();
+    if (!Par.cpu)
+        reinterpret_cast<CGpuNode *>(gNode)->PrintTimingStats();
 
     delete gNode;
 
@@ -248,15 +309,22 @@ int commandLineHelp(void)
     printf("Usage: easywave  -grid ...  -source ...  -time ... [optional parameters]\n");
     printf("-grid ...         bathymetry in GoldenSoftware(C) GRD format (text or binary)\n");
     printf("-source ...       input wave either als GRD-file or file with Okada faults\n");
+    printf("-ensemble ...     instead of -source: file with one source and an optional label per line\n");
     printf("-time ...         simulation time in [min]\n");
     printf("Optional parameters:\n");
     printf("-step ...         simulation time step, default- estimated from bathymetry\n");
+    printf("-bathy_cache ...  native copy of the bathymetry, used when up to date and written otherwise\n");
     printf("-coriolis         use Coriolis fource, default- no\n");
     printf("-poi ...          POIs file\n");
     printf("-label ...        model name, default- 'eWave'\n");
     printf("-progress ...     show simulation progress each ... minutes, default- 10\n");
     printf("-propagation ...  write wave propagation grid each ... minutes, default- 5\n");
+    printf("-out_format ...   propagation grid values as float, half or rle (lossless), default- float\n");
+    printf("-out_queue ...    propagation grids waiting for the writer thread, default- 4\n");
     printf("-dump ...         make solution dump each ... physical seconds, default- 0\n");
+    printf("-checkpoint ...   write a checkpoint each ... minutes, default- 0 (none)\n");
+    printf("-checkpoint_file ...  checkpoint file, default- easywave.ckpt\n");
+    printf("-restart ...      continue from a checkpoint instead of -source\n");
     printf("-nolog            deactivate logging\n");
     printf("-poi_dt_out ...   output time step for mariograms in [sec], default- 30\n");
     printf("-poi_search_dist ...  in [km], default- 10\n");
@@ -268,6 +336,8 @@ int commandLineHelp(void)
     printf("-ssh_arrival ...  threshold for arrival times in [m], default- 0.001\n");
     printf("                  negative value considered as relative threshold\n");
     printf("-gpu              start GPU version of EasyWave (requires a CUDA capable device)\n");
+    printf("-cpu              run the time steps on the CPU (OpenMP) instead of the device\n");
+    printf("-cpu_tile ...     width of the column strips per CPU thread, default- 64\n");
     printf("-verbose          generate verbose output on stdout\n");
     printf("\nExample:\n");
     printf("\t easyWave -grid gebcoIndonesia.grd  -source fault.inp  -time 120\n\n");
@@ -288,6 +288,30 @@ int CGpuNode::copyIntermediate()
     return 0;
 }
 
+int CGpuNode::copyState()
+{
+
+    Params &dp = data.params;
+
+    /* sea surface, maximum height and arrival times */
+    if (copyIntermediate() || copyFromGPU())
+        return 1;
+
+#ifdef ENABLE_GPU_TIMINGS
+    std::chrono::steady_clock::time_point const tStart(std::chrono::steady_clock::now());
+#endif
+    CUDA_CALL(cudaMemcpy(fM_1D_aligned, data.fM, dp.nI * dp.pI * sizeof(float), cudaMemcpyDeviceToHost));
+    CUDA_CALL(cudaMemcpy(fN_1D_aligned, data.fN, dp.nI * dp.pI * sizeof(float), cudaMemcpyDeviceToHost));
+#ifdef ENABLE_GPU_TIMINGS
+    std::chrono::steady_clock::time_point const tStop(std::chrono::steady_clock::now());
+    m_vecTimers[TIMER_MEMD2H] += std::chrono::steady_clock::duration(tStop - tStart);
+#endif
+    AlignData(fM_1D_aligned, fM, dp.nI, dp.pI, dp.nJ);
+    AlignData(fN_1D_aligned, fN, dp.nI, dp.pI, dp.nJ);
+
+    return 0;
+}
+
 int CGpuNode::copyPOIs()
 {
 
@@ -318,6 +318,35 @@ int CGpuNode::copyIntermediate()
     }
 }
 
+int CGpuNode::copyState()
+{
+    try {
+        Params &dp = data.params;
+
+        /* sea surface, maximum height and arrival times */
+        copyIntermediate();
+        copyFromGPU();
+
+#ifdef ENABLE_GPU_TIMINGS
+        std::chrono::steady_clock::time_point const tStart(std::chrono::steady_clock::now());
+#endif
+        m_syclHandler->GetQueue().memcpy(fM_1D_aligned, data.fM, dp.nI * dp.pI * sizeof(float)).wait();
+        m_syclHandler->GetQueue().memcpy(fN_1D_aligned, data.fN, dp.nI * dp.pI * sizeof(float)).wait();
+#ifdef ENABLE_GPU_TIMINGS
+        std::chrono::steady_clock::time_point const tStop(std::chrono::steady_clock::now());
+        m_vecTimers[TIMER_MEMD2H] += std::chrono::duration(tStop - tStart);
+#endif
+        AlignData(fM_1D_aligned, fM, dp.nI, dp.pI, dp.nJ);
+        AlignData(fN_1D_aligned, fN, dp.nI, dp.pI, dp.nJ);
+
+        return 0;
+    } catch (sycl::exception const &e) {
+        LOG_ERROR("SYCL exception caught \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception was caught ...");
+    }
+}
+
 int CGpuNode::copyPOIs()
 {
     try {
@@ -177,6 +177,7 @@ class CGpuNode : public CArrayNode
     int  copyFromGPU();
     int  copyIntermediate();
     int  copyPOIs();
+    int  copyState();
     int  freeMem();
     int  run();
     void PrintTimingStats();
@@ -42,9 +42,17 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "utilits.h"
 #include "cOgrd.h"
@@ -246,82 +254,316 @@ int cOgrd::readHeader(const char *grdfile)
 }
 
 //=========================================================================
-// Grid initialization from Golden Software GRD-file
-int cOgrd::readGRD(const char *grdfile)
+// Native grid cache: this header followed by nx*ny floats in idx() order
+struct GrdCacheHeader {
+    char    magic[4]; // "EWGC"
+    int32_t version;
+    int32_t nx, ny;
+    double  xmin, xmax, ymin, ymax;
+    int64_t srcSize; // size and modification time (s, ns) of the GRD-file the cache was made from
+    int64_t srcMtime;
+    int64_t srcMtimeNsec;
+};
+
+#define GRD_CACHE_VERSION 2
+#define GRD_DSBB_HEADER   (4 + 2 * sizeof(unsigned short) + 6 * sizeof(double))
+#define GRD_ASCII_CHUNK   (4 << 20) // bytes of DSAA text parsed by one task
+#define GRD_TILE          64
+
+// Next whitespace-separated token in [p, end); returns its start or NULL, p is moved behind it
+static const char *grdNextToken(const char *&p, const char *end, int &len)
 {
-    FILE  *fp;
-    char   dsaa_label[8];
-    int    i, j, ierr, isBin;
-    short  shval;
-    float  fval;
-    double dval;
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    if (p == end)
+        return NULL;
 
-    // check if bathymetry file is in ascii or binary format
-    if ((fp = fopen(grdfile, "rb")) == NULL)
-        return Err.post("Unable to read file %s", grdfile);
-    memset(dsaa_label, 0, 5);
-    ierr = fread(dsaa_label, 4, 1, fp);
-    if (!strcmp(dsaa_label, "DSAA"))
-        isBin = 0;
-    else if (!strcmp(dsaa_label, "DSBB"))
-        isBin = 1;
-    else {
+    const char *tok = p;
+    while (p < end && !isspace((unsigned char)*p))
+        p++;
+    len = (int)(p - tok);
+
+    return tok;
+}
+
+// The mapped file is not zero-terminated, so tokens are copied before conversion
+static int grdTokenToDouble(const char *tok, int len, double &dval)
+{
+    char buf[64];
+
+    if (tok == NULL || len >= (int)sizeof(buf))
+        return 1;
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    dval     = strtod(buf, NULL);
+
+    return 0;
+}
+
+static int grdReadCache(cOgrd &grd, const char *cachefile, const struct stat &src, float *&data)
+{
+    FILE          *fp;
+    GrdCacheHeader hdr;
+
+    if ((fp = fopen(cachefile, "rb")) == NULL)
+        return 1;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, "EWGC", 4) || hdr.version != GRD_CACHE_VERSION ||
+        hdr.srcSize != (int64_t)src.st_size || hdr.srcMtime != (int64_t)src.st_mtim.tv_sec ||
+        hdr.srcMtimeNsec != (int64_t)src.st_mtim.tv_nsec || hdr.nx < 2 || hdr.ny < 2) {
         fclose(fp);
-        return Err.post("%s is not a GRD-file", grdfile);
+        return 1;
+    }
+
+    data = new float[(size_t)hdr.nx * hdr.ny];
+    if (fread(data, sizeof(float), (size_t)hdr.nx * hdr.ny, fp) != (size_t)hdr.nx * hdr.ny) {
+        delete[] data;
+        data = NULL;
+        fclose(fp);
+        return 1;
     }
     fclose(fp);
 
-    // Read Surfer GRD-file
-    if (isBin) {
-        fp   = fopen(grdfile, "rb");
-        ierr = fread(dsaa_label, 4, 1, fp);
-        ierr = fread(&shval, sizeof(short), 1, fp);
-        nx   = shval;
-        ierr = fread(&shval, sizeof(short), 1, fp);
-        ny   = shval;
-    } else {
-        fp   = fopen(grdfile, "rt");
-        ierr = fscanf(fp, "%7s", dsaa_label);
-        ierr = fscanf(fp, " %d %d ", &nx, &ny);
+    grd.nx   = hdr.nx;
+    grd.ny   = hdr.ny;
+    grd.xmin = hdr.xmin;
+    grd.xmax = hdr.xmax;
+    grd.ymin = hdr.ymin;
+    grd.ymax = hdr.ymax;
+
+    return 0;
+}
+
+static int grdWriteCache(cOgrd &grd, const char *cachefile, const struct stat &src, const float *data)
+{
+    FILE          *fp;
+    GrdCacheHeader hdr;
+    char           tmpfile[1024];
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "EWGC", 4);
+    hdr.version      = GRD_CACHE_VERSION;
+    hdr.nx           = grd.nx;
+    hdr.ny           = grd.ny;
+    hdr.xmin         = grd.xmin;
+    hdr.xmax         = grd.xmax;
+    hdr.ymin         = grd.ymin;
+    hdr.ymax         = grd.ymax;
+    hdr.srcSize      = (int64_t)src.st_size;
+    hdr.srcMtime     = (int64_t)src.st_mtim.tv_sec;
+    hdr.srcMtimeNsec = (int64_t)src.st_mtim.tv_nsec;
+
+    // write to a temporary file first so that concurrent runs never see a partial cache
+    snprintf(tmpfile, sizeof(tmpfile), "%s.%d", cachefile, (int)getpid());
+    if ((fp = fopen(tmpfile, "wb")) == NULL)
+        return 1;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(data, sizeof(float), (size_t)grd.nnod, fp) != (size_t)grd.nnod) {
+        fclose(fp);
+        remove(tmpfile);
+        return 1;
     }
+    fclose(fp);
 
-    nnod = nx * ny;
+    return rename(tmpfile, cachefile) ? 1 : 0;
+}
 
-    if (val)
-        delete[] val;
-    val = new double[nnod];
-    for (int l = 0; l < nnod; l++)
-        val[l] = noval;
+// DSBB: header followed by rows of nx floats; the mapped rows are transposed tile by tile
+static int grdParseBinary(cOgrd &grd, const char *map, size_t size, float *&data)
+{
+    unsigned short shval;
+    double         dval[6];
+
+    if (size < GRD_DSBB_HEADER)
+        return 1;
+
+    memcpy(&shval, map + 4, sizeof(shval));
+    grd.nx = shval;
+    memcpy(&shval, map + 4 + sizeof(shval), sizeof(shval));
+    grd.ny = shval;
+    memcpy(dval, map + 4 + 2 * sizeof(shval), sizeof(dval));
+    grd.xmin = dval[0];
+    grd.xmax = dval[1];
+    grd.ymin = dval[2];
+    grd.ymax = dval[3]; // zmin zmax
+
+    const int nx = grd.nx;
+    const int ny = grd.ny;
+
+    if (nx < 2 || ny < 2 || size < GRD_DSBB_HEADER + sizeof(float) * (size_t)nx * ny)
+        return 1;
+
+    const float *rows = (const float *)(map + GRD_DSBB_HEADER);
+    data              = new float[(size_t)nx * ny];
+
+#pragma omp parallel for schedule(static)
+    for (int jb = 0; jb < ny; jb += GRD_TILE) {
+        for (int ib = 0; ib < nx; ib += GRD_TILE) {
+            const int iEnd = std::min(ib + GRD_TILE, nx);
+            const int jEnd = std::min(jb + GRD_TILE, ny);
+            for (int i = ib; i < iEnd; i++)
+                for (int j = jb; j < jEnd; j++)
+                    data[(size_t)ny * i + j] = rows[(size_t)nx * j + i];
+        }
+    }
 
-    if (isBin) {
-        ierr = fread(&xmin, sizeof(double), 1, fp);
-        ierr = fread(&xmax, sizeof(double), 1, fp);
-        ierr = fread(&ymin, sizeof(double), 1, fp);
-        ierr = fread(&ymax, sizeof(double), 1, fp);
-        ierr = fread(&dval, sizeof(double), 1, fp);
-        ierr = fread(&dval, sizeof(double), 1, fp); // zmin zmax
-    } else {
-        ierr = fscanf(fp, " %lf %lf ", &xmin, &xmax);
-        ierr = fscanf(fp, " %lf %lf ", &ymin, &ymax);
-        ierr = fscanf(fp, " %*s %*s "); // zmin, zmax
+    return 0;
+}
+
+// DSAA: the text after the header is cut at whitespace into chunks that are
+// parsed in parallel; a first pass counts the values of each chunk so that
+// every value knows its position in the grid
+static int grdParseAscii(cOgrd &grd, const char *map, size_t size, float *&data)
+{
+    const char *p   = map;
+    const char *end = map + size;
+    const char *tok;
+    double      hval[8];
+    int         len;
+
+    if (grdNextToken(p, end, len) == NULL) // DSAA
+        return 1;
+    for (int k = 0; k < 8; k++) {
+        tok = grdNextToken(p, end, len);
+        if (grdTokenToDouble(tok, len, hval[k]))
+            return 1;
+    }
+    grd.nx   = (int)hval[0];
+    grd.ny   = (int)hval[1];
+    grd.xmin = hval[2];
+    grd.xmax = hval[3];
+    grd.ymin = hval[4];
+    grd.ymax = hval[5]; // zmin zmax
+
+    const int nx = grd.nx;
+    const int ny = grd.ny;
+
+    if (nx < 2 || ny < 2)
+        return 1;
+
+    const size_t       numChunks = std::max<size_t>(1, (end - p + GRD_ASCII_CHUNK - 1) / GRD_ASCII_CHUNK);
+    std::vector<const char *> bounds(numChunks + 1);
+    std::vector<long>  first(numChunks + 1, 0);
+
+    bounds[0] = p;
+    for (size_t c = 1; c < numChunks; c++) {
+        const char *b = std::max(bounds[c - 1], p + c * GRD_ASCII_CHUNK);
+        while (b < end && !isspace((unsigned char)*b))
+            b++;
+        bounds[c] = b;
+    }
+    bounds[numChunks] = end;
+
+#pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < (long)numChunks; c++) {
+        const char *q = bounds[c];
+        int         l;
+        long        n = 0;
+        while (grdNextToken(q, bounds[c + 1], l) != NULL)
+            n++;
+        first[c + 1] = n;
+    }
+    for (size_t c = 0; c < numChunks; c++)
+        first[c + 1] += first[c];
+
+    if (first[numChunks] < (long)nx * ny)
+        return 2;
+
+    data = new float[(size_t)nx * ny];
+
+#pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < (long)numChunks; c++) {
+        const char *q = bounds[c];
+        const char *t;
+        char        buf[64];
+        int         l;
+        for (long k = first[c]; k < (long)nx * ny && (t = grdNextToken(q, bounds[c + 1], l)) != NULL; k++) {
+            l = std::min(l, (int)sizeof(buf) - 1);
+            memcpy(buf, t, l);
+            buf[l] = '\0';
+            // rows run along x in the file, idx() has y as the inner index
+            data[(size_t)ny * (k % nx) + k / nx] = strtof(buf, NULL);
+        }
     }
 
-    dx = (xmax - xmin) / (nx - 1);
-    dy = (ymax - ymin) / (ny - 1);
+    return 0;
+}
 
-    for (j = 0; j < ny; j++) {
-        for (i = 0; i < nx; i++) {
+//=========================================================================
+// Read a GRD-file into a new float array in idx() order and set the grid
+// geometry; val is not touched. DSBB files are memory-mapped, DSAA files are
+// parsed by several threads. With a cachefile, a native copy of the grid is
+// read from there when it matches the GRD-file and written otherwise.
+int cOgrd::readGRDfloat(const char *grdfile, float *&data, const char *cachefile)
+{
+    struct stat st;
+    int         fd, ierr;
+    char       *map;
 
-            if (isBin)
-                ierr = fread(&fval, sizeof(float), 1, fp);
-            else
-                ierr = fscanf(fp, " %f ", &fval);
+    data = NULL;
 
-            val[idx(i, j)] = (double)fval;
+    if (stat(grdfile, &st) != 0)
+        return Err.post("Unable to read file %s", grdfile);
+
+    if (cachefile == NULL || grdReadCache(*this, cachefile, st, data) != 0) {
+
+        if ((fd = open(grdfile, O_RDONLY)) < 0)
+            return Err.post("Unable to read file %s", grdfile);
+        if (st.st_size < 4 ||
+            (map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == (char *)MAP_FAILED) {
+            close(fd);
+            return Err.post("%s is not a GRD-file", grdfile);
+        }
+        close(fd);
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        if (!strncmp(map, "DSBB", 4))
+            ierr = grdParseBinary(*this, map, st.st_size, data);
+        else if (!strncmp(map, "DSAA", 4))
+            ierr = grdParseAscii(*this, map, st.st_size, data);
+        else
+            ierr = -1;
+
+        munmap(map, st.st_size);
+
+        if (ierr) {
+            delete[] data;
+            data = NULL;
+            if (ierr < 0)
+                return Err.post("%s is not a GRD-file", grdfile);
+            return Err.post("%s: data corrupted", grdfile);
         }
+
+        nnod = nx * ny;
+        if (cachefile != NULL && grdWriteCache(*this, cachefile, st, data) != 0)
+            Log.print("Unable to write grid cache %s", cachefile);
     }
 
-    fclose(fp);
+    nnod = nx * ny;
+    dx   = (xmax - xmin) / (nx - 1);
+    dy   = (ymax - ymin) / (ny - 1);
+
+    return 0;
+}
+
+//=========================================================================
+// Grid initialization from Golden Software GRD-file
+int cOgrd::readGRD(const char *grdfile)
+{
+    float *data;
+    int    ierr;
+
+    if ((ierr = readGRDfloat(grdfile, data)) != 0)
+        return ierr;
+
+    if (val)
+        delete[] val;
+    val = new double[nnod];
+
+#pragma omp parallel for schedule(static)
+    for (int l = 0; l < nnod; l++)
+        val[l] = (double)data[l];
+
+    delete[] data;
 
     return 0;
 }
@@ -71,6 +71,7 @@ class cOgrd
     int     initialize(double xmin0, double xmax0, double dx0, double ymin0, double ymax0, double dy0);
     int     readHeader(const char *grdfile);
     int     readGRD(const char *grdfile);
+    int     readGRDfloat(const char *grdfile, float *&data, const char *cachefile = NULL);
     int     readXYZ(const char *xyzfile);
     int     readRasterStream(FILE *fp, int ordering, int ydirection);
     cOgrd  *extract(int i1, int i2, int j1, int j2);
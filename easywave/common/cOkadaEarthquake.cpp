@@ -47,6 +47,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
 #include "utilits.h"
 #include "cOkadaEarthquake.h"
@@ -232,11 +233,12 @@ int cOkadaEarthquake::calculate(double lon, double lat, double &uz)
 }
 
 //=========================================================================
-// Calculate surface displacements by summing effect from all ruptures
+// Calculate surface displacements by summing effect from all ruptures.
+// Grid columns are shared among threads; every fault is evaluated in one batch
+// per column and only inside its deformation area (see getDeformArea)
 int cOkadaEarthquake::calculate(cOgrd &uZ)
 {
-    int    i, j, n, ierr;
-    double uzf;
+    int ierr;
 
     if (!finalized)
         return Err.post("cOkadaEarthquake::calculate: eq not finalized");
@@ -244,15 +246,40 @@ int cOkadaEarthquake::calculate(cOgrd &uZ)
     if (ierr)
         return ierr;
 
+    std::vector<double> lonmin(nfault), lonmax(nfault), latmin(nfault), latmax(nfault);
+    for (int n = 0; n < nfault; n++) {
+        ierr = fault[n].getDeformArea(lonmin[n], lonmax[n], latmin[n], latmax[n]);
+        if (ierr)
+            return ierr;
+    }
+
     // calculate displacenents on a grid
-    for (i = 0; i < uZ.nx; i++) {
-        for (j = 0; j < uZ.ny; j++) {
-
-            for (n = 0; n < nfault; n++) {
-                ierr = fault[n].calculate(uZ.getX(i, j), uZ.getY(i, j), uzf);
-                if (ierr)
-                    return ierr;
-                uZ(i, j) = uZ(i, j) + uzf;
+#pragma omp parallel default(shared)
+    {
+        std::vector<double> lon(uZ.ny), lat(uZ.ny), uzf(uZ.ny);
+
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < uZ.nx; i++) {
+            for (int j = 0; j < uZ.ny; j++) {
+                lon[j] = uZ.getX(i, j);
+                lat[j] = uZ.getY(i, j);
+            }
+
+            for (int n = 0; n < nfault; n++) {
+                if (lon[0] < lonmin[n] || lon[0] > lonmax[n])
+                    continue;
+
+                int j0 = 0, j1 = uZ.ny - 1;
+                while (j0 <= j1 && lat[j0] < latmin[n])
+                    j0++;
+                while (j1 >= j0 && lat[j1] > latmax[n])
+                    j1--;
+                if (j0 > j1)
+                    continue;
+
+                fault[n].calculate(j1 - j0 + 1, &lon[j0], &lat[j0], &uzf[j0]);
+                for (int j = j0; j <= j1; j++)
+                    uZ(i, j) = uZ(i, j) + uzf[j];
             }
         }
     }
@@ -264,8 +291,7 @@ int cOkadaEarthquake::calculate(cOgrd &uZ)
 // Calculate surface displacements by summing effect from all ruptures
 int cOkadaEarthquake::calculate(cOgrd &uZ, cOgrd &uLon, cOgrd &uLat)
 {
-    int    i, j, n, ierr;
-    double uzf, ulonf, ulatf;
+    int ierr;
 
     if (!finalized)
         return Err.post("cOkadaEarthquake::calculate: eq not finalized");
@@ -276,14 +302,15 @@ int cOkadaEarthquake::calculate(cOgrd &uZ, cOgrd &uLon, cOgrd &uLat)
     uLon = uZ;
     uLat = uZ;
 
-    // calculate displacenents on a grid
-    for (i = 0; i < uZ.nx; i++) {
-        for (j = 0; j < uZ.ny; j++) {
+    // calculate displacenents on a grid, one column per thread
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for (int i = 0; i < uZ.nx; i++) {
+        double uzf, ulonf, ulatf;
+
+        for (int j = 0; j < uZ.ny; j++) {
 
-            for (n = 0; n < nfault; n++) {
-                ierr = fault[n].calculate(uZ.getX(i, j), uZ.getY(i, j), uzf, ulonf, ulatf);
-                if (ierr)
-                    return ierr;
+            for (int n = 0; n < nfault; n++) {
+                fault[n].calculate(uZ.getX(i, j), uZ.getY(i, j), uzf, ulonf, ulatf);
                 uZ(i, j)   = uZ(i, j) + uzf;
                 uLon(i, j) = uLon(i, j) + ulonf;
                 uLat(i, j) = uLat(i, j) + ulatf;
@@ -520,6 +520,32 @@ int cOkadaFault::calculate(double lon0, double lat0, double &uz)
     return 0;
 }
 
+//=========================================================================
+// vertical displacement at n points; identical to the single point version
+int cOkadaFault::calculate(int n, const double *lon0, const double *lat0, double *uz)
+{
+#define FLT_BATCH 256
+    int    k, l, m;
+    double x[FLT_BATCH], y[FLT_BATCH];
+
+    if (!checked) {
+        Err.post("cOkadaFault::calculate: attempt with non-checked fault");
+        return FLT_ERR_INTERNAL;
+    }
+
+    for (k = 0; k < n; k += FLT_BATCH) {
+        m = (n - k < FLT_BATCH) ? n - k : FLT_BATCH;
+
+        for (l = 0; l < m; l++)
+            global2local(lon0[k + l], lat0[k + l], x[l], y[l]);
+
+        // Okada model
+        okadaUz(length, width, zbot, sind, cosd, sslip, dslip, x, y, m, uz + k);
+    }
+
+    return 0;
+}
+
 //======================================================================================
 // Input parameter selection: Solution table
 // if given:
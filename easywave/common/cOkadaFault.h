@@ -98,8 +98,10 @@ class cOkadaFault
     int    getDeformArea(double &lonmin, double &lonmax, double &latmin, double &latmax);
     int    calculate(double lon, double lat, double &uz, double &ulon, double &ulat);
     int    calculate(double lon, double lat, double &uz);
+    int    calculate(int n, const double *lon, const double *lat, double *uz);
 };
 
 int okada(double L, double W, double D, double sinD, double cosD, double U1, double U2, double x, double y, int flag_xy, double *Ux, double *Uy, double *Uz);
+int okadaUz(double L, double W, double D, double sinD, double cosD, double U1, double U2, const double *x, const double *y, int n, double *Uz);
 
 #endif // OKADAFAULT_H
@@ -44,6 +44,8 @@
 #ifndef EASYWAVE_H
 #define EASYWAVE_H
 
+#include <vector>
+
 #include "ewdefs.h"
 
 #define Re      6384.e+3 // Earth radius
@@ -58,13 +60,28 @@ int  ewSource(double &dIOReadTime);
 int  ewStep();
 int  ewStepCor();
 
-int ewStart2DOutput();
-int ewOut2D();
-int ewDump2D();
-int ewLoadPOIs();
-int ewSavePOIs();
-int ewDumpPOIs();
-int ewDumpPOIsCompact(int istage);
+int    ewStart2DOutput();
+int    ewOut2D();
+int    ewStop2DOutput();
+int    ewDump2D();
+void   ewEncodeRLE(const float *src, int n, std::vector<char> &out);
+size_t ewDecodeRLE(const char *src, size_t size, float *dst, int n);
+int    ewLoadPOIs();
+int    ewSavePOIs();
+int    ewDumpPOIs();
+int    ewDumpPOIsCompact(int istage);
+int    ewAllocPOIScenarios(int numScenarios);
+int    ewSelectPOIScenario(int scenario);
+size_t ewPOIStateSize();
+void   ewPackPOIState(char *buf);
+int    ewUnpackPOIState(const char *buf, size_t size);
+
+int ewRunEnsemble(double &dIOReadTime);
+
+int ewStartCheckpoints();
+int ewCheckpoint(int lastProgress, int lastPropagation);
+int ewStopCheckpoints();
+int ewLoadCheckpoint(int &startTime, int &lastProgress, int &lastPropagation);
 
 extern int   NPOIs;
 extern long *idxPOI;
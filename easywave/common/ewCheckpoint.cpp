@@ -0,0 +1,277 @@
+/*
+ * Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of the European Union Public License 1.2
+ *
+ * If a copy of the license was not distributed with this file, you can obtain one at
+ * https://joinup.ec.europa.eu/sites/default/files/custom-page/attachment/2020-03/EUPL-1.2%20EN.txt
+ *
+ * SPDX-License-Identifier: EUPL-1.2
+ */
+
+// Checkpoint and restart of the simulation state
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utilits.h"
+#include "easywave.h"
+
+/*
+ * A checkpoint holds everything that changes during the time loop: sea
+ * surface, maximum height, fluxes, arrival times, the calculation area and
+ * the POI time series. Depth and coefficients are derived from the
+ * bathymetry again on restart. The node arrays are run-length coded (see
+ * ewEncodeRLE()), which makes the mostly untouched grid outside the
+ * calculation area almost free.
+ *
+ * The state is copied on the calling thread and written by a background
+ * thread into a temporary file that replaces the checkpoint when complete,
+ * so an interrupted write never destroys the previous checkpoint.
+ */
+#define CKPT_VERSION 2
+#define CKPT_VARS    5
+
+static const int CkptVars[CKPT_VARS] = {iH, iHmax, iM, iN, iTime};
+
+struct CheckpointHeader {
+    char  magic[4]; // "EWCK"
+    int   version;
+    int   nLon, nLat;
+    int   dt;
+    int   coriolis;
+    int   time; // model time of the next step
+    int   imin, imax, jmin, jmax;
+    int   lastProgress, lastPropagation;
+    float sshArrival;
+};
+
+struct Checkpoint {
+    CheckpointHeader   hdr;
+    std::vector<float> vars[CKPT_VARS];
+    std::vector<char>  pois;
+};
+
+static Checkpoint              State;
+static std::thread             Writer;
+static std::mutex              StateMutex;
+static std::condition_variable StateCond;
+static bool                    Pending;
+static bool                    StopWriter;
+
+static int writeCheckpoint(Checkpoint *ckpt, std::vector<char> &buf)
+{
+    FILE    *fp;
+    char     tmpfile[1024];
+    uint64_t size;
+    int      k, ok;
+
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", Par.fileCheckpoint);
+    fp = fopen(tmpfile, "wb");
+    if (fp == NULL)
+        return Err.post("Unable to write %s", tmpfile);
+
+    ok = fwrite(&ckpt->hdr, sizeof(ckpt->hdr), 1, fp) == 1;
+    for (k = 0; k < CKPT_VARS; k++) {
+        ewEncodeRLE(ckpt->vars[k].data(), (int)ckpt->vars[k].size(), buf);
+        size = buf.size();
+        ok   = ok && fwrite(&size, sizeof(size), 1, fp) == 1;
+        ok   = ok && fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+    }
+    size = ckpt->pois.size();
+    ok   = ok && fwrite(&size, sizeof(size), 1, fp) == 1;
+    ok   = ok && fwrite(ckpt->pois.data(), 1, ckpt->pois.size(), fp) == ckpt->pois.size();
+    ok   = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmpfile, Par.fileCheckpoint)) {
+        remove(tmpfile);
+        return Err.post("Unable to write %s", Par.fileCheckpoint);
+    }
+
+    return 0;
+}
+
+static void writerLoop()
+{
+    std::vector<char> buf;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(StateMutex);
+            StateCond.wait(lock, [] { return StopWriter || Pending; });
+            if (!Pending)
+                return;
+        }
+
+        writeCheckpoint(&State, buf);
+
+        {
+            std::lock_guard<std::mutex> lock(StateMutex);
+            Pending = false;
+        }
+        StateCond.notify_all();
+    }
+}
+
+int ewStartCheckpoints()
+{
+    Pending    = false;
+    StopWriter = false;
+    Writer     = std::thread(writerLoop);
+
+    return 0;
+}
+
+// called at the end of a time step, after the state was copied from the device
+int ewCheckpoint(int lastProgress, int lastPropagation)
+{
+    int         k, m;
+    const int   size = NLon * NLat;
+    CNode      &Node = *gNode;
+    Checkpoint &ckpt = State;
+
+    // the previous checkpoint must be written before its buffer is reused
+    {
+        std::unique_lock<std::mutex> lock(StateMutex);
+        StateCond.wait(lock, [] { return !Pending; });
+    }
+
+    memcpy(ckpt.hdr.magic, "EWCK", 4);
+    ckpt.hdr.version         = CKPT_VERSION;
+    ckpt.hdr.nLon            = NLon;
+    ckpt.hdr.nLat            = NLat;
+    ckpt.hdr.dt              = Par.dt;
+    ckpt.hdr.coriolis        = Par.coriolis;
+    ckpt.hdr.time            = Par.time + Par.dt;
+    ckpt.hdr.imin            = Imin;
+    ckpt.hdr.imax            = Imax;
+    ckpt.hdr.jmin            = Jmin;
+    ckpt.hdr.jmax            = Jmax;
+    ckpt.hdr.lastProgress    = lastProgress + Par.dt;
+    ckpt.hdr.lastPropagation = lastPropagation + Par.dt;
+    ckpt.hdr.sshArrival      = Par.sshArrivalThreshold;
+
+    for (k = 0; k < CKPT_VARS; k++) {
+        ckpt.vars[k].resize(size);
+        float *dst = ckpt.vars[k].data();
+        int    var = CkptVars[k];
+#pragma omp parallel for default(shared) private(m)
+        for (m = 0; m < size; m++)
+            dst[m] = Node(m, var);
+    }
+
+    ckpt.pois.resize(ewPOIStateSize());
+    ewPackPOIState(ckpt.pois.data());
+
+    {
+        std::lock_guard<std::mutex> lock(StateMutex);
+        Pending = true;
+    }
+    StateCond.notify_all();
+
+    Log.print("Checkpoint at %s", utlTimeSplitString(ckpt.hdr.time));
+
+    return 0;
+}
+
+int ewStopCheckpoints()
+{
+    {
+        std::lock_guard<std::mutex> lock(StateMutex);
+        StopWriter = true;
+    }
+    StateCond.notify_all();
+
+    if (Writer.joinable())
+        Writer.join();
+
+    return 0;
+}
+
+// replaces ewSource(): the node arrays, area and POI series are taken from Par.fileRestart
+int ewLoadCheckpoint(int &startTime, int &lastProgress, int &lastPropagation)
+{
+    FILE              *fp;
+    long               fsize;
+    size_t             pos, used;
+    uint64_t           size;
+    int                k, m;
+    const int          ncells = NLon * NLat;
+    CheckpointHeader   hdr;
+    std::vector<char>  buf;
+    std::vector<float> var(ncells);
+    CNode             &Node = *gNode;
+
+    fp = fopen(Par.fileRestart, "rb");
+    if (fp == NULL)
+        return Err.post("Cannot open checkpoint %s", Par.fileRestart);
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf.resize(fsize > 0 ? fsize : 0);
+    if (fsize <= 0 || fread(buf.data(), 1, buf.size(), fp) != buf.size()) {
+        fclose(fp);
+        return Err.post("Cannot read checkpoint %s", Par.fileRestart);
+    }
+    fclose(fp);
+
+    if (buf.size() < sizeof(hdr))
+        return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+    memcpy(&hdr, buf.data(), sizeof(hdr));
+    if (memcmp(hdr.magic, "EWCK", 4) || hdr.version != CKPT_VERSION)
+        return Err.post("%s is not an easyWave checkpoint", Par.fileRestart);
+    if (hdr.nLon != NLon || hdr.nLat != NLat)
+        return Err.post("Checkpoint was written for a %dx%d grid, bathymetry is %dx%d", hdr.nLon, hdr.nLat, NLon, NLat);
+    if (hdr.dt != Par.dt)
+        return Err.post("Checkpoint was written with a time step of %d sec, use -step %d", hdr.dt, hdr.dt);
+    if (hdr.coriolis != Par.coriolis)
+        return Err.post("Checkpoint was written %s Coriolis force", (hdr.coriolis ? "with" : "without"));
+
+    pos = sizeof(hdr);
+    for (k = 0; k < CKPT_VARS; k++) {
+        if (pos + sizeof(size) > buf.size())
+            return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+        memcpy(&size, buf.data() + pos, sizeof(size));
+        pos += sizeof(size);
+        if (size > buf.size() - pos)
+            return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+        used = ewDecodeRLE(buf.data() + pos, size, var.data(), ncells);
+        if (used != size)
+            return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+        pos += size;
+
+        int          v   = CkptVars[k];
+        const float *src = var.data();
+#pragma omp parallel for default(shared) private(m)
+        for (m = 0; m < ncells; m++)
+            Node(m, v) = src[m];
+    }
+
+    if (pos + sizeof(size) > buf.size())
+        return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+    memcpy(&size, buf.data() + pos, sizeof(size));
+    pos += sizeof(size);
+    if (size != buf.size() - pos)
+        return Err.post("Corrupted checkpoint %s", Par.fileRestart);
+    if (size) {
+        if (ewUnpackPOIState(buf.data() + pos, size))
+            return -1;
+    } else if (ewPOIStateSize())
+        Log.print("Checkpoint holds no POI time series, they start at the restart time");
+
+    Imin                    = hdr.imin;
+    Imax                    = hdr.imax;
+    Jmin                    = hdr.jmin;
+    Jmax                    = hdr.jmax;
+    Par.sshArrivalThreshold = hdr.sshArrival;
+    startTime               = hdr.time;
+    lastProgress            = hdr.lastProgress;
+    lastPropagation         = hdr.lastPropagation;
+
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of the European Union Public License 1.2
+ *
+ * If a copy of the license was not distributed with this file, you can obtain one at
+ * https://joinup.ec.europa.eu/sites/default/files/custom-page/attachment/2020-03/EUPL-1.2%20EN.txt
+ *
+ * SPDX-License-Identifier: EUPL-1.2
+ */
+
+// Time stepping on the CPU, see ewCpuNode.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+
+#include "utilits.h"
+#include "easywave.h"
+#include "ewCpuNode.h"
+
+CCpuNode::CCpuNode()
+{
+    /* strips narrower than two columns would only consist of seams */
+    tileWidth = std::max(Par.cpuTile, 2);
+    threaded  = true;
+    iMin = iMax = jMin = jMax = 0;
+    sshArrival = 0;
+}
+
+/* sea surface height at the open boundaries; reads fluxes only, so it can be set before the interior */
+void CCpuNode::updateOpenBoundaries()
+{
+    int i, j, m;
+
+    if (jMin <= 2) {
+        for (i = 2; i <= (NLon - 1); i++) {
+            m    = idx(1, i);
+            h[m] = sqrt(pow(fN[m], 2.) + 0.25 * pow((fM[m] + fM[m - NLat]), 2.)) * C1[i];
+            if (fN[m] > 0)
+                h[m] = -h[m];
+        }
+    }
+    if (iMin <= 2) {
+        for (j = 2; j <= (NLat - 1); j++) {
+            m    = idx(j, 1);
+            h[m] = sqrt(pow(fM[m], 2.) + 0.25 * pow((fN[m] + fN[m - 1]), 2.)) * C2[j];
+            if (fM[m] > 0)
+                h[m] = -h[m];
+        }
+    }
+    if (jMax >= (NLat - 1)) {
+        for (i = 2; i <= (NLon - 1); i++) {
+            m    = idx(NLat, i);
+            h[m] = sqrt(pow(fN[m - 1], 2.) + 0.25 * pow((fM[m] + fM[m - 1]), 2.)) * C3[i];
+            if (fN[m - 1] < 0)
+                h[m] = -h[m];
+        }
+    }
+    if (iMax >= (NLon - 1)) {
+        for (j = 2; j <= (NLat - 1); j++) {
+            m    = idx(j, NLon);
+            h[m] = sqrt(pow(fM[m - NLat], 2.) + 0.25 * pow((fN[m] + fN[m - 1]), 2.)) * C4[j];
+            if (fM[m - NLat] < 0)
+                h[m] = -h[m];
+        }
+    }
+    if (jMin <= 2) {
+        m    = idx(1, 1);
+        h[m] = sqrt(pow(fM[m], 2.) + pow(fN[m], 2.)) * C1[1];
+        if (fN[m] > 0)
+            h[m] = -h[m];
+        m    = idx(1, NLon);
+        h[m] = sqrt(pow(fM[m - NLat], 2.) + pow(fN[m], 2.)) * C1[NLon];
+        if (fN[m] > 0)
+            h[m] = -h[m];
+    }
+    /* same condition as in ewStep() */
+    if (jMin >= (NLat - 1)) {
+        m    = idx(NLat, 1);
+        h[m] = sqrt(pow(fM[m], 2.) + pow(fN[m - 1], 2.)) * C3[1];
+        if (fN[m - 1] < 0)
+            h[m] = -h[m];
+        m    = idx(NLat, NLon);
+        h[m] = sqrt(pow(fM[m - NLat], 2.) + pow(fN[m - 1], 2.)) * C3[NLon];
+        if (fN[m - 1] < 0)
+            h[m] = -h[m];
+    }
+}
+
+/* mass conservation in column i; all arrays are offset so that they can be indexed by j */
+void CCpuNode::updateMassColumn(int i)
+{
+    const int          off     = idx(0, i);
+    const float *const D       = d + off;
+    float *const       H       = h + off;
+    float *const       Hmax    = hMax + off;
+    const float *const M       = fM + off;
+    const float *const Mw      = fM + off - NLat;
+    const float *const N       = fN + off;
+    const float *const R1      = cR1 + off;
+    float *const       T       = tArr + off;
+    const float        zero    = Par.sshZeroThreshold;
+    const float        arrival = sshArrival;
+    const float        time    = (float)Par.time;
+
+#pragma omp simd
+    for (int j = jMin; j <= jMax; j++) {
+        const bool wet  = D[j] != 0;
+        float      hNew = H[j] - R1[j] * (M[j] - Mw[j] + N[j] * R6[j] - N[j - 1] * R6[j - 1]);
+        const float absH = fabsf(hNew);
+
+        hNew    = (absH < zero) ? 0.f : hNew;
+        H[j]    = wet ? hNew : H[j];
+        Hmax[j] = (wet && hNew > Hmax[j]) ? hNew : Hmax[j];
+        T[j]    = (wet && arrival != 0 && T[j] < 0 && absH > arrival) ? time : T[j];
+    }
+}
+
+/* moment conservation in column i without Coriolis force */
+void CCpuNode::updateFluxColumn(int i)
+{
+    const int          off = idx(0, i);
+    const float *const D   = d + off;
+    const float *const De  = d + off + NLat;
+    const float *const H   = h + off;
+    const float *const He  = h + off + NLat;
+    float *const       M   = fM + off;
+    float *const       N   = fN + off;
+    const float *const R2  = cR2 + off;
+    const float *const R4  = cR4 + off;
+
+#pragma omp simd
+    for (int j = jMin; j <= jMax; j++) {
+        M[j] = ((D[j] * De[j]) != 0) ? M[j] - R2[j] * (He[j] - H[j]) : M[j];
+        N[j] = ((D[j] * D[j + 1]) != 0) ? N[j] - R4[j] * (H[j + 1] - H[j]) : N[j];
+    }
+}
+
+/* longitudinal flux in column i with Coriolis force; needs the fluxes N of columns i and i+1 before their update */
+void CCpuNode::updateFluxMColumn(int i)
+{
+    const int          off = idx(0, i);
+    const float *const D   = d + off;
+    const float *const De  = d + off + NLat;
+    const float *const H   = h + off;
+    const float *const He  = h + off + NLat;
+    float *const       M   = fM + off;
+    const float *const N   = fN + off;
+    const float *const Ne  = fN + off + NLat;
+    const float *const R2  = cR2 + off;
+    const float *const R3  = cR3 + off;
+
+#pragma omp simd
+    for (int j = jMin; j <= jMax; j++) {
+        const float v1 = He[j] - H[j];
+        const float v2 = N[j - 1] + N[j] + Ne[j] + Ne[j - 1];
+        M[j]           = ((D[j] * De[j]) != 0) ? M[j] - R2[j] * v1 + R3[j] * v2 : M[j];
+    }
+}
+
+/* lattitudial flux in column i with Coriolis force; needs the updated fluxes M of columns i-1 and i */
+void CCpuNode::updateFluxNColumn(int i)
+{
+    const int          off = idx(0, i);
+    const float *const D   = d + off;
+    const float *const H   = h + off;
+    const float *const M   = fM + off;
+    const float *const Mw  = fM + off - NLat;
+    float *const       N   = fN + off;
+    const float *const R4  = cR4 + off;
+    const float *const R5  = cR5 + off;
+
+#pragma omp simd
+    for (int j = jMin; j <= jMax; j++) {
+        const float v1 = H[j + 1] - H[j];
+        const float v2 = Mw[j] + M[j] + Mw[j + 1] + M[j + 1];
+        N[j]           = ((D[j] * D[j + 1]) != 0) ? N[j] - R4[j] * v1 - R5[j] * v2 : N[j];
+    }
+}
+
+/* open boundaries of M in the first and last row; they only depend on the boundary sea surface */
+void CCpuNode::updateBoundaryFluxMRows()
+{
+    int i, m;
+
+    if (jMin <= 2) {
+        for (i = 1; i <= (NLon - 1); i++) {
+            m     = idx(1, i);
+            fM[m] = fM[m] - cR2[m] * (h[m + NLat] - h[m]);
+        }
+    }
+    if (jMax >= (NLat - 1)) {
+        for (i = 1; i <= (NLon - 1); i++) {
+            m     = idx(NLat, i);
+            fM[m] = fM[m] - cR2[m] * (h[m + NLat] - h[m]);
+        }
+    }
+}
+
+/* open boundary of M in the first column; needs the sea surface of column 2 */
+void CCpuNode::updateBoundaryFluxMColumn()
+{
+    int j, m;
+
+    for (j = 1; j <= NLat; j++) {
+        m     = idx(j, 1);
+        fM[m] = fM[m] - cR2[m] * (h[m + NLat] - h[m]);
+    }
+}
+
+void CCpuNode::updateBoundaryFluxN()
+{
+    int i, j, m;
+
+    if (iMin <= 2) {
+        for (j = 1; j <= (NLat - 1); j++) {
+            m     = idx(j, 1);
+            fN[m] = fN[m] - cR4[m] * (h[m + 1] - h[m]);
+        }
+    }
+    if (jMin <= 2) {
+        for (i = 1; i <= NLon; i++) {
+            m     = idx(1, i);
+            fN[m] = fN[m] - cR4[m] * (h[m + 1] - h[m]);
+        }
+    }
+    if (iMax >= (NLon - 1)) {
+        for (j = 1; j <= (NLat - 1); j++) {
+            m     = idx(j, NLon);
+            fN[m] = fN[m] - cR4[m] * (h[m + 1] - h[m]);
+        }
+    }
+}
+
+/*
+ * Sweep one strip. The fluxes of column i-1 (N: i-2 with Coriolis) are updated
+ * right after the sea surface of column i. Columns whose update depends on a
+ * neighbouring strip are left to run(): M of the last column and, with
+ * Coriolis, N of the first and the last column.
+ */
+void CCpuNode::sweepTile(int tile, bool coriolis)
+{
+    const int  a     = tileStart[tile];
+    const int  b     = tileEnd[tile];
+    const bool first = tile == 0;
+    const bool last  = tile == (int)tileStart.size() - 1;
+
+    for (int i = a; i <= b; i++) {
+        updateMassColumn(i);
+
+        /* iMin <= 2: the first strip starts at column 2 */
+        if (i == 2)
+            updateBoundaryFluxMColumn();
+
+        if (i - 1 >= a) {
+            if (coriolis)
+                updateFluxMColumn(i - 1);
+            else
+                updateFluxColumn(i - 1);
+        }
+
+        if (coriolis && i - 2 >= a && (i - 2 > a || first))
+            updateFluxNColumn(i - 2);
+    }
+
+    if (last) {
+        if (coriolis)
+            updateFluxMColumn(b);
+        else
+            updateFluxColumn(b);
+    }
+
+    if (coriolis) {
+        if (b - 1 >= a && (b - 1 > a || first))
+            updateFluxNColumn(b - 1);
+        if (last && (b > a || first))
+            updateFluxNColumn(b);
+    }
+}
+
+/* calculation area for the next step */
+void CCpuNode::enlargeArea()
+{
+    int i, j, enlarge;
+
+    if (iMin > 2) {
+        for (enlarge = 0, j = jMin; j <= jMax; j++) {
+            if (fabs(h[idx(j, iMin + 2)]) > Par.sshClipThreshold) {
+                enlarge = 1;
+                break;
+            }
+        }
+        if (enlarge) {
+            iMin--;
+            if (iMin < 2)
+                iMin = 2;
+        }
+    }
+    if (iMax < (NLon - 1)) {
+        for (enlarge = 0, j = jMin; j <= jMax; j++) {
+            if (fabs(h[idx(j, iMax - 2)]) > Par.sshClipThreshold) {
+                enlarge = 1;
+                break;
+            }
+        }
+        if (enlarge) {
+            iMax++;
+            if (iMax > (NLon - 1))
+                iMax = NLon - 1;
+        }
+    }
+    if (jMin > 2) {
+        for (enlarge = 0, i = iMin; i <= iMax; i++) {
+            if (fabs(h[idx(jMin + 2, i)]) > Par.sshClipThreshold) {
+                enlarge = 1;
+                break;
+            }
+        }
+        if (enlarge) {
+            jMin--;
+            if (jMin < 2)
+                jMin = 2;
+        }
+    }
+    if (jMax < (NLat - 1)) {
+        for (enlarge = 0, i = iMin; i <= iMax; i++) {
+            if (fabs(h[idx(jMax - 2, i)]) > Par.sshClipThreshold) {
+                enlarge = 1;
+                break;
+            }
+        }
+        if (enlarge) {
+            jMax++;
+            if (jMax > (NLat - 1))
+                jMax = NLat - 1;
+        }
+    }
+}
+
+/* one time step on the area iMin..iMax x jMin..jMax, which is enlarged afterwards */
+int CCpuNode::step()
+{
+    const bool coriolis = Par.coriolis;
+
+    updateOpenBoundaries();
+    updateBoundaryFluxMRows();
+
+    tileStart.clear();
+    tileEnd.clear();
+    for (int i = iMin; i <= iMax; i += tileWidth) {
+        tileStart.push_back(i);
+        tileEnd.push_back(std::min(i + tileWidth - 1, iMax));
+    }
+    const int numTiles = (int)tileStart.size();
+
+#pragma omp parallel default(shared) if (threaded)
+    {
+#pragma omp for schedule(dynamic)
+        for (int t = 0; t < numTiles; t++)
+            sweepTile(t, coriolis);
+
+        // seams: M of the last column of a strip needs the sea surface of the next one
+#pragma omp for
+        for (int t = 0; t < numTiles - 1; t++) {
+            if (coriolis)
+                updateFluxMColumn(tileEnd[t]);
+            else
+                updateFluxColumn(tileEnd[t]);
+        }
+
+        // seams: N needs M of both neighbouring columns
+        if (coriolis) {
+#pragma omp for
+            for (int t = 0; t < numTiles; t++) {
+                if (t > 0)
+                    updateFluxNColumn(tileStart[t]);
+                if (t < numTiles - 1 && (tileEnd[t] > tileStart[t] || t == 0))
+                    updateFluxNColumn(tileEnd[t]);
+            }
+        }
+    }
+
+    updateBoundaryFluxN();
+    enlargeArea();
+
+    return 0;
+}
+
+int CCpuNode::run()
+{
+    iMin       = Imin;
+    iMax       = Imax;
+    jMin       = Jmin;
+    jMax       = Jmax;
+    sshArrival = Par.sshArrivalThreshold;
+
+    step();
+
+    Imin = iMin;
+    Imax = iMax;
+    Jmin = jMin;
+    Jmax = jMax;
+
+    return 0;
+}
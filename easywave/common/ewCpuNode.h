@@ -0,0 +1,64 @@
+/*
+ * Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of the European Union Public License 1.2
+ *
+ * If a copy of the license was not distributed with this file, you can obtain one at
+ * https://joinup.ec.europa.eu/sites/default/files/custom-page/attachment/2020-03/EUPL-1.2%20EN.txt
+ *
+ * SPDX-License-Identifier: EUPL-1.2
+ */
+
+#ifndef EW_CPUNODE_H
+#define EW_CPUNODE_H
+
+#include <vector>
+
+#include "easywave.h"
+#include "ewNode.h"
+
+/*
+ * Multithreaded CPU backend on the structure-of-arrays layout of CArrayNode.
+ *
+ * The active area is cut into strips of Par.cpuTile columns that are swept by
+ * different threads. Inside a strip the momentum update of column i-1 runs
+ * right after the mass update of column i (i-2 for the latitudinal flux with
+ * Coriolis), so every column is streamed through the cache once per time step
+ * instead of once per sweep. The columns where two strips meet are finished
+ * after all strips are done. Results are identical to ewStep()/ewStepCor().
+ */
+class CCpuNode : public CArrayNode
+{
+  protected:
+    int tileWidth;
+
+    /* spread the strips of a step over the OpenMP threads */
+    bool threaded;
+
+    /* calculation area and arrival threshold; run() syncs them with the globals */
+    int   iMin, iMax, jMin, jMax;
+    float sshArrival;
+
+    /* first and last column of each strip of the current step */
+    std::vector<int> tileStart;
+    std::vector<int> tileEnd;
+
+  private:
+    void updateOpenBoundaries();
+    void updateMassColumn(int i);
+    void updateFluxColumn(int i);
+    void updateFluxMColumn(int i);
+    void updateFluxNColumn(int i);
+    void updateBoundaryFluxMRows();
+    void updateBoundaryFluxMColumn();
+    void updateBoundaryFluxN();
+    void sweepTile(int tile, bool coriolis);
+    void enlargeArea();
+
+  public:
+    CCpuNode();
+    int step();
+    int run();
+};
+
+#endif /* EW_CPUNODE_H */
@@ -0,0 +1,316 @@
+/*
+ * Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of the European Union Public License 1.2
+ *
+ * If a copy of the license was not distributed with this file, you can obtain one at
+ * https://joinup.ec.europa.eu/sites/default/files/custom-page/attachment/2020-03/EUPL-1.2%20EN.txt
+ *
+ * SPDX-License-Identifier: EUPL-1.2
+ */
+
+// Ensemble runs: many sources over one bathymetry, see ewEnsemble.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "utilits.h"
+#include "easywave.h"
+#include "ewEnsemble.h"
+
+CEnsembleNode::CEnsembleNode()
+{
+    owner     = NULL;
+    hBatch    = NULL;
+    hMaxBatch = NULL;
+    fMBatch   = NULL;
+    fNBatch   = NULL;
+    tArrBatch = NULL;
+}
+
+CEnsembleNode::CEnsembleNode(CEnsembleNode *master, int scenario)
+{
+    const size_t off = (size_t)scenario * NLon * NLat;
+
+    owner     = master;
+    hBatch    = NULL;
+    hMaxBatch = NULL;
+    fMBatch   = NULL;
+    fNBatch   = NULL;
+    tArrBatch = NULL;
+
+    /* read-only arrays of the owner */
+    d    = master->d;
+    cR1  = master->cR1;
+    cR2  = master->cR2;
+    cR3  = master->cR3;
+    cR4  = master->cR4;
+    cR5  = master->cR5;
+    topo = master->topo;
+
+    /* slices of the batched state */
+    h    = master->hBatch + off;
+    hMax = master->hMaxBatch + off;
+    fM   = master->fMBatch + off;
+    fN   = master->fNBatch + off;
+    tArr = master->tArrBatch + off;
+}
+
+int CEnsembleNode::allocScenarios(int numScenarios)
+{
+    const size_t size = sizeof(float) * numScenarios * NLon * NLat;
+
+    CHKRET(hBatch = (float *)malloc(size));
+    CHKRET(hMaxBatch = (float *)malloc(size));
+    CHKRET(fMBatch = (float *)malloc(size));
+    CHKRET(fNBatch = (float *)malloc(size));
+    CHKRET(tArrBatch = (float *)malloc(size));
+
+    for (int n = 0; n < numScenarios; n++)
+        views.push_back(new CEnsembleNode(this, n));
+
+    return 0;
+}
+
+void CEnsembleNode::setArea(int imin, int imax, int jmin, int jmax, float arrival)
+{
+    iMin       = imin;
+    iMax       = imax;
+    jMin       = jmin;
+    jMax       = jmax;
+    sshArrival = arrival;
+}
+
+void CEnsembleNode::getArea(int &imin, int &imax, int &jmin, int &jmax)
+{
+    imin = iMin;
+    imax = iMax;
+    jmin = jMin;
+    jmax = jMax;
+}
+
+int CEnsembleNode::freeMem()
+{
+    /* views do not own any memory */
+    if (owner)
+        return 0;
+
+    for (size_t n = 0; n < views.size(); n++)
+        delete views[n];
+    views.clear();
+
+    free(hBatch);
+    free(hMaxBatch);
+    free(fMBatch);
+    free(fNBatch);
+    free(tArrBatch);
+
+    return CArrayNode::freeMem();
+}
+
+struct EnsembleScenario {
+    std::string source;
+    std::string label;
+    double      computeTime;
+};
+
+/* ensemble file: one scenario per line, source file and optional label */
+static int ewReadEnsemble(std::vector<EnsembleScenario> &scenarios)
+{
+    FILE            *fp;
+    int              line, n;
+    char             record[256], source[256], label[64];
+    EnsembleScenario scen;
+
+    fp = fopen(Par.fileEnsemble, "rt");
+    if (fp == NULL)
+        return Err.post("Cannot open ensemble file %s", Par.fileEnsemble);
+
+    line = 0;
+    while (utlReadNextRecord(fp, record, &line) != EOF) {
+        n = sscanf(record, "%255s %47s", source, label);
+        if (n < 1) {
+            Log.print("! Bad ensemble record: %s", record);
+            continue;
+        }
+        if (n < 2)
+            snprintf(label, sizeof(label), "%.40s.%3.3d", Par.modelName, (int)scenarios.size() + 1);
+
+        scen.source      = source;
+        scen.label       = label;
+        scen.computeTime = 0.;
+        scenarios.push_back(scen);
+    }
+    fclose(fp);
+
+    if (scenarios.empty())
+        return Err.post("Empty ensemble file");
+
+    return 0;
+}
+
+int ewRunEnsemble(double &dIOReadTime)
+{
+    int   ierr, n, numScenarios, numThreads, lastProgress;
+    int   imin, imax, jmin, jmax;
+    bool  outer;
+    char *fileSource, *modelName;
+    float arrival, hmax;
+    FILE *fp;
+    char  buf[128];
+
+    std::vector<EnsembleScenario>         scenarios;
+    std::chrono::steady_clock::time_point tpStart, tpStep;
+    double                                dSourceTime, dLoopTime;
+
+    ierr = ewReadEnsemble(scenarios);
+    if (ierr)
+        return ierr;
+    numScenarios = (int)scenarios.size();
+    Log.print("Ensemble of %d scenarios read from %s", numScenarios, Par.fileEnsemble);
+
+    CEnsembleNode *master = new CEnsembleNode();
+    gNode                 = master;
+
+    // bathymetry, coefficients and POIs are shared by all scenarios
+    ierr = ewLoadBathymetry(dIOReadTime);
+    if (ierr)
+        return ierr;
+
+    ierr = ewLoadPOIs();
+    if (ierr)
+        return ierr;
+
+    if (master->allocScenarios(numScenarios))
+        return Err.post("Error allocating memory for %d scenarios", numScenarios);
+
+    ierr = ewAllocPOIScenarios(numScenarios);
+    if (ierr)
+        return ierr;
+
+    // initial wave of every scenario; ewSource() may turn a relative arrival threshold into an absolute one
+    fileSource = Par.fileSource;
+    arrival    = Par.sshArrivalThreshold;
+    tpStart    = std::chrono::steady_clock::now();
+    for (n = 0; n < numScenarios; n++) {
+        CEnsembleNode *view = master->scenario(n);
+
+        gNode                   = view;
+        Par.fileSource          = (char *)scenarios[n].source.c_str();
+        Par.sshArrivalThreshold = arrival;
+
+        ewReset();
+        ierr = ewSource(dIOReadTime);
+        if (ierr)
+            return Err.post("Cannot set up scenario %s from %s", scenarios[n].label.c_str(), Par.fileSource);
+
+        view->setArea(Imin, Imax, Jmin, Jmax, Par.sshArrivalThreshold);
+        Log.print("Scenario %s: source %s", scenarios[n].label.c_str(), Par.fileSource);
+    }
+    dSourceTime             = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+    Par.fileSource          = fileSource;
+    Par.sshArrivalThreshold = arrival;
+    gNode                   = master;
+    Log.print("Sources of %d scenarios set up in %.3f sec", numScenarios, dSourceTime);
+
+    ewLogParams();
+
+    // one scenario per thread when there are enough of them, otherwise the strips of each scenario are shared
+#ifdef _OPENMP
+    numThreads = omp_get_max_threads();
+#else
+    numThreads = 1;
+#endif
+    outer = numScenarios >= numThreads;
+    for (n = 0; n < numScenarios; n++)
+        master->scenario(n)->setThreaded(!outer);
+
+    if (Par.outPropagation)
+        Log.print("Propagation output is not written in ensemble mode");
+
+    Log.print("Starting ensemble loop with %d scenarios on %d threads...", numScenarios, numThreads);
+    tpStart = std::chrono::steady_clock::now();
+
+    for (Par.time = 0, lastProgress = Par.outProgress; Par.time <= Par.timeMax; Par.time += Par.dt, lastProgress += Par.dt) {
+
+        if (Par.filePOIs && Par.poiDt && ((Par.time / Par.poiDt) * Par.poiDt == Par.time)) {
+            for (n = 0; n < numScenarios; n++) {
+                gNode = master->scenario(n);
+                ewSelectPOIScenario(n);
+                ewSavePOIs();
+            }
+            gNode = master;
+        }
+
+        if (outer) {
+#pragma omp parallel for schedule(dynamic) private(tpStep)
+            for (n = 0; n < numScenarios; n++) {
+                tpStep = std::chrono::steady_clock::now();
+                master->scenario(n)->step();
+                scenarios[n].computeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStep).count();
+            }
+        } else {
+            for (n = 0; n < numScenarios; n++) {
+                tpStep = std::chrono::steady_clock::now();
+                master->scenario(n)->step();
+                scenarios[n].computeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStep).count();
+            }
+        }
+
+        if (Par.outProgress && lastProgress >= Par.outProgress) {
+            dLoopTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+            Log.print("Model time = %s,   elapsed: %ld msec", utlTimeSplitString(Par.time), (long)(dLoopTime * 1000));
+            lastProgress = 0;
+        }
+    }
+
+    dLoopTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+    Log.print("Finishing ensemble loop");
+
+    // results of every scenario under its own label
+    Log.print("Final dump...");
+    sprintf(buf, "%.100s.ensemble.summary", Par.modelName);
+    fp = fopen(buf, "wt");
+    if (fp)
+        fprintf(fp, "ID Imin Imax Jmin Jmax SSHmax CPUsec Source\n");
+
+    modelName = Par.modelName;
+    for (n = 0; n < numScenarios; n++) {
+        CEnsembleNode *view = master->scenario(n);
+
+        gNode = view;
+        view->getArea(Imin, Imax, Jmin, Jmax);
+        ewSelectPOIScenario(n);
+        Par.modelName = (char *)scenarios[n].label.c_str();
+        ewDumpPOIs();
+        ewDump2D();
+
+        if (fp) {
+            view->getArea(imin, imax, jmin, jmax);
+            hmax = 0.;
+            for (int i = imin; i <= imax; i++)
+                for (int j = jmin; j <= jmax; j++)
+                    if ((*view)(idx(j, i), iHmax) > hmax)
+                        hmax = (*view)(idx(j, i), iHmax);
+            fprintf(fp, "%s %d %d %d %d %.3f %.3f %s\n", scenarios[n].label.c_str(), imin, imax, jmin, jmax, hmax, scenarios[n].computeTime, scenarios[n].source.c_str());
+        }
+    }
+    Par.modelName = modelName;
+    gNode         = master;
+    if (fp)
+        fclose(fp);
+
+    Log.print("Ensemble: %d scenarios in %.3f sec, %.1f scenarios/hour", numScenarios, dLoopTime, (dLoopTime > 0 ? numScenarios * 3600. / dLoopTime : 0.));
+
+    master->freeMem();
+    delete master;
+    gNode = NULL;
+
+    return 0;
+}
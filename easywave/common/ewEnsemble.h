@@ -0,0 +1,61 @@
+/*
+ * Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of the European Union Public License 1.2
+ *
+ * If a copy of the license was not distributed with this file, you can obtain one at
+ * https://joinup.ec.europa.eu/sites/default/files/custom-page/attachment/2020-03/EUPL-1.2%20EN.txt
+ *
+ * SPDX-License-Identifier: EUPL-1.2
+ */
+
+#ifndef EW_ENSEMBLE_H
+#define EW_ENSEMBLE_H
+
+#include <vector>
+
+#include "easywave.h"
+#include "ewCpuNode.h"
+
+/*
+ * Node of an ensemble run: many sources propagated over one bathymetry.
+ *
+ * The node that loads the bathymetry owns the depth, the coefficients R1..R5
+ * and the topography. allocScenarios() adds one batched block per state
+ * variable (h, hMax, M, N, arrival time) holding all scenarios back to back
+ * and creates a view per scenario. A view shares the read-only arrays of its
+ * owner, points into its slice of the batched blocks and keeps its own
+ * calculation area, so the scenarios can be stepped concurrently.
+ */
+class CEnsembleNode : public CCpuNode
+{
+  private:
+    /* NULL for the node that owns the arrays */
+    CEnsembleNode *owner;
+
+    std::vector<CEnsembleNode *> views;
+
+    float *hBatch;
+    float *hMaxBatch;
+    float *fMBatch;
+    float *fNBatch;
+    float *tArrBatch;
+
+    CEnsembleNode(CEnsembleNode *master, int scenario);
+
+  public:
+    CEnsembleNode();
+
+    int allocScenarios(int numScenarios);
+    int numScenarios() { return (int)views.size(); }
+    CEnsembleNode *scenario(int n) { return views[n]; }
+
+    /* calculation area and arrival threshold of the scenario */
+    void setArea(int imin, int imax, int jmin, int jmax, float arrival);
+    void getArea(int &imin, int &imax, int &jmin, int &jmax);
+    void setThreaded(bool on) { threaded = on; }
+
+    int freeMem();
+};
+
+#endif /* EW_ENSEMBLE_H */
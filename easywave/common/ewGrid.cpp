@@ -48,6 +48,7 @@
 #include <cassert>
 
 #include "utilits.h"
+#include "cOgrd.h"
 #include "easywave.h"
 #include <cmath>
 #include "FileHandler.h"
@@ -67,13 +68,10 @@ float *C4;
 
 int ewLoadBathymetry(double &dTotalIOReadTime)
 {
-    FILE          *fp;
-    char           fileLabel[5];
-    unsigned short shval;
-    int            ierr, isBin, i, j, m, k;
-    float          fval;
-    double         dval;
-    double         dAccumulateIOReadTime(0.0);
+    int    ierr, i, j, m, k;
+    float  fval;
+    float *buf;
+    cOgrd  grd;
 
     std::chrono::steady_clock::time_point tpStart;
     CNode                                &Node = *gNode;
@@ -85,147 +83,60 @@ int ewLoadBathymetry(double &dTotalIOReadTime)
         return 2;
     }
 
-    // check if bathymetry file is in ascii or binary format
-
-    fp = fopen(Par.fileBathymetry, "rb");
-    assert(fp != nullptr); // Should never be empty once reached here
-
-    memset(fileLabel, 0, 5);
+    // DSBB is memory-mapped, DSAA parsed in parallel, or both replaced by the native cache
     tpStart = std::chrono::steady_clock::now();
-    ierr    = fread(fileLabel, 4, 1, fp);
-    dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-    if (!strcmp(fileLabel, "DSAA"))
-        isBin = 0;
-    else if (!strcmp(fileLabel, "DSBB"))
-        isBin = 1;
-    else {
-        if (fp != nullptr)
-            fclose(fp);
-        return Err.post("%s: not GRD-file!", Par.fileBathymetry);
-    }
-
-    fclose(fp);
-
-    if (isBin) {
-        tpStart = std::chrono::steady_clock::now();
-        fp      = fopen(Par.fileBathymetry, "rb");
-        ierr    = fread(fileLabel, 4, 1, fp);
-        ierr    = fread(&shval, sizeof(unsigned short), 1, fp);
-        NLon    = shval;
-        ierr    = fread(&shval, sizeof(unsigned short), 1, fp);
-        NLat    = shval;
-        dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-    } else {
-        tpStart = std::chrono::steady_clock::now();
-        fp      = fopen(Par.fileBathymetry, "rt");
-        ierr    = fscanf(fp, "%4s", fileLabel);
-        ierr    = fscanf(fp, " %d %d ", &NLon, &NLat);
-        dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-        if (NLon == -1 || NLat == -1) {
-            fclose(fp);
-            return Err.post("Data corrupted");
-        }
-    }
+    ierr    = grd.readGRDfloat(Par.fileBathymetry, buf, Par.fileBathymetryCache);
+    if (ierr)
+        return ierr;
+    double dIOReadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+    Log.print("Bathymetry read in %.3f sec", dIOReadTime);
+    dTotalIOReadTime += dIOReadTime;
+
+    NLon   = grd.nx;
+    NLat   = grd.ny;
+    LonMin = grd.xmin;
+    LonMax = grd.xmax;
+    LatMin = grd.ymin;
+    LatMax = grd.ymax;
 
     // try to allocate memory for GRIDNODE structure and for caching arrays
     if (Node.mallocMem()) {
-        fclose(fp);
+        delete[] buf;
         return Err.post("Error allocating memory");
     }
 
-    if (isBin) {
-        tpStart = std::chrono::steady_clock::now();
-        ierr    = fread(&LonMin, sizeof(double), 1, fp);
-        ierr    = fread(&LonMax, sizeof(double), 1, fp);
-        ierr    = fread(&LatMin, sizeof(double), 1, fp);
-        ierr    = fread(&LatMax, sizeof(double), 1, fp);
-        ierr    = fread(&dval, sizeof(double), 1, fp);
-        ierr    = fread(&dval, sizeof(double), 1, fp); // zmin zmax
-        dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-    } else {
-        tpStart = std::chrono::steady_clock::now();
-        ierr    = fscanf(fp, " %lf %lf ", &LonMin, &LonMax);
-        ierr    = fscanf(fp, " %lf %lf ", &LatMin, &LatMax);
-        ierr    = fscanf(fp, " %*s %*s "); // zmin, zmax
-        dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-    }
-
-    if (NLon - 1 == 0) {
-        fclose(fp);
-        return Err.post("Fatal error, NLon - 1 is zero");
-    }
-
-    if (NLat - 1 == 0) {
-        fclose(fp);
-        return Err.post("Fatal error, NLat - 1 is zero");
-    }
-
     DLon = (LonMax - LonMin) / (NLon - 1); // in degrees
     DLat = (LatMax - LatMin) / (NLat - 1);
 
     Dx = Re * g2r(DLon); // in m along the equator
     Dy = Re * g2r(DLat);
 
-    if (isBin) {
-
-        /* NOTE: optimal would be reading everything in one step, but that does not work because rows and columns are transposed
-         * (only possible with binary data at all) - use temporary buffer for now (consumes additional memory!) */
-        float *buf = new float[NLat * NLon];
-        tpStart    = std::chrono::steady_clock::now();
-        ierr       = fread(buf, sizeof(float), NLat * NLon, fp);
-        dAccumulateIOReadTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
-
-        for (i = 1; i <= NLon; i++) {
-            for (j = 1; j <= NLat; j++) {
-
-                m = idx(j, i);
-
-                if (isBin)
-                    fval = buf[(j - 1) * NLon + (i - 1)];
-                // ierr = fread( &fval, sizeof(float), 1, fp );
-
-                Node(m, iTopo) = fval;
-                Node(m, iTime) = -1;
-                Node(m, iD)    = -fval;
-
-                if (Node(m, iD) < 0) {
-                    Node(m, iD) = 0.0f;
-                } else if (Node(m, iD) < Par.dmin) {
-                    Node(m, iD) = Par.dmin;
-                }
-            }
-        }
-
-        delete[] buf;
-
-    } else {
-
+    // buf is in the same column order as the nodes
+#pragma omp parallel for default(shared) private(i, j, m, fval)
+    for (i = 1; i <= NLon; i++) {
         for (j = 1; j <= NLat; j++) {
-            for (i = 1; i <= NLon; i++) {
 
-                m    = idx(j, i);
-                ierr = fscanf(fp, " %f ", &fval);
+            m    = idx(j, i);
+            fval = buf[m];
 
-                Node(m, iTopo) = fval;
-                Node(m, iTime) = -1;
-                Node(m, iD)    = -fval;
+            Node(m, iTopo) = fval;
+            Node(m, iTime) = -1;
+            Node(m, iD)    = -fval;
 
-                if (Node(m, iD) < 0) {
-                    Node(m, iD) = 0.0f;
-                } else if (Node(m, iD) < Par.dmin) {
-                    Node(m, iD) = Par.dmin;
-                }
+            if (Node(m, iD) < 0) {
+                Node(m, iD) = 0.0f;
+            } else if (Node(m, iD) < Par.dmin) {
+                Node(m, iD) = Par.dmin;
             }
         }
     }
 
-    dTotalIOReadTime += dAccumulateIOReadTime;
+    delete[] buf;
+
     for (k = 1; k < MAX_VARS_PER_NODE - 2; k++) {
         Node.initMemory(k, 0);
     }
 
-    fclose(fp);
-
     if (!Par.dt) { // time step not explicitly defined
 
         // Make bathymetry from topography. Compute stable time step.
@@ -66,6 +66,7 @@ class CNode
     virtual int    copyFromGPU()                              = 0;
     virtual int    copyIntermediate()                         = 0;
     virtual int    copyPOIs()                                 = 0;
+    virtual int    copyState()                                = 0;
     virtual int    freeMem()                                  = 0;
     virtual int    run()                                      = 0;
 
@@ -138,6 +139,7 @@ class CStructNode : public CNode
     int copyFromGPU() { return 0; }
     int copyIntermediate() { return 0; }
     int copyPOIs() { return 0; }
+    int copyState() { return 0; }
 };
 
 #pragma pack(push, 1)
@@ -247,6 +249,7 @@ class CArrayNode : public CNode
     virtual int copyFromGPU() { return 0; }
     virtual int copyIntermediate() { return 0; }
     virtual int copyPOIs() { return 0; }
+    virtual int copyState() { return 0; }
 };
 #pragma pack(pop)
 
@@ -43,84 +43,321 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "utilits.h"
 #include "easywave.h"
 #include <cmath>
 
+/*
+ * Propagation snapshots are copied into one of Par.outQueue buffers and
+ * written by a background thread, so the time loop only waits for the disk
+ * when all buffers are still queued.
+ */
+struct Snapshot {
+    int                nrec;
+    int                time;
+    char               timeStr[32];
+    int                imin, imax, jmin, jmax;
+    short              nOutI, nOutJ;
+    double             lonOutMin, lonOutMax, latOutMin, latOutMax;
+    std::vector<float> ssh; // nOutJ rows of nOutI values
+};
+
 static char *IndexFile;
+static FILE *IndexFp;
 static int   Nrec2DOutput;
 
+static std::thread             Writer;
+static std::mutex              QueueMutex;
+static std::condition_variable QueueCond;
+static std::deque<Snapshot *>  Pending;
+static std::vector<Snapshot *> Free;
+static int                     NumSnapshots;
+static bool                    StopWriter;
+
+// IEEE half precision with round to nearest even
+static uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int      exp  = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) // inf, nan
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if (exp >= 31) // overflow
+        return sign | 0x7c00;
+    if (exp <= 0) { // subnormal or zero
+        if (exp < -10)
+            return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half  = mant >> shift;
+        uint32_t rest  = mant & ((1u << shift) - 1);
+        uint32_t mid   = 1u << (shift - 1);
+        if (rest > mid || (rest == mid && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++; // may carry into the exponent, which rounds up to the next power of two or to inf
+    return half;
+}
+
+// Run-length coding of 32-bit words: a short n > 0 is followed by n literal
+// words, n < 0 by one word that repeats -n times
+void ewEncodeRLE(const float *src, int n, std::vector<char> &out)
+{
+    const uint32_t *w = (const uint32_t *)src;
+    int             k = 0;
+
+    out.clear();
+    while (k < n) {
+        int run = 1;
+        while (k + run < n && run < 32767 && w[k + run] == w[k])
+            run++;
+
+        if (run > 1) {
+            short hdr = -run;
+            out.insert(out.end(), (char *)&hdr, (char *)&hdr + sizeof(hdr));
+            out.insert(out.end(), (char *)&w[k], (char *)&w[k] + sizeof(uint32_t));
+            k += run;
+        } else {
+            int lit = 1;
+            while (k + lit < n && lit < 32767 && !(k + lit + 1 < n && w[k + lit + 1] == w[k + lit]))
+                lit++;
+            short hdr = lit;
+            out.insert(out.end(), (char *)&hdr, (char *)&hdr + sizeof(hdr));
+            out.insert(out.end(), (char *)&w[k], (char *)&w[k + lit]);
+            k += lit;
+        }
+    }
+}
+
+// Inverse of ewEncodeRLE(); returns the number of bytes consumed, 0 for malformed input
+size_t ewDecodeRLE(const char *src, size_t size, float *dst, int n)
+{
+    size_t pos = 0;
+    int    k   = 0;
+
+    while (k < n) {
+        short hdr;
+        if (pos + sizeof(hdr) > size)
+            return 0;
+        memcpy(&hdr, src + pos, sizeof(hdr));
+        pos += sizeof(hdr);
+
+        if (hdr > 0) {
+            if (k + hdr > n || pos + hdr * sizeof(float) > size)
+                return 0;
+            memcpy(dst + k, src + pos, hdr * sizeof(float));
+            pos += hdr * sizeof(float);
+            k += hdr;
+        } else if (hdr < 0) {
+            if (k - hdr > n || pos + sizeof(float) > size)
+                return 0;
+            for (int r = 0; r < -hdr; r++)
+                memcpy(dst + k + r, src + pos, sizeof(float));
+            pos += sizeof(float);
+            k -= hdr;
+        } else
+            return 0;
+    }
+
+    return pos;
+}
+
+static void writeSnapshot(Snapshot *snap, std::vector<char> &buf)
+{
+    FILE  *fp;
+    double dtmp;
+    char   record[128];
+    size_t n = (size_t)snap->nOutI * snap->nOutJ;
+
+    // the label tells readers how the values are stored
+    const char *label = (Par.outFormat == OUT2D_HALF) ? "DSHB" : (Par.outFormat == OUT2D_RLE) ? "DSRB" : "DSBB";
+
+    sprintf(record, "%s.2D.%5.5d.ssh", Par.modelName, snap->time);
+    fp = fopen(record, "wb");
+    if (fp == NULL) {
+        Err.post("Unable to write %s", record);
+        return;
+    }
+    fwrite(label, 4, 1, fp);
+    fwrite(&snap->nOutI, sizeof(short), 1, fp);
+    fwrite(&snap->nOutJ, sizeof(short), 1, fp);
+    fwrite(&snap->lonOutMin, sizeof(double), 1, fp);
+    fwrite(&snap->lonOutMax, sizeof(double), 1, fp);
+    fwrite(&snap->latOutMin, sizeof(double), 1, fp);
+    fwrite(&snap->latOutMax, sizeof(double), 1, fp);
+    dtmp = -1.;
+    fwrite(&dtmp, sizeof(double), 1, fp);
+    dtmp = +1.;
+    fwrite(&dtmp, sizeof(double), 1, fp);
+
+    if (Par.outFormat == OUT2D_HALF) {
+        buf.resize(n * sizeof(uint16_t));
+        uint16_t *h = (uint16_t *)buf.data();
+        for (size_t k = 0; k < n; k++)
+            h[k] = floatToHalf(snap->ssh[k]);
+        fwrite(buf.data(), 1, buf.size(), fp);
+    } else if (Par.outFormat == OUT2D_RLE) {
+        ewEncodeRLE(snap->ssh.data(), (int)n, buf);
+        fwrite(buf.data(), 1, buf.size(), fp);
+    } else {
+        fwrite(snap->ssh.data(), sizeof(float), n, fp);
+    }
+    fclose(fp);
+
+    // updating contents file
+    fprintf(IndexFp, "%3.3d %s %d %d %d %d\n", snap->nrec, snap->timeStr, snap->imin, snap->imax, snap->jmin, snap->jmax);
+    fflush(IndexFp);
+}
+
+static void writerLoop()
+{
+    std::vector<char> buf;
+
+    for (;;) {
+        Snapshot *snap;
+        {
+            std::unique_lock<std::mutex> lock(QueueMutex);
+            QueueCond.wait(lock, [] { return StopWriter || !Pending.empty(); });
+            if (Pending.empty())
+                return;
+            snap = Pending.front();
+        }
+
+        writeSnapshot(snap, buf);
+
+        {
+            std::lock_guard<std::mutex> lock(QueueMutex);
+            Pending.pop_front();
+            Free.push_back(snap);
+        }
+        QueueCond.notify_all();
+    }
+}
+
 int ewStart2DOutput()
 {
-    FILE *fp;
-    char  buf[64];
+    char buf[64];
 
     // start index file
     sprintf(buf, "%s.2D.idx", Par.modelName);
     IndexFile = strdup(buf);
 
-    fp = fopen(IndexFile, "wt");
+    IndexFp = fopen(IndexFile, "wt");
+    if (IndexFp == NULL)
+        return Err.post("Unable to write %s", IndexFile);
 
-    fprintf(fp, "%g %g %d %g %g %d\n", LonMin, LonMax, NLon, LatMin, LatMax, NLat);
-
-    fclose(fp);
+    fprintf(IndexFp, "%g %g %d %g %g %d\n", LonMin, LonMax, NLon, LatMin, LatMax, NLat);
+    fflush(IndexFp);
 
     Nrec2DOutput = 0;
+    NumSnapshots = 0;
+    StopWriter   = false;
+    Writer       = std::thread(writerLoop);
 
     return 0;
 }
 
 int ewOut2D()
 {
-    FILE  *fp;
-    short  nOutI, nOutJ;
-    int    i, j, m;
-    float  ftmp;
-    double dtmp, lonOutMin, lonOutMax, latOutMin, latOutMax;
-    char   record[128];
+    Snapshot *snap;
+    int       i, j;
+
+    // without a writer thread no buffer would ever be returned to the free list
+    if (!Writer.joinable())
+        return Err.post("2D output was not started");
 
     CNode &Node = *gNode;
 
+    // take a free buffer, or allocate one while fewer than Par.outQueue exist, or wait for the writer
+    {
+        std::unique_lock<std::mutex> lock(QueueMutex);
+        QueueCond.wait(lock, [] { return !Free.empty() || NumSnapshots < Par.outQueue; });
+        if (!Free.empty()) {
+            snap = Free.back();
+            Free.pop_back();
+        } else {
+            snap = new Snapshot;
+            NumSnapshots++;
+        }
+    }
+
     Nrec2DOutput++;
 
-    nOutI     = Imax - Imin + 1;
-    lonOutMin = getLon(Imin);
-    lonOutMax = getLon(Imax);
-    nOutJ     = Jmax - Jmin + 1;
-    latOutMin = getLat(Jmin);
-    latOutMax = getLat(Jmax);
+    snap->nrec      = Nrec2DOutput;
+    snap->time      = Par.time;
+    snap->imin      = Imin;
+    snap->imax      = Imax;
+    snap->jmin      = Jmin;
+    snap->jmax      = Jmax;
+    snap->nOutI     = Imax - Imin + 1;
+    snap->lonOutMin = getLon(Imin);
+    snap->lonOutMax = getLon(Imax);
+    snap->nOutJ     = Jmax - Jmin + 1;
+    snap->latOutMin = getLat(Jmin);
+    snap->latOutMax = getLat(Jmax);
+    snprintf(snap->timeStr, sizeof(snap->timeStr), "%s", utlTimeSplitString(Par.time));
 
-    // write ssh
-    sprintf(record, "%s.2D.%5.5d.ssh", Par.modelName, Par.time);
-    fp = fopen(record, "wb");
-    fwrite("DSBB", 4, 1, fp);
-    fwrite(&nOutI, sizeof(short), 1, fp);
-    fwrite(&nOutJ, sizeof(short), 1, fp);
-    fwrite(&lonOutMin, sizeof(double), 1, fp);
-    fwrite(&lonOutMax, sizeof(double), 1, fp);
-    fwrite(&latOutMin, sizeof(double), 1, fp);
-    fwrite(&latOutMax, sizeof(double), 1, fp);
-    dtmp = -1.;
-    fwrite(&dtmp, sizeof(double), 1, fp);
-    dtmp = +1.;
-    fwrite(&dtmp, sizeof(double), 1, fp);
+    const int nOutI = Imax - Imin + 1;
+    snap->ssh.resize((size_t)nOutI * (Jmax - Jmin + 1));
+    float *ssh = snap->ssh.data();
+
+#pragma omp parallel for default(shared) private(i, j)
     for (j = Jmin; j <= Jmax; j++) {
+        float *row = ssh + (size_t)(j - Jmin) * nOutI;
         for (i = Imin; i <= Imax; i++) {
-            m = idx(j, i);
-            if (fabs(Node(m, iH)) < Par.sshTransparencyThreshold)
-                ftmp = (float)9999;
+            float h = Node(idx(j, i), iH);
+            if (fabs(h) < Par.sshTransparencyThreshold)
+                row[i - Imin] = (float)9999;
             else
-                ftmp = (float)Node(m, iH);
-            fwrite(&ftmp, sizeof(float), 1, fp);
+                row[i - Imin] = h;
         }
     }
-    fclose(fp);
 
-    // updating contents file
-    fp = fopen(IndexFile, "at");
-    fprintf(fp, "%3.3d %s %d %d %d %d\n", Nrec2DOutput, utlTimeSplitString(Par.time), Imin, Imax, Jmin, Jmax);
-    fclose(fp);
+    {
+        std::lock_guard<std::mutex> lock(QueueMutex);
+        Pending.push_back(snap);
+    }
+    QueueCond.notify_all();
+
+    return 0;
+}
+
+int ewStop2DOutput()
+{
+    {
+        std::lock_guard<std::mutex> lock(QueueMutex);
+        StopWriter = true;
+    }
+    QueueCond.notify_all();
+
+    if (Writer.joinable())
+        Writer.join();
+
+    for (Snapshot *snap : Free)
+        delete snap;
+    Free.clear();
+    NumSnapshots = 0;
+
+    if (IndexFp != NULL)
+        fclose(IndexFp);
+    IndexFp = NULL;
 
     return 0;
 }
@@ -143,6 +380,9 @@ int ewDump2D()
     latOutMin = getLat(Jmin);
     latOutMax = getLat(Jmax);
 
+    // whole rows are written at once
+    std::vector<float> row(nOutI);
+
     // write ssh max
     sprintf(record, "%s.2D.sshmax", Par.modelName);
     fp = fopen(record, "wb");
@@ -158,10 +398,9 @@ int ewDump2D()
     dtmp = 1.;
     fwrite(&dtmp, sizeof(double), 1, fp);
     for (j = Jmin; j <= Jmax; j++) {
-        for (i = Imin; i <= Imax; i++) {
-            ftmp = (float)Node(idx(j, i), iHmax);
-            fwrite(&ftmp, sizeof(float), 1, fp);
-        }
+        for (i = Imin; i <= Imax; i++)
+            row[i - Imin] = (float)Node(idx(j, i), iHmax);
+        fwrite(row.data(), sizeof(float), nOutI, fp);
     }
     fclose(fp);
 
@@ -188,8 +427,9 @@ int ewDump2D()
             } else {
                 ftmpcalc = ftmp / 60.0f;
             }
-            fwrite(&ftmpcalc, sizeof(float), 1, fp);
+            row[i - Imin] = ftmpcalc;
         }
+        fwrite(row.data(), sizeof(float), nOutI, fp);
     }
     fclose(fp);
 
@@ -44,6 +44,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
 
 #include "utilits.h"
 #include "easywave.h"
@@ -56,19 +59,158 @@ int            NPOIs;
 static char  **idPOI;
 long          *idxPOI;
 static int    *flagRunupPOI;
+static double *ampPOI;
 static int     NtPOI;
 static int    *timePOI;
-static float **sshPOI;
+static float  *sshPOI; // NtPOI rows of NPOIs values, row it is saved at timePOI[it]
+
+/* time series of all ensemble scenarios; set 0 is the one allocated by ewLoadPOIs() */
+static int     NumPOISets;
+static int   **timePOISets;
+static float **sshPOISets;
+
+/*
+ * Index of the wet grid nodes used to snap POIs given by coordinates. The
+ * nodes with a depth within poi_min_depth..poi_max_depth are sorted into
+ * square buckets of POI_BUCKET x POI_BUCKET nodes. A POI visits the buckets
+ * ring by ring around its own one and stops as soon as no node of the next
+ * ring can be closer than the best node found so far or than poi_search_dist.
+ */
+#define POI_BUCKET 8
+
+struct POIIndex {
+    int               nbLon, nbLat;
+    std::vector<int>  start; // nodes of bucket b are nodes[start[b]..start[b+1]-1]
+    std::vector<long> nodes;
+};
+
+struct POIRecord {
+    std::string record;
+    char        id[64];
+    double      lon, lat;
+    int         flag;
+    int         status; // 0 accepted, 1 bad record, 2 out of grid, 3 too far
+    long        node;
+    double      d2;
+};
+
+static void ewBuildPOIIndex(POIIndex &index)
+{
+    int    bi, bj, i, j;
+    double depth;
+
+    CNode &Node = *gNode;
+
+    index.nbLon = (NLon + POI_BUCKET - 1) / POI_BUCKET;
+    index.nbLat = (NLat + POI_BUCKET - 1) / POI_BUCKET;
+    index.start.assign((size_t)index.nbLon * index.nbLat + 1, 0);
+
+    // a column of buckets only holds nodes of its own grid columns, so the columns are counted and filled in parallel
+#pragma omp parallel for default(shared) private(bi, i, j, depth)
+    for (bi = 0; bi < index.nbLon; bi++) {
+        int *count = &index.start[(size_t)bi * index.nbLat + 1];
+        for (i = bi * POI_BUCKET + 1; i <= NLon && i <= (bi + 1) * POI_BUCKET; i++)
+            for (j = 1; j <= NLat; j++) {
+                depth = Node(idx(j, i), iD);
+                if (depth >= Par.poiDepthMin && depth <= Par.poiDepthMax)
+                    count[(j - 1) / POI_BUCKET]++;
+            }
+    }
+
+    for (size_t b = 1; b < index.start.size(); b++)
+        index.start[b] += index.start[b - 1];
+    index.nodes.resize(index.start.back());
+
+#pragma omp parallel for default(shared) private(bi, bj, i, j, depth)
+    for (bi = 0; bi < index.nbLon; bi++) {
+        std::vector<int> pos(index.start.begin() + (size_t)bi * index.nbLat, index.start.begin() + (size_t)(bi + 1) * index.nbLat);
+        for (i = bi * POI_BUCKET + 1; i <= NLon && i <= (bi + 1) * POI_BUCKET; i++)
+            for (j = 1; j <= NLat; j++) {
+                depth = Node(idx(j, i), iD);
+                if (depth >= Par.poiDepthMin && depth <= Par.poiDepthMax) {
+                    bj                     = (j - 1) / POI_BUCKET;
+                    index.nodes[pos[bj]++] = idx(j, i);
+                }
+            }
+    }
+}
+
+// closest indexed node to (lon,lat) within poi_search_dist; local distances are treated as cartesian (2 min cell distortion at 60 degrees is only about 2 meters or 0.2%)
+static long ewSnapPOI(const POIIndex &index, double lon, double lat, double lenLon, double lenLat, double &d2min)
+{
+    int    bi0, bj0, bi, bj, bimin, bimax, bjmin, bjmax, i, j, k, m;
+    long   n, nmin;
+    double x, y, dx, dy, d2, dist, stepLon, stepLat;
+
+    // position in cells, node (j,i) lies at (i-1,j-1)
+    x   = (lon - LonMin) / DLon;
+    y   = (lat - LatMin) / DLat;
+    bi0 = (int)x / POI_BUCKET;
+    if (bi0 >= index.nbLon)
+        bi0 = index.nbLon - 1;
+    bj0 = (int)y / POI_BUCKET;
+    if (bj0 >= index.nbLat)
+        bj0 = index.nbLat - 1;
+
+    stepLon = lenLon * DLon;
+    stepLat = lenLat * DLat;
+
+    d2min = RealMax;
+    nmin  = -1;
+    for (k = 0;; k++) {
+
+        // a node in ring k is more than (k-1)*POI_BUCKET cells away in longitude or latitude
+        if (k > 0) {
+            dist = (k - 1) * POI_BUCKET * (stepLon < stepLat ? stepLon : stepLat);
+            if (dist > Par.poiDistMax || (nmin >= 0 && dist * dist > d2min))
+                break;
+        }
+
+        bimin = bi0 - k;
+        bimax = bi0 + k;
+        bjmin = bj0 - k;
+        bjmax = bj0 + k;
+        if (bimin < 0 && bimax >= index.nbLon && bjmin < 0 && bjmax >= index.nbLat)
+            break;
+
+        for (bi = (bimin < 0 ? 0 : bimin); bi <= bimax && bi < index.nbLon; bi++)
+            for (bj = (bjmin < 0 ? 0 : bjmin); bj <= bjmax && bj < index.nbLat; bj++) {
+                if (bi != bimin && bi != bimax && bj != bjmin && bj != bjmax)
+                    continue;
+
+                // skip the bucket if none of its nodes can be closer
+                dx = (x < bi * POI_BUCKET) ? bi * POI_BUCKET - x : (x > (bi + 1) * POI_BUCKET - 1 ? x - ((bi + 1) * POI_BUCKET - 1) : 0.);
+                dy = (y < bj * POI_BUCKET) ? bj * POI_BUCKET - y : (y > (bj + 1) * POI_BUCKET - 1 ? y - ((bj + 1) * POI_BUCKET - 1) : 0.);
+                d2 = pow(stepLon * dx, 2.) + pow(stepLat * dy, 2.);
+                if (d2 > d2min || d2 > (double)Par.poiDistMax * Par.poiDistMax)
+                    continue;
+
+                int b = bi * index.nbLat + bj;
+                for (m = index.start[b]; m < index.start[b + 1]; m++) {
+                    n  = index.nodes[m];
+                    i  = n / NLat + 1;
+                    j  = n - (i - 1) * NLat + 1;
+                    d2 = pow(lenLon * (lon - getLon(i)), 2.) +
+                         pow(lenLat * (lat - getLat(j)), 2.);
+                    if (d2 < d2min || (d2 == d2min && n < nmin)) {
+                        d2min = d2;
+                        nmin  = n;
+                    }
+                }
+            }
+    }
+
+    return nmin;
+}
 
 int ewLoadPOIs()
 {
-    FILE  *fp, *fpFit, *fpAcc, *fpRej;
-    int    ierr, line;
-    int    i, j, i0, j0, imin, imax, jmin, jmax, flag, it, n;
-    int    rad, nmin, itype;
+    FILE  *fp, *fpAcc, *fpRej;
+    int    line;
+    int    i, j, i0, j0, it, n;
+    int    nmin, itype, numRecords;
     char   record[256], buf[256], id[64];
-    double lon, lat, d2, d2min, lenLon, lenLat, depth;
-    double POIdistMax, POIdepthMin, POIdepthMax;
+    double lenLat;
 
     CNode &Node = *gNode;
 
@@ -91,8 +233,8 @@ int ewLoadPOIs()
     flagRunupPOI = new int[MaxPOIs];
     if (!flagRunupPOI)
         return Err.post("Error allocating memory");
-    sshPOI = new float *[MaxPOIs];
-    if (!sshPOI)
+    ampPOI = new double[MaxPOIs];
+    if (!ampPOI)
         return Err.post("Error allocating memory");
 
     // read first record and get idea about the input type
@@ -123,102 +265,99 @@ int ewLoadPOIs()
         Log.print("%d POIs of %d loaded successfully; %d POIs rejected", NPOIs, MaxPOIs, (MaxPOIs - NPOIs));
     } else if (itype == 3) { // poi-name and coordinates
 
-        if (Par.poiReport) {
-            fpAcc = fopen("poi_accepted.lst", "wt");
-            fprintf(fpAcc, "ID lon lat   lonIJ latIJ depthIJ   dist[km]\n");
-            fpRej = fopen("poi_rejected.lst", "wt");
-        }
+        std::vector<POIRecord> pois;
+        POIIndex               index;
+        POIRecord              poi;
 
-        lenLat = My_PI * Re / 180;
+        std::chrono::steady_clock::time_point const tpStart(std::chrono::steady_clock::now());
 
         fp   = fopen(Par.filePOIs, "rt");
-        line = NPOIs = 0;
+        line = 0;
         while (utlReadNextRecord(fp, record, &line) != EOF) {
 
-            i = sscanf(record, "%s %lf %lf %d", id, &lon, &lat, &flag);
+            poi.record = record;
+            poi.node   = -1;
+            poi.d2     = RealMax;
+            i          = sscanf(record, "%63s %lf %lf %d", poi.id, &poi.lon, &poi.lat, &poi.flag);
             if (i == 3)
-                flag = 1;
-            else if (i == 4)
-                ;
-            else {
-                Log.print("! Bad POI record: %s", record);
-                if (Par.poiReport)
-                    fprintf(fpRej, "%s\n", record);
+                poi.flag = 1;
+            poi.status = (i == 3 || i == 4) ? 0 : 1;
+            pois.push_back(poi);
+        }
+        fclose(fp);
+        numRecords = (int)pois.size();
+
+        ewBuildPOIIndex(index);
+
+        // snap all POIs at once, every POI is independent of the others
+        lenLat = My_PI * Re / 180;
+#pragma omp parallel for default(shared) private(i0, j0) schedule(dynamic, 64)
+        for (n = 0; n < numRecords; n++) {
+            POIRecord &p = pois[n];
+            if (p.status)
                 continue;
-            }
 
-            // find the closest water grid node. Local distances could be treated as cartesian (2 min cell distortion at 60 degrees is only about 2 meters or 0.2%)
-            i0 = (int)((lon - LonMin) / DLon) + 1;
-            j0 = (int)((lat - LatMin) / DLat) + 1;
+            i0 = (int)((p.lon - LonMin) / DLon) + 1;
+            j0 = (int)((p.lat - LatMin) / DLat) + 1;
             if (i0 < 1 || i0 > NLon || j0 < 1 || j0 > NLat) {
-                Log.print("!POI out of grid: %s", record);
-                if (Par.poiReport)
-                    fprintf(fpRej, "%s\n", record);
+                p.status = 2;
                 continue;
             }
-            lenLon = lenLat * R6[j0];
-
-            for (nmin = -1, rad = 0; rad < NLon && rad < NLat; rad++) {
-
-                d2min = RealMax;
-
-                imin = i0 - rad;
-                if (imin < 1)
-                    imin = 1;
-                imax = i0 + rad + 1;
-                if (imax > NLon)
-                    imax = NLon;
-                jmin = j0 - rad;
-                if (jmin < 1)
-                    jmin = 1;
-                jmax = j0 + rad + 1;
-                if (jmax > NLat)
-                    jmax = NLat;
-                for (i = imin; i <= imax; i++)
-                    for (j = jmin; j <= jmax; j++) {
-                        if (i != imin && i != imax && j != jmin && j != jmax)
-                            continue;
-                        n     = idx(j, i);
-                        depth = Node(n, iD);
-                        if (depth < Par.poiDepthMin || depth > Par.poiDepthMax)
-                            continue;
-                        d2 = pow(lenLon * (lon - getLon(i)), 2.) +
-                             pow(lenLat * (lat - getLat(j)), 2.);
-                        if (d2 < d2min) {
-                            d2min = d2;
-                            nmin  = n;
-                        }
-                    }
 
-                if (nmin > 0)
-                    break;
-            }
+            p.node = ewSnapPOI(index, p.lon, p.lat, lenLat * R6[j0], lenLat, p.d2);
+            if (p.node < 0 || sqrt(p.d2) > Par.poiDistMax)
+                p.status = 3;
+        }
 
-            if (sqrt(d2min) > Par.poiDistMax) {
-                Log.print("! Closest water node too far: %s", record);
+        if (Par.poiReport) {
+            fpAcc = fopen("poi_accepted.lst", "wt");
+            fprintf(fpAcc, "ID lon lat   lonIJ latIJ depthIJ   dist[km]\n");
+            fpRej = fopen("poi_rejected.lst", "wt");
+        }
+
+        NPOIs = 0;
+        for (n = 0; n < numRecords; n++) {
+            POIRecord &p = pois[n];
+
+            if (p.status) {
+                if (p.status == 1)
+                    Log.print("! Bad POI record: %s", p.record.c_str());
+                else if (p.status == 2)
+                    Log.print("!POI out of grid: %s", p.record.c_str());
+                else
+                    Log.print("! Closest water node too far: %s", p.record.c_str());
                 if (Par.poiReport)
-                    fprintf(fpRej, "%s\n", record);
+                    fprintf(fpRej, "%s\n", p.record.c_str());
                 continue;
             }
 
-            idPOI[NPOIs]        = strdup(id);
-            idxPOI[NPOIs]       = nmin;
-            flagRunupPOI[NPOIs] = flag;
+            idPOI[NPOIs]        = strdup(p.id);
+            idxPOI[NPOIs]       = p.node;
+            flagRunupPOI[NPOIs] = p.flag;
             NPOIs++;
-            i = nmin / NLat + 1;
-            j = nmin - (i - 1) * NLat + 1;
+            i = p.node / NLat + 1;
+            j = p.node - (i - 1) * NLat + 1;
             if (Par.poiReport)
-                fprintf(fpAcc, "%s %.4f %.4f   %.4f %.4f %.1f   %.3f\n", id, lon, lat, getLon(i), getLat(j), Node(nmin, iD), sqrt(d2min) / 1000);
+                fprintf(fpAcc, "%s %.4f %.4f   %.4f %.4f %.1f   %.3f\n", p.id, p.lon, p.lat, getLon(i), getLat(j), Node(p.node, iD), sqrt(p.d2) / 1000);
         }
 
-        fclose(fp);
         Log.print("%d POIs of %d loaded successfully; %d POIs rejected", NPOIs, MaxPOIs, (MaxPOIs - NPOIs));
+        Log.print("POIs snapped to %d of %d water nodes in %.3f sec", NPOIs, (int)index.nodes.size(),
+                  std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count());
         if (Par.poiReport) {
             fclose(fpAcc);
             fclose(fpRej);
         }
     }
 
+    // the depth at a POI does not change, so the runup factor is fixed
+    for (n = 0; n < NPOIs; n++) {
+        if (flagRunupPOI[n])
+            ampPOI[n] = pow(Node(idxPOI[n], iD), 0.25);
+        else
+            ampPOI[n] = 1.;
+    }
+
     // if mareograms
     if (Par.poiDt) {
         NtPOI = Par.timeMax / Par.poiDt + 1;
@@ -227,12 +366,101 @@ int ewLoadPOIs()
         for (it = 0; it < NtPOI; it++)
             timePOI[it] = -1;
 
-        for (n = 0; n < NPOIs; n++) {
-            sshPOI[n] = new float[NtPOI];
-            for (it = 0; it < NtPOI; it++)
-                sshPOI[n][it] = 0.;
-        }
+        sshPOI = new float[(size_t)NtPOI * NPOIs]();
+        if (!sshPOI)
+            return Err.post("Error allocating memory");
+    }
+
+    return 0;
+}
+
+int ewAllocPOIScenarios(int numScenarios)
+{
+    int    s, it;
+    float *block;
+
+    if (!NPOIs || !Par.poiDt)
+        return 0;
+
+    timePOISets = new int *[numScenarios];
+    sshPOISets  = new float *[numScenarios];
+    if (!timePOISets || !sshPOISets)
+        return Err.post("Error allocating memory");
+
+    // the series of the other scenarios follow each other in one block
+    block = new float[(size_t)(numScenarios - 1) * NtPOI * NPOIs]();
+    if (!block)
+        return Err.post("Error allocating memory");
+
+    timePOISets[0] = timePOI;
+    sshPOISets[0]  = sshPOI;
+    for (s = 1; s < numScenarios; s++) {
+        timePOISets[s] = new int[NtPOI];
+        for (it = 0; it < NtPOI; it++)
+            timePOISets[s][it] = -1;
+
+        sshPOISets[s] = block + (size_t)(s - 1) * NtPOI * NPOIs;
     }
+    NumPOISets = numScenarios;
+
+    return 0;
+}
+
+// following ewSavePOIs() and ewDumpPOIs() use the time series of this scenario
+int ewSelectPOIScenario(int scenario)
+{
+    if (scenario < 0 || scenario >= NumPOISets)
+        return 0;
+
+    timePOI = timePOISets[scenario];
+    sshPOI  = sshPOISets[scenario];
+
+    return 0;
+}
+
+// POI time series as one block for checkpoints: NPOIs, NtPOI, timePOI and the rows of the series
+size_t ewPOIStateSize()
+{
+    if (!NPOIs || !Par.poiDt)
+        return 0;
+
+    return 2 * sizeof(int) + NtPOI * sizeof(int) + (size_t)NPOIs * NtPOI * sizeof(float);
+}
+
+void ewPackPOIState(char *buf)
+{
+    if (!NPOIs || !Par.poiDt)
+        return;
+
+    memcpy(buf, &NPOIs, sizeof(int));
+    buf += sizeof(int);
+    memcpy(buf, &NtPOI, sizeof(int));
+    buf += sizeof(int);
+    memcpy(buf, timePOI, NtPOI * sizeof(int));
+    buf += NtPOI * sizeof(int);
+    memcpy(buf, sshPOI, (size_t)NtPOI * NPOIs * sizeof(float));
+}
+
+// the restarted run may be longer or shorter than the one that wrote the block
+int ewUnpackPOIState(const char *buf, size_t size)
+{
+    int numPOIs, numT, nt;
+
+    if (!NPOIs || !Par.poiDt)
+        return 0;
+
+    if (size < 2 * sizeof(int))
+        return Err.post("Corrupted POI time series in checkpoint");
+    memcpy(&numPOIs, buf, sizeof(int));
+    memcpy(&numT, buf + sizeof(int), sizeof(int));
+    if (numPOIs != NPOIs || size != 2 * sizeof(int) + numT * sizeof(int) + (size_t)numPOIs * numT * sizeof(float))
+        return Err.post("Checkpoint was written for %d POIs, %d loaded", numPOIs, NPOIs);
+    buf += 2 * sizeof(int);
+
+    nt = (numT < NtPOI) ? numT : NtPOI;
+    memcpy(timePOI, buf, nt * sizeof(int));
+    buf += numT * sizeof(int);
+    memcpy(sshPOI, buf, (size_t)nt * NPOIs * sizeof(float));
 
     return 0;
 }
@@ -240,7 +468,7 @@ int ewLoadPOIs()
 int ewSavePOIs()
 {
     int    it, n;
-    double ampFactor;
+    float *row;
 
     CNode &Node = *gNode;
 
@@ -251,15 +479,9 @@ int ewSavePOIs()
 
     timePOI[it] = Par.time;
 
-    for (n = 0; n < NPOIs; n++) {
-
-        if (flagRunupPOI[n])
-            ampFactor = pow(Node(idxPOI[n], iD), 0.25);
-        else
-            ampFactor = 1.;
-
-        sshPOI[n][it] = ampFactor * Node(idxPOI[n], iH);
-    }
+    row = sshPOI + (size_t)it * NPOIs;
+    for (n = 0; n < NPOIs; n++)
+        row[n] = ampPOI[n] * Node(idxPOI[n], iH);
 
     return 0;
 }
@@ -269,7 +491,7 @@ int ewDumpPOIs()
     FILE  *fp;
     char   buf[64];
     int    n, it;
-    double ampFactor, dbuf;
+    double dbuf;
 
     CNode &Node = *gNode;
 
@@ -288,7 +510,7 @@ int ewDumpPOIs()
         for (it = 0; (timePOI[it] != -1 && it < NtPOI); it++) {
             fprintf(fp, "%6.2f", (double)timePOI[it] / 60);
             for (n = 0; n < NPOIs; n++)
-                fprintf(fp, " %7.3f", sshPOI[n][it]);
+                fprintf(fp, " %7.3f", sshPOI[(size_t)it * NPOIs + n]);
             fprintf(fp, "\n");
         }
 
@@ -308,12 +530,7 @@ int ewDumpPOIs()
             dbuf = -1.;
         fprintf(fp, " %6.2f", dbuf);
 
-        if (flagRunupPOI[n])
-            ampFactor = pow(Node(idxPOI[n], iD), 0.25);
-        else
-            ampFactor = 1;
-
-        fprintf(fp, " %6.3f\n", (ampFactor * Node(idxPOI[n], iHmax)));
+        fprintf(fp, " %6.3f\n", (ampPOI[n] * Node(idxPOI[n], iHmax)));
     }
 
     fclose(fp);
@@ -66,10 +66,30 @@ int ewParam(int argc, char **argv)
     } else
         return -1;
 
-    // Source: Okada faults or Surfer grid
+    // Native copy of the bathymetry, read instead of the GRD-file when up to date and written otherwise
+    if ((argn = utlCheckCommandLineOption(argc, argv, "bathy_cache", 11)) != 0) {
+        Par.fileBathymetryCache = strdup(argv[argn + 1]);
+    } else
+        Par.fileBathymetryCache = NULL;
+
+    // Ensemble: list of sources propagated over the same bathymetry
+    if ((argn = utlCheckCommandLineOption(argc, argv, "ensemble", 8)) != 0) {
+        Par.fileEnsemble = strdup(argv[argn + 1]);
+    } else
+        Par.fileEnsemble = NULL;
+
+    // Restart from a checkpoint instead of starting from the source
+    if ((argn = utlCheckCommandLineOption(argc, argv, "restart", 7)) != 0) {
+        Par.fileRestart = strdup(argv[argn + 1]);
+    } else
+        Par.fileRestart = NULL;
+
+    // Source: Okada faults or Surfer grid; taken from the ensemble file or the checkpoint otherwise
     if ((argn = utlCheckCommandLineOption(argc, argv, "source", 6)) != 0) {
         Par.fileSource = strdup(argv[argn + 1]);
-    } else
+    } else if (Par.fileEnsemble || Par.fileRestart)
+        Par.fileSource = NULL;
+    else
         return -1;
 
     // Simulation time, [sec]
@@ -119,6 +139,36 @@ int ewParam(int argc, char **argv)
     else
         Par.outPropagation = 300;
 
+    // 2D-wave propagation output format: float, half (IEEE float16) or rle (lossless run-length coding)
+    Par.outFormat = OUT2D_FLOAT;
+    if ((argn = utlCheckCommandLineOption(argc, argv, "out_format", 10)) != 0) {
+        if (!strcmp(argv[argn + 1], "half"))
+            Par.outFormat = OUT2D_HALF;
+        else if (!strcmp(argv[argn + 1], "rle"))
+            Par.outFormat = OUT2D_RLE;
+        else if (strcmp(argv[argn + 1], "float"))
+            return -1;
+    }
+
+    // 2D-wave propagation output: snapshots that may wait for the writer thread
+    if ((argn = utlCheckCommandLineOption(argc, argv, "out_queue", 9)) != 0)
+        Par.outQueue = atoi(argv[argn + 1]);
+    else
+        Par.outQueue = 4;
+    if (Par.outQueue < 1)
+        Par.outQueue = 1;
+
+    // Checkpoints of the simulation state, [sec model time] (the trailing '\0' keeps -checkpoint_file from matching)
+    if ((argn = utlCheckCommandLineOption(argc, argv, "checkpoint", 11)) != 0)
+        Par.outCheckpoint = (int)(atof(argv[argn + 1]) * 60);
+    else
+        Par.outCheckpoint = 0;
+
+    if ((argn = utlCheckCommandLineOption(argc, argv, "checkpoint_file", 15)) != 0)
+        Par.fileCheckpoint = strdup(argv[argn + 1]);
+    else
+        Par.fileCheckpoint = strdup("easywave.ckpt");
+
     // minimal calculation depth, [m]
     if ((argn = utlCheckCommandLineOption(argc, argv, "min_depth", 9)) != 0)
         Par.dmin = (float)atof(argv[argn + 1]);
@@ -209,6 +259,18 @@ int ewParam(int argc, char **argv)
     else
         Par.gpu = false;
 
+    // Run the time steps on the CPU instead of the device (the trailing '\0' keeps -cpu_tile from matching)
+    if ((argn = utlCheckCommandLineOption(argc, argv, "cpu", 4)) != 0)
+        Par.cpu = true;
+    else
+        Par.cpu = false;
+
+    // Width of the column strips swept by one CPU thread, [grid columns]
+    if ((argn = utlCheckCommandLineOption(argc, argv, "cpu_tile", 8)) != 0)
+        Par.cpuTile = atoi(argv[argn + 1]);
+    else
+        Par.cpuTile = 64;
+
     if ((argn = utlCheckCommandLineOption(argc, argv, "adjust_ztop", 11)) != 0)
         Par.adjustZtop = true;
     else
@@ -227,12 +289,22 @@ void ewLogParams(void)
     Log.print("\nModel parameters for this simulation:");
     Log.print("timestep: %d sec", Par.dt);
     Log.print("max time: %g min", (float)Par.timeMax / 60);
+    Log.print("propagation output: %s, %d queued snapshots", (Par.outFormat == OUT2D_HALF ? "half" : (Par.outFormat == OUT2D_RLE ? "rle" : "float")), Par.outQueue);
+    if (Par.outCheckpoint)
+        Log.print("checkpoint: every %g min to %s", (float)Par.outCheckpoint / 60, Par.fileCheckpoint);
+    if (Par.fileRestart)
+        Log.print("restart: %s", Par.fileRestart);
     Log.print("poi_dt_out: %d sec", Par.poiDt);
     Log.print("poi_report: %s", (Par.poiReport ? "yes" : "no"));
     Log.print("poi_search_dist: %g km", Par.poiDistMax / 1000.);
     Log.print("poi_min_depth: %g m", Par.poiDepthMin);
     Log.print("poi_max_depth: %g m", Par.poiDepthMax);
     Log.print("coriolis: %s", (Par.coriolis ? "yes" : "no"));
+    if (Par.fileEnsemble)
+        Log.print("ensemble: %s", Par.fileEnsemble);
+    Log.print("cpu: %s", (Par.cpu || Par.fileEnsemble ? "yes" : "no"));
+    if (Par.cpu || Par.fileEnsemble)
+        Log.print("cpu_tile: %d columns", Par.cpuTile);
     Log.print("min_depth: %g m", Par.dmin);
     Log.print("ssh0_rel: %g", Par.ssh0ThresholdRel);
     Log.print("ssh0_abs: %g m", Par.ssh0ThresholdAbs);
@@ -169,11 +169,13 @@ int ewSource(double &dTotalIOReadTime)
 
         // calculate uplift on a rectangular grid
         // set grid resolution, grid dimensions will be set automatically
-        uZ.dx = DLon;
-        uZ.dy = DLat;
-        ierr  = eq.calculate(uZ);
+        uZ.dx   = DLon;
+        uZ.dy   = DLat;
+        tpStart = std::chrono::steady_clock::now();
+        ierr    = eq.calculate(uZ);
         if (ierr)
             return ierr;
+        Log.print("Okada deformation of %d fault(s) on %dx%d nodes in %.3f sec", eq.nfault, uZ.nx, uZ.ny, std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count());
 
         if (effSymSource) {
             // integrate for tsunami energy
@@ -28,6 +28,11 @@
 #define iTime 10
 #define iTopo 11
 
+// storage of the 2D propagation snapshots
+#define OUT2D_FLOAT 0
+#define OUT2D_HALF  1
+#define OUT2D_RLE   2
+
 // Global data
 struct EWPARAMS {
     char *modelName;
@@ -35,6 +40,10 @@ struct EWPARAMS {
     char *fileBathymetry;
     char *fileSource;
     char *filePOIs;
+    char *fileBathymetryCache;
+    char *fileEnsemble;
+    char *fileCheckpoint;
+    char *fileRestart;
     int   dt;
     int   time;
     int   timeMax;
@@ -43,7 +52,11 @@ struct EWPARAMS {
     int   outDump;
     int   outProgress;
     int   outPropagation;
+    int   outFormat;
+    int   outQueue;
+    int   outCheckpoint;
     int   coriolis;
+    int   cpuTile;
     float dmin;
     float poiDistMax;
     float poiDepthMin;
@@ -55,6 +68,7 @@ struct EWPARAMS {
     float sshTransparencyThreshold;
     float sshArrivalThreshold;
     bool  gpu;
+    bool  cpu;
     bool  adjustZtop;
     bool  verbose;
 };
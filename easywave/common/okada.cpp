@@ -49,74 +49,85 @@
 #define My_PI    3.14159265358979
 #define DISPLMAX 1000
 
-double fun_Chinnery(double (*fun)(double ksi, double eta), double x, double y);
-double f_ssUx(double ksi, double eta);
-double f_ssUy(double ksi, double eta);
-double f_ssUz(double ksi, double eta);
-double f_dsUx(double ksi, double eta);
-double f_dsUy(double ksi, double eta);
-double f_dsUz(double ksi, double eta);
-double fun_R(double ksi, double eta);
-double fun_X(double ksi, double eta);
-double fun_yp(double ksi, double eta);
-double fun_dp(double ksi, double eta);
-double fun_I1(double ksi, double eta);
-double fun_I2(double ksi, double eta);
-double fun_I3(double ksi, double eta);
-double fun_I4(double ksi, double eta);
-double fun_I5(double ksi, double eta);
-
-static double sdip;
-static double cdip;
-static double p;
-static double q;
-static double width;
-static double length;
-static double elast;
+// Geometry of one evaluation; passed explicitly so that several threads can evaluate at once
+struct OkadaGeom {
+    double sdip;
+    double cdip;
+    double p;
+    double q;
+    double width;
+    double length;
+    double elast;
+};
+
+typedef double (*OkadaFun)(const OkadaGeom &g, double ksi, double eta);
+
+double fun_Chinnery(OkadaFun fun, const OkadaGeom &g, double x, double y);
+double f_ssUx(const OkadaGeom &g, double ksi, double eta);
+double f_ssUy(const OkadaGeom &g, double ksi, double eta);
+double f_ssUz(const OkadaGeom &g, double ksi, double eta);
+double f_dsUx(const OkadaGeom &g, double ksi, double eta);
+double f_dsUy(const OkadaGeom &g, double ksi, double eta);
+double f_dsUz(const OkadaGeom &g, double ksi, double eta);
+double fun_R(const OkadaGeom &g, double ksi, double eta);
+double fun_X(const OkadaGeom &g, double ksi, double eta);
+double fun_yp(const OkadaGeom &g, double ksi, double eta);
+double fun_dp(const OkadaGeom &g, double ksi, double eta);
+double fun_I1(const OkadaGeom &g, double ksi, double eta);
+double fun_I2(const OkadaGeom &g, double ksi, double eta);
+double fun_I3(const OkadaGeom &g, double ksi, double eta);
+double fun_I4(const OkadaGeom &g, double ksi, double eta);
+double fun_I5(const OkadaGeom &g, double ksi, double eta);
+
+static void setGeom(OkadaGeom &g, double L, double W, double D, double sinD, double cosD, double y)
+{
+    g.sdip = sinD;
+    if (fabs(g.sdip) < 1.e-10)
+        g.sdip = 0;
+    g.cdip = cosD;
+    if (fabs(g.cdip) < 1.e-10)
+        g.cdip = 0;
+    g.p      = y * g.cdip + D * g.sdip;
+    g.q      = y * g.sdip - D * g.cdip;
+    g.width  = W;
+    g.length = L;
+    g.elast  = 0.5; // mu/(lambda+mu)
+}
 
 //============================================================================
 int okada(double L, double W, double D, double sinD, double cosD, double U1, double U2, double x, double y, int flag_xy, double *Ux, double *Uy, double *Uz)
 {
-    double U1x, U2x, U1y, U2y, U1z, U2z;
-
-    sdip = sinD;
-    if (fabs(sdip) < 1.e-10)
-        sdip = 0;
-    cdip = cosD;
-    if (fabs(cdip) < 1.e-10)
-        cdip = 0;
-    p      = y * cdip + D * sdip;
-    q      = y * sdip - D * cdip;
-    width  = W;
-    length = L;
-    elast  = 0.5; // mu/(lambda+mu)
+    double    U1x, U2x, U1y, U2y, U1z, U2z;
+    OkadaGeom g;
+
+    setGeom(g, L, W, D, sinD, cosD, y);
 
     U1x = U2x = U1y = U2y = U1z = U2z = 0;
 
     if (U1 != 0) {
         if (flag_xy) {
-            U1x = -U1 / 2 / My_PI * fun_Chinnery(f_ssUx, x, y);
+            U1x = -U1 / 2 / My_PI * fun_Chinnery(f_ssUx, g, x, y);
             if (fabs(U1x) > DISPLMAX)
                 U1x = 0;
-            U1y = -U1 / 2 / My_PI * fun_Chinnery(f_ssUy, x, y);
+            U1y = -U1 / 2 / My_PI * fun_Chinnery(f_ssUy, g, x, y);
             if (fabs(U1y) > DISPLMAX)
                 U1y = 0;
         }
-        U1z = -U1 / 2 / My_PI * fun_Chinnery(f_ssUz, x, y);
+        U1z = -U1 / 2 / My_PI * fun_Chinnery(f_ssUz, g, x, y);
         if (fabs(U1z) > DISPLMAX)
             U1z = 0;
     }
 
     if (U2 != 0) {
         if (flag_xy) {
-            U2x = -U2 / 2 / My_PI * fun_Chinnery(f_dsUx, x, y);
+            U2x = -U2 / 2 / My_PI * fun_Chinnery(f_dsUx, g, x, y);
             if (fabs(U2x) > DISPLMAX)
                 U2x = 0;
-            U2y = -U2 / 2 / My_PI * fun_Chinnery(f_dsUy, x, y);
+            U2y = -U2 / 2 / My_PI * fun_Chinnery(f_dsUy, g, x, y);
             if (fabs(U2y) > DISPLMAX)
                 U2y = 0;
         }
-        U2z = -U2 / 2 / My_PI * fun_Chinnery(f_dsUz, x, y);
+        U2z = -U2 / 2 / My_PI * fun_Chinnery(f_dsUz, g, x, y);
         if (fabs(U2z) > DISPLMAX)
             U2z = 0;
     }
@@ -128,241 +139,317 @@ int okada(double L, double W, double D, double sinD, double cosD, double U1, dou
     return 0;
 }
 
-double fun_Chinnery(double (*fun)(double ksi, double eta), double x, double /*y*/)
+/*
+ * Vertical displacement of strike slip (ss) and dip slip (ds) at one corner
+ * of the Chinnery sum. Same arithmetic as f_ssUz() and f_dsUz(), but R and dp
+ * are computed once and there is no call through a function pointer.
+ */
+static inline void cornerUz(const OkadaGeom &g, double ksi, double eta, double &ss, double &ds)
+{
+    const double q  = g.q;
+    const double R  = sqrt(ksi * ksi + eta * eta + q * q);
+    const double dp = eta * g.sdip - q * g.cdip;
+    double       I4, I5, X, term2;
+
+    if (g.cdip != 0)
+        I4 = g.elast / g.cdip * (log(R + dp) - g.sdip * log(R + eta));
+    else
+        I4 = -g.elast * q / (R + dp);
+
+    if (ksi == 0)
+        I5 = 0;
+    else {
+        X = sqrt(ksi * ksi + q * q);
+        if (g.cdip != 0)
+            I5 = g.elast * 2 / g.cdip * atan((eta * (X + q * g.cdip) + X * (R + X) * g.sdip) / (ksi * (R + X) * g.cdip));
+        else
+            I5 = -g.elast * ksi * g.sdip / (R + dp);
+    }
+
+    if (q * R == 0) {
+        if (ksi * eta == 0)
+            term2 = 0;
+        else if (ksi * eta * q * R > 0)
+            term2 = My_PI;
+        else
+            term2 = -My_PI;
+    } else
+        term2 = atan(ksi * eta / q / R);
+
+    ss = dp * q / R / (R + eta) + q * g.sdip / (R + eta) + I4 * g.sdip;
+    ds = dp * q / R / (R + ksi) + g.sdip * term2 - I5 * g.sdip * g.cdip;
+}
+
+//============================================================================
+// Vertical displacement only, for n points at once; gives the same Uz as okada()
+int okadaUz(double L, double W, double D, double sinD, double cosD, double U1, double U2, const double *x, const double *y, int n, double *Uz)
+{
+    double    ss[4], ds[4], U1z, U2z;
+    OkadaGeom g;
+
+    for (int k = 0; k < n; k++) {
+        setGeom(g, L, W, D, sinD, cosD, y[k]);
+
+        cornerUz(g, x[k], g.p, ss[0], ds[0]);
+        cornerUz(g, x[k], g.p - g.width, ss[1], ds[1]);
+        cornerUz(g, x[k] - g.length, g.p, ss[2], ds[2]);
+        cornerUz(g, x[k] - g.length, g.p - g.width, ss[3], ds[3]);
+
+        U1z = U2z = 0;
+
+        if (U1 != 0) {
+            U1z = -U1 / 2 / My_PI * (ss[0] - ss[1] - ss[2] + ss[3]);
+            if (fabs(U1z) > DISPLMAX)
+                U1z = 0;
+        }
+
+        if (U2 != 0) {
+            U2z = -U2 / 2 / My_PI * (ds[0] - ds[1] - ds[2] + ds[3]);
+            if (fabs(U2z) > DISPLMAX)
+                U2z = 0;
+        }
+
+        Uz[k] = U1z + U2z;
+    }
+
+    return 0;
+}
+
+double fun_Chinnery(OkadaFun fun, const OkadaGeom &g, double x, double /*y*/)
 {
     double value;
 
-    value = fun(x, p) - fun(x, p - width) - fun(x - length, p) + fun(x - length, p - width);
+    value = fun(g, x, g.p) - fun(g, x, g.p - g.width) - fun(g, x - g.length, g.p) + fun(g, x - g.length, g.p - g.width);
 
     return value;
 }
 
-double f_ssUx(double ksi, double eta)
+double f_ssUx(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, I1, term2;
 
-    R  = fun_R(ksi, eta);
-    I1 = fun_I1(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I1 = fun_I1(g, ksi, eta);
 
-    if (q * R == 0) {
+    if (g.q * R == 0) {
         if (ksi * eta == 0) {
             term2 = 0;
         } else {
-            if (ksi * eta * q * R > 0)
+            if (ksi * eta * g.q * R > 0)
                 term2 = My_PI;
             else
                 term2 = -My_PI;
         }
     } else {
-        term2 = atan(ksi * eta / q / R);
+        term2 = atan(ksi * eta / g.q / R);
     }
 
-    val = ksi * q / R / (R + eta) + term2 + I1 * sdip;
+    val = ksi * g.q / R / (R + eta) + term2 + I1 * g.sdip;
 
     return val;
 }
 
-double f_ssUy(double ksi, double eta)
+double f_ssUy(const OkadaGeom &g, double ksi, double eta)
 {
     double val, yp, R, I2;
 
-    R  = fun_R(ksi, eta);
-    I2 = fun_I2(ksi, eta);
-    yp = fun_yp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I2 = fun_I2(g, ksi, eta);
+    yp = fun_yp(g, ksi, eta);
 
-    val = yp * q / R / (R + eta) + q * cdip / (R + eta) + I2 * sdip;
+    val = yp * g.q / R / (R + eta) + g.q * g.cdip / (R + eta) + I2 * g.sdip;
 
     return val;
 }
 
-double f_ssUz(double ksi, double eta)
+double f_ssUz(const OkadaGeom &g, double ksi, double eta)
 {
     double val, dp, R, I4;
 
-    R  = fun_R(ksi, eta);
-    I4 = fun_I4(ksi, eta);
-    dp = fun_dp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I4 = fun_I4(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
 
-    val = dp * q / R / (R + eta) + q * sdip / (R + eta) + I4 * sdip;
+    val = dp * g.q / R / (R + eta) + g.q * g.sdip / (R + eta) + I4 * g.sdip;
 
     return val;
 }
 
-double f_dsUx(double ksi, double eta)
+double f_dsUx(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, I3;
 
-    R  = fun_R(ksi, eta);
-    I3 = fun_I3(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I3 = fun_I3(g, ksi, eta);
 
-    val = q / R - I3 * sdip * cdip;
+    val = g.q / R - I3 * g.sdip * g.cdip;
 
     return val;
 }
 
-double f_dsUy(double ksi, double eta)
+double f_dsUy(const OkadaGeom &g, double ksi, double eta)
 {
     double val, yp, R, I1, term2;
 
-    R  = fun_R(ksi, eta);
-    I1 = fun_I1(ksi, eta);
-    yp = fun_yp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I1 = fun_I1(g, ksi, eta);
+    yp = fun_yp(g, ksi, eta);
 
-    if (q * R == 0) {
+    if (g.q * R == 0) {
         if (ksi * eta == 0) {
             term2 = 0;
         } else {
-            if (ksi * eta * q * R > 0)
+            if (ksi * eta * g.q * R > 0)
                 term2 = My_PI;
             else
                 term2 = -My_PI;
         }
     } else {
-        term2 = atan(ksi * eta / q / R);
+        term2 = atan(ksi * eta / g.q / R);
     }
 
-    val = yp * q / R / (R + ksi) + cdip * term2 - I1 * sdip * cdip;
+    val = yp * g.q / R / (R + ksi) + g.cdip * term2 - I1 * g.sdip * g.cdip;
 
     return val;
 }
 
-double f_dsUz(double ksi, double eta)
+double f_dsUz(const OkadaGeom &g, double ksi, double eta)
 {
     double val, dp, R, I5, term2;
 
-    R  = fun_R(ksi, eta);
-    I5 = fun_I5(ksi, eta);
-    dp = fun_dp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I5 = fun_I5(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
 
-    if (q * R == 0) {
+    if (g.q * R == 0) {
         if (ksi * eta == 0) {
             term2 = 0;
         } else {
-            if (ksi * eta * q * R > 0)
+            if (ksi * eta * g.q * R > 0)
                 term2 = My_PI;
             else
                 term2 = -My_PI;
         }
     } else {
-        term2 = atan(ksi * eta / q / R);
+        term2 = atan(ksi * eta / g.q / R);
     }
 
-    val = dp * q / R / (R + ksi) + sdip * term2 - I5 * sdip * cdip;
+    val = dp * g.q / R / (R + ksi) + g.sdip * term2 - I5 * g.sdip * g.cdip;
 
     return val;
 }
 
-double fun_R(double ksi, double eta)
+double fun_R(const OkadaGeom &g, double ksi, double eta)
 {
     double val;
 
-    val = sqrt(ksi * ksi + eta * eta + q * q);
+    val = sqrt(ksi * ksi + eta * eta + g.q * g.q);
 
     return val;
 }
 
-double fun_X(double ksi, double /* eta */)
+double fun_X(const OkadaGeom &g, double ksi, double /* eta */)
 {
     double val;
 
-    val = sqrt(ksi * ksi + q * q);
+    val = sqrt(ksi * ksi + g.q * g.q);
 
     return val;
 }
 
-double fun_dp(double /* ksi */, double eta)
+double fun_dp(const OkadaGeom &g, double /* ksi */, double eta)
 {
     double val;
 
-    val = eta * sdip - q * cdip;
+    val = eta * g.sdip - g.q * g.cdip;
 
     return val;
 }
 
-double fun_yp(double /* ksi */, double eta)
+double fun_yp(const OkadaGeom &g, double /* ksi */, double eta)
 {
     double val;
 
-    val = eta * cdip + q * sdip;
+    val = eta * g.cdip + g.q * g.sdip;
 
     return val;
 }
 
-double fun_I1(double ksi, double eta)
+double fun_I1(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, dp, I5;
 
-    R  = fun_R(ksi, eta);
-    dp = fun_dp(ksi, eta);
-    I5 = fun_I5(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
+    I5 = fun_I5(g, ksi, eta);
 
-    if (cdip != 0)
-        val = elast * (-1. / cdip * ksi / (R + dp)) - sdip / cdip * I5;
+    if (g.cdip != 0)
+        val = g.elast * (-1. / g.cdip * ksi / (R + dp)) - g.sdip / g.cdip * I5;
     else
-        val = -elast / 2 * ksi * q / (R + dp) / (R + dp);
+        val = -g.elast / 2 * ksi * g.q / (R + dp) / (R + dp);
 
     return val;
 }
 
-double fun_I2(double ksi, double eta)
+double fun_I2(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, I3;
 
-    R  = fun_R(ksi, eta);
-    I3 = fun_I3(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    I3 = fun_I3(g, ksi, eta);
 
-    val = elast * (-log(R + eta)) - I3;
+    val = g.elast * (-log(R + eta)) - I3;
 
     return val;
 }
 
-double fun_I3(double ksi, double eta)
+double fun_I3(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, yp, dp, I4;
 
-    R  = fun_R(ksi, eta);
-    yp = fun_yp(ksi, eta);
-    dp = fun_dp(ksi, eta);
-    I4 = fun_I4(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    yp = fun_yp(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
+    I4 = fun_I4(g, ksi, eta);
 
-    if (cdip != 0)
-        val = elast * (1. / cdip * yp / (R + dp) - log(R + eta)) + sdip / cdip * I4;
+    if (g.cdip != 0)
+        val = g.elast * (1. / g.cdip * yp / (R + dp) - log(R + eta)) + g.sdip / g.cdip * I4;
     else
-        val = elast / 2 * (eta / (R + dp) + yp * q / (R + dp) / (R + dp) - log(R + eta));
+        val = g.elast / 2 * (eta / (R + dp) + yp * g.q / (R + dp) / (R + dp) - log(R + eta));
 
     return val;
 }
 
-double fun_I4(double ksi, double eta)
+double fun_I4(const OkadaGeom &g, double ksi, double eta)
 {
     double val, R, dp;
 
-    R  = fun_R(ksi, eta);
-    dp = fun_dp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
 
-    if (cdip != 0)
-        val = elast / cdip * (log(R + dp) - sdip * log(R + eta));
+    if (g.cdip != 0)
+        val = g.elast / g.cdip * (log(R + dp) - g.sdip * log(R + eta));
     else
-        val = -elast * q / (R + dp);
+        val = -g.elast * g.q / (R + dp);
 
     return val;
 }
 
-double fun_I5(double ksi, double eta)
+double fun_I5(const OkadaGeom &g, double ksi, double eta)
 {
     double val, dp, X, R;
 
     if (ksi == 0)
         return (double)0;
 
-    R  = fun_R(ksi, eta);
-    X  = fun_X(ksi, eta);
-    dp = fun_dp(ksi, eta);
+    R  = fun_R(g, ksi, eta);
+    X  = fun_X(g, ksi, eta);
+    dp = fun_dp(g, ksi, eta);
 
-    if (cdip != 0)
-        val = elast * 2 / cdip * atan((eta * (X + q * cdip) + X * (R + X) * sdip) / (ksi * (R + X) * cdip));
+    if (g.cdip != 0)
+        val = g.elast * 2 / g.cdip * atan((eta * (X + g.q * g.cdip) + X * (R + X) * g.sdip) / (ksi * (R + X) * g.cdip));
     else
-        val = -elast * ksi * sdip / (R + dp);
+        val = -g.elast * ksi * g.sdip / (R + dp);
 
     return val;
 }
@@ -0,0 +1,875 @@
+/*​ Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#include "stdio.h"
+#include "stdint.h"
+#include "vector"
+#include "algorithm"
+
+#define CPP_MODULE "CUCKOO"
+#include "cuckoo.h"
+#include "tablecommon.h"
+
+// An empty slot is all ones, like an empty PackedSlots word
+static const uint64_t kEmptyWord = 0xFFFFFFFFFFFFFFFFull;
+
+// A deleted stash entry. It is never reused before the next rebuild, so the
+// probe sequences of the stash that pass it stay intact.
+static const uint64_t kStashTombstoneWord = ((uint64_t)kEmpty << 32) | kTombstone;
+
+// Home entry of key in the stash, from the high bits of a multiplicative hash.
+// The stash is a small linear probing table: a lookup probes from the home
+// entry up to the first empty one instead of scanning all stashed keys.
+static __device__
+inline uint32_t stash_home(uint32_t key)
+{
+    return (uint32_t)(((uint64_t)(key * 0x9E3779B9u) * kCuckooStashSize) >> 32);
+}
+
+static __device__
+inline uint64_t atomic_cas_word(uint64_t* address, uint64_t compare, uint64_t val)
+{
+    return atomicCAS((unsigned long long*)address, (unsigned long long)compare, (unsigned long long)val);
+}
+
+static __device__
+inline uint64_t atomic_exchange_word(uint64_t* address, uint64_t val)
+{
+    return atomicExch((unsigned long long*)address, (unsigned long long)val);
+}
+
+// Both candidate buckets come from one 64 bit Murmur3 mix of the key. The
+// second bucket is forced to differ from the first so every key has two
+// choices.
+static __device__
+inline void cuckoo_buckets(uint32_t key, uint32_t num_buckets, uint32_t* b1, uint32_t* b2)
+{
+    uint64_t k = key;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+
+    *b1 = (uint32_t)k & (num_buckets - 1);
+    *b2 = (uint32_t)(k >> 32) & (num_buckets - 1);
+    if (*b2 == *b1) {
+        *b2 = *b1 ^ 1;
+    }
+}
+
+// A bucket is read with one aligned load of all its slots and compared in
+// registers, which the compiler turns into wide vector loads
+template <uint32_t BucketSize>
+struct alignas(sizeof(uint64_t) * BucketSize) Bucket
+{
+    uint64_t words[BucketSize];
+};
+
+// Bit i of key_mask is set if slot i of the bucket holds key, bit i of
+// empty_mask if slot i is empty
+template <uint32_t BucketSize>
+__device__
+inline void match_bucket(const uint64_t* slots, uint32_t bucket, uint32_t key, uint32_t* key_mask, uint32_t* empty_mask)
+{
+    Bucket<BucketSize> b = *reinterpret_cast<const Bucket<BucketSize>*>(slots + (size_t)bucket * BucketSize);
+
+    uint32_t keys = 0, empties = 0;
+#pragma unroll
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        keys    |= (uint32_t)((uint32_t)b.words[i] == key) << i;
+        empties |= (uint32_t)(b.words[i] == kEmptyWord) << i;
+    }
+    *key_mask   = keys;
+    *empty_mask = empties;
+}
+
+// Find the slot or stash entry holding key; nullptr if the key is not present.
+// probes is set to the number of buckets read, 3 if the stash was probed.
+template <uint32_t BucketSize>
+__device__
+inline uint64_t* cuckoo_locate(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t num_stashed,
+    uint32_t key,
+    uint32_t* probes)
+{
+    uint32_t buckets[2];
+    cuckoo_buckets(key, num_buckets, &buckets[0], &buckets[1]);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        uint32_t key_mask, empty_mask;
+        match_bucket<BucketSize>(slots, buckets[i], key, &key_mask, &empty_mask);
+        if (key_mask != 0) {
+            *probes = i + 1;
+            return slots + (size_t)buckets[i] * BucketSize + (__ffs(key_mask) - 1);
+        }
+    }
+
+    *probes = 2;
+    if (num_stashed != 0) {
+        *probes = 3;
+        uint32_t home = stash_home(key);
+        for (uint32_t i = 0; i < kCuckooStashSize; i++) {
+            uint64_t* word = stash + ((home + i) & (kCuckooStashSize - 1));
+            if ((uint32_t)*word == key) {
+                return word;
+            }
+            if (*word == kEmptyWord) {
+                break;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// Store item (value << 32 | key) in the first empty slot of bucket, or replace
+// the value if the bucket already holds its key. Returns false if the bucket is
+// full.
+template <uint32_t BucketSize>
+__device__
+inline bool claim_in_bucket(uint64_t* slots, uint32_t bucket, uint64_t item, uint32_t* num_used)
+{
+    uint32_t  key   = (uint32_t)item;
+    uint64_t* words = slots + (size_t)bucket * BucketSize;
+
+    while (true) {
+        uint32_t key_mask, empty_mask;
+        match_bucket<BucketSize>(slots, bucket, key, &key_mask, &empty_mask);
+
+        if (key_mask != 0) {
+            uint64_t* word = words + (__ffs(key_mask) - 1);
+            uint64_t  prev = *word;
+            while ((uint32_t)prev == key) {
+                uint64_t seen = atomic_cas_word(word, prev, item);
+                if (seen == prev) {
+                    return true;
+                }
+                prev = seen;
+            }
+            // The key was evicted meanwhile, look again
+            continue;
+        }
+
+        if (empty_mask == 0) {
+            return false;
+        }
+        uint64_t* word = words + (__ffs(empty_mask) - 1);
+        if (atomic_cas_word(word, kEmptyWord, item) == kEmptyWord) {
+            atomicAdd(num_used, 1u);
+            return true;
+        }
+        // Another thread took the slot, look again
+    }
+}
+
+// Place item in one of its buckets. If both are full, a random slot of one of
+// them is displaced and its key carried on to its other bucket, for up to
+// kCuckooMaxEvictions steps; the key in hand after that goes to the stash.
+// Past the end of the stash it is lost, which the host reports.
+template <uint32_t BucketSize>
+__device__
+inline void cuckoo_place(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions,
+    uint64_t item)
+{
+    uint32_t b1, b2;
+    cuckoo_buckets((uint32_t)item, num_buckets, &b1, &b2);
+    if (claim_in_bucket<BucketSize>(slots, b1, item, num_used) ||
+        claim_in_bucket<BucketSize>(slots, b2, item, num_used)) {
+        return;
+    }
+
+    // xorshift32; the key seeds it so concurrent chains take different paths
+    uint32_t rng    = (uint32_t)item * 0x9E3779B9u | 1;
+    uint32_t bucket = (rng >> 31) ? b1 : b2;
+
+    for (uint32_t i = 0; i < kCuckooMaxEvictions; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+
+        uint64_t victim = atomic_exchange_word(slots + (size_t)bucket * BucketSize + (rng & (BucketSize - 1)), item);
+        atomicAdd(num_evictions, 1u);
+        if (victim == kEmptyWord) {
+            atomicAdd(num_used, 1u);
+            return;
+        }
+
+        // The displaced key is counted already; claiming a slot for it
+        // counts the key that took its place
+        item = victim;
+        uint32_t v1, v2;
+        cuckoo_buckets((uint32_t)item, num_buckets, &v1, &v2);
+        bucket = (bucket == v1) ? v2 : v1;
+        if (claim_in_bucket<BucketSize>(slots, bucket, item, num_used)) {
+            return;
+        }
+    }
+
+    uint32_t index = atomicAdd(num_stashed, 1u);
+    if (index < kCuckooStashSize) {
+        // At most kCuckooStashSize entries are ever claimed, so an empty one is left
+        uint32_t home = stash_home((uint32_t)item);
+        for (uint32_t i = 0; i < kCuckooStashSize; i++) {
+            if (atomic_cas_word(stash + ((home + i) & (kCuckooStashSize - 1)), kEmptyWord, item) == kEmptyWord) {
+                break;
+            }
+        }
+        atomicAdd(num_used, 1u);
+    }
+}
+
+// Allocate the buckets and the stash of a table, all empty
+template <uint32_t BucketSize>
+static void create_cuckoo_slots(CuckooHashTable<BucketSize>& ht, uint32_t num_buckets)
+{
+    ht.numBuckets = num_buckets;
+    ht.capacity   = num_buckets * BucketSize;
+
+    // cudaMalloc aligns to 256 bytes, so every bucket starts on its own line(s)
+    checkCUDA(cudaMalloc(&ht.pSlots, sizeof(uint64_t) * ht.capacity));
+    checkCUDA(cudaMalloc(&ht.pStash, sizeof(uint64_t) * kCuckooStashSize));
+    checkCUDA(cudaMemset(ht.pSlots, 0xff, sizeof(uint64_t) * ht.capacity));
+    checkCUDA(cudaMemset(ht.pStash, 0xff, sizeof(uint64_t) * kCuckooStashSize));
+}
+
+template <uint32_t BucketSize>
+CuckooHashTable<BucketSize> create_cuckoo_hashtable(uint32_t capacity, float maxLoadFactor)
+{
+    CuckooHashTable<BucketSize> hashtable = {};
+
+    try {
+        hashtable.maxLoadFactor = maxLoadFactor;
+
+        create_streams(hashtable);
+
+        // Every key needs two distinct buckets
+        create_cuckoo_slots(hashtable, std::max(2u, round_up_pow2(capacity) / BucketSize));
+        checkCUDA(cudaMalloc(&hashtable.pNumUsed, sizeof(uint32_t)));
+        checkCUDA(cudaMalloc(&hashtable.pNumStashed, sizeof(uint32_t)));
+        checkCUDA(cudaMalloc(&hashtable.pNumEvictions, sizeof(uint32_t)));
+        checkCUDA(cudaMemset(hashtable.pNumUsed, 0, sizeof(uint32_t)));
+        checkCUDA(cudaMemset(hashtable.pNumStashed, 0, sizeof(uint32_t)));
+        checkCUDA(cudaMemset(hashtable.pNumEvictions, 0, sizeof(uint32_t)));
+        checkCUDA(cudaDeviceSynchronize());
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return hashtable;
+}
+
+// Read the key and stash counters, and fail if the stash overflowed
+template <uint32_t BucketSize>
+static void read_counters(CuckooHashTable<BucketSize>& ht, uint32_t* num_used, uint32_t* num_stashed)
+{
+    checkCUDA(cudaMemcpyAsync(num_used, ht.pNumUsed, sizeof(uint32_t), cudaMemcpyDeviceToHost, ht.stream));
+    checkCUDA(cudaMemcpyAsync(num_stashed, ht.pNumStashed, sizeof(uint32_t), cudaMemcpyDeviceToHost, ht.stream));
+    checkCUDA(cudaStreamSynchronize(ht.stream));
+
+    if (*num_stashed > kCuckooStashSize) {
+        LOG_ERROR("Cuckoo stash overflowed, " << (*num_stashed - kCuckooStashSize) << " keys were lost");
+    }
+}
+
+// Reinsert the old slots, then the live old stash entries, into the new table
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_rebuild(
+    const uint64_t* old_slots,
+    uint32_t old_capacity,
+    const uint64_t* old_stash,
+    uint32_t old_stash_words,
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < old_capacity + old_stash_words) {
+        uint64_t word = tid < old_capacity ? old_slots[tid] : old_stash[tid - old_capacity];
+        if (word != kEmptyWord && word != kStashTombstoneWord) {
+            cuckoo_place<BucketSize>(slots, num_buckets, stash, num_used, num_stashed, num_evictions, word);
+        }
+    }
+}
+
+// Move all keys into a new table of num_buckets buckets. Unlike linear
+// probing the rebuild is not incremental: a key may be in either of its
+// buckets, so lookups could not tell which array is authoritative.
+template <uint32_t BucketSize>
+static void rebuild_cuckoo(CuckooHashTable<BucketSize>& ht, uint32_t num_buckets)
+{
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed);
+
+    uint64_t* old_slots       = ht.pSlots;
+    uint64_t* old_stash       = ht.pStash;
+    uint32_t  old_capacity    = ht.capacity;
+    uint32_t  old_stash_words = num_stashed != 0 ? kCuckooStashSize : 0;  // the stash is hashed
+
+    create_cuckoo_slots(ht, num_buckets);
+    checkCUDA(cudaMemsetAsync(ht.pNumUsed, 0, sizeof(uint32_t), ht.stream));
+    checkCUDA(cudaMemsetAsync(ht.pNumStashed, 0, sizeof(uint32_t), ht.stream));
+
+    int threadblocksize = 1024;
+    int gridsize = (int)(((uint64_t)old_capacity + old_stash_words + threadblocksize - 1) / threadblocksize);
+
+    gpu_cuckoo_rebuild<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+        old_slots,
+        old_capacity,
+        old_stash,
+        old_stash_words,
+        ht.pSlots,
+        ht.numBuckets,
+        ht.pStash,
+        ht.pNumUsed,
+        ht.pNumStashed,
+        ht.pNumEvictions);
+    CUDA_CHECK_LAST_ERROR();
+
+    read_counters(ht, &num_used, &num_stashed);
+    checkCUDA(cudaFree(old_stash));
+    checkCUDA(cudaFree(old_slots));
+
+    ht.numUsedBound = num_used;
+    ht.numResizes++;
+}
+
+// Grow the table if inserting num_kvs more keys could exceed the max load
+// factor, or if more than half of the stash is in use
+template <uint32_t BucketSize>
+static void reserve_hashtable(CuckooHashTable<BucketSize>& ht, uint32_t num_kvs)
+{
+    auto fits = [&](uint64_t num_keys, uint64_t capacity) {
+        return num_keys <= (uint64_t)((double)capacity * ht.maxLoadFactor);
+    };
+
+    // Below kCuckooQuietLoad the eviction chains stay far shorter than
+    // kCuckooMaxEvictions and nothing is stashed. Above it the stash counter
+    // is read before every batch, so stash pressure starts a rebuild in time.
+    uint64_t num_keys = (uint64_t)ht.numUsedBound + num_kvs;
+    if (fits(num_keys, ht.capacity) && num_keys <= (uint64_t)((double)ht.capacity * kCuckooQuietLoad)) {
+        return;
+    }
+
+    // The bound counts overwrites and deleted keys; only now pay for an exact count
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed);
+    ht.numUsedBound = num_used;
+
+    uint32_t num_buckets = ht.numBuckets;
+    while (!fits((uint64_t)num_used + num_kvs, (uint64_t)num_buckets * BucketSize) ||
+           (num_buckets == ht.numBuckets && num_stashed > kCuckooStashSize / 2)) {
+        if ((uint64_t)num_buckets * BucketSize >= 0x80000000u) {
+            LOG_ERROR("Hash table cannot grow beyond " << (uint64_t)num_buckets * BucketSize << " slots");
+        }
+        num_buckets <<= 1;
+    }
+
+    if (num_buckets != ht.numBuckets) {
+        rebuild_cuckoo(ht, num_buckets);
+    }
+}
+
+template <uint32_t BucketSize>
+void sync_hashtable(CuckooHashTable<BucketSize>& ht)
+{
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed);
+}
+
+template <uint32_t BucketSize>
+void complete_resize_hashtable(CuckooHashTable<BucketSize>& ht)
+{
+    // Rebuilds finish before the insert that started them returns
+}
+
+template <uint32_t BucketSize>
+void compact_hashtable(CuckooHashTable<BucketSize>& ht)
+{
+    // Deletes empty their slot, there are no tombstones to drop
+}
+
+// First insert pass: keys already in the table get the new value in place and
+// are marked done by setting their key in kvs to kEmpty
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_update(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    KeyValue* kvs,
+    unsigned int numkvs)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs) {
+        uint32_t key = kvs[tid].key;
+        uint32_t probes;
+
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, key, &probes);
+        if (word == nullptr) {
+            return;
+        }
+
+        // Another thread of the batch may update the same key; either value wins
+        uint64_t desired = ((uint64_t)kvs[tid].value << 32) | key;
+        uint64_t prev    = *word;
+        while ((uint32_t)prev == key) {
+            uint64_t seen = atomic_cas_word(word, prev, desired);
+            if (seen == prev) {
+                break;
+            }
+            prev = seen;
+        }
+        kvs[tid].key = kEmpty;
+    }
+}
+
+// Second insert pass: place the keys that were not in the table
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_insert(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions,
+    const KeyValue* kvs,
+    unsigned int numkvs)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs && kvs[tid].key != kEmpty) {
+        cuckoo_place<BucketSize>(slots, num_buckets, stash, num_used, num_stashed, num_evictions,
+                                 ((uint64_t)kvs[tid].value << 32) | kvs[tid].key);
+    }
+}
+
+// Third insert pass. A key that occurs twice in a batch is merged when both
+// copies meet in the same bucket, but while an eviction carries one copy the
+// other can be placed elsewhere. After a batch with evictions every copy of a
+// new key but the first (bucket 1, bucket 2, stash order) is removed.
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_dedupe(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    const uint32_t* num_stashed,
+    const uint32_t* num_evictions,
+    const KeyValue* kvs,
+    unsigned int numkvs)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid >= numkvs || *num_evictions == 0 || kvs[tid].key == kEmpty) {
+        return;
+    }
+
+    uint32_t key = kvs[tid].key;
+    uint32_t b1, b2;
+    cuckoo_buckets(key, num_buckets, &b1, &b2);
+
+    bool kept = false;
+    auto visit = [&](uint64_t* word, uint64_t freed) {
+        uint64_t prev = *word;
+        while ((uint32_t)prev == key) {
+            if (!kept) {
+                kept = true;
+                return;
+            }
+            uint64_t seen = atomic_cas_word(word, prev, freed);
+            if (seen == prev) {
+                atomicSub(num_used, 1u);
+                return;
+            }
+            prev = seen;
+        }
+    };
+
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        visit(slots + (size_t)b1 * BucketSize + i, kEmptyWord);
+    }
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        visit(slots + (size_t)b2 * BucketSize + i, kEmptyWord);
+    }
+    if (*num_stashed != 0) {
+        uint32_t home = stash_home(key);
+        for (uint32_t i = 0; i < kCuckooStashSize && stash[(home + i) & (kCuckooStashSize - 1)] != kEmptyWord; i++) {
+            visit(stash + ((home + i) & (kCuckooStashSize - 1)), kStashTombstoneWord);
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+void insert_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        reserve_hashtable(ht, num_kvs);
+
+        // Copy this batch of key-value pairs to the device
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, kvs, num_kvs);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 1024;
+        int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
+
+        checkCUDA(cudaMemsetAsync(ht.pNumEvictions, 0, sizeof(uint32_t), ht.stream));
+        gpu_cuckoo_update<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumStashed,
+            device_kvs,
+            (uint32_t)num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        gpu_cuckoo_insert<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumUsed,
+            ht.pNumStashed,
+            ht.pNumEvictions,
+            device_kvs,
+            (uint32_t)num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        gpu_cuckoo_dedupe<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumUsed,
+            ht.pNumStashed,
+            ht.pNumEvictions,
+            device_kvs,
+            (uint32_t)num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
+
+        ht.numUsedBound += num_kvs;
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Lookup keys in the hashtable, and return the values
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_lookup(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    KeyValue* kvs,
+    unsigned int numkvs)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs) {
+        uint32_t probes;
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, kvs[tid].key, &probes);
+        kvs[tid].value = word != nullptr ? (uint32_t)(*word >> 32) : kEmpty;
+    }
+}
+
+template <uint32_t BucketSize>
+void lookup_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    KeyValue* kvs,
+    uint32_t num_kvs)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        // Copy this batch of key-value pairs to the device
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, (const KeyValue*)kvs, num_kvs);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 1024;
+        int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
+
+        gpu_cuckoo_lookup<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumStashed,
+            device_kvs,
+            (uint32_t)num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Delete each key in kvs from the hash table, if the key exists. The slot
+// becomes empty again: no key is ever probed past it.
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_delete(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    const uint32_t* num_stashed,
+    const KeyValue* kvs,
+    unsigned int numkvs)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs) {
+        uint32_t key = kvs[tid].key;
+        uint32_t probes;
+
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, key, &probes);
+        if (word == nullptr) {
+            return;
+        }
+
+        // A stash entry becomes a tombstone so the probe sequences through it stay intact
+        uint64_t freed = (word >= stash && word < stash + kCuckooStashSize) ? kStashTombstoneWord : kEmptyWord;
+
+        // Loses only if another thread deleted the same key first
+        uint64_t prev = *word;
+        while ((uint32_t)prev == key) {
+            uint64_t seen = atomic_cas_word(word, prev, freed);
+            if (seen == prev) {
+                atomicSub(num_used, 1u);
+                return;
+            }
+            prev = seen;
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+void delete_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        // Copy the keyvalues to the GPU
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, kvs, num_kvs);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 1024;
+        int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
+
+        gpu_cuckoo_delete<BucketSize><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumUsed,
+            ht.pNumStashed,
+            device_kvs,
+            (uint32_t)num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Iterate over every slot and stash entry; return non-empty key/values
+__global__
+void gpu_cuckoo_iterate(
+    const uint64_t* slots,
+    uint32_t capacity,
+    const uint64_t* stash,
+    uint32_t stash_words,
+    KeyValue* kvs,
+    uint32_t* kvs_size)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < capacity + stash_words) {
+        uint64_t word = tid < capacity ? slots[tid] : stash[tid - capacity];
+        if (word != kEmptyWord && word != kStashTombstoneWord) {
+            uint32_t size = atomicAdd(kvs_size, 1u);
+            kvs[size].key   = (uint32_t)word;
+            kvs[size].value = (uint32_t)(word >> 32);
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+std::vector<KeyValue> iterate_hashtable(CuckooHashTable<BucketSize>& ht)
+{
+    std::vector<KeyValue> kvs;
+
+    try {
+        uint32_t num_used, num_stashed;
+        read_counters(ht, &num_used, &num_stashed);
+        ht.numUsedBound = num_used;
+        uint32_t stash_words = num_stashed != 0 ? kCuckooStashSize : 0;
+
+        uint32_t* device_num_kvs;
+        KeyValue* device_kvs;
+        checkCUDA(cudaMalloc(&device_num_kvs, sizeof(uint32_t)));
+        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * std::max(num_used, 1u)));
+
+        checkCUDA(cudaMemset(device_num_kvs, 0, sizeof(uint32_t)));
+
+        int threadblocksize = 1024;
+        int gridsize = (int)(((uint64_t)ht.capacity + stash_words + threadblocksize - 1) / threadblocksize);
+
+        gpu_cuckoo_iterate<<<gridsize, threadblocksize>>>(
+            ht.pSlots,
+            ht.capacity,
+            ht.pStash,
+            stash_words,
+            device_kvs,
+            device_num_kvs);
+        CUDA_CHECK_LAST_ERROR();
+        uint32_t num_kvs;
+        checkCUDA(cudaMemcpy(&num_kvs, device_num_kvs, sizeof(uint32_t), cudaMemcpyDeviceToHost));
+        checkCUDA(cudaDeviceSynchronize());
+
+        kvs.resize(num_kvs);
+
+        checkCUDA(cudaMemcpy(kvs.data(), device_kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyDeviceToHost));
+        checkCUDA(cudaDeviceSynchronize());
+
+        checkCUDA(cudaFree(device_kvs));
+        checkCUDA(cudaFree(device_num_kvs));
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return kvs;
+}
+
+// Count the buckets read to look up each key, the same way cuckoo_locate does
+template <uint32_t BucketSize>
+__global__
+void gpu_cuckoo_probe_histogram(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    const KeyValue* kvs,
+    unsigned int numkvs,
+    uint32_t* histogram)
+{
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs) {
+        uint32_t probes;
+        cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, kvs[tid].key, &probes);
+        atomicAdd(&histogram[probes], 1u);
+    }
+}
+
+template <uint32_t BucketSize>
+std::vector<uint32_t> probe_histogram_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs)
+{
+    std::vector<uint32_t> histogram(kProbeHistogramBins, 0);
+    if (num_kvs == 0) {
+        return histogram;
+    }
+
+    try {
+        sync_hashtable(ht);
+
+        KeyValue* device_kvs;
+        uint32_t* device_histogram;
+        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * num_kvs));
+        checkCUDA(cudaMalloc(&device_histogram, sizeof(uint32_t) * kProbeHistogramBins));
+        checkCUDA(cudaMemcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyHostToDevice));
+        checkCUDA(cudaMemset(device_histogram, 0, sizeof(uint32_t) * kProbeHistogramBins));
+
+        int threadblocksize = 1024;
+        int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
+
+        gpu_cuckoo_probe_histogram<BucketSize><<<gridsize, threadblocksize>>>(
+            ht.pSlots,
+            ht.numBuckets,
+            ht.pStash,
+            ht.pNumStashed,
+            device_kvs,
+            (uint32_t)num_kvs,
+            device_histogram);
+        CUDA_CHECK_LAST_ERROR();
+        checkCUDA(cudaMemcpy(histogram.data(), device_histogram, sizeof(uint32_t) * kProbeHistogramBins, cudaMemcpyDeviceToHost));
+
+        checkCUDA(cudaFree(device_histogram));
+        checkCUDA(cudaFree(device_kvs));
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return histogram;
+}
+
+// Free the memory of the hashtable
+template <uint32_t BucketSize>
+void destroy_hashtable(CuckooHashTable<BucketSize>& ht)
+{
+    checkCUDA(cudaDeviceSynchronize());
+
+    destroy_streams(ht);
+    checkCUDA(cudaFree(ht.pNumEvictions));
+    checkCUDA(cudaFree(ht.pNumStashed));
+    checkCUDA(cudaFree(ht.pNumUsed));
+    checkCUDA(cudaFree(ht.pStash));
+    checkCUDA(cudaFree(ht.pSlots));
+    ht = {};
+}
+
+#define INSTANTIATE_CUCKOO(B)                                                                               \
+    template CuckooHashTable<B> create_cuckoo_hashtable<B>(uint32_t, float);                               \
+    template void insert_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t);                      \
+    template void lookup_hashtable<B>(CuckooHashTable<B>&, KeyValue*, uint32_t);                            \
+    template void delete_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t);                      \
+    template void sync_hashtable<B>(CuckooHashTable<B>&);                                                   \
+    template void complete_resize_hashtable<B>(CuckooHashTable<B>&);                                        \
+    template void compact_hashtable<B>(CuckooHashTable<B>&);                                                \
+    template std::vector<uint32_t> probe_histogram_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t); \
+    template std::vector<KeyValue> iterate_hashtable<B>(CuckooHashTable<B>&);                               \
+    template void destroy_hashtable<B>(CuckooHashTable<B>&);
+
+INSTANTIATE_CUCKOO(8)
+INSTANTIATE_CUCKOO(16)
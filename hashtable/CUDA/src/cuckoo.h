@@ -0,0 +1,93 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#pragma once
+
+#include "linearprobing.h"
+
+// Bucketized cuckoo hashing: every key has two candidate buckets of
+// BucketSize slots and lives in one of them, so a lookup reads at most two
+// buckets (one or two 64-byte lines each). Slots pack a 32-bit key and a
+// 32-bit value in one word like PackedSlots; deletes empty the slot, there
+// are no tombstones. A key that cannot be placed after kCuckooMaxEvictions
+// displacements goes to a small stash, itself a linear probing table, that
+// lookups probe as a last resort.
+
+// Length of an eviction chain before its key is moved to the stash
+const uint32_t kCuckooMaxEvictions = 128;
+
+// Stash entries (a power of two); the table is rebuilt at twice the size once
+// half are used
+const uint32_t kCuckooStashSize = 1024;
+
+// Load factor from which inserts read the stash counter before every batch
+const float kCuckooQuietLoad = 0.5f;
+
+template <uint32_t BucketSize>
+struct CuckooHashTable
+{
+    static_assert(BucketSize == 8 || BucketSize == 16, "buckets span one or two 64-byte lines");
+
+    using KeyValueType = KeyValue;
+
+    uint64_t* pSlots;          // numBuckets * BucketSize words, value << 32 | key
+    uint32_t  numBuckets;      // power of two
+    uint32_t  capacity;        // numBuckets * BucketSize slots
+    uint64_t* pStash;          // kCuckooStashSize words
+    uint32_t* pNumUsed;        // device counter of keys in the slots and the stash
+    uint32_t* pNumStashed;     // device counter of claimed stash entries, may exceed kCuckooStashSize
+    uint32_t* pNumEvictions;   // device counter of evictions of the current insert batch
+    uint32_t  numUsedBound;    // host-side upper bound on keys held by the table
+    float     maxLoadFactor;
+
+    // Kernels run on stream in submission order; uploads run on copyStream
+    cudaStream_t  stream;
+    cudaStream_t  copyStream;
+    StagingBuffer<KeyValue> staging[kNumStagingBuffers];
+    uint32_t      stagingCapacity; // KeyValues per staging buffer
+    uint32_t      nextStaging;
+
+    uint32_t  numResizes;
+    uint32_t  numCompactions;  // always 0, deletes leave nothing to reclaim
+};
+
+// The operations are defined for bucket sizes 8 and 16 and follow the
+// HashTable API; a table grows by a stop-the-world rebuild at twice the size.
+template <uint32_t BucketSize>
+CuckooHashTable<BucketSize> create_cuckoo_hashtable(uint32_t capacity, float maxLoadFactor);
+
+template <uint32_t BucketSize>
+void insert_hashtable(CuckooHashTable<BucketSize>& hashtable, const KeyValue* kvs, uint32_t num_kvs);
+template <uint32_t BucketSize>
+void lookup_hashtable(CuckooHashTable<BucketSize>& hashtable,       KeyValue* kvs, uint32_t num_kvs);
+template <uint32_t BucketSize>
+void delete_hashtable(CuckooHashTable<BucketSize>& hashtable, const KeyValue* kvs, uint32_t num_kvs);
+
+// Wait until all submitted batches have been applied; fails if the stash
+// overflowed and keys were lost
+template <uint32_t BucketSize>
+void sync_hashtable(CuckooHashTable<BucketSize>& hashtable);
+
+// Nothing is ever left in flight or to reclaim; present for API parity
+template <uint32_t BucketSize>
+void complete_resize_hashtable(CuckooHashTable<BucketSize>& hashtable);
+template <uint32_t BucketSize>
+void compact_hashtable(CuckooHashTable<BucketSize>& hashtable);
+
+// Histogram of the number of buckets read to look up each key in kvs: 1 or 2,
+// and 3 when the stash had to be probed
+template <uint32_t BucketSize>
+std::vector<uint32_t> probe_histogram_hashtable(CuckooHashTable<BucketSize>& hashtable, const KeyValue* kvs, uint32_t num_kvs);
+
+template <uint32_t BucketSize>
+std::vector<KeyValue> iterate_hashtable(CuckooHashTable<BucketSize>& hashtable);
+
+template <uint32_t BucketSize>
+void destroy_hashtable(CuckooHashTable<BucketSize>& hashtable);
@@ -11,34 +11,222 @@
 #include "stdio.h"
 #include "stdint.h"
 #include "vector"
+#include "algorithm"
+#include "cstring"
 
 #define CPP_MODULE "KERNEL"
 #include "linearprobing.h"
+#include "tablecommon.h"
 
 // 32 bit Murmur3 hash
 __device__
-uint32_t hash(uint32_t k)
+uint32_t hash(uint32_t k, uint32_t capacity)
 {
     k ^= k >> 16;
     k *= 0x85ebca6b;
     k ^= k >> 13;
     k *= 0xc2b2ae35;
     k ^= k >> 16;
-    return k & (kHashTableCapacity - 1);
+    return k & (capacity - 1);
 }
 
-// Create a hash table. For linear probing, this is just an array of KeyValues
-KeyValue* create_hashtable()
+// 64 bit Murmur3 finalizer
+__device__
+uint32_t hash(uint64_t k, uint32_t capacity)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return (uint32_t)k & (capacity - 1);
+}
+
+__device__
+uint32_t atomic_cas(uint32_t* address, uint32_t compare, uint32_t val)
+{
+    return atomicCAS(address, compare, val);
+}
+
+__device__
+uint64_t atomic_cas(uint64_t* address, uint64_t compare, uint64_t val)
+{
+    return atomicCAS((unsigned long long*)address, (unsigned long long)compare, (unsigned long long)val);
+}
+
+// Slot access for PackedSlots. Empty slots are all ones, which is kEmpty for
+// both the key and the value; a tombstone keeps the value of its key.
+static const uint64_t kEmptyWord = 0xFFFFFFFFFFFFFFFFull;
+
+__device__
+inline uint64_t pack_slot(uint32_t key, uint32_t value)
+{
+    return ((uint64_t)value << 32) | key;
+}
+
+__device__
+inline uint32_t slot_key(const PackedSlots& s, uint32_t slot)
+{
+    return (uint32_t)s.pWords[slot];
+}
+
+__device__
+inline uint32_t slot_value(const PackedSlots& s, uint32_t slot)
+{
+    return (uint32_t)(s.pWords[slot] >> 32);
+}
+
+// Store key and value in slot if it is empty. If the slot already holds key
+// and overwrite is set, replace the value. Returns the key the slot held.
+__device__
+inline uint32_t claim_slot(const PackedSlots& s, uint32_t slot, uint32_t key, uint32_t value, bool overwrite)
+{
+    uint64_t desired = pack_slot(key, value);
+    uint64_t prev = atomic_cas(&s.pWords[slot], kEmptyWord, desired);
+    if (prev == kEmptyWord) {
+        return kEmpty;
+    }
+    // Another thread of the batch may update the same key; either value wins
+    while (overwrite && (uint32_t)prev == key) {
+        uint64_t seen = atomic_cas(&s.pWords[slot], prev, desired);
+        if (seen == prev) {
+            break;
+        }
+        prev = seen;
+    }
+    return (uint32_t)prev;
+}
+
+// Replace key by a tombstone; returns true if this call removed it
+__device__
+inline bool erase_slot(const PackedSlots& s, uint32_t slot, uint32_t key)
+{
+    uint64_t current = s.pWords[slot];
+    while ((uint32_t)current == key) {
+        uint64_t seen = atomic_cas(&s.pWords[slot], current, pack_slot(kTombstone, (uint32_t)(current >> 32)));
+        if (seen == current) {
+            return true;
+        }
+        current = seen;
+    }
+    return false;
+}
+
+// Slot access for SplitSlots: the key array is claimed with a CAS, the value
+// is stored in its own array afterwards
+template <typename K, typename V>
+__device__
+inline K slot_key(const SplitSlots<K, V>& s, uint32_t slot)
+{
+    return s.pKeys[slot];
+}
+
+template <typename K, typename V>
+__device__
+inline V slot_value(const SplitSlots<K, V>& s, uint32_t slot)
+{
+    return s.pValues[slot];
+}
+
+// Claim slot as key | kBusyKeyBit, store the value and only then publish the
+// key. A slot busy with the same key is being written by another thread of
+// the batch, whose value wins.
+template <typename K, typename V>
+__device__
+inline K claim_busy_slot(const SplitSlots<K, V>& s, uint32_t slot, K key, const V& value, bool overwrite)
+{
+    const K busy_key = key | (K)kBusyKeyBit;
+    K prev = atomic_cas(&s.pKeys[slot], empty_key<K>(), busy_key);
+    if (prev == empty_key<K>() ||
+        (overwrite && prev == key && atomic_cas(&s.pKeys[slot], key, busy_key) == key)) {
+        s.pValues[slot] = value;
+        __threadfence();
+        atomic_cas(&s.pKeys[slot], busy_key, key);
+    }
+    // Report a busy slot as its key; empty and tombstone keys have the bit set too
+    if (prev == empty_key<K>() || prev == tombstone_key<K>()) {
+        return prev;
+    }
+    return prev & ~(K)kBusyKeyBit;
+}
+
+template <typename K, typename V>
+__device__
+inline K claim_slot(const SplitSlots<K, V>& s, uint32_t slot, K key, const V& value, bool overwrite)
+{
+    if (value_needs_busy_bit<V>()) {
+        return claim_busy_slot(s, slot, key, value, overwrite);
+    }
+    K prev = atomic_cas(&s.pKeys[slot], empty_key<K>(), key);
+    if (prev == empty_key<K>() || (overwrite && prev == key)) {
+        s.pValues[slot] = value;
+    }
+    return prev;
+}
+
+template <typename K, typename V>
+__device__
+inline bool erase_slot(const SplitSlots<K, V>& s, uint32_t slot, K key)
+{
+    // Loses only if another thread deleted the same key first
+    return s.pKeys[slot] == key &&
+           atomic_cas(&s.pKeys[slot], key, tombstone_key<K>()) == key;
+}
+
+// Allocate an array of capacity empty slots
+static void create_slots(PackedSlots& s, uint32_t capacity)
 {
-    KeyValue* hashtable;
+    checkCUDA(cudaMalloc(&s.pWords, sizeof(uint64_t) * capacity));
+
+    // Initialize hash table to empty
+    static_assert(kEmpty == 0xFFFFFFFF, "memset expected kEmpty=0xFFFFFFFF");
+    checkCUDA(cudaMemset(s.pWords, 0xFF, sizeof(uint64_t) * capacity));
+}
+
+template <typename K, typename V>
+static void create_slots(SplitSlots<K, V>& s, uint32_t capacity)
+{
+    checkCUDA(cudaMalloc(&s.pKeys, sizeof(K) * capacity));
+    checkCUDA(cudaMalloc(&s.pValues, sizeof(V) * capacity));
+
+    // Only the keys mark a slot as empty
+    static_assert(empty_key<K>() == (K)~(K)0, "memset expected an all ones empty key");
+    checkCUDA(cudaMemset(s.pKeys, 0xFF, sizeof(K) * capacity));
+}
+
+static void free_slots(PackedSlots& s)
+{
+    checkCUDA(cudaFree(s.pWords));
+    s = {};
+}
+
+template <typename K, typename V>
+static void free_slots(SplitSlots<K, V>& s)
+{
+    checkCUDA(cudaFree(s.pKeys));
+    checkCUDA(cudaFree(s.pValues));
+    s = {};
+}
+
+// Create a hash table. For linear probing, this is just an array of slots
+template <typename Layout>
+HashTable<Layout> create_hashtable(uint32_t capacity, float maxLoadFactor, float tombstoneThreshold)
+{
+    HashTable<Layout> hashtable = {};
 
     try {
-        // Allocate memory
-        checkCUDA(cudaMalloc(&hashtable, sizeof(KeyValue) * kHashTableCapacity));
+        hashtable.capacity           = round_up_pow2(capacity);
+        hashtable.maxLoadFactor      = maxLoadFactor;
+        hashtable.tombstoneThreshold = tombstoneThreshold;
+
+        create_streams(hashtable);
 
-        // Initialize hash table to empty
-        static_assert(kEmpty == 0xFFFFFFFF, "memset expected kEmpty=0xFFFFFFFF");
-        checkCUDA(cudaMemset(hashtable, 0xFF, sizeof(KeyValue) * kHashTableCapacity));
+        // Allocate memory
+        create_slots(hashtable.slots, hashtable.capacity);
+        checkCUDA(cudaMalloc(&hashtable.pNumUsed, sizeof(uint32_t)));
+        checkCUDA(cudaMalloc(&hashtable.pNumTombstones, sizeof(uint32_t)));
+        checkCUDA(cudaMemset(hashtable.pNumUsed, 0, sizeof(uint32_t)));
+        checkCUDA(cudaMemset(hashtable.pNumTombstones, 0, sizeof(uint32_t)));
         checkCUDA(cudaDeviceSynchronize());
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
@@ -49,47 +237,277 @@ KeyValue* create_hashtable()
     return hashtable;
 }
 
+// Move old slots [first, first + count) into the new array. Keys that already
+// exist in the new array were inserted after the resize started and are newer,
+// so they are left alone. Tombstones are dropped.
+template <typename Layout>
+__global__
+void gpu_hashtable_migrate(
+    Layout old_slots,
+    uint32_t first,
+    uint32_t count,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_used)
+{
+    using Key = typename Layout::Key;
+
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < count) {
+        Key key = slot_key(old_slots, first + tid);
+        if (key == empty_key<Key>() || key == tombstone_key<Key>()) {
+            return;
+        }
+        uint32_t slot = hash(key, capacity);
+
+        while (true) {
+            Key prev = claim_slot(hashtable, slot, key, slot_value(old_slots, first + tid), false);
+            if (prev == empty_key<Key>()) {
+                atomicAdd(num_used, 1u);
+                return;
+            }
+            if (prev == key) {
+                return;
+            }
+
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+}
+
+// Migrate up to num_slots old slots; frees the old array once it is drained
+template <typename Layout>
+static void migrate_hashtable(HashTable<Layout>& ht, uint64_t num_slots)
+{
+    if (ht.oldCapacity == 0) {
+        return;
+    }
+
+    uint32_t first = ht.migrateCursor;
+    uint32_t count = (uint32_t)std::min<uint64_t>(num_slots, ht.oldCapacity - first);
+
+    int threadblocksize = 1024;
+    int gridsize = (count + threadblocksize - 1) / threadblocksize;
+
+    gpu_hashtable_migrate<Layout><<<gridsize, threadblocksize, 0, ht.stream>>>(
+        ht.oldSlots,
+        first,
+        count,
+        ht.slots,
+        ht.capacity,
+        ht.pNumUsed);
+    CUDA_CHECK_LAST_ERROR();
+
+    ht.migrateCursor += count;
+    if (ht.migrateCursor == ht.oldCapacity) {
+        // Lookups and deletes submitted so far may still read the old array
+        checkCUDA(cudaStreamSynchronize(ht.stream));
+        free_slots(ht.oldSlots);
+        ht.oldCapacity   = 0;
+        ht.migrateCursor = 0;
+    }
+}
+
+// Amount of migration work done alongside an operation on num_kvs keys
+static uint64_t migrate_slots_for(uint32_t num_kvs)
+{
+    return std::max<uint64_t>(kMinMigrateSlots, (uint64_t)num_kvs * kMigrateSlotsPerKey);
+}
+
+// Start moving all live keys into a fresh array of capacity slots. A rebuild
+// to the same capacity is how tombstones get reclaimed.
+template <typename Layout>
+static void begin_rebuild(HashTable<Layout>& ht, uint32_t capacity)
+{
+    checkCUDA(cudaStreamSynchronize(ht.stream));
+
+    ht.oldSlots      = ht.slots;
+    ht.oldCapacity   = ht.capacity;
+    ht.migrateCursor = 0;
+    create_slots(ht.slots, capacity);
+    ht.capacity      = capacity;
+    checkCUDA(cudaMemset(ht.pNumUsed, 0, sizeof(uint32_t)));
+    checkCUDA(cudaMemset(ht.pNumTombstones, 0, sizeof(uint32_t)));
+    checkCUDA(cudaDeviceSynchronize());
+    ht.numTombstoneBound = 0;
+}
+
+// Read the claimed-slot and tombstone counters of the current array
+template <typename Layout>
+static void read_counters(HashTable<Layout>& ht, uint32_t* num_used, uint32_t* num_tombstones)
+{
+    checkCUDA(cudaMemcpyAsync(num_used, ht.pNumUsed, sizeof(uint32_t), cudaMemcpyDeviceToHost, ht.stream));
+    checkCUDA(cudaMemcpyAsync(num_tombstones, ht.pNumTombstones, sizeof(uint32_t), cudaMemcpyDeviceToHost, ht.stream));
+    checkCUDA(cudaStreamSynchronize(ht.stream));
+}
+
+template <typename Layout>
+void sync_hashtable(HashTable<Layout>& ht)
+{
+    checkCUDA(cudaStreamSynchronize(ht.stream));
+}
+
+template <typename Layout>
+void complete_resize_hashtable(HashTable<Layout>& ht)
+{
+    try {
+        migrate_hashtable(ht, ht.oldCapacity);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Start a resize if inserting num_kvs more keys could exceed the max load factor.
+// The new array is sized so that it can take the whole batch; the old array is
+// drained incrementally by subsequent operations. If dropping the tombstones is
+// enough to make room, the table is rebuilt at its current capacity instead.
+template <typename Layout>
+static void reserve_hashtable(HashTable<Layout>& ht, uint32_t num_kvs)
+{
+    auto fits = [&](uint64_t num_keys, uint32_t capacity) {
+        return num_keys <= (uint64_t)((double)capacity * ht.maxLoadFactor);
+    };
+
+    if (fits((uint64_t)ht.numUsedBound + num_kvs, ht.capacity)) {
+        return;
+    }
+
+    // The bound counts overwrites and deleted keys; only now pay for an exact count
+    migrate_hashtable(ht, ht.oldCapacity);
+    uint32_t num_used, num_tombstones;
+    read_counters(ht, &num_used, &num_tombstones);
+    ht.numUsedBound = num_used;
+
+    if (fits((uint64_t)num_used + num_kvs, ht.capacity)) {
+        return;
+    }
+
+    uint64_t num_keys = (uint64_t)(num_used - num_tombstones) + num_kvs;
+    uint32_t capacity = ht.capacity;
+    while (!fits(num_keys, capacity)) {
+        if (capacity == 0x80000000u) {
+            LOG_ERROR("Hash table cannot grow beyond " << capacity << " slots");
+        }
+        capacity <<= 1;
+    }
+
+    if (capacity == ht.capacity) {
+        ht.numCompactions++;
+    } else {
+        ht.numResizes++;
+    }
+    begin_rebuild(ht, capacity);
+    ht.numUsedBound = num_used - num_tombstones;
+}
+
+// Start an incremental compaction once tombstones pass the threshold. While a
+// rebuild is in flight there is nothing to do, it drops tombstones anyway.
+template <typename Layout>
+static void check_tombstones(HashTable<Layout>& ht)
+{
+    if (ht.tombstoneThreshold <= 0.0f || ht.oldCapacity != 0) {
+        return;
+    }
+
+    // Delete batches stay asynchronous until the bound says the threshold may be crossed
+    uint64_t threshold = (uint64_t)((double)ht.capacity * ht.tombstoneThreshold);
+    if (ht.numTombstoneBound <= threshold) {
+        return;
+    }
+
+    uint32_t num_used, num_tombstones;
+    read_counters(ht, &num_used, &num_tombstones);
+    ht.numTombstoneBound = num_tombstones;
+    if (num_tombstones <= threshold) {
+        return;
+    }
+
+    begin_rebuild(ht, ht.capacity);
+    ht.numUsedBound = num_used - num_tombstones;
+    ht.numCompactions++;
+}
+
+template <typename Layout>
+void compact_hashtable(HashTable<Layout>& ht)
+{
+    try {
+        migrate_hashtable(ht, ht.oldCapacity);
+
+        uint32_t num_used, num_tombstones;
+        read_counters(ht, &num_used, &num_tombstones);
+        if (num_tombstones == 0) {
+            return;
+        }
+
+        begin_rebuild(ht, ht.capacity);
+        ht.numUsedBound = num_used - num_tombstones;
+        ht.numCompactions++;
+        migrate_hashtable(ht, ht.oldCapacity);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
 // Insert the key/values in kvs into the hashtable
+template <typename Layout>
 __global__
 void gpu_hashtable_insert(
-    KeyValue* hashtable,
-    const KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_used,
+    const KeyValueOf<Layout>* kvs,
     unsigned int numkvs)
 {
+    using Key = typename Layout::Key;
+
     unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
     if (tid < numkvs) {
-        uint32_t key   = kvs[tid].key;
-        uint32_t value = kvs[tid].value;
-        uint32_t slot  = hash(key);
+        Key      key  = kvs[tid].key;
+        uint32_t slot = hash(key, capacity);
 
         while (true) {
-            uint32_t prev = atomicCAS(&hashtable[slot].key, kEmpty, key);
-            if (prev == kEmpty || prev == key) {
-                hashtable[slot].value = value;
+            Key prev = claim_slot(hashtable, slot, key, kvs[tid].value, true);
+            if (prev == empty_key<Key>()) {
+                atomicAdd(num_used, 1u);
+            }
+            if (prev == empty_key<Key>() || prev == key) {
                 return;
             }
 
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+            slot = (slot + 1) & (capacity - 1);
         }
     }
 }
 
+template <typename Layout>
 void insert_hashtable(
-    KeyValue* pHashTable, // hashtable
-    const KeyValue* kvs,  // starting position for this batch of key-value pairs
-    uint32_t num_kvs)     // number of key-value pairs in this batch
+    HashTable<Layout>& ht,          // hashtable
+    const KeyValueOf<Layout>* kvs,  // starting position for this batch of key-value pairs
+    uint32_t num_kvs)               // number of key-value pairs in this batch
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        reserve_hashtable(ht, num_kvs);
+        migrate_hashtable(ht, migrate_slots_for(num_kvs));
+
         // Copy this batch of key-value pairs to the device
-        KeyValue* device_kvs;
-        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * num_kvs));
-        checkCUDA(cudaMemcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyHostToDevice));
+        StagingBuffer<KV>& sb = stage_batch(ht, kvs, num_kvs);
+        KV* device_kvs = sb.pDevice;
 
 #ifdef CALC_BLOCK
         // Have CUDA calculate the thread block size
         int mingridsize;
         int threadblocksize = 256;
-        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert, 0, 0));
+        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert<Layout>, 0, 0));
         std::cout << "insert threadblocksize: " << threadblocksize << std::endl;
 #else
         int threadblocksize = 1024; // perf does not seem to vary w/ thread block size (for all kernels in hashtable)
@@ -97,14 +515,16 @@ void insert_hashtable(
 
         int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
 
-        gpu_hashtable_insert<<<gridsize, threadblocksize>>>(
-            pHashTable,
+        gpu_hashtable_insert<Layout><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.slots,
+            ht.capacity,
+            ht.pNumUsed,
             device_kvs,
             (uint32_t)num_kvs);
         CUDA_CHECK_LAST_ERROR();
-        checkCUDA(cudaDeviceSynchronize());
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
 
-        checkCUDA(cudaFree(device_kvs));
+        ht.numUsedBound += num_kvs;
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -112,48 +532,80 @@ void insert_hashtable(
     }
 }
 
+// Probe one slot array for key; returns false if the key is not present
+template <typename Layout>
+__device__
+bool gpu_hashtable_find(
+    const Layout& hashtable,
+    uint32_t capacity,
+    typename Layout::Key key,
+    typename Layout::Value* value)
+{
+    using Key = typename Layout::Key;
+
+    uint32_t slot = hash(key, capacity);
+
+    while (true) {
+        Key slot_key_ = slot_key(hashtable, slot);
+        if (slot_key_ == key) {
+            *value = slot_value(hashtable, slot);
+            return true;
+        }
+        if (slot_key_ == empty_key<Key>()) {
+            return false;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
 // Lookup keys in the hashtable, and return the values
+// During a resize, keys missing from the new array may still be in the old one
+template <typename Layout>
 __global__
 void gpu_hashtable_lookup(
-    KeyValue* hashtable,
-    KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    Layout old_hashtable,
+    uint32_t old_capacity,
+    KeyValueOf<Layout>* kvs,
     unsigned int numkvs)
 {
     unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
     if (tid < numkvs) {
-        uint32_t key  = kvs[tid].key;
-        uint32_t slot = hash(key);
+        auto key   = kvs[tid].key;
+        auto value = empty_value<typename Layout::Value>();
 
-        while (true) {
-            if (hashtable[slot].key == key) {
-                kvs[tid].value = hashtable[slot].value;
-                return;
-            }
-            if (hashtable[slot].key == kEmpty) {
-                kvs[tid].value = kEmpty;
-                return;
-            }
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+        if (!gpu_hashtable_find(hashtable, capacity, key, &value) && old_capacity != 0) {
+            gpu_hashtable_find(old_hashtable, old_capacity, key, &value);
         }
+        kvs[tid].value = value;
     }
 }
 
+template <typename Layout>
 void lookup_hashtable(
-    KeyValue* pHashTable,
-    KeyValue* kvs,
+    HashTable<Layout>& ht,
+    KeyValueOf<Layout>* kvs,
     uint32_t num_kvs)
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        migrate_hashtable(ht, migrate_slots_for(num_kvs));
+
         // Copy this batch of key-value pairs to the device
-        KeyValue* device_kvs;
-        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * num_kvs));
-        checkCUDA(cudaMemcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyHostToDevice));
+        StagingBuffer<KV>& sb = stage_batch(ht, kvs, num_kvs);
+        KV* device_kvs = sb.pDevice;
 
 #ifdef CALC_BLOCK
         // Have CUDA calculate the thread block size
         int mingridsize;
         int threadblocksize = 256;
-        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert, 0, 0));
+        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert<Layout>, 0, 0));
         std::cout << "lookup threadblocksize: " << threadblocksize << std::endl;
 #else
         int threadblocksize = 1024;
@@ -161,14 +613,15 @@ void lookup_hashtable(
 
         int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
 
-        gpu_hashtable_lookup<<<gridsize, threadblocksize>>>(
-            pHashTable,
+        gpu_hashtable_lookup<Layout><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.slots,
+            ht.capacity,
+            ht.oldSlots,
+            ht.oldCapacity,
             device_kvs,
             (uint32_t)num_kvs);
         CUDA_CHECK_LAST_ERROR();
-        checkCUDA(cudaDeviceSynchronize());
-
-        checkCUDA(cudaFree(device_kvs));
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -176,49 +629,84 @@ void lookup_hashtable(
     }
 }
 
+// Replace key in one slot array by a tombstone; returns true if this call removed it
+template <typename Layout>
+__device__
+bool gpu_hashtable_erase(
+    const Layout& hashtable,
+    uint32_t capacity,
+    typename Layout::Key key)
+{
+    using Key = typename Layout::Key;
+
+    uint32_t slot = hash(key, capacity);
+
+    while (true) {
+        Key slot_key_ = slot_key(hashtable, slot);
+        if (slot_key_ == key) {
+            return erase_slot(hashtable, slot, key);
+        }
+        if (slot_key_ == empty_key<Key>()) {
+            return false;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
 // Delete each key in kvs from the hash table, if the key exists
-// A deleted key is left in the hash table, but its value is set to kEmpty
-// Deleted keys are not reused; once a key is assigned a slot, it never moves
+// The slot of a deleted key becomes a tombstone: lookups probe past it and
+// inserts do not reuse it, so once a key is assigned a slot it never moves.
+// Tombstones are reclaimed when the table is compacted or resized.
+// During a resize the key is deleted from both arrays, so the migration does
+// not bring it back
+template <typename Layout>
 __global__
 void gpu_hashtable_delete(
-    KeyValue* hashtable,
-    const KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_tombstones,
+    Layout old_hashtable,
+    uint32_t old_capacity,
+    const KeyValueOf<Layout>* kvs,
     unsigned int numkvs)
 {
     unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
     if (tid < numkvs) {
-        uint32_t key  = kvs[tid].key;
-        uint32_t slot = hash(key);
+        auto key = kvs[tid].key;
 
-        while (true) {
-            if (hashtable[slot].key == key) {
-                hashtable[slot].value = kEmpty;
-                return;
-            }
-            if (hashtable[slot].key == kEmpty) {
-                return;
-            }
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+        if (gpu_hashtable_erase(hashtable, capacity, key)) {
+            atomicAdd(num_tombstones, 1u);
+        }
+        if (old_capacity != 0) {
+            gpu_hashtable_erase(old_hashtable, old_capacity, key);
         }
     }
 }
 
+template <typename Layout>
 void delete_hashtable(
-    KeyValue* pHashTable,
-    const KeyValue* kvs,
+    HashTable<Layout>& ht,
+    const KeyValueOf<Layout>* kvs,
     uint32_t num_kvs)
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        migrate_hashtable(ht, migrate_slots_for(num_kvs));
+
         // Copy the keyvalues to the GPU
-        KeyValue* device_kvs;
-        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * num_kvs));
-        checkCUDA(cudaMemcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyHostToDevice));
+        StagingBuffer<KV>& sb = stage_batch(ht, kvs, num_kvs);
+        KV* device_kvs = sb.pDevice;
 
 #ifdef CALC_BLOCK
         // Have CUDA calculate the thread block size
         int mingridsize;
         int threadblocksize = 256;
-        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert, 0, 0));
+        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_hashtable_insert<Layout>, 0, 0));
         std::cout << "delete threadblocksize: " << threadblocksize << std::endl;
 #else
         int threadblocksize = 1024;
@@ -226,14 +714,19 @@ void delete_hashtable(
 
         int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
 
-        gpu_hashtable_delete<<<gridsize, threadblocksize>>>(
-            pHashTable,
+        gpu_hashtable_delete<Layout><<<gridsize, threadblocksize, 0, ht.stream>>>(
+            ht.slots,
+            ht.capacity,
+            ht.pNumTombstones,
+            ht.oldSlots,
+            ht.oldCapacity,
             device_kvs,
             (uint32_t)num_kvs);
         CUDA_CHECK_LAST_ERROR();
-        checkCUDA(cudaDeviceSynchronize());
+        checkCUDA(cudaEventRecord(sb.kernel, ht.stream));
 
-        checkCUDA(cudaFree(device_kvs));
+        ht.numTombstoneBound += num_kvs;
+        check_tombstones(ht);
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -242,33 +735,43 @@ void delete_hashtable(
 }
 
 // Iterate over every item in the hashtable; return non-empty key/values
+template <typename Layout>
 __global__
 void gpu_iterate_hashtable(
-    KeyValue* pHashTable,
-    KeyValue* kvs,
+    Layout pHashTable,
+    uint32_t capacity,
+    KeyValueOf<Layout>* kvs,
     uint32_t* kvs_size)
 {
+    using Key = typename Layout::Key;
+
     unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
-    if (tid < kHashTableCapacity) {
-        if (pHashTable[tid].key != kEmpty) {
-            uint32_t value = pHashTable[tid].value;
-            if (value != kEmpty) {
-                uint32_t size = atomicAdd(kvs_size, 1);
-                kvs[size] = pHashTable[tid];
-            }
+    if (tid < capacity) {
+        Key key = slot_key(pHashTable, tid);
+        if (key != empty_key<Key>() && key != tombstone_key<Key>()) {
+            uint32_t size = atomicAdd(kvs_size, 1u);
+            kvs[size].key   = key;
+            kvs[size].value = slot_value(pHashTable, tid);
         }
     }
 }
 
-std::vector<KeyValue> iterate_hashtable(KeyValue* pHashTable)
+template <typename Layout>
+std::vector<KeyValueOf<Layout>> iterate_hashtable(HashTable<Layout>& ht)
 {
-    std::vector<KeyValue> kvs;
+    using KV = KeyValueOf<Layout>;
+
+    std::vector<KV> kvs;
 
     try {
+        // All live keys must be in one array before it is walked
+        migrate_hashtable(ht, ht.oldCapacity);
+        sync_hashtable(ht);
+
         uint32_t* device_num_kvs;
-        KeyValue* device_kvs;
+        KV*       device_kvs;
         checkCUDA(cudaMalloc(&device_num_kvs, sizeof(uint32_t)));
-        checkCUDA(cudaMalloc(&device_kvs, sizeof(KeyValue) * kNumKeyValues));
+        checkCUDA(cudaMalloc(&device_kvs, sizeof(KV) * std::min(ht.capacity, std::max(ht.numUsedBound, 1u))));
 
         checkCUDA(cudaMemset(device_num_kvs, 0, sizeof(uint32_t)));
 
@@ -276,16 +779,17 @@ std::vector<KeyValue> iterate_hashtable(KeyValue* pHashTable)
         // Have CUDA calculate the thread block size
         int mingridsize;
         int threadblocksize = 256;
-        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_iterate_hashtable, 0, 0));
+        checkCUDA(cudaOccupancyMaxPotentialBlockSize(&mingridsize, &threadblocksize, gpu_iterate_hashtable<Layout>, 0, 0));
         std::cout << "iterate threadblocksize: " << threadblocksize << std::endl;
 #else
         int threadblocksize = 1024;
 #endif
 
-        int gridsize = (kHashTableCapacity + threadblocksize - 1) / threadblocksize;
+        int gridsize = (ht.capacity + threadblocksize - 1) / threadblocksize;
 
-        gpu_iterate_hashtable<<<gridsize, threadblocksize>>>(
-            pHashTable,
+        gpu_iterate_hashtable<Layout><<<gridsize, threadblocksize>>>(
+            ht.slots,
+            ht.capacity,
             device_kvs,
             device_num_kvs);
         CUDA_CHECK_LAST_ERROR();
@@ -295,7 +799,7 @@ std::vector<KeyValue> iterate_hashtable(KeyValue* pHashTable)
 
         kvs.resize(num_kvs);
 
-        checkCUDA(cudaMemcpy(kvs.data(), device_kvs, sizeof(KeyValue) * num_kvs, cudaMemcpyDeviceToHost));
+        checkCUDA(cudaMemcpy(kvs.data(), device_kvs, sizeof(KV) * num_kvs, cudaMemcpyDeviceToHost));
         checkCUDA(cudaDeviceSynchronize());
 
         checkCUDA(cudaFree(device_kvs));
@@ -309,8 +813,110 @@ std::vector<KeyValue> iterate_hashtable(KeyValue* pHashTable)
     return kvs;
 }
 
+// Count the slots inspected to look up each key, the same way gpu_hashtable_find probes
+template <typename Layout>
+__global__
+void gpu_hashtable_probe_histogram(
+    Layout hashtable,
+    uint32_t capacity,
+    const KeyValueOf<Layout>* kvs,
+    unsigned int numkvs,
+    uint32_t* histogram)
+{
+    using Key = typename Layout::Key;
+
+    unsigned int tid = blockIdx.x * blockDim.x + threadIdx.x;
+    if (tid < numkvs) {
+        Key      key    = kvs[tid].key;
+        uint32_t slot   = hash(key, capacity);
+        uint32_t probes = 1;
+
+        while (slot_key(hashtable, slot) != key && slot_key(hashtable, slot) != empty_key<Key>()) {
+            slot = (slot + 1) & (capacity - 1);
+            probes++;
+        }
+
+        atomicAdd(&histogram[min(probes, kProbeHistogramBins - 1)], 1u);
+    }
+}
+
+template <typename Layout>
+std::vector<uint32_t> probe_histogram_hashtable(
+    HashTable<Layout>& ht,
+    const KeyValueOf<Layout>* kvs,
+    uint32_t num_kvs)
+{
+    using KV = KeyValueOf<Layout>;
+
+    std::vector<uint32_t> histogram(kProbeHistogramBins, 0);
+    if (num_kvs == 0) {
+        return histogram;
+    }
+
+    try {
+        // Probe lengths are only meaningful for a single array
+        migrate_hashtable(ht, ht.oldCapacity);
+        sync_hashtable(ht);
+
+        KV*       device_kvs;
+        uint32_t* device_histogram;
+        checkCUDA(cudaMalloc(&device_kvs, sizeof(KV) * num_kvs));
+        checkCUDA(cudaMalloc(&device_histogram, sizeof(uint32_t) * kProbeHistogramBins));
+        checkCUDA(cudaMemcpy(device_kvs, kvs, sizeof(KV) * num_kvs, cudaMemcpyHostToDevice));
+        checkCUDA(cudaMemset(device_histogram, 0, sizeof(uint32_t) * kProbeHistogramBins));
+
+        int threadblocksize = 1024;
+        int gridsize = ((uint32_t)num_kvs + threadblocksize - 1) / threadblocksize;
+
+        gpu_hashtable_probe_histogram<Layout><<<gridsize, threadblocksize>>>(
+            ht.slots,
+            ht.capacity,
+            device_kvs,
+            (uint32_t)num_kvs,
+            device_histogram);
+        CUDA_CHECK_LAST_ERROR();
+        checkCUDA(cudaMemcpy(histogram.data(), device_histogram, sizeof(uint32_t) * kProbeHistogramBins, cudaMemcpyDeviceToHost));
+
+        checkCUDA(cudaFree(device_histogram));
+        checkCUDA(cudaFree(device_kvs));
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return histogram;
+}
+
 // Free the memory of the hashtable
-void destroy_hashtable(KeyValue* pHashTable)
+template <typename Layout>
+void destroy_hashtable(HashTable<Layout>& ht)
 {
-    checkCUDA(cudaFree(pHashTable));
+    checkCUDA(cudaDeviceSynchronize());
+
+    destroy_streams(ht);
+    if (ht.oldCapacity != 0) {
+        free_slots(ht.oldSlots);
+    }
+    checkCUDA(cudaFree(ht.pNumTombstones));
+    checkCUDA(cudaFree(ht.pNumUsed));
+    free_slots(ht.slots);
+    ht = {};
 }
+
+#define INSTANTIATE_HASHTABLE(Layout)                                                                       \
+    template HashTable<Layout> create_hashtable<Layout>(uint32_t, float, float);                           \
+    template void insert_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t);        \
+    template void lookup_hashtable<Layout>(HashTable<Layout>&, KeyValueOf<Layout>*, uint32_t);              \
+    template void delete_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t);        \
+    template void sync_hashtable<Layout>(HashTable<Layout>&);                                               \
+    template void complete_resize_hashtable<Layout>(HashTable<Layout>&);                                    \
+    template void compact_hashtable<Layout>(HashTable<Layout>&);                                            \
+    template std::vector<uint32_t> probe_histogram_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t); \
+    template std::vector<KeyValueOf<Layout>> iterate_hashtable<Layout>(HashTable<Layout>&);                 \
+    template void destroy_hashtable<Layout>(HashTable<Layout>&);
+
+INSTANTIATE_HASHTABLE(PackedSlots)
+INSTANTIATE_HASHTABLE(SplitSlots32)
+INSTANTIATE_HASHTABLE(SplitSlots64)
+INSTANTIATE_HASHTABLE(SplitSlots64x16)
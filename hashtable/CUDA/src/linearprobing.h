@@ -13,35 +13,209 @@
 #include <cuda.h>
 #include <cuda_runtime.h>
 #include <iostream>
+#include <vector>
 #include <sstream>
 
 #ifndef CPP_MODULE
 #define CPP_MODULE "UNKN"
 #endif
 
-struct KeyValue
+template <typename Key, typename Value>
+struct KeyValueT
 {
-    uint32_t key;
-    uint32_t value;
+    Key   key;
+    Value value;
 };
 
-const uint32_t kHashTableCapacity = 256 * 1024 * 1024;
+using KeyValue = KeyValueT<uint32_t, uint32_t>;
 
-const uint32_t kNumKeyValues = kHashTableCapacity / 2;
+// Payload of the widest benchmarked layout
+struct Payload16
+{
+    uint64_t lo;
+    uint64_t hi;
+
+    bool operator==(const Payload16& other) const { return lo == other.lo && hi == other.hi; }
+    bool operator!=(const Payload16& other) const { return !(*this == other); }
+};
+
+// Default number of slots; the capacity is chosen at run time (--capacity)
+// and rounded up to a power of two
+const uint32_t kDefaultHashTableCapacity = 256 * 1024 * 1024;
+
+const uint32_t kDefaultNumKeyValues = kDefaultHashTableCapacity / 2;
 
 const uint32_t kEmpty = 0xFFFFFFFF;
 
+// Key of a deleted slot. Tombstones keep probe chains intact; inserts never
+// reuse them, they are dropped when the table is compacted or resized.
+// Keys must therefore be in the range [0, kTombstone).
+const uint32_t kTombstone = 0xFFFFFFFE;
+
+// Reserved keys of any key width: all ones marks an empty slot, all ones
+// minus one a tombstone
+template <typename Key>
+__host__ __device__ constexpr Key empty_key() { return (Key)~(Key)0; }
+
+template <typename Key>
+__host__ __device__ constexpr Key tombstone_key() { return (Key)(empty_key<Key>() - 1); }
+
+// Value a lookup reports for a key that is not present: all ones, kEmpty for
+// 32-bit values
+template <typename Value>
+__host__ __device__ constexpr Value empty_value() { return empty_key<Value>(); }
+
+template <>
+__host__ __device__ constexpr Payload16 empty_value<Payload16>() { return Payload16{~0ull, ~0ull}; }
+
+// Values wider than 64 bits cannot be stored in one write. While such a value
+// is written, its 64-bit key carries kBusyKeyBit, and other inserts of the same
+// key leave the slot to the writer instead of storing their value concurrently.
+// Keys of these layouts must therefore be in the range [0, kBusyKeyBit).
+const uint64_t kBusyKeyBit = 1ull << 63;
+
+template <typename Value>
+__host__ __device__ constexpr bool value_needs_busy_bit() { return sizeof(Value) > sizeof(uint64_t); }
+
+// Upper bound (exclusive) of the keys a layout accepts
+template <typename Key, typename Value>
+__host__ __device__ constexpr Key key_limit() { return value_needs_busy_bit<Value>() ? (Key)kBusyKeyBit : tombstone_key<Key>(); }
+
 const uint32_t NUM_LOOPS = 1;
 
-KeyValue* create_hashtable();
+// A table grows (doubles) once an insert would push the load factor past this
+const float kDefaultMaxLoadFactor = 0.5f;
+
+// Number of old slots migrated per key of an operation while a resize is in
+// flight. With a max load factor of 0.5 and doubling, 2 slots per inserted key
+// drain the old array before the new one can reach its own threshold.
+const uint32_t kMigrateSlotsPerKey = 2;
+
+// Lower bound on the number of old slots migrated per operation, so small
+// lookup/delete batches still make progress on a pending resize
+const uint32_t kMinMigrateSlots = 1024 * 1024;
+
+// A delete batch that leaves more than this fraction of the slots as
+// tombstones starts a same-size rebuild of the table (0 disables it)
+const float kDefaultTombstoneThreshold = 0.25f;
+
+// Probe length histogram bins; the last bin also counts longer probes
+const uint32_t kProbeHistogramBins = 64;
+
+// Slot layouts. Both probe a key array the same way and differ in how a key
+// and its value are stored:
+// - PackedSlots keeps a 32-bit key and a 32-bit value in one 64-bit word, so
+//   claiming a slot and storing the value is a single 64-bit CAS
+// - SplitSlots claims a slot with a CAS on the key array and stores the value
+//   in a separate array, for 64-bit keys and payloads wider than 32 bits
+struct PackedSlots
+{
+    using Key   = uint32_t;
+    using Value = uint32_t;
+
+    uint64_t* pWords;   // value << 32 | key
+};
+
+template <typename K, typename V>
+struct SplitSlots
+{
+    using Key   = K;
+    using Value = V;
+
+    K* pKeys;
+    V* pValues;
+};
+
+using SplitSlots32    = SplitSlots<uint32_t, uint32_t>;
+using SplitSlots64    = SplitSlots<uint64_t, uint64_t>;
+using SplitSlots64x16 = SplitSlots<uint64_t, Payload16>;
+
+template <typename Layout>
+using KeyValueOf = KeyValueT<typename Layout::Key, typename Layout::Value>;
+
+// Batches are uploaded through a ring of persistent staging buffers owned by
+// the table, so the upload of batch N+1 overlaps the kernel of batch N
+const uint32_t kNumStagingBuffers = 2;
+
+template <typename KV>
+struct StagingBuffer
+{
+    KV*         pHost;         // pinned host copy of a batch
+    KV*         pDevice;
+    cudaEvent_t upload;        // recorded after the last upload from pHost
+    cudaEvent_t kernel;        // recorded after the last kernel reading pDevice
+};
+
+// Linear probing table with a runtime capacity. When a resize is in flight,
+// oldSlots holds the previous array; its slots [migrateCursor, oldCapacity)
+// have not been moved to slots yet and are still consulted by lookups.
+template <typename Layout = PackedSlots>
+struct HashTable
+{
+    using KeyValueType = KeyValueOf<Layout>;
+
+    Layout    slots;           // current slot array (capacity slots)
+    uint32_t  capacity;        // power of two
+    uint32_t* pNumUsed;        // device counter of claimed slots in slots, tombstones included
+    uint32_t* pNumTombstones;  // device counter of tombstones in slots
+    uint32_t  numUsedBound;    // host-side upper bound on keys held by the table
+    uint32_t  numTombstoneBound; // host-side upper bound on tombstones in slots
+    float     maxLoadFactor;
+    float     tombstoneThreshold;
+
+    Layout    oldSlots;        // array being drained while oldCapacity != 0
+    uint32_t  oldCapacity;     // 0 when no resize is in flight
+    uint32_t  migrateCursor;   // next old slot to migrate
+
+    // All kernels touching the slots run on one stream, so batches take effect
+    // in the order they were submitted; uploads run on their own stream
+    cudaStream_t  stream;
+    cudaStream_t  copyStream;
+    StagingBuffer<KeyValueOf<Layout>> staging[kNumStagingBuffers];
+    uint32_t      stagingCapacity; // KeyValues per staging buffer
+    uint32_t      nextStaging;
+
+    uint32_t  numResizes;
+    uint32_t  numCompactions;
+};
+
+// The operations are defined for PackedSlots, SplitSlots32, SplitSlots64 and
+// SplitSlots64x16
+template <typename Layout = PackedSlots>
+HashTable<Layout> create_hashtable(uint32_t capacity, float maxLoadFactor, float tombstoneThreshold);
+
+// Batch operations are asynchronous: kvs is copied into a staging buffer before
+// the call returns, the kernel may still be running. Lookup results are left in
+// the device staging buffer.
+template <typename Layout>
+void insert_hashtable(HashTable<Layout>& hashtable, const KeyValueOf<Layout>* kvs, uint32_t num_kvs);
+template <typename Layout>
+void lookup_hashtable(HashTable<Layout>& hashtable,       KeyValueOf<Layout>* kvs, uint32_t num_kvs);
+template <typename Layout>
+void delete_hashtable(HashTable<Layout>& hashtable, const KeyValueOf<Layout>* kvs, uint32_t num_kvs);
+
+// Wait until all submitted batches have been applied
+template <typename Layout>
+void sync_hashtable(HashTable<Layout>& hashtable);
+
+// Finish any in-flight resize so that all keys live in hashtable.slots
+template <typename Layout>
+void complete_resize_hashtable(HashTable<Layout>& hashtable);
+
+// Rebuild the table in place, dropping all tombstones
+template <typename Layout>
+void compact_hashtable(HashTable<Layout>& hashtable);
 
-void insert_hashtable(KeyValue* hashtable, const KeyValue* kvs, uint32_t num_kvs);
-void lookup_hashtable(KeyValue* hashtable,       KeyValue* kvs, uint32_t num_kvs);
-void delete_hashtable(KeyValue* hashtable, const KeyValue* kvs, uint32_t num_kvs);
+// Histogram of the number of slots probed to look up each key in kvs;
+// bin i counts lookups that inspected i slots
+template <typename Layout>
+std::vector<uint32_t> probe_histogram_hashtable(HashTable<Layout>& hashtable, const KeyValueOf<Layout>* kvs, uint32_t num_kvs);
 
-std::vector<KeyValue> iterate_hashtable(KeyValue* hashtable);
+template <typename Layout>
+std::vector<KeyValueOf<Layout>> iterate_hashtable(HashTable<Layout>& hashtable);
 
-void destroy_hashtable(KeyValue* hashtable);
+template <typename Layout>
+void destroy_hashtable(HashTable<Layout>& hashtable);
 
 #define checkCUDA(expression)                                   \
 {                                                               \
@@ -0,0 +1,87 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+// Host-side helpers shared by the table engines (linearprobing.cu, cuckoo.cu)
+
+#pragma once
+
+#include "cstring"
+#include "linearprobing.h"
+
+static inline uint32_t round_up_pow2(uint32_t n)
+{
+    uint32_t capacity = 1;
+    while (capacity < n && capacity < 0x80000000u) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Create the kernel and copy streams of a table and the events of its staging buffers
+template <typename Table>
+static void create_streams(Table& ht)
+{
+    checkCUDA(cudaStreamCreate(&ht.stream));
+    checkCUDA(cudaStreamCreate(&ht.copyStream));
+    for (auto& sb : ht.staging) {
+        checkCUDA(cudaEventCreateWithFlags(&sb.upload, cudaEventDisableTiming));
+        checkCUDA(cudaEventCreateWithFlags(&sb.kernel, cudaEventDisableTiming));
+    }
+}
+
+// Copy a batch into the next staging buffer of a table and start its upload.
+// Staging buffers are only (re)allocated when a batch larger than any before
+// arrives.
+template <typename Table, typename KV>
+static StagingBuffer<KV>& stage_batch(Table& ht, const KV* kvs, uint32_t num_kvs)
+{
+    if (num_kvs > ht.stagingCapacity) {
+        checkCUDA(cudaDeviceSynchronize());
+        for (StagingBuffer<KV>& sb : ht.staging) {
+            if (sb.pHost != nullptr) {
+                checkCUDA(cudaFreeHost(sb.pHost));
+                checkCUDA(cudaFree(sb.pDevice));
+            }
+            checkCUDA(cudaMallocHost(&sb.pHost, sizeof(KV) * num_kvs));
+            checkCUDA(cudaMalloc(&sb.pDevice, sizeof(KV) * num_kvs));
+        }
+        ht.stagingCapacity = num_kvs;
+    }
+
+    StagingBuffer<KV>& sb = ht.staging[ht.nextStaging];
+    ht.nextStaging = (ht.nextStaging + 1) % kNumStagingBuffers;
+
+    // The previous upload from this buffer has to finish before it is
+    // overwritten, and the kernel that read its device copy before the new
+    // upload lands there
+    checkCUDA(cudaEventSynchronize(sb.upload));
+    memcpy(sb.pHost, kvs, sizeof(KV) * num_kvs);
+    checkCUDA(cudaStreamWaitEvent(ht.copyStream, sb.kernel, 0));
+    checkCUDA(cudaMemcpyAsync(sb.pDevice, sb.pHost, sizeof(KV) * num_kvs, cudaMemcpyHostToDevice, ht.copyStream));
+    checkCUDA(cudaEventRecord(sb.upload, ht.copyStream));
+    checkCUDA(cudaStreamWaitEvent(ht.stream, sb.upload, 0));
+    return sb;
+}
+
+// Free the staging buffers, events and streams of a table; the device must be idle
+template <typename Table>
+static void destroy_streams(Table& ht)
+{
+    for (auto& sb : ht.staging) {
+        if (sb.pHost != nullptr) {
+            checkCUDA(cudaFreeHost(sb.pHost));
+            checkCUDA(cudaFree(sb.pDevice));
+        }
+        checkCUDA(cudaEventDestroy(sb.upload));
+        checkCUDA(cudaEventDestroy(sb.kernel));
+    }
+    checkCUDA(cudaStreamDestroy(ht.copyStream));
+    checkCUDA(cudaStreamDestroy(ht.stream));
+}
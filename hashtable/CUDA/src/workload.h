@@ -0,0 +1,88 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+#include "linearprobing.h"
+
+// Mixed-operation workloads: a table is preloaded with numKeys distinct keys,
+// then a stream of lookup/insert/delete batches drawn from a key distribution
+// is replayed against it. Every batch holds a single operation type; the mix
+// decides which type each batch gets.
+
+enum class KeyDistribution
+{
+    None,       // classic insert/lookup/delete phases
+    Uniform,    // every key equally likely, keys scattered over the key space
+    Zipf,       // rank r drawn with probability ~ 1 / r^theta, keys scattered
+    Sequential, // dense consecutive keys visited in order (auto-increment ids)
+    Clustered   // runs of clusterSize consecutive keys at random places
+};
+
+enum class WorkloadOp
+{
+    Lookup,
+    Insert,
+    Delete
+};
+
+const uint32_t kNumWorkloadOps = 3;
+
+const double   kDefaultZipfTheta         = 0.99;
+const uint32_t kDefaultWorkloadBatchSize = 1024 * 1024;
+const uint32_t kDefaultClusterSize       = 64;
+
+struct WorkloadConfig
+{
+    KeyDistribution distribution = KeyDistribution::None;
+    double   zipfTheta   = kDefaultZipfTheta;
+    uint32_t numKeys     = 0;  // keys preloaded into the table
+    uint32_t numOps      = 0;  // keys touched by the mixed phase (0: numKeys)
+    uint32_t batchSize   = kDefaultWorkloadBatchSize;
+    uint32_t clusterSize = kDefaultClusterSize;
+    float    mix[kNumWorkloadOps] = { 95.0f, 5.0f, 0.0f }; // lookup/insert/delete weights
+    float    missRatio   = 0.0f; // fraction of lookup/delete keys absent from the key set
+    uint32_t seed        = 0;
+};
+
+struct WorkloadBatch
+{
+    WorkloadOp            op;
+    std::vector<KeyValue> kvs;
+};
+
+struct Workload
+{
+    WorkloadConfig             config;
+    std::vector<KeyValue>      preloadKvs;
+    std::vector<WorkloadBatch> batches;
+};
+
+// Parse "uniform", "zipf", "sequential" or "clustered"; returns false otherwise
+bool parse_key_distribution(const char* name, KeyDistribution* distribution);
+
+// Parse a mix such as "95/5" (lookup/insert) or "50/40/10" (lookup/insert/delete)
+bool parse_workload_mix(const char* mix, float weights[kNumWorkloadOps]);
+
+const char* workload_op_name(WorkloadOp op);
+
+std::string describe_workload(const WorkloadConfig& config);
+
+// Generate the preload keys and the batches of the mixed phase
+Workload generate_workload(const WorkloadConfig& config);
+
+// Per-batch wall time (ms) of a replayed workload, indexed like Workload::batches
+void print_workload_report(
+    const Workload& workload,
+    double preload_ms,
+    const std::vector<double>& batch_ms);
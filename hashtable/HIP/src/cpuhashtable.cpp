@@ -0,0 +1,156 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#include "stdint.h"
+#include "cpuhashtable.h"
+
+// Empty and deleted slots keep kEmpty as value, so a slot is free only while
+// the whole 64-bit word equals kEmptySlot
+static const uint64_t kEmptySlot = ((uint64_t)kEmpty << 32) | kEmpty;
+
+static inline uint64_t pack(uint32_t key, uint32_t value)
+{
+    return ((uint64_t)value << 32) | key;
+}
+
+static inline uint32_t slot_key(uint64_t slot)
+{
+    return (uint32_t)slot;
+}
+
+// Same 32 bit Murmur3 finalizer as the device table
+static inline uint32_t cpu_hash(uint32_t k, uint32_t capacity)
+{
+    k ^= k >> 16;
+    k *= 0x85ebca6b;
+    k ^= k >> 13;
+    k *= 0xc2b2ae35;
+    k ^= k >> 16;
+    return k & (capacity - 1);
+}
+
+CpuHashTable create_cpu_hashtable(uint32_t capacity, uint32_t num_threads)
+{
+    CpuHashTable hashtable;
+    hashtable.capacity = 1;
+    while (hashtable.capacity < capacity) {
+        hashtable.capacity <<= 1;
+    }
+    hashtable.numThreads = num_threads;
+    hashtable.pSlots.reset(new std::atomic<uint64_t>[hashtable.capacity]);
+
+    // First touch from the threads that will probe the slots
+    std::atomic<uint64_t>* slots = hashtable.pSlots.get();
+    parallel_for_chunks(hashtable.capacity, num_threads, [slots](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            slots[i].store(kEmptySlot, std::memory_order_relaxed);
+        }
+    });
+
+    return hashtable;
+}
+
+void insert_cpu_hashtable(CpuHashTable& ht, const KeyValue* kvs, uint32_t num_kvs)
+{
+    std::atomic<uint64_t>* slots = ht.pSlots.get();
+    uint32_t capacity = ht.capacity;
+
+    parallel_for_chunks(num_kvs, ht.numThreads, [=](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t key = kvs[i].key;
+            uint64_t desired = pack(key, kvs[i].value);
+            uint32_t slot = cpu_hash(key, capacity);
+
+            while (true) {
+                uint64_t current = slots[slot].load(std::memory_order_relaxed);
+                if (current == kEmptySlot &&
+                    slots[slot].compare_exchange_strong(current, desired, std::memory_order_relaxed)) {
+                    break;
+                }
+                // current holds the occupied slot now; update the value if it is our key
+                while (slot_key(current) == key &&
+                       !slots[slot].compare_exchange_weak(current, desired, std::memory_order_relaxed)) {
+                }
+                if (slot_key(current) == key) {
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+    });
+}
+
+void lookup_cpu_hashtable(CpuHashTable& ht, KeyValue* kvs, uint32_t num_kvs)
+{
+    std::atomic<uint64_t>* slots = ht.pSlots.get();
+    uint32_t capacity = ht.capacity;
+
+    parallel_for_chunks(num_kvs, ht.numThreads, [=](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t key = kvs[i].key;
+            uint32_t slot = cpu_hash(key, capacity);
+
+            while (true) {
+                uint64_t current = slots[slot].load(std::memory_order_relaxed);
+                if (slot_key(current) == key) {
+                    kvs[i].value = (uint32_t)(current >> 32);
+                    break;
+                }
+                if (slot_key(current) == kEmpty) {
+                    kvs[i].value = kEmpty;
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+    });
+}
+
+void delete_cpu_hashtable(CpuHashTable& ht, const KeyValue* kvs, uint32_t num_kvs)
+{
+    std::atomic<uint64_t>* slots = ht.pSlots.get();
+    uint32_t capacity = ht.capacity;
+    const uint64_t tombstone = pack(kTombstone, kEmpty);
+
+    parallel_for_chunks(num_kvs, ht.numThreads, [=](uint32_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t key = kvs[i].key;
+            uint32_t slot = cpu_hash(key, capacity);
+
+            while (true) {
+                uint64_t current = slots[slot].load(std::memory_order_relaxed);
+                if (slot_key(current) == key) {
+                    // Fails only if the key was already replaced by a tombstone
+                    while (slot_key(current) == key &&
+                           !slots[slot].compare_exchange_weak(current, tombstone, std::memory_order_relaxed)) {
+                    }
+                    break;
+                }
+                if (slot_key(current) == kEmpty) {
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+        }
+    });
+}
+
+std::vector<KeyValue> iterate_cpu_hashtable(const CpuHashTable& ht)
+{
+    std::vector<KeyValue> kvs;
+    for (uint32_t i = 0; i < ht.capacity; i++) {
+        uint64_t current = ht.pSlots[i].load(std::memory_order_relaxed);
+        uint32_t key = slot_key(current);
+        if (key != kEmpty && key != kTombstone) {
+            kvs.push_back(KeyValue{ key, (uint32_t)(current >> 32) });
+        }
+    }
+    return kvs;
+}
@@ -0,0 +1,61 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "linearprobing.h"
+
+// Host threads used by the CPU baseline and the verifier
+inline uint32_t num_cpu_threads()
+{
+    uint32_t n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Split [0, n) into one contiguous chunk per thread and run
+// fn(thread, begin, end) on each. The split only depends on n and
+// num_threads, so two calls with the same arguments see the same chunks.
+template <typename Fn>
+void parallel_for_chunks(size_t n, uint32_t num_threads, Fn fn)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (uint32_t t = 0; t < num_threads; t++) {
+        threads.emplace_back(fn, t, n * t / num_threads, n * (t + 1) / num_threads);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Multithreaded linear probing table on the host, used as the CPU baseline.
+// It probes like the device table, but packs key and value into one 64-bit
+// slot so an insert of a new key is a single CAS. The capacity is fixed.
+struct CpuHashTable
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> pSlots;
+    uint32_t capacity;     // power of two
+    uint32_t numThreads;
+};
+
+CpuHashTable create_cpu_hashtable(uint32_t capacity, uint32_t num_threads);
+
+void insert_cpu_hashtable(CpuHashTable& hashtable, const KeyValue* kvs, uint32_t num_kvs);
+
+// Stores the value of each key in kvs, kEmpty for keys that are not present
+void lookup_cpu_hashtable(CpuHashTable& hashtable,       KeyValue* kvs, uint32_t num_kvs);
+
+void delete_cpu_hashtable(CpuHashTable& hashtable, const KeyValue* kvs, uint32_t num_kvs);
+
+std::vector<KeyValue> iterate_cpu_hashtable(const CpuHashTable& hashtable);
@@ -0,0 +1,87 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+// Host-side helpers shared by the table engines (linearprobing.cpp, cuckoo.cpp)
+
+#pragma once
+
+#include "cstring"
+#include "linearprobing.h"
+
+static inline uint32_t round_up_pow2(uint32_t n)
+{
+    uint32_t capacity = 1;
+    while (capacity < n && capacity < 0x80000000u) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Create the kernel and copy streams of a table and the events of its staging buffers
+template <typename Table>
+static void create_streams(Table& ht)
+{
+    checkCUDA(hipStreamCreate(&ht.stream));
+    checkCUDA(hipStreamCreate(&ht.copyStream));
+    for (auto& sb : ht.staging) {
+        checkCUDA(hipEventCreateWithFlags(&sb.upload, hipEventDisableTiming));
+        checkCUDA(hipEventCreateWithFlags(&sb.kernel, hipEventDisableTiming));
+    }
+}
+
+// Copy a batch into the next staging buffer of a table and start its upload.
+// Staging buffers are only (re)allocated when a batch larger than any before
+// arrives.
+template <typename Table, typename KV>
+static StagingBuffer<KV>& stage_batch(Table& ht, const KV* kvs, uint32_t num_kvs)
+{
+    if (num_kvs > ht.stagingCapacity) {
+        checkCUDA(hipDeviceSynchronize());
+        for (StagingBuffer<KV>& sb : ht.staging) {
+            if (sb.pHost != nullptr) {
+                checkCUDA(hipHostFree(sb.pHost));
+                checkCUDA(hipFree(sb.pDevice));
+            }
+            checkCUDA(hipHostMalloc(&sb.pHost, sizeof(KV) * num_kvs));
+            checkCUDA(hipMalloc(&sb.pDevice, sizeof(KV) * num_kvs));
+        }
+        ht.stagingCapacity = num_kvs;
+    }
+
+    StagingBuffer<KV>& sb = ht.staging[ht.nextStaging];
+    ht.nextStaging = (ht.nextStaging + 1) % kNumStagingBuffers;
+
+    // The previous upload from this buffer has to finish before it is
+    // overwritten, and the kernel that read its device copy before the new
+    // upload lands there
+    checkCUDA(hipEventSynchronize(sb.upload));
+    memcpy(sb.pHost, kvs, sizeof(KV) * num_kvs);
+    checkCUDA(hipStreamWaitEvent(ht.copyStream, sb.kernel, 0));
+    checkCUDA(hipMemcpyAsync(sb.pDevice, sb.pHost, sizeof(KV) * num_kvs, hipMemcpyHostToDevice, ht.copyStream));
+    checkCUDA(hipEventRecord(sb.upload, ht.copyStream));
+    checkCUDA(hipStreamWaitEvent(ht.stream, sb.upload, 0));
+    return sb;
+}
+
+// Free the staging buffers, events and streams of a table; the device must be idle
+template <typename Table>
+static void destroy_streams(Table& ht)
+{
+    for (auto& sb : ht.staging) {
+        if (sb.pHost != nullptr) {
+            checkCUDA(hipHostFree(sb.pHost));
+            checkCUDA(hipFree(sb.pDevice));
+        }
+        checkCUDA(hipEventDestroy(sb.upload));
+        checkCUDA(hipEventDestroy(sb.kernel));
+    }
+    checkCUDA(hipStreamDestroy(ht.copyStream));
+    checkCUDA(hipStreamDestroy(ht.stream));
+}
@@ -10,92 +10,208 @@
 
 #include "stdio.h"
 #include "stdint.h"
-#include "unordered_set"
 #include "unordered_map"
 #include "vector"
 #include "algorithm"
 #include "random"
 #include "linearprobing.h"
+#include "workload.h"
+#include "cpuhashtable.h"
 
-void test_correctness(
-    std::vector<KeyValue> insert_kvs,
-    std::vector<KeyValue> delete_kvs,
-    std::vector<KeyValue> kvs)
+// Parallel LSD radix sort of items by a key of key_bits bits, 8 bits per pass.
+// Counts are laid out digit-major, thread-minor, so each thread scatters its
+// chunk to its own stable range. Passes on which all keys share a digit are skipped.
+template <typename T, typename KeyFn>
+static void radix_sort(std::vector<T>& items, KeyFn key, uint32_t key_bits, uint32_t num_threads)
 {
-    printf("Testing that there are no duplicate keys...\n");
-    std::unordered_set<uint32_t> unique_keys;
-    for (uint32_t i = 0; i < kvs.size(); i++)
-    {
-        if (i % 10000000 == 0)
-            printf("    Verifying %d/%d\n", i, (uint32_t)kvs.size());
+    const uint32_t kRadix = 256;
+    std::vector<T> buffer(items.size());
+    std::vector<size_t> offsets(num_threads * kRadix);
 
-        KeyValue* node = &kvs[i];
-        if (unique_keys.find(node->key) != unique_keys.end())
-        {
-            printf("Duplicate key found in GPU hash table at slot %d\n", i);
-            exit(-1);
+    for (uint32_t shift = 0; shift < key_bits; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_for_chunks(items.size(), num_threads, [&](uint32_t t, size_t begin, size_t end) {
+            size_t* counts = &offsets[t * kRadix];
+            for (size_t i = begin; i < end; i++) {
+                counts[(key(items[i]) >> shift) & (kRadix - 1)]++;
+            }
+        });
+
+        size_t offset = 0;
+        bool single_digit = false;
+        for (uint32_t d = 0; d < kRadix; d++) {
+            size_t digit_start = offset;
+            for (uint32_t t = 0; t < num_threads; t++) {
+                size_t count = offsets[t * kRadix + d];
+                offsets[t * kRadix + d] = offset;
+                offset += count;
+            }
+            single_digit |= offset - digit_start == items.size();
+        }
+        if (single_digit) {
+            continue;
         }
-        unique_keys.insert(node->key);
+
+        parallel_for_chunks(items.size(), num_threads, [&](uint32_t t, size_t begin, size_t end) {
+            size_t* next = &offsets[t * kRadix];
+            for (size_t i = begin; i < end; i++) {
+                buffer[next[(key(items[i]) >> shift) & (kRadix - 1)]++] = items[i];
+            }
+        });
+        items.swap(buffer);
     }
+}
 
-    printf("Building unordered_map from original list...\n");
-    std::unordered_map<uint32_t, std::vector<uint32_t>> all_kvs_map;
-    for (uint32_t i = 0; i < insert_kvs.size(); i++)
-    {
-        if (i % 10000000 == 0)
-            printf("    Inserting %d/%d\n", i, (uint32_t)insert_kvs.size());
+// Sort the hashtable contents and both original lists, then compare them with
+// one merge pass per thread over disjoint key ranges
+template <typename KV>
+void test_correctness(
+    std::vector<KV> insert_kvs,
+    std::vector<KV> delete_kvs,
+    std::vector<KV> kvs)
+{
+    using Key = decltype(KV::key);
 
-        auto iter = all_kvs_map.find(insert_kvs[i].key);
-        if (iter == all_kvs_map.end())
-        {
-            all_kvs_map[insert_kvs[i].key] = std::vector<uint32_t>({ insert_kvs[i].value });
+    uint32_t num_threads = num_cpu_threads();
+    uint32_t key_bits    = sizeof(Key) * 8;
+    auto kv_key = [](const KV& kv) { return (uint64_t)kv.key; };
+
+    printf("Sorting hashtable and original lists on %u threads...\n", num_threads);
+    radix_sort(kvs, kv_key, key_bits, num_threads);
+    radix_sort(insert_kvs, kv_key, key_bits, num_threads);
+    radix_sort(delete_kvs, kv_key, key_bits, num_threads);
+
+    // Split the key space at keys of the sorted hashtable so the threads get
+    // similar shares of it; a key range never straddles two threads. The last
+    // range is open-ended, 64-bit keys have no larger bound to split at.
+    std::vector<Key> splits(num_threads);
+    for (uint32_t t = 0; t < num_threads; t++) {
+        splits[t] = t == 0 || kvs.empty() ? 0 : kvs[kvs.size() * t / num_threads].key;
+    }
+
+    auto range_begin = [&](const std::vector<KV>& sorted, uint32_t t) {
+        if (t == num_threads) {
+            return sorted.size();
         }
-        else
-        {
-            iter->second.push_back(insert_kvs[i].value);
+        return (size_t)(std::lower_bound(sorted.begin(), sorted.end(), splits[t],
+            [](const KV& kv, Key k) { return kv.key < k; }) - sorted.begin());
+    };
+
+    printf("Comparing hashtable with the original lists...\n");
+    std::vector<const char*> errors(num_threads, nullptr);
+    parallel_for_chunks(num_threads, num_threads, [&](uint32_t t, size_t, size_t) {
+        size_t i = range_begin(insert_kvs, t), i_end = range_begin(insert_kvs, t + 1);
+        size_t d = range_begin(delete_kvs, t), d_end = range_begin(delete_kvs, t + 1);
+        size_t k = range_begin(kvs, t),        k_end = range_begin(kvs, t + 1);
+
+        while (i < i_end) {
+            Key key = insert_kvs[i].key;
+            size_t group_end = i;
+            while (group_end < i_end && insert_kvs[group_end].key == key) {
+                group_end++;
+            }
+            while (d < d_end && delete_kvs[d].key < key) {
+                d++;
+            }
+
+            if (k < k_end && kvs[k].key < key) {
+                errors[t] = "Hashtable key not found in original list";
+                return;
+            }
+            bool present = k < k_end && kvs[k].key == key;
+            if (d < d_end && delete_kvs[d].key == key) {
+                if (present) {
+                    errors[t] = "Deleted key found in hashtable";
+                    return;
+                }
+            } else {
+                if (!present) {
+                    errors[t] = "# of unique keys in hashtable is incorrect";
+                    return;
+                }
+                // Duplicate keys in the original list may have left any of their values
+                bool found = false;
+                for (size_t j = i; j < group_end && !found; j++) {
+                    found = insert_kvs[j].value == kvs[k].value;
+                }
+                if (!found) {
+                    errors[t] = "Hashtable value not found in original list";
+                    return;
+                }
+                k++;
+                if (k < k_end && kvs[k].key == key) {
+                    errors[t] = "Duplicate key found in GPU hash table";
+                    return;
+                }
+            }
+            i = group_end;
+        }
+        if (k < k_end) {
+            errors[t] = "Hashtable key not found in original list";
+        }
+    });
+
+    for (const char* error : errors) {
+        if (error != nullptr) {
+            printf("%s\n", error);
+            exit(-1);
         }
     }
 
-    for (uint32_t i = 0; i < delete_kvs.size(); i++)
-    {
-        if (i % 10000000 == 0)
-            printf("    Deleting %d/%d\n", i, (uint32_t)delete_kvs.size());
+    return;
+}
+
+template void test_correctness<KeyValue>(std::vector<KeyValue>, std::vector<KeyValue>, std::vector<KeyValue>);
+template void test_correctness<KeyValueOf<SplitSlots64>>(
+    std::vector<KeyValueOf<SplitSlots64>>, std::vector<KeyValueOf<SplitSlots64>>, std::vector<KeyValueOf<SplitSlots64>>);
+template void test_correctness<KeyValueOf<SplitSlots64x16>>(
+    std::vector<KeyValueOf<SplitSlots64x16>>, std::vector<KeyValueOf<SplitSlots64x16>>, std::vector<KeyValueOf<SplitSlots64x16>>);
 
-        auto iter = all_kvs_map.find(delete_kvs[i].key);
-        if (iter != all_kvs_map.end())
+// Replay a workload on a std::unordered_map and compare the final contents
+void test_workload_correctness(
+    const Workload& workload,
+    std::vector<KeyValue> kvs)
+{
+    printf("Replaying workload on std::unordered_map...\n");
+    std::unordered_map<uint32_t, uint32_t> expected;
+    for (const KeyValue& kv : workload.preloadKvs)
+    {
+        expected[kv.key] = kv.value;
+    }
+    for (const WorkloadBatch& batch : workload.batches)
+    {
+        if (batch.op == WorkloadOp::Insert)
+        {
+            for (const KeyValue& kv : batch.kvs)
+                expected[kv.key] = kv.value;
+        }
+        else if (batch.op == WorkloadOp::Delete)
         {
-            all_kvs_map.erase(iter);
+            for (const KeyValue& kv : batch.kvs)
+                expected.erase(kv.key);
         }
     }
 
-    if (unique_keys.size() != all_kvs_map.size())
+    if (kvs.size() != expected.size())
     {
-        printf("# of unique keys in hashtable is incorrect\n");
+        printf("# of keys in hashtable is incorrect (%zu, expected %zu)\n", kvs.size(), expected.size());
         exit(-1);
     }
 
-    printf("Testing that each key/value in hashtable is in the original list...\n");
+    printf("Testing that each key/value in hashtable matches the replay...\n");
     for (uint32_t i = 0; i < kvs.size(); i++)
     {
-        if (i % 10000000 == 0)
-            printf("    Verifying %d/%d\n", i, (uint32_t)kvs.size());
-
-        auto iter = all_kvs_map.find(kvs[i].key);
-        if (iter == all_kvs_map.end())
+        auto iter = expected.find(kvs[i].key);
+        if (iter == expected.end())
         {
-            printf("Hashtable key not found in original list\n");
+            printf("Hashtable key not found in replay (or duplicated)\n");
             exit(-1);
         }
-
-        std::vector<uint32_t>& values = iter->second;
-        if (std::find(values.begin(), values.end(), kvs[i].value) == values.end())
+        if (iter->second != kvs[i].value)
         {
-            printf("Hashtable value not found in original list\n");
+            printf("Hashtable value does not match the last insert of its key\n");
             exit(-1);
         }
+        expected.erase(iter);
     }
-
-    printf("Deleting std::unordered_map and std::unique_set...\n");
-
-    return;
 }
@@ -0,0 +1,356 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#include "algorithm"
+#include "cmath"
+#include "cstring"
+#include "numeric"
+#include "stdexcept"
+#include "stdint.h"
+#include "stdio.h"
+#include "workload.h"
+
+bool parse_key_distribution(const char* name, KeyDistribution* distribution)
+{
+    if (strcmp(name, "uniform") == 0) {
+        *distribution = KeyDistribution::Uniform;
+    } else if (strcmp(name, "zipf") == 0) {
+        *distribution = KeyDistribution::Zipf;
+    } else if (strcmp(name, "sequential") == 0) {
+        *distribution = KeyDistribution::Sequential;
+    } else if (strcmp(name, "clustered") == 0) {
+        *distribution = KeyDistribution::Clustered;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_workload_mix(const char* mix, float weights[kNumWorkloadOps])
+{
+    float parsed[kNumWorkloadOps] = { 0.0f, 0.0f, 0.0f };
+    const char* p = mix;
+    char* end = nullptr;
+    uint32_t n = 0;
+    while (n < kNumWorkloadOps) {
+        parsed[n] = strtof(p, &end);
+        if (end == p || parsed[n] < 0.0f) {
+            return false;
+        }
+        n++;
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != '/') {
+            return false;
+        }
+        p = end + 1;
+    }
+    // The last field must end the string: "50/40/10/99" is not a mix
+    if (n < 2 || *end != '\0' || parsed[0] + parsed[1] + parsed[2] <= 0.0f) {
+        return false;
+    }
+    std::copy(parsed, parsed + kNumWorkloadOps, weights);
+    return true;
+}
+
+const char* workload_op_name(WorkloadOp op)
+{
+    switch (op) {
+    case WorkloadOp::Lookup: return "lookup";
+    case WorkloadOp::Insert: return "insert";
+    case WorkloadOp::Delete: return "delete";
+    }
+    return "unknown";
+}
+
+std::string describe_workload(const WorkloadConfig& config)
+{
+    char buf[256];
+    switch (config.distribution) {
+    case KeyDistribution::Uniform:    snprintf(buf, sizeof(buf), "uniform"); break;
+    case KeyDistribution::Zipf:       snprintf(buf, sizeof(buf), "zipf (theta %.2f)", config.zipfTheta); break;
+    case KeyDistribution::Sequential: snprintf(buf, sizeof(buf), "sequential"); break;
+    case KeyDistribution::Clustered:  snprintf(buf, sizeof(buf), "clustered (%u keys per cluster)", config.clusterSize); break;
+    default:                          snprintf(buf, sizeof(buf), "none"); break;
+    }
+    std::string s = buf;
+    snprintf(buf, sizeof(buf), ", mix %g/%g/%g lookup/insert/delete, miss ratio %.2f, %u keys, %u ops in batches of %u",
+        config.mix[0], config.mix[1], config.mix[2], config.missRatio, config.numKeys, config.numOps, config.batchSize);
+    return s + buf;
+}
+
+// Bijection on 32-bit values (lowbias32 mixer). Walking the cycle past the two
+// reserved keys keeps it a bijection on [0, kTombstone).
+static uint32_t scramble(uint32_t x, uint32_t seed)
+{
+    do {
+        x ^= seed;
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+    } while (x >= kTombstone);
+    return x;
+}
+
+// Maps a key rank to a key; distinct ranks give distinct keys, so ranks
+// [0, numKeys) form the key set and ranks past missBase are guaranteed misses.
+struct KeySpace
+{
+    KeyDistribution distribution;
+    uint32_t seed;
+    uint64_t clusterSize;
+    uint64_t numClusters;
+    uint64_t clusterMul;
+    uint64_t clusterAdd;
+
+    KeySpace(const WorkloadConfig& config)
+        : distribution(config.distribution),
+          seed(config.seed),
+          clusterSize(config.clusterSize),
+          numClusters(kTombstone / config.clusterSize),
+          clusterAdd(config.seed % (kTombstone / config.clusterSize))
+    {
+        // Clusters are placed by an affine permutation of the cluster index
+        clusterMul = 2654435761u % numClusters;
+        while (std::gcd(clusterMul, numClusters) != 1) {
+            clusterMul++;
+        }
+    }
+
+    uint32_t key(uint64_t rank) const
+    {
+        switch (distribution) {
+        case KeyDistribution::Sequential:
+            return (uint32_t)rank;
+        case KeyDistribution::Clustered: {
+            uint64_t cluster = (rank / clusterSize * clusterMul + clusterAdd) % numClusters;
+            return (uint32_t)(cluster * clusterSize + rank % clusterSize);
+        }
+        default:
+            return scramble((uint32_t)rank, seed);
+        }
+    }
+};
+
+// Zipf ranks in [1, n] by rejection-inversion (Hormann and Derflinger), which
+// needs O(1) setup instead of a table of n probabilities
+class ZipfSampler
+{
+public:
+    ZipfSampler(uint32_t n, double theta)
+        : n(n), theta(theta)
+    {
+        hIntegralX1 = hIntegral(1.5) - 1.0;
+        hIntegralN  = hIntegral(n + 0.5);
+        s = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+    }
+
+    uint32_t operator()(std::mt19937& rnd)
+    {
+        std::uniform_real_distribution<double> dis(0.0, 1.0);
+        while (true) {
+            double u = hIntegralN + dis(rnd) * (hIntegralX1 - hIntegralN);
+            double x = hIntegralInverse(u);
+            double k = std::floor(x + 0.5);
+            k = std::min(std::max(k, 1.0), (double)n);
+            if (k - x <= s || u >= hIntegral(k + 0.5) - h(k)) {
+                return (uint32_t)k;
+            }
+        }
+    }
+
+private:
+    // log1p(x) / x and expm1(x) / x, continuous at 0
+    static double helper1(double x)
+    {
+        return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+
+    static double helper2(double x)
+    {
+        return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+    }
+
+    double h(double x) const
+    {
+        return std::exp(-theta * std::log(x));
+    }
+
+    double hIntegral(double x) const
+    {
+        double log_x = std::log(x);
+        return helper2((1.0 - theta) * log_x) * log_x;
+    }
+
+    double hIntegralInverse(double x) const
+    {
+        double t = std::max(x * (1.0 - theta), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+    uint32_t n;
+    double   theta;
+    double   hIntegralX1;
+    double   hIntegralN;
+    double   s;
+};
+
+// Draws ranks in [base, base + count) following the configured distribution
+class RankSampler
+{
+public:
+    RankSampler(const WorkloadConfig& config, uint64_t base, uint32_t count)
+        : distribution(config.distribution),
+          base(base),
+          count(count),
+          clusterSize(config.clusterSize),
+          uniform(0, count - 1),
+          zipf(count, config.zipfTheta)
+    {
+    }
+
+    uint64_t operator()(std::mt19937& rnd)
+    {
+        switch (distribution) {
+        case KeyDistribution::Zipf:
+            return base + zipf(rnd) - 1;
+        case KeyDistribution::Sequential: {
+            uint64_t rank = base + cursor;
+            cursor = cursor + 1 == count ? 0 : cursor + 1;
+            return rank;
+        }
+        case KeyDistribution::Clustered:
+            // Visit a whole run of consecutive keys, then jump to another cluster
+            if (runIndex == runLength) {
+                uint32_t num_clusters = (count + clusterSize - 1) / clusterSize;
+                runStart  = std::uniform_int_distribution<uint32_t>(0, num_clusters - 1)(rnd) * clusterSize;
+                runLength = std::min(clusterSize, count - runStart);
+                runIndex  = 0;
+            }
+            return base + runStart + runIndex++;
+        default:
+            return base + uniform(rnd);
+        }
+    }
+
+private:
+    KeyDistribution distribution;
+    uint64_t base;
+    uint32_t count;
+    uint32_t clusterSize;
+    std::uniform_int_distribution<uint32_t> uniform;
+    ZipfSampler zipf;
+    uint32_t cursor    = 0;
+    uint32_t runStart  = 0;
+    uint32_t runLength = 0;
+    uint32_t runIndex  = 0;
+};
+
+Workload generate_workload(const WorkloadConfig& config)
+{
+    Workload workload;
+    workload.config = config;
+    WorkloadConfig& cfg = workload.config;
+    if (cfg.numOps == 0) {
+        cfg.numOps = cfg.numKeys;
+    }
+    if (cfg.distribution != KeyDistribution::Clustered) {
+        cfg.clusterSize = 1;
+    }
+
+    // Misses come from a disjoint, equally sized rank range
+    uint64_t miss_base = ((uint64_t)cfg.numKeys + cfg.clusterSize - 1) / cfg.clusterSize * cfg.clusterSize;
+    if (miss_base + cfg.numKeys > kTombstone) {
+        throw std::runtime_error("workload key set does not fit into the key space");
+    }
+
+    KeySpace key_space(cfg);
+    std::mt19937 rnd(cfg.seed);
+
+    workload.preloadKvs.reserve(cfg.numKeys);
+    for (uint32_t i = 0; i < cfg.numKeys; i++) {
+        workload.preloadKvs.push_back(KeyValue{ key_space.key(i), 0 });
+    }
+    if (cfg.distribution != KeyDistribution::Sequential) {
+        std::shuffle(workload.preloadKvs.begin(), workload.preloadKvs.end(), rnd);
+    }
+
+    RankSampler hits(cfg, 0, cfg.numKeys);
+    RankSampler misses(cfg, miss_base, cfg.numKeys);
+    std::bernoulli_distribution is_miss(cfg.missRatio);
+    std::discrete_distribution<uint32_t> pick_op(cfg.mix, cfg.mix + kNumWorkloadOps);
+
+    uint32_t num_batches = (cfg.numOps + cfg.batchSize - 1) / cfg.batchSize;
+    workload.batches.resize(num_batches);
+    for (uint32_t b = 0; b < num_batches; b++) {
+        WorkloadBatch& batch = workload.batches[b];
+        batch.op = (WorkloadOp)pick_op(rnd);
+
+        uint32_t size = b + 1 < num_batches ? cfg.batchSize : cfg.numOps - b * cfg.batchSize;
+        batch.kvs.resize(size);
+        for (KeyValue& kv : batch.kvs) {
+            // Inserts update keys of the key set; the value records the
+            // batch that wrote it, so replays are deterministic
+            bool miss = batch.op != WorkloadOp::Insert && is_miss(rnd);
+            kv.key   = key_space.key(miss ? misses(rnd) : hits(rnd));
+            kv.value = batch.op == WorkloadOp::Insert ? b + 1 : 0;
+        }
+    }
+
+    return workload;
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static void print_workload_row(const char* name, uint64_t num_keys, std::vector<double> batch_ms)
+{
+    if (batch_ms.empty()) {
+        return;
+    }
+    std::sort(batch_ms.begin(), batch_ms.end());
+    double total_ms = std::accumulate(batch_ms.begin(), batch_ms.end(), 0.0);
+    printf("    %-8s %8zu %12llu %12.2f %10.3f %10.3f\n", name, batch_ms.size(), (unsigned long long)num_keys,
+        num_keys / (total_ms / 1000.0) / 1000000.0, percentile(batch_ms, 50.0), percentile(batch_ms, 99.0));
+}
+
+void print_workload_report(
+    const Workload& workload,
+    double preload_ms,
+    const std::vector<double>& batch_ms)
+{
+    printf("Workload: %s\n", describe_workload(workload.config).c_str());
+    printf("Preload: %zu keys in %f ms (%f Mkeys/second)\n", workload.preloadKvs.size(), preload_ms,
+        workload.preloadKvs.size() / (preload_ms / 1000.0) / 1000000.0);
+
+    std::vector<double> op_ms[kNumWorkloadOps];
+    uint64_t op_keys[kNumWorkloadOps] = { 0, 0, 0 };
+    for (size_t i = 0; i < workload.batches.size(); i++) {
+        uint32_t op = (uint32_t)workload.batches[i].op;
+        op_ms[op].push_back(batch_ms[i]);
+        op_keys[op] += workload.batches[i].kvs.size();
+    }
+
+    printf("    %-8s %8s %12s %12s %10s %10s\n", "op", "batches", "keys", "Mkeys/s", "p50 ms", "p99 ms");
+    for (uint32_t op = 0; op < kNumWorkloadOps; op++) {
+        print_workload_row(workload_op_name((WorkloadOp)op), op_keys[op], op_ms[op]);
+    }
+    print_workload_row("all", op_keys[0] + op_keys[1] + op_keys[2], batch_ms);
+}
@@ -0,0 +1,960 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+#include "stdio.h"
+#include "stdint.h"
+#include "vector"
+
+#define CPP_MODULE "CUCKOO"
+#include "cuckoo.h"
+
+#include <sycl/sycl.hpp>
+#include <algorithm>
+#include "acas.h"
+#include "tablecommon.h"
+
+// An empty slot is all ones, like an empty PackedSlots word
+static const uint64_t kEmptyWord = 0xFFFFFFFFFFFFFFFFull;
+
+// A deleted stash entry. It is never reused before the next rebuild, so the
+// probe sequences of the stash that pass it stay intact.
+static const uint64_t kStashTombstoneWord = ((uint64_t)kEmpty << 32) | kTombstone;
+
+// Home entry of key in the stash, from the high bits of a multiplicative hash.
+// The stash is a small linear probing table: a lookup probes from the home
+// entry up to the first empty one instead of scanning all stashed keys.
+static inline uint32_t stash_home(uint32_t key)
+{
+    return (uint32_t)(((uint64_t)(key * 0x9E3779B9u) * kCuckooStashSize) >> 32);
+}
+
+template <typename T>
+static void atomic_increment(T* counter)
+{
+    sycl::atomic_ref<T, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(counter[0]).fetch_add(1);
+}
+
+template <typename T>
+static void atomic_decrement(T* counter)
+{
+    sycl::atomic_ref<T, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(counter[0]).fetch_sub(1);
+}
+
+static inline uint64_t atomic_exchange(uint64_t* word, uint64_t desired)
+{
+    return sycl::atomic_ref<uint64_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(word[0]).exchange(desired);
+}
+
+// Both candidate buckets come from one 64 bit Murmur3 mix of the key. The
+// second bucket is forced to differ from the first so every key has two
+// choices.
+static inline void cuckoo_buckets(uint32_t key, uint32_t num_buckets, uint32_t* b1, uint32_t* b2)
+{
+    uint64_t k = key;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+
+    *b1 = (uint32_t)k & (num_buckets - 1);
+    *b2 = (uint32_t)(k >> 32) & (num_buckets - 1);
+    if (*b2 == *b1) {
+        *b2 = *b1 ^ 1;
+    }
+}
+
+// A bucket is read with one aligned load of all its slots and compared in
+// registers, which the compiler turns into wide vector loads
+template <uint32_t BucketSize>
+struct alignas(sizeof(uint64_t) * BucketSize) Bucket
+{
+    uint64_t words[BucketSize];
+};
+
+// Bit i of key_mask is set if slot i of the bucket holds key, bit i of
+// empty_mask if slot i is empty
+template <uint32_t BucketSize>
+inline void match_bucket(const uint64_t* slots, uint32_t bucket, uint32_t key, uint32_t* key_mask, uint32_t* empty_mask)
+{
+    Bucket<BucketSize> b = *reinterpret_cast<const Bucket<BucketSize>*>(slots + (size_t)bucket * BucketSize);
+
+    uint32_t keys = 0, empties = 0;
+#pragma unroll
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        keys    |= (uint32_t)((uint32_t)b.words[i] == key) << i;
+        empties |= (uint32_t)(b.words[i] == kEmptyWord) << i;
+    }
+    *key_mask   = keys;
+    *empty_mask = empties;
+}
+
+// Find the slot or stash entry holding key; nullptr if the key is not present.
+// probes is set to the number of buckets read, 3 if the stash was probed.
+template <uint32_t BucketSize>
+inline uint64_t* cuckoo_locate(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t num_stashed,
+    uint32_t key,
+    uint32_t* probes)
+{
+    uint32_t buckets[2];
+    cuckoo_buckets(key, num_buckets, &buckets[0], &buckets[1]);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        uint32_t key_mask, empty_mask;
+        match_bucket<BucketSize>(slots, buckets[i], key, &key_mask, &empty_mask);
+        if (key_mask != 0) {
+            *probes = i + 1;
+            return slots + (size_t)buckets[i] * BucketSize + sycl::ctz(key_mask);
+        }
+    }
+
+    *probes = 2;
+    if (num_stashed != 0) {
+        *probes = 3;
+        uint32_t home = stash_home(key);
+        for (uint32_t i = 0; i < kCuckooStashSize; i++) {
+            uint64_t* word = stash + ((home + i) & (kCuckooStashSize - 1));
+            if ((uint32_t)*word == key) {
+                return word;
+            }
+            if (*word == kEmptyWord) {
+                break;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// Store item (value << 32 | key) in the first empty slot of bucket, or replace
+// the value if the bucket already holds its key. Returns false if the bucket is
+// full.
+template <uint32_t BucketSize>
+inline bool claim_in_bucket(uint64_t* slots, uint32_t bucket, uint64_t item, uint32_t* num_used)
+{
+    uint32_t  key   = (uint32_t)item;
+    uint64_t* words = slots + (size_t)bucket * BucketSize;
+
+    while (true) {
+        uint32_t key_mask, empty_mask;
+        match_bucket<BucketSize>(slots, bucket, key, &key_mask, &empty_mask);
+
+        if (key_mask != 0) {
+            uint64_t* word = words + sycl::ctz(key_mask);
+            uint64_t  prev = *word;
+            while ((uint32_t)prev == key) {
+                uint64_t seen = acas::atomic_compare_exchange_strong(word, prev, item);
+                if (seen == prev) {
+                    return true;
+                }
+                prev = seen;
+            }
+            // The key was evicted meanwhile, look again
+            continue;
+        }
+
+        if (empty_mask == 0) {
+            return false;
+        }
+        uint64_t* word = words + sycl::ctz(empty_mask);
+        if (acas::atomic_compare_exchange_strong(word, kEmptyWord, item) == kEmptyWord) {
+            atomic_increment(num_used);
+            return true;
+        }
+        // Another work-item took the slot, look again
+    }
+}
+
+// Place item in one of its buckets. If both are full, a random slot of one of
+// them is displaced and its key carried on to its other bucket, for up to
+// kCuckooMaxEvictions steps; the key in hand after that goes to the stash.
+// Past the end of the stash it is lost, which the host reports.
+template <uint32_t BucketSize>
+inline void cuckoo_place(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions,
+    uint64_t item)
+{
+    uint32_t b1, b2;
+    cuckoo_buckets((uint32_t)item, num_buckets, &b1, &b2);
+    if (claim_in_bucket<BucketSize>(slots, b1, item, num_used) ||
+        claim_in_bucket<BucketSize>(slots, b2, item, num_used)) {
+        return;
+    }
+
+    // xorshift32; the key seeds it so concurrent chains take different paths
+    uint32_t rng    = (uint32_t)item * 0x9E3779B9u | 1;
+    uint32_t bucket = (rng >> 31) ? b1 : b2;
+
+    for (uint32_t i = 0; i < kCuckooMaxEvictions; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+
+        uint64_t victim = atomic_exchange(slots + (size_t)bucket * BucketSize + (rng & (BucketSize - 1)), item);
+        atomic_increment(num_evictions);
+        if (victim == kEmptyWord) {
+            atomic_increment(num_used);
+            return;
+        }
+
+        // The displaced key is counted already; claiming a slot for it
+        // counts the key that took its place
+        item = victim;
+        uint32_t v1, v2;
+        cuckoo_buckets((uint32_t)item, num_buckets, &v1, &v2);
+        bucket = (bucket == v1) ? v2 : v1;
+        if (claim_in_bucket<BucketSize>(slots, bucket, item, num_used)) {
+            return;
+        }
+    }
+
+    uint32_t index = sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(num_stashed[0]).fetch_add(1);
+    if (index < kCuckooStashSize) {
+        // At most kCuckooStashSize entries are ever claimed, so an empty one is left
+        uint32_t home = stash_home((uint32_t)item);
+        for (uint32_t i = 0; i < kCuckooStashSize; i++) {
+            if (acas::atomic_compare_exchange_strong(stash + ((home + i) & (kCuckooStashSize - 1)), kEmptyWord, item) == kEmptyWord) {
+                break;
+            }
+        }
+        atomic_increment(num_used);
+    }
+}
+
+// Allocate the buckets and the stash of a table, all empty
+template <uint32_t BucketSize>
+static void create_cuckoo_slots(CuckooHashTable<BucketSize>& ht, uint32_t num_buckets, sycl::queue& qht)
+{
+    ht.numBuckets = num_buckets;
+    ht.capacity   = num_buckets * BucketSize;
+    ht.pSlots     = sycl::aligned_alloc_device<uint64_t>(sizeof(Bucket<BucketSize>), ht.capacity, qht);
+    ht.pStash     = sycl::malloc_device<uint64_t>(kCuckooStashSize, qht);
+
+    qht.memset(ht.pSlots, 0xFF, sizeof(uint64_t) * ht.capacity);
+    qht.memset(ht.pStash, 0xFF, sizeof(uint64_t) * kCuckooStashSize);
+}
+
+template <uint32_t BucketSize>
+CuckooHashTable<BucketSize> create_cuckoo_hashtable(uint32_t capacity, float maxLoadFactor, sycl::queue& qht)
+{
+    CuckooHashTable<BucketSize> hashtable = {};
+
+    try {
+        hashtable.maxLoadFactor = maxLoadFactor;
+
+        // Every key needs two distinct buckets
+        create_cuckoo_slots(hashtable, std::max(2u, round_up_pow2(capacity) / BucketSize), qht);
+        hashtable.pNumUsed      = sycl::malloc_device<uint32_t>(1, qht);
+        hashtable.pNumStashed   = sycl::malloc_device<uint32_t>(1, qht);
+        hashtable.pNumEvictions = sycl::malloc_device<uint32_t>(1, qht);
+        qht.memset(hashtable.pNumUsed, 0, sizeof(uint32_t));
+        qht.memset(hashtable.pNumStashed, 0, sizeof(uint32_t));
+        qht.memset(hashtable.pNumEvictions, 0, sizeof(uint32_t));
+        qht.wait();
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return hashtable;
+}
+
+// Read the key and stash counters, and fail if the stash overflowed
+template <uint32_t BucketSize>
+static void read_counters(CuckooHashTable<BucketSize>& ht, uint32_t* num_used, uint32_t* num_stashed, sycl::queue& qht)
+{
+    qht.memcpy(num_used, ht.pNumUsed, sizeof(uint32_t), ht.lastKernel);
+    qht.memcpy(num_stashed, ht.pNumStashed, sizeof(uint32_t), ht.lastKernel);
+    qht.wait();
+
+    if (*num_stashed > kCuckooStashSize) {
+        LOG_ERROR("Cuckoo stash overflowed, " << (*num_stashed - kCuckooStashSize) << " keys were lost");
+    }
+}
+
+// Reinsert the old slots, then the live old stash entries, into the new table
+template <uint32_t BucketSize>
+void gpu_cuckoo_rebuild(
+    const uint64_t* old_slots,
+    uint32_t old_capacity,
+    const uint64_t* old_stash,
+    uint32_t old_stash_words,
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < old_capacity + old_stash_words) {
+        uint64_t word = tid < old_capacity ? old_slots[tid] : old_stash[tid - old_capacity];
+        if (word != kEmptyWord && word != kStashTombstoneWord) {
+            cuckoo_place<BucketSize>(slots, num_buckets, stash, num_used, num_stashed, num_evictions, word);
+        }
+    }
+}
+
+// Move all keys into a new table of num_buckets buckets. Unlike linear
+// probing the rebuild is not incremental: a key may be in either of its
+// buckets, so lookups could not tell which array is authoritative.
+template <uint32_t BucketSize>
+static void rebuild_cuckoo(CuckooHashTable<BucketSize>& ht, uint32_t num_buckets, sycl::queue& qht)
+{
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed, qht);
+
+    uint64_t* old_slots       = ht.pSlots;
+    uint64_t* old_stash       = ht.pStash;
+    uint32_t  old_capacity    = ht.capacity;
+    uint32_t  old_stash_words = num_stashed != 0 ? kCuckooStashSize : 0;  // the stash is hashed
+
+    create_cuckoo_slots(ht, num_buckets, qht);
+    qht.memset(ht.pNumUsed, 0, sizeof(uint32_t));
+    qht.memset(ht.pNumStashed, 0, sizeof(uint32_t));
+    qht.wait();
+
+    int threadblocksize = 256;
+
+    uint64_t* slots         = ht.pSlots;
+    uint64_t* stash         = ht.pStash;
+    uint32_t* pnum_used     = ht.pNumUsed;
+    uint32_t* pnum_stashed  = ht.pNumStashed;
+    uint32_t* num_evictions = ht.pNumEvictions;
+
+    ht.lastKernel = qht.parallel_for(
+        sycl::nd_range<1>(round_up_global_size((size_t)old_capacity + old_stash_words, threadblocksize), threadblocksize),
+        [=](sycl::nd_item<1> item) {
+
+            gpu_cuckoo_rebuild<BucketSize>(
+                old_slots,
+                old_capacity,
+                old_stash,
+                old_stash_words,
+                slots,
+                num_buckets,
+                stash,
+                pnum_used,
+                pnum_stashed,
+                num_evictions,
+                item);
+        }
+    );
+    ht.lastKernel.wait();
+
+    sycl::free(old_stash, qht);
+    sycl::free(old_slots, qht);
+
+    read_counters(ht, &num_used, &num_stashed, qht);
+    ht.numUsedBound = num_used;
+    ht.numResizes++;
+}
+
+// Grow the table if inserting num_kvs more keys could exceed the max load
+// factor, or if more than half of the stash is in use
+template <uint32_t BucketSize>
+static void reserve_hashtable(CuckooHashTable<BucketSize>& ht, uint32_t num_kvs, sycl::queue& qht)
+{
+    auto fits = [&](uint64_t num_keys, uint64_t capacity) {
+        return num_keys <= (uint64_t)((double)capacity * ht.maxLoadFactor);
+    };
+
+    // Below kCuckooQuietLoad the eviction chains stay far shorter than
+    // kCuckooMaxEvictions and nothing is stashed. Above it the stash counter
+    // is read before every batch, so stash pressure starts a rebuild in time.
+    uint64_t num_keys = (uint64_t)ht.numUsedBound + num_kvs;
+    if (fits(num_keys, ht.capacity) && num_keys <= (uint64_t)((double)ht.capacity * kCuckooQuietLoad)) {
+        return;
+    }
+
+    // The bound counts overwrites and deleted keys; only now pay for an exact count
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed, qht);
+    ht.numUsedBound = num_used;
+
+    uint32_t num_buckets = ht.numBuckets;
+    while (!fits((uint64_t)num_used + num_kvs, (uint64_t)num_buckets * BucketSize) ||
+           (num_buckets == ht.numBuckets && num_stashed > kCuckooStashSize / 2)) {
+        if ((uint64_t)num_buckets * BucketSize >= 0x80000000u) {
+            LOG_ERROR("Hash table cannot grow beyond " << (uint64_t)num_buckets * BucketSize << " slots");
+        }
+        num_buckets <<= 1;
+    }
+
+    if (num_buckets != ht.numBuckets) {
+        rebuild_cuckoo(ht, num_buckets, qht);
+    }
+}
+
+template <uint32_t BucketSize>
+void sync_hashtable(CuckooHashTable<BucketSize>& ht, sycl::queue& qht)
+{
+    ht.lastKernel.wait();
+
+    uint32_t num_used, num_stashed;
+    read_counters(ht, &num_used, &num_stashed, qht);
+}
+
+template <uint32_t BucketSize>
+void complete_resize_hashtable(CuckooHashTable<BucketSize>& ht, sycl::queue& qht)
+{
+    // Rebuilds finish before the insert that started them returns
+}
+
+template <uint32_t BucketSize>
+void compact_hashtable(CuckooHashTable<BucketSize>& ht, sycl::queue& qht)
+{
+    // Deletes empty their slot, there are no tombstones to drop
+}
+
+// First insert pass: keys already in the table get the new value in place and
+// are marked done by setting their key in kvs to kEmpty
+template <uint32_t BucketSize>
+void gpu_cuckoo_update(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    KeyValue* kvs,
+    unsigned int numkvs,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs) {
+        uint32_t key = kvs[tid].key;
+        uint32_t probes;
+
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, key, &probes);
+        if (word == nullptr) {
+            return;
+        }
+
+        // Another work-item of the batch may update the same key; either value wins
+        uint64_t desired = ((uint64_t)kvs[tid].value << 32) | key;
+        uint64_t prev    = *word;
+        while ((uint32_t)prev == key) {
+            uint64_t seen = acas::atomic_compare_exchange_strong(word, prev, desired);
+            if (seen == prev) {
+                break;
+            }
+            prev = seen;
+        }
+        kvs[tid].key = kEmpty;
+    }
+}
+
+// Second insert pass: place the keys that were not in the table
+template <uint32_t BucketSize>
+void gpu_cuckoo_insert(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    uint32_t* num_stashed,
+    uint32_t* num_evictions,
+    const KeyValue* kvs,
+    unsigned int numkvs,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs && kvs[tid].key != kEmpty) {
+        cuckoo_place<BucketSize>(slots, num_buckets, stash, num_used, num_stashed, num_evictions,
+                                 ((uint64_t)kvs[tid].value << 32) | kvs[tid].key);
+    }
+}
+
+// Third insert pass. A key that occurs twice in a batch is merged when both
+// copies meet in the same bucket, but while an eviction carries one copy the
+// other can be placed elsewhere. After a batch with evictions every copy of a
+// new key but the first (bucket 1, bucket 2, stash order) is removed.
+template <uint32_t BucketSize>
+void gpu_cuckoo_dedupe(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    const uint32_t* num_stashed,
+    const uint32_t* num_evictions,
+    const KeyValue* kvs,
+    unsigned int numkvs,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid >= numkvs || *num_evictions == 0 || kvs[tid].key == kEmpty) {
+        return;
+    }
+
+    uint32_t key = kvs[tid].key;
+    uint32_t b1, b2;
+    cuckoo_buckets(key, num_buckets, &b1, &b2);
+
+    bool kept = false;
+    auto visit = [&](uint64_t* word, uint64_t freed) {
+        uint64_t prev = *word;
+        while ((uint32_t)prev == key) {
+            if (!kept) {
+                kept = true;
+                return;
+            }
+            uint64_t seen = acas::atomic_compare_exchange_strong(word, prev, freed);
+            if (seen == prev) {
+                atomic_decrement(num_used);
+                return;
+            }
+            prev = seen;
+        }
+    };
+
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        visit(slots + (size_t)b1 * BucketSize + i, kEmptyWord);
+    }
+    for (uint32_t i = 0; i < BucketSize; i++) {
+        visit(slots + (size_t)b2 * BucketSize + i, kEmptyWord);
+    }
+    if (*num_stashed != 0) {
+        uint32_t home = stash_home(key);
+        for (uint32_t i = 0; i < kCuckooStashSize && stash[(home + i) & (kCuckooStashSize - 1)] != kEmptyWord; i++) {
+            visit(stash + ((home + i) & (kCuckooStashSize - 1)), kStashTombstoneWord);
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+void insert_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs,
+    sycl::queue& qht)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        reserve_hashtable(ht, num_kvs, qht);
+
+        // Copy this batch of key-value pairs to the device
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, kvs, num_kvs, qht);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 256;
+
+        uint64_t* slots         = ht.pSlots;
+        uint32_t  num_buckets   = ht.numBuckets;
+        uint64_t* stash         = ht.pStash;
+        uint32_t* num_used      = ht.pNumUsed;
+        uint32_t* num_stashed   = ht.pNumStashed;
+        uint32_t* num_evictions = ht.pNumEvictions;
+
+        sycl::nd_range<1> range(round_up_global_size(num_kvs, threadblocksize), threadblocksize);
+
+        auto e1 = qht.memset(num_evictions, 0, sizeof(uint32_t), ht.lastKernel);
+        auto e2 = qht.parallel_for(range, std::vector<sycl::event>{sb.upload, e1},
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_update<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_stashed,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    item);
+            }
+        );
+        auto e3 = qht.parallel_for(range, e2,
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_insert<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_used,
+                    num_stashed,
+                    num_evictions,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    item);
+            }
+        );
+        sb.kernel = qht.parallel_for(range, e3,
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_dedupe<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_used,
+                    num_stashed,
+                    num_evictions,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    item);
+            }
+        );
+        ht.lastKernel = sb.kernel;
+
+        ht.numUsedBound += num_kvs;
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Lookup keys in the hashtable, and return the values
+template <uint32_t BucketSize>
+void gpu_cuckoo_lookup(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    KeyValue* kvs,
+    unsigned int numkvs,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs) {
+        uint32_t probes;
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, kvs[tid].key, &probes);
+        kvs[tid].value = word != nullptr ? (uint32_t)(*word >> 32) : kEmpty;
+    }
+}
+
+template <uint32_t BucketSize>
+void lookup_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    KeyValue* kvs,
+    uint32_t num_kvs,
+    sycl::queue& qht)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        // Copy this batch of key-value pairs to the device
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, (const KeyValue*)kvs, num_kvs, qht);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 256;
+
+        uint64_t* slots       = ht.pSlots;
+        uint32_t  num_buckets = ht.numBuckets;
+        uint64_t* stash       = ht.pStash;
+        uint32_t* num_stashed = ht.pNumStashed;
+
+        sb.kernel = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{sb.upload, ht.lastKernel},
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_lookup<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_stashed,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    item);
+            }
+        );
+        ht.lastKernel = sb.kernel;
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Delete each key in kvs from the hash table, if the key exists. The slot
+// becomes empty again: no key is ever probed past it.
+template <uint32_t BucketSize>
+void gpu_cuckoo_delete(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    uint32_t* num_used,
+    const uint32_t* num_stashed,
+    const KeyValue* kvs,
+    unsigned int numkvs,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs) {
+        uint32_t key = kvs[tid].key;
+        uint32_t probes;
+
+        uint64_t* word = cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, key, &probes);
+        if (word == nullptr) {
+            return;
+        }
+
+        // A stash entry becomes a tombstone so the probe sequences through it stay intact
+        uint64_t freed = (word >= stash && word < stash + kCuckooStashSize) ? kStashTombstoneWord : kEmptyWord;
+
+        // Loses only if another work-item deleted the same key first
+        uint64_t prev = *word;
+        while ((uint32_t)prev == key) {
+            uint64_t seen = acas::atomic_compare_exchange_strong(word, prev, freed);
+            if (seen == prev) {
+                atomic_decrement(num_used);
+                return;
+            }
+            prev = seen;
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+void delete_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs,
+    sycl::queue& qht)
+{
+    if (num_kvs == 0) {
+        return;
+    }
+
+    try {
+        // Copy the keyvalues to the GPU
+        StagingBuffer<KeyValue>& sb = stage_batch(ht, kvs, num_kvs, qht);
+        KeyValue* device_kvs = sb.pDevice;
+
+        int threadblocksize = 256;
+
+        uint64_t* slots       = ht.pSlots;
+        uint32_t  num_buckets = ht.numBuckets;
+        uint64_t* stash       = ht.pStash;
+        uint32_t* num_used    = ht.pNumUsed;
+        uint32_t* num_stashed = ht.pNumStashed;
+
+        sb.kernel = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{sb.upload, ht.lastKernel},
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_delete<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_used,
+                    num_stashed,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    item);
+            }
+        );
+        ht.lastKernel = sb.kernel;
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Iterate over every slot and stash entry; return non-empty key/values
+void gpu_cuckoo_iterate(
+    const uint64_t* slots,
+    uint32_t capacity,
+    const uint64_t* stash,
+    uint32_t stash_words,
+    KeyValue* kvs,
+    uint32_t* kvs_size,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < capacity + stash_words) {
+        uint64_t word = tid < capacity ? slots[tid] : stash[tid - capacity];
+        if (word != kEmptyWord && word != kStashTombstoneWord) {
+            uint32_t size = sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(kvs_size[0]).fetch_add(1);
+            kvs[size].key   = (uint32_t)word;
+            kvs[size].value = (uint32_t)(word >> 32);
+        }
+    }
+}
+
+template <uint32_t BucketSize>
+std::vector<KeyValue> iterate_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    sycl::queue& qht)
+{
+    std::vector<KeyValue> kvs;
+
+    try {
+        uint32_t num_used, num_stashed;
+        read_counters(ht, &num_used, &num_stashed, qht);
+        ht.numUsedBound = num_used;
+        uint32_t stash_words = num_stashed != 0 ? kCuckooStashSize : 0;
+
+        uint32_t* device_num_kvs;
+        KeyValue* device_kvs;
+        device_num_kvs = sycl::malloc_device<uint32_t>(1, qht);
+        device_kvs = sycl::malloc_device<KeyValue>(std::max(num_used, 1u), qht);
+
+        auto e1 = qht.memset(device_num_kvs, 0, sizeof(uint32_t));
+
+        int threadblocksize = 256;
+
+        uint64_t* slots    = ht.pSlots;
+        uint32_t  capacity = ht.capacity;
+        uint64_t* stash    = ht.pStash;
+
+        auto e2 = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size((size_t)capacity + stash_words, threadblocksize), threadblocksize), std::move(e1),
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_iterate(
+                    slots,
+                    capacity,
+                    stash,
+                    stash_words,
+                    device_kvs,
+                    device_num_kvs,
+                    item);
+            }
+        );
+
+        uint32_t num_kvs;
+        qht.memcpy(&num_kvs, device_num_kvs, sizeof(uint32_t), std::move(e2));
+        qht.wait();
+
+        kvs.resize(num_kvs);
+
+        qht.memcpy(kvs.data(), device_kvs, sizeof(KeyValue) * num_kvs);
+        qht.wait();
+
+        sycl::free(device_kvs, qht);
+        sycl::free(device_num_kvs, qht);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return kvs;
+}
+
+// Count the buckets read to look up each key, the same way cuckoo_locate does
+template <uint32_t BucketSize>
+void gpu_cuckoo_probe_histogram(
+    uint64_t* slots,
+    uint32_t num_buckets,
+    uint64_t* stash,
+    const uint32_t* num_stashed,
+    const KeyValue* kvs,
+    unsigned int numkvs,
+    uint32_t* histogram,
+    sycl::nd_item<1> item)
+{
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs) {
+        uint32_t probes;
+        cuckoo_locate<BucketSize>(slots, num_buckets, stash, *num_stashed, kvs[tid].key, &probes);
+        atomic_increment(&histogram[probes]);
+    }
+}
+
+template <uint32_t BucketSize>
+std::vector<uint32_t> probe_histogram_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    const KeyValue* kvs,
+    uint32_t num_kvs,
+    sycl::queue& qht)
+{
+    std::vector<uint32_t> histogram(kProbeHistogramBins, 0);
+
+    try {
+        sync_hashtable(ht, qht);
+
+        KeyValue* device_kvs;
+        uint32_t* device_histogram;
+        device_kvs       = sycl::malloc_device<KeyValue>(std::max(num_kvs, 1u), qht);
+        device_histogram = sycl::malloc_device<uint32_t>(kProbeHistogramBins, qht);
+        auto e1 = qht.memcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs);
+        auto e2 = qht.memset(device_histogram, 0, sizeof(uint32_t) * kProbeHistogramBins);
+
+        int threadblocksize = 256;
+
+        uint64_t* slots       = ht.pSlots;
+        uint32_t  num_buckets = ht.numBuckets;
+        uint64_t* stash       = ht.pStash;
+        uint32_t* num_stashed = ht.pNumStashed;
+
+        auto e3 = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{e1, e2},
+            [=](sycl::nd_item<1> item) {
+
+                gpu_cuckoo_probe_histogram<BucketSize>(
+                    slots,
+                    num_buckets,
+                    stash,
+                    num_stashed,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    device_histogram,
+                    item);
+            }
+        );
+
+        qht.memcpy(histogram.data(), device_histogram, sizeof(uint32_t) * kProbeHistogramBins, std::move(e3));
+        qht.wait();
+
+        sycl::free(device_histogram, qht);
+        sycl::free(device_kvs, qht);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return histogram;
+}
+
+// Free the memory of the hashtable
+template <uint32_t BucketSize>
+void destroy_hashtable(
+    CuckooHashTable<BucketSize>& ht,
+    sycl::queue& qht)
+{
+    qht.wait();
+
+    free_staging(ht, qht);
+    sycl::free(ht.pNumEvictions, qht);
+    sycl::free(ht.pNumStashed, qht);
+    sycl::free(ht.pNumUsed, qht);
+    sycl::free(ht.pStash, qht);
+    sycl::free(ht.pSlots, qht);
+    ht = {};
+}
+
+#define INSTANTIATE_CUCKOO(B)                                                                                                   \
+    template CuckooHashTable<B> create_cuckoo_hashtable<B>(uint32_t, float, sycl::queue&);                                     \
+    template void insert_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t, sycl::queue&);                            \
+    template void lookup_hashtable<B>(CuckooHashTable<B>&, KeyValue*, uint32_t, sycl::queue&);                                  \
+    template void delete_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t, sycl::queue&);                            \
+    template void sync_hashtable<B>(CuckooHashTable<B>&, sycl::queue&);                                                         \
+    template void complete_resize_hashtable<B>(CuckooHashTable<B>&, sycl::queue&);                                              \
+    template void compact_hashtable<B>(CuckooHashTable<B>&, sycl::queue&);                                                      \
+    template std::vector<uint32_t> probe_histogram_hashtable<B>(CuckooHashTable<B>&, const KeyValue*, uint32_t, sycl::queue&);  \
+    template std::vector<KeyValue> iterate_hashtable<B>(CuckooHashTable<B>&, sycl::queue&);                                     \
+    template void destroy_hashtable<B>(CuckooHashTable<B>&, sycl::queue&);
+
+INSTANTIATE_CUCKOO(8)
+INSTANTIATE_CUCKOO(16)
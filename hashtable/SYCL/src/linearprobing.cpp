@@ -17,31 +17,200 @@
 
 #include <sycl/sycl.hpp>
 #include <chrono>
+#include <algorithm>
+#include <cstring>
 #include "acas.h"
+#include "tablecommon.h"
 
 // 32 bit Murmur3 hash
-uint32_t hash(uint32_t k)
+uint32_t hash(uint32_t k, uint32_t capacity)
 {
     k ^= k >> 16;
     k *= 0x85ebca6b;
     k ^= k >> 13;
     k *= 0xc2b2ae35;
     k ^= k >> 16;
-    return k & (kHashTableCapacity - 1);
+    return k & (capacity - 1);
 }
 
-// Create a hash table. For linear probing, this is just an array of KeyValues
-KeyValue* create_hashtable(sycl::queue& qht)
+// 64 bit Murmur3 finalizer
+uint32_t hash(uint64_t k, uint32_t capacity)
 {
-    KeyValue* hashtable;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return (uint32_t)k & (capacity - 1);
+}
+
+template <typename T>
+static void atomic_increment(T* counter)
+{
+    sycl::atomic_ref<T, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(counter[0]).fetch_add(1);
+}
+
+// Slot access for PackedSlots. Empty slots are all ones, which is kEmpty for
+// both the key and the value; a tombstone keeps the value of its key.
+static const uint64_t kEmptyWord = 0xFFFFFFFFFFFFFFFFull;
+
+static inline uint64_t pack_slot(uint32_t key, uint32_t value)
+{
+    return ((uint64_t)value << 32) | key;
+}
+
+inline uint32_t slot_key(const PackedSlots& s, uint32_t slot)
+{
+    return (uint32_t)s.pWords[slot];
+}
+
+inline uint32_t slot_value(const PackedSlots& s, uint32_t slot)
+{
+    return (uint32_t)(s.pWords[slot] >> 32);
+}
+
+// Store key and value in slot if it is empty. If the slot already holds key
+// and overwrite is set, replace the value. Returns the key the slot held.
+inline uint32_t claim_slot(const PackedSlots& s, uint32_t slot, uint32_t key, uint32_t value, bool overwrite)
+{
+    uint64_t desired = pack_slot(key, value);
+    uint64_t prev = acas::atomic_compare_exchange_strong(&s.pWords[slot], kEmptyWord, desired);
+    if (prev == kEmptyWord) {
+        return kEmpty;
+    }
+    // Another work-item of the batch may update the same key; either value wins
+    while (overwrite && (uint32_t)prev == key) {
+        uint64_t seen = acas::atomic_compare_exchange_strong(&s.pWords[slot], prev, desired);
+        if (seen == prev) {
+            break;
+        }
+        prev = seen;
+    }
+    return (uint32_t)prev;
+}
+
+// Replace key by a tombstone; returns true if this call removed it
+inline bool erase_slot(const PackedSlots& s, uint32_t slot, uint32_t key)
+{
+    uint64_t current = s.pWords[slot];
+    while ((uint32_t)current == key) {
+        uint64_t seen = acas::atomic_compare_exchange_strong(&s.pWords[slot], current, pack_slot(kTombstone, (uint32_t)(current >> 32)));
+        if (seen == current) {
+            return true;
+        }
+        current = seen;
+    }
+    return false;
+}
+
+// Slot access for SplitSlots: the key array is claimed with a CAS, the value
+// is stored in its own array afterwards
+template <typename K, typename V>
+inline K slot_key(const SplitSlots<K, V>& s, uint32_t slot)
+{
+    return s.pKeys[slot];
+}
+
+template <typename K, typename V>
+inline V slot_value(const SplitSlots<K, V>& s, uint32_t slot)
+{
+    return s.pValues[slot];
+}
+
+// Claim slot as key | kBusyKeyBit, store the value and only then publish the
+// key. A slot busy with the same key is being written by another work-item of
+// the batch, whose value wins.
+template <typename K, typename V>
+inline K claim_busy_slot(const SplitSlots<K, V>& s, uint32_t slot, K key, const V& value, bool overwrite)
+{
+    const K busy_key = key | (K)kBusyKeyBit;
+    K prev = acas::atomic_compare_exchange_strong(&s.pKeys[slot], empty_key<K>(), busy_key);
+    if (prev == empty_key<K>() ||
+        (overwrite && prev == key && acas::atomic_compare_exchange_strong(&s.pKeys[slot], key, busy_key) == key)) {
+        s.pValues[slot] = value;
+        sycl::atomic_fence(sycl::memory_order::release, sycl::memory_scope::device);
+        acas::atomic_compare_exchange_strong(&s.pKeys[slot], busy_key, key);
+    }
+    // Report a busy slot as its key; empty and tombstone keys have the bit set too
+    if (prev == empty_key<K>() || prev == tombstone_key<K>()) {
+        return prev;
+    }
+    return prev & ~(K)kBusyKeyBit;
+}
+
+template <typename K, typename V>
+inline K claim_slot(const SplitSlots<K, V>& s, uint32_t slot, K key, const V& value, bool overwrite)
+{
+    if (value_needs_busy_bit<V>()) {
+        return claim_busy_slot(s, slot, key, value, overwrite);
+    }
+    K prev = acas::atomic_compare_exchange_strong(&s.pKeys[slot], empty_key<K>(), key);
+    if (prev == empty_key<K>() || (overwrite && prev == key)) {
+        s.pValues[slot] = value;
+    }
+    return prev;
+}
+
+template <typename K, typename V>
+inline bool erase_slot(const SplitSlots<K, V>& s, uint32_t slot, K key)
+{
+    // Loses only if another work-item deleted the same key first
+    return s.pKeys[slot] == key &&
+           acas::atomic_compare_exchange_strong(&s.pKeys[slot], key, tombstone_key<K>()) == key;
+}
+
+// Allocate an array of capacity empty slots
+static void create_slots(PackedSlots& s, uint32_t capacity, sycl::queue& qht)
+{
+    s.pWords = sycl::malloc_device<uint64_t>(capacity, qht);
+
+    // Initialize hash table to empty
+    static_assert(kEmpty == 0xFFFFFFFF, "memset expected kEmpty=0xFFFFFFFF");
+    qht.memset(s.pWords, 0xFF, sizeof(uint64_t) * capacity);
+}
+
+template <typename K, typename V>
+static void create_slots(SplitSlots<K, V>& s, uint32_t capacity, sycl::queue& qht)
+{
+    s.pKeys   = sycl::malloc_device<K>(capacity, qht);
+    s.pValues = sycl::malloc_device<V>(capacity, qht);
+
+    // Only the keys mark a slot as empty
+    static_assert(empty_key<K>() == (K)~(K)0, "memset expected an all ones empty key");
+    qht.memset(s.pKeys, 0xFF, sizeof(K) * capacity);
+}
+
+static void free_slots(PackedSlots& s, sycl::queue& qht)
+{
+    sycl::free(s.pWords, qht);
+    s = {};
+}
+
+template <typename K, typename V>
+static void free_slots(SplitSlots<K, V>& s, sycl::queue& qht)
+{
+    sycl::free(s.pKeys, qht);
+    sycl::free(s.pValues, qht);
+    s = {};
+}
+
+// Create a hash table. For linear probing, this is just an array of slots
+template <typename Layout>
+HashTable<Layout> create_hashtable(uint32_t capacity, float maxLoadFactor, float tombstoneThreshold, sycl::queue& qht)
+{
+    HashTable<Layout> hashtable = {};
 
     try {
-        // Allocate memory
-        hashtable = sycl::malloc_device<KeyValue>(kHashTableCapacity, qht);
+        hashtable.capacity           = round_up_pow2(capacity);
+        hashtable.maxLoadFactor      = maxLoadFactor;
+        hashtable.tombstoneThreshold = tombstoneThreshold;
 
-        // Initialize hash table to empty
-        static_assert(kEmpty == 0xFFFFFFFF, "memset expected kEmpty=0xFFFFFFFF");
-        qht.memset(hashtable, 0xFF, sizeof(KeyValue) * kHashTableCapacity);
+        // Allocate memory
+        create_slots(hashtable.slots, hashtable.capacity, qht);
+        hashtable.pNumUsed       = sycl::malloc_device<uint32_t>(1, qht);
+        hashtable.pNumTombstones = sycl::malloc_device<uint32_t>(1, qht);
+        qht.memset(hashtable.pNumUsed, 0, sizeof(uint32_t));
+        qht.memset(hashtable.pNumTombstones, 0, sizeof(uint32_t));
         qht.wait();
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
@@ -52,60 +221,306 @@ KeyValue* create_hashtable(sycl::queue& qht)
     return hashtable;
 }
 
+// Move old slots [first, first + count) into the new array. Keys that already
+// exist in the new array were inserted after the resize started and are newer,
+// so they are left alone. Tombstones are dropped.
+template <typename Layout>
+void gpu_hashtable_migrate(
+    Layout old_slots,
+    uint32_t first,
+    uint32_t count,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_used,
+    sycl::nd_item<1> item)
+{
+    using Key = typename Layout::Key;
+
+    unsigned int tid = item.get_global_id(0);
+    if (tid < count) {
+        Key key = slot_key(old_slots, first + tid);
+        if (key == empty_key<Key>() || key == tombstone_key<Key>()) {
+            return;
+        }
+        uint32_t slot = hash(key, capacity);
+
+        while (true) {
+            Key prev = claim_slot(hashtable, slot, key, slot_value(old_slots, first + tid), false);
+            if (prev == empty_key<Key>()) {
+                atomic_increment(num_used);
+                return;
+            }
+            if (prev == key) {
+                return;
+            }
+
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+}
+
+// Migrate up to num_slots old slots; frees the old array once it is drained
+template <typename Layout>
+static void migrate_hashtable(HashTable<Layout>& ht, uint64_t num_slots, sycl::queue& qht)
+{
+    if (ht.oldCapacity == 0) {
+        return;
+    }
+
+    uint32_t first = ht.migrateCursor;
+    uint32_t count = (uint32_t)std::min<uint64_t>(num_slots, ht.oldCapacity - first);
+
+    Layout    old_slots = ht.oldSlots;
+    Layout    slots     = ht.slots;
+    uint32_t  capacity  = ht.capacity;
+    uint32_t* num_used  = ht.pNumUsed;
+
+    int threadblocksize = 256;
+
+    ht.lastKernel = qht.parallel_for(
+        sycl::nd_range<1>(round_up_global_size(count, threadblocksize), threadblocksize), ht.lastKernel,
+        [=](sycl::nd_item<1> item) {
+
+            gpu_hashtable_migrate(
+                old_slots,
+                first,
+                count,
+                slots,
+                capacity,
+                num_used,
+                item);
+        }
+    );
+
+    ht.migrateCursor += count;
+    if (ht.migrateCursor == ht.oldCapacity) {
+        // Lookups and deletes submitted so far may still read the old array
+        ht.lastKernel.wait();
+        free_slots(ht.oldSlots, qht);
+        ht.oldCapacity   = 0;
+        ht.migrateCursor = 0;
+    }
+}
+
+// Amount of migration work done alongside an operation on num_kvs keys
+static uint64_t migrate_slots_for(uint32_t num_kvs)
+{
+    return std::max<uint64_t>(kMinMigrateSlots, (uint64_t)num_kvs * kMigrateSlotsPerKey);
+}
+
+// Start moving all live keys into a fresh array of capacity slots. A rebuild
+// to the same capacity is how tombstones get reclaimed.
+template <typename Layout>
+static void begin_rebuild(HashTable<Layout>& ht, uint32_t capacity, sycl::queue& qht)
+{
+    ht.lastKernel.wait();
+
+    ht.oldSlots      = ht.slots;
+    ht.oldCapacity   = ht.capacity;
+    ht.migrateCursor = 0;
+    create_slots(ht.slots, capacity, qht);
+    ht.capacity      = capacity;
+    qht.memset(ht.pNumUsed, 0, sizeof(uint32_t));
+    qht.memset(ht.pNumTombstones, 0, sizeof(uint32_t));
+    qht.wait();
+    ht.numTombstoneBound = 0;
+}
+
+// Read the claimed-slot and tombstone counters of the current array
+template <typename Layout>
+static void read_counters(HashTable<Layout>& ht, uint32_t* num_used, uint32_t* num_tombstones, sycl::queue& qht)
+{
+    qht.memcpy(num_used, ht.pNumUsed, sizeof(uint32_t), ht.lastKernel);
+    qht.memcpy(num_tombstones, ht.pNumTombstones, sizeof(uint32_t), ht.lastKernel);
+    qht.wait();
+}
+
+template <typename Layout>
+void sync_hashtable(HashTable<Layout>& ht, sycl::queue& qht)
+{
+    ht.lastKernel.wait();
+}
+
+template <typename Layout>
+void complete_resize_hashtable(HashTable<Layout>& ht, sycl::queue& qht)
+{
+    try {
+        migrate_hashtable(ht, ht.oldCapacity, qht);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
+// Start a resize if inserting num_kvs more keys could exceed the max load factor.
+// The new array is sized so that it can take the whole batch; the old array is
+// drained incrementally by subsequent operations. If dropping the tombstones is
+// enough to make room, the table is rebuilt at its current capacity instead.
+template <typename Layout>
+static void reserve_hashtable(HashTable<Layout>& ht, uint32_t num_kvs, sycl::queue& qht)
+{
+    auto fits = [&](uint64_t num_keys, uint32_t capacity) {
+        return num_keys <= (uint64_t)((double)capacity * ht.maxLoadFactor);
+    };
+
+    if (fits((uint64_t)ht.numUsedBound + num_kvs, ht.capacity)) {
+        return;
+    }
+
+    // The bound counts overwrites and deleted keys; only now pay for an exact count
+    migrate_hashtable(ht, ht.oldCapacity, qht);
+    uint32_t num_used, num_tombstones;
+    read_counters(ht, &num_used, &num_tombstones, qht);
+    ht.numUsedBound = num_used;
+
+    if (fits((uint64_t)num_used + num_kvs, ht.capacity)) {
+        return;
+    }
+
+    uint64_t num_keys = (uint64_t)(num_used - num_tombstones) + num_kvs;
+    uint32_t capacity = ht.capacity;
+    while (!fits(num_keys, capacity)) {
+        if (capacity == 0x80000000u) {
+            LOG_ERROR("Hash table cannot grow beyond " << capacity << " slots");
+        }
+        capacity <<= 1;
+    }
+
+    if (capacity == ht.capacity) {
+        ht.numCompactions++;
+    } else {
+        ht.numResizes++;
+    }
+    begin_rebuild(ht, capacity, qht);
+    ht.numUsedBound = num_used - num_tombstones;
+}
+
+// Start an incremental compaction once tombstones pass the threshold. While a
+// rebuild is in flight there is nothing to do, it drops tombstones anyway.
+template <typename Layout>
+static void check_tombstones(HashTable<Layout>& ht, sycl::queue& qht)
+{
+    if (ht.tombstoneThreshold <= 0.0f || ht.oldCapacity != 0) {
+        return;
+    }
+
+    // Delete batches stay asynchronous until the bound says the threshold may be crossed
+    uint64_t threshold = (uint64_t)((double)ht.capacity * ht.tombstoneThreshold);
+    if (ht.numTombstoneBound <= threshold) {
+        return;
+    }
+
+    uint32_t num_used, num_tombstones;
+    read_counters(ht, &num_used, &num_tombstones, qht);
+    ht.numTombstoneBound = num_tombstones;
+    if (num_tombstones <= threshold) {
+        return;
+    }
+
+    begin_rebuild(ht, ht.capacity, qht);
+    ht.numUsedBound = num_used - num_tombstones;
+    ht.numCompactions++;
+}
+
+template <typename Layout>
+void compact_hashtable(HashTable<Layout>& ht, sycl::queue& qht)
+{
+    try {
+        migrate_hashtable(ht, ht.oldCapacity, qht);
+
+        uint32_t num_used, num_tombstones;
+        read_counters(ht, &num_used, &num_tombstones, qht);
+        if (num_tombstones == 0) {
+            return;
+        }
+
+        begin_rebuild(ht, ht.capacity, qht);
+        ht.numUsedBound = num_used - num_tombstones;
+        ht.numCompactions++;
+        migrate_hashtable(ht, ht.oldCapacity, qht);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+}
+
 // Insert the key/values in kvs into the hashtable
+template <typename Layout>
 void gpu_hashtable_insert(
-    KeyValue* hashtable,
-    const KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_used,
+    const KeyValueOf<Layout>* kvs,
     unsigned int numkvs,
     sycl::nd_item<1> item)
 {
+    using Key = typename Layout::Key;
+
     unsigned int tid = item.get_global_id(0);
     if (tid < numkvs) {
-        uint32_t key   = kvs[tid].key;
-        uint32_t value = kvs[tid].value;
-        uint32_t slot  = hash(key);
+        Key      key  = kvs[tid].key;
+        uint32_t slot = hash(key, capacity);
 
         while (true) {
-            uint32_t prev = acas::atomic_compare_exchange_strong(&hashtable[slot].key, kEmpty, key);
-            if (prev == kEmpty || prev == key) {
-                hashtable[slot].value = value;
+            Key prev = claim_slot(hashtable, slot, key, kvs[tid].value, true);
+            if (prev == empty_key<Key>()) {
+                atomic_increment(num_used);
+            }
+            if (prev == empty_key<Key>() || prev == key) {
                 return;
             }
 
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+            slot = (slot + 1) & (capacity - 1);
         }
     }
 }
 
+template <typename Layout>
 void insert_hashtable(
-    KeyValue* pHashTable, // hashtable
-    const KeyValue* kvs,  // starting position for this batch of key-value pairs
-    uint32_t num_kvs,     // number of key-value pairs in this batch
+    HashTable<Layout>& ht,          // hashtable
+    const KeyValueOf<Layout>* kvs,  // starting position for this batch of key-value pairs
+    uint32_t num_kvs,               // number of key-value pairs in this batch
     sycl::queue& qht)
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        reserve_hashtable(ht, num_kvs, qht);
+        migrate_hashtable(ht, migrate_slots_for(num_kvs), qht);
+
         // Copy this batch of key-value pairs to the device
-        KeyValue* device_kvs;
-        device_kvs = sycl::malloc_device<KeyValue>(num_kvs, qht);
-        auto e1 = qht.memcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs);
+        StagingBuffer<KV>& sb = stage_batch(ht, kvs, num_kvs, qht);
+        KV* device_kvs = sb.pDevice;
 
         int threadblocksize = 256; // perf does not seem to vary w/ thread block size (for all kernels in hashtable)
 
+        Layout    slots    = ht.slots;
+        uint32_t  capacity = ht.capacity;
+        uint32_t* num_used = ht.pNumUsed;
+
         // Create events for GPU timing
-        qht.parallel_for(
-            sycl::nd_range<1>(num_kvs, threadblocksize), std::move(e1),
+        sb.kernel = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{sb.upload, ht.lastKernel},
             [=](sycl::nd_item<1> item) {
 
                 gpu_hashtable_insert(
-                    pHashTable,
+                    slots,
+                    capacity,
+                    num_used,
                     device_kvs,
                     (uint32_t)num_kvs,
                     item);
             }
         );
-        qht.wait();
+        ht.lastKernel = sb.kernel;
 
-        sycl::free(device_kvs, qht);
+        ht.numUsedBound += num_kvs;
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -113,60 +528,97 @@ void insert_hashtable(
     }
 }
 
+// Probe one slot array for key; returns false if the key is not present
+template <typename Layout>
+bool gpu_hashtable_find(
+    const Layout& hashtable,
+    uint32_t capacity,
+    typename Layout::Key key,
+    typename Layout::Value* value)
+{
+    using Key = typename Layout::Key;
+
+    uint32_t slot = hash(key, capacity);
+
+    while (true) {
+        Key slot_key_ = slot_key(hashtable, slot);
+        if (slot_key_ == key) {
+            *value = slot_value(hashtable, slot);
+            return true;
+        }
+        if (slot_key_ == empty_key<Key>()) {
+            return false;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
 // Lookup keys in the hashtable, and return the values
+// During a resize, keys missing from the new array may still be in the old one
+template <typename Layout>
 void gpu_hashtable_lookup(
-    KeyValue* hashtable,
-    KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    Layout old_hashtable,
+    uint32_t old_capacity,
+    KeyValueOf<Layout>* kvs,
     unsigned int numkvs,
     sycl::nd_item<1> item)
 {
     unsigned int tid = item.get_global_id(0);
     if (tid < numkvs) {
-        uint32_t key  = kvs[tid].key;
-        uint32_t slot = hash(key);
+        auto key   = kvs[tid].key;
+        auto value = empty_value<typename Layout::Value>();
 
-        while (true) {
-            if (hashtable[slot].key == key) {
-                kvs[tid].value = hashtable[slot].value;
-                return;
-            }
-            if (hashtable[slot].key == kEmpty) {
-                kvs[tid].value = kEmpty;
-                return;
-            }
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+        if (!gpu_hashtable_find(hashtable, capacity, key, &value) && old_capacity != 0) {
+            gpu_hashtable_find(old_hashtable, old_capacity, key, &value);
         }
+        kvs[tid].value = value;
     }
 }
 
+template <typename Layout>
 void lookup_hashtable(
-    KeyValue* pHashTable,
-    KeyValue* kvs,
+    HashTable<Layout>& ht,
+    KeyValueOf<Layout>* kvs,
     uint32_t num_kvs,
     sycl::queue& qht)
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        migrate_hashtable(ht, migrate_slots_for(num_kvs), qht);
+
         // Copy this batch of key-value pairs to the device
-        KeyValue* device_kvs;
-        device_kvs = sycl::malloc_device<KeyValue>(num_kvs, qht);
-        auto e1 = qht.memcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs);
+        StagingBuffer<KV>& sb = stage_batch(ht, (const KV*)kvs, num_kvs, qht);
+        KV* device_kvs = sb.pDevice;
 
         int threadblocksize = 256;
 
-        qht.parallel_for(
-            sycl::nd_range<1>(num_kvs, threadblocksize), std::move(e1),
+        Layout   slots        = ht.slots;
+        uint32_t capacity     = ht.capacity;
+        Layout   old_slots    = ht.oldSlots;
+        uint32_t old_capacity = ht.oldCapacity;
+
+        sb.kernel = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{sb.upload, ht.lastKernel},
             [=](sycl::nd_item<1> item) {
 
                 gpu_hashtable_lookup(
-                    pHashTable,
+                    slots,
+                    capacity,
+                    old_slots,
+                    old_capacity,
                     device_kvs,
                     (uint32_t)num_kvs,
                     item);
             }
         );
-        qht.wait();
-
-        sycl::free(device_kvs, qht);
+        ht.lastKernel = sb.kernel;
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -174,61 +626,106 @@ void lookup_hashtable(
     }
 }
 
+// Replace key in one slot array by a tombstone; returns true if this call removed it
+template <typename Layout>
+bool gpu_hashtable_erase(
+    const Layout& hashtable,
+    uint32_t capacity,
+    typename Layout::Key key)
+{
+    using Key = typename Layout::Key;
+
+    uint32_t slot = hash(key, capacity);
+
+    while (true) {
+        Key slot_key_ = slot_key(hashtable, slot);
+        if (slot_key_ == key) {
+            return erase_slot(hashtable, slot, key);
+        }
+        if (slot_key_ == empty_key<Key>()) {
+            return false;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
 // Delete each key in kvs from the hash table, if the key exists
-// A deleted key is left in the hash table, but its value is set to kEmpty
-// Deleted keys are not reused; once a key is assigned a slot, it never moves
+// The slot of a deleted key becomes a tombstone: lookups probe past it and
+// inserts do not reuse it, so once a key is assigned a slot it never moves.
+// Tombstones are reclaimed when the table is compacted or resized.
+// During a resize the key is deleted from both arrays, so the migration does
+// not bring it back
+template <typename Layout>
 void gpu_hashtable_delete(
-    KeyValue* hashtable,
-    const KeyValue* kvs,
+    Layout hashtable,
+    uint32_t capacity,
+    uint32_t* num_tombstones,
+    Layout old_hashtable,
+    uint32_t old_capacity,
+    const KeyValueOf<Layout>* kvs,
     unsigned int numkvs,
     sycl::nd_item<1> item)
 {
     unsigned int tid = item.get_global_id(0);
     if (tid < numkvs) {
-        uint32_t key  = kvs[tid].key;
-        uint32_t slot = hash(key);
+        auto key = kvs[tid].key;
 
-        while (true) {
-            if (hashtable[slot].key == key) {
-                hashtable[slot].value = kEmpty;
-                return;
-            }
-            if (hashtable[slot].key == kEmpty) {
-                return;
-            }
-            slot = (slot + 1) & (kHashTableCapacity - 1);
+        if (gpu_hashtable_erase(hashtable, capacity, key)) {
+            atomic_increment(num_tombstones);
+        }
+        if (old_capacity != 0) {
+            gpu_hashtable_erase(old_hashtable, old_capacity, key);
         }
     }
 }
 
+template <typename Layout>
 void delete_hashtable(
-    KeyValue* pHashTable,
-    const KeyValue* kvs,
+    HashTable<Layout>& ht,
+    const KeyValueOf<Layout>* kvs,
     uint32_t num_kvs,
     sycl::queue& qht)
 {
+    using KV = KeyValueOf<Layout>;
+
+    if (num_kvs == 0) {
+        return;
+    }
+
     try {
+        migrate_hashtable(ht, migrate_slots_for(num_kvs), qht);
+
         // Copy the keyvalues to the GPU
-        KeyValue* device_kvs;
-        device_kvs = sycl::malloc_device<KeyValue>(num_kvs, qht);
-        auto e1 = qht.memcpy(device_kvs, kvs, sizeof(KeyValue) * num_kvs);
+        StagingBuffer<KV>& sb = stage_batch(ht, kvs, num_kvs, qht);
+        KV* device_kvs = sb.pDevice;
 
         int threadblocksize = 256;
 
-        qht.parallel_for(
-            sycl::nd_range<1>(num_kvs, threadblocksize), std::move(e1),
+        Layout    slots          = ht.slots;
+        uint32_t  capacity       = ht.capacity;
+        uint32_t* num_tombstones = ht.pNumTombstones;
+        Layout    old_slots      = ht.oldSlots;
+        uint32_t  old_capacity   = ht.oldCapacity;
+
+        sb.kernel = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{sb.upload, ht.lastKernel},
             [=](sycl::nd_item<1> item) {
 
                 gpu_hashtable_delete(
-                    pHashTable,
+                    slots,
+                    capacity,
+                    num_tombstones,
+                    old_slots,
+                    old_capacity,
                     device_kvs,
                     (uint32_t)num_kvs,
                     item) ;
             }
         );
-        qht.wait();
+        ht.lastKernel = sb.kernel;
 
-        sycl::free(device_kvs, qht);
+        ht.numTombstoneBound += num_kvs;
+        check_tombstones(ht, qht);
     } catch (std::exception const& e) {
         LOG_ERROR("Exception caught, \'" << e.what() << "\'");
     } catch (...) {
@@ -237,47 +734,61 @@ void delete_hashtable(
 }
 
 // Iterate over every item in the hashtable; return non-empty key/values
+template <typename Layout>
 void gpu_iterate_hashtable(
-    KeyValue* pHashTable,
-    KeyValue* kvs,
+    Layout pHashTable,
+    uint32_t capacity,
+    KeyValueOf<Layout>* kvs,
     uint32_t* kvs_size,
     sycl::nd_item<1> item)
 {
+    using Key = typename Layout::Key;
+
     unsigned int tid = item.get_global_id(0);
-    if (tid < kHashTableCapacity) {
-        if (pHashTable[tid].key != kEmpty) {
-            uint32_t value = pHashTable[tid].value;
-            if (value != kEmpty) {
-                // uint32_t size = sycl::atomic<uint32_t>(sycl::global_ptr<uint32_t>(kvs_size)).fetch_add(1);
-                uint32_t size = sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(kvs_size[0]).fetch_add(1);
-                kvs[size] = pHashTable[tid];
-            }
+    if (tid < capacity) {
+        Key key = slot_key(pHashTable, tid);
+        if (key != empty_key<Key>() && key != tombstone_key<Key>()) {
+            // uint32_t size = sycl::atomic<uint32_t>(sycl::global_ptr<uint32_t>(kvs_size)).fetch_add(1);
+            uint32_t size = sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space>(kvs_size[0]).fetch_add(1);
+            kvs[size].key   = key;
+            kvs[size].value = slot_value(pHashTable, tid);
         }
     }
 }
 
-std::vector<KeyValue> iterate_hashtable(
-    KeyValue* pHashTable,
+template <typename Layout>
+std::vector<KeyValueOf<Layout>> iterate_hashtable(
+    HashTable<Layout>& ht,
     sycl::queue& qht)
 {
-    std::vector<KeyValue> kvs;
+    using KV = KeyValueOf<Layout>;
+
+    std::vector<KV> kvs;
 
     try {
+        // All live keys must be in one array before it is walked
+        migrate_hashtable(ht, ht.oldCapacity, qht);
+        sync_hashtable(ht, qht);
+
         uint32_t* device_num_kvs;
-        KeyValue* device_kvs;
+        KV*       device_kvs;
         device_num_kvs = sycl::malloc_device<uint32_t>(1, qht);
-        device_kvs = sycl::malloc_device<KeyValue>(kNumKeyValues, qht);
+        device_kvs = sycl::malloc_device<KV>(std::min(ht.capacity, std::max(ht.numUsedBound, 1u)), qht);
 
         auto e1 = qht.memset(device_num_kvs, 0, sizeof(uint32_t));
 
         int threadblocksize = 256;
 
+        Layout   slots    = ht.slots;
+        uint32_t capacity = ht.capacity;
+
         auto e2 = qht.parallel_for(
-            sycl::nd_range<1>(kHashTableCapacity, threadblocksize), std::move(e1),
+            sycl::nd_range<1>(round_up_global_size(capacity, threadblocksize), threadblocksize), std::move(e1),
             [=](sycl::nd_item<1> item) {
 
                 gpu_iterate_hashtable(
-                    pHashTable,
+                    slots,
+                    capacity,
                     device_kvs,
                     device_num_kvs,
                     item);
@@ -290,7 +801,7 @@ std::vector<KeyValue> iterate_hashtable(
 
         kvs.resize(num_kvs);
 
-        qht.memcpy(kvs.data(), device_kvs, sizeof(KeyValue) * num_kvs);
+        qht.memcpy(kvs.data(), device_kvs, sizeof(KV) * num_kvs);
         qht.wait();
 
         sycl::free(device_kvs, qht);
@@ -304,10 +815,121 @@ std::vector<KeyValue> iterate_hashtable(
     return kvs;
 }
 
+// Count the slots inspected to look up each key, the same way gpu_hashtable_find probes
+template <typename Layout>
+void gpu_hashtable_probe_histogram(
+    Layout hashtable,
+    uint32_t capacity,
+    const KeyValueOf<Layout>* kvs,
+    unsigned int numkvs,
+    uint32_t* histogram,
+    sycl::nd_item<1> item)
+{
+    using Key = typename Layout::Key;
+
+    unsigned int tid = item.get_global_id(0);
+    if (tid < numkvs) {
+        Key      key    = kvs[tid].key;
+        uint32_t slot   = hash(key, capacity);
+        uint32_t probes = 1;
+
+        while (slot_key(hashtable, slot) != key && slot_key(hashtable, slot) != empty_key<Key>()) {
+            slot = (slot + 1) & (capacity - 1);
+            probes++;
+        }
+
+        uint32_t bin = sycl::min(probes, kProbeHistogramBins - 1);
+        atomic_increment(&histogram[bin]);
+    }
+}
+
+template <typename Layout>
+std::vector<uint32_t> probe_histogram_hashtable(
+    HashTable<Layout>& ht,
+    const KeyValueOf<Layout>* kvs,
+    uint32_t num_kvs,
+    sycl::queue& qht)
+{
+    using KV = KeyValueOf<Layout>;
+
+    std::vector<uint32_t> histogram(kProbeHistogramBins, 0);
+
+    try {
+        // Probe lengths are only meaningful for a single array
+        migrate_hashtable(ht, ht.oldCapacity, qht);
+        sync_hashtable(ht, qht);
+
+        KV*       device_kvs;
+        uint32_t* device_histogram;
+        device_kvs       = sycl::malloc_device<KV>(std::max(num_kvs, 1u), qht);
+        device_histogram = sycl::malloc_device<uint32_t>(kProbeHistogramBins, qht);
+        auto e1 = qht.memcpy(device_kvs, kvs, sizeof(KV) * num_kvs);
+        auto e2 = qht.memset(device_histogram, 0, sizeof(uint32_t) * kProbeHistogramBins);
+
+        int threadblocksize = 256;
+
+        Layout   slots    = ht.slots;
+        uint32_t capacity = ht.capacity;
+
+        auto e3 = qht.parallel_for(
+            sycl::nd_range<1>(round_up_global_size(num_kvs, threadblocksize), threadblocksize), std::vector<sycl::event>{e1, e2},
+            [=](sycl::nd_item<1> item) {
+
+                gpu_hashtable_probe_histogram(
+                    slots,
+                    capacity,
+                    device_kvs,
+                    (uint32_t)num_kvs,
+                    device_histogram,
+                    item);
+            }
+        );
+
+        qht.memcpy(histogram.data(), device_histogram, sizeof(uint32_t) * kProbeHistogramBins, std::move(e3));
+        qht.wait();
+
+        sycl::free(device_histogram, qht);
+        sycl::free(device_kvs, qht);
+    } catch (std::exception const& e) {
+        LOG_ERROR("Exception caught, \'" << e.what() << "\'");
+    } catch (...) {
+        LOG_ERROR("Unknown exception caught, bailing...");
+    }
+
+    return histogram;
+}
+
 // Free the memory of the hashtable
+template <typename Layout>
 void destroy_hashtable(
-    KeyValue* pHashTable,
+    HashTable<Layout>& ht,
     sycl::queue& qht)
 {
-    sycl::free(pHashTable, qht);
+    qht.wait();
+
+    free_staging(ht, qht);
+    if (ht.oldCapacity != 0) {
+        free_slots(ht.oldSlots, qht);
+    }
+    sycl::free(ht.pNumTombstones, qht);
+    sycl::free(ht.pNumUsed, qht);
+    free_slots(ht.slots, qht);
+    ht = {};
 }
+
+#define INSTANTIATE_HASHTABLE(Layout)                                                                                       \
+    template HashTable<Layout> create_hashtable<Layout>(uint32_t, float, float, sycl::queue&);                             \
+    template void insert_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t, sycl::queue&);          \
+    template void lookup_hashtable<Layout>(HashTable<Layout>&, KeyValueOf<Layout>*, uint32_t, sycl::queue&);                \
+    template void delete_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t, sycl::queue&);          \
+    template void sync_hashtable<Layout>(HashTable<Layout>&, sycl::queue&);                                                 \
+    template void complete_resize_hashtable<Layout>(HashTable<Layout>&, sycl::queue&);                                      \
+    template void compact_hashtable<Layout>(HashTable<Layout>&, sycl::queue&);                                              \
+    template std::vector<uint32_t> probe_histogram_hashtable<Layout>(HashTable<Layout>&, const KeyValueOf<Layout>*, uint32_t, sycl::queue&); \
+    template std::vector<KeyValueOf<Layout>> iterate_hashtable<Layout>(HashTable<Layout>&, sycl::queue&);                   \
+    template void destroy_hashtable<Layout>(HashTable<Layout>&, sycl::queue&);
+
+INSTANTIATE_HASHTABLE(PackedSlots)
+INSTANTIATE_HASHTABLE(SplitSlots32)
+INSTANTIATE_HASHTABLE(SplitSlots64)
+INSTANTIATE_HASHTABLE(SplitSlots64x16)
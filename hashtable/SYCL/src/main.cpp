@@ -17,7 +17,11 @@
 #include "vector"
 #include "chrono"
 #include <cstring>
+#include <type_traits>
 #include "linearprobing.h"
+#include "cuckoo.h"
+#include "workload.h"
+#include "cpuhashtable.h"
 
 // #define DEBUG_TIME
 #define CPP_MODULE "MAIN"
@@ -53,36 +57,52 @@ double get_elapsed_time(Time start)
     return us.count() / 1000.0f;
 }
 
-// Create random keys/values in the range [0, kEmpty)
-// kEmpty is used to indicate an empty slot
-std::vector<KeyValue> generate_random_keyvalues(
+// Random integer in the range [0, tombstone_key<T>())
+template <typename T>
+T random_value(std::mt19937& rnd)
+{
+    std::uniform_int_distribution<T> dis(0, tombstone_key<T>() - 1);
+    return dis(rnd);
+}
+
+template <>
+Payload16 random_value<Payload16>(std::mt19937& rnd)
+{
+    uint64_t lo = random_value<uint64_t>(rnd);
+    uint64_t hi = random_value<uint64_t>(rnd);
+    return Payload16{lo, hi};
+}
+
+// Create random keys/values; keys are in the range [0, key_limit) of their layout
+// The all ones key is used to indicate an empty slot and tombstone_key a deleted one
+template <typename KV>
+std::vector<KV> generate_random_keyvalues(
     std::mt19937& rnd,
     uint32_t numkvs)
 {
-    std::uniform_int_distribution<uint32_t> dis(0, kEmpty - 1);
-
-    std::vector<KeyValue> kvs;
+    std::vector<KV> kvs;
     kvs.reserve(numkvs);
 
     for (uint32_t i = 0; i < numkvs; i++)
     {
-        uint32_t rand0 = dis(rnd);
-        uint32_t rand1 = dis(rnd);
-        kvs.push_back(KeyValue{rand0, rand1});
+        auto rand0 = random_value<decltype(KV::key)>(rnd) % key_limit<decltype(KV::key), decltype(KV::value)>();
+        auto rand1 = random_value<decltype(KV::value)>(rnd);
+        kvs.push_back(KV{rand0, rand1});
     }
 
     return kvs;
 }
 
 // return numshuffledkvs random items from kvs
-std::vector<KeyValue> shuffle_keyvalues(
+template <typename KV>
+std::vector<KV> shuffle_keyvalues(
     std::mt19937& rnd,
-    std::vector<KeyValue> kvs,
+    std::vector<KV> kvs,
     uint32_t numshuffledkvs)
 {
     std::shuffle(kvs.begin(), kvs.end(), rnd);
 
-    std::vector<KeyValue> shuffled_kvs;
+    std::vector<KV> shuffled_kvs;
     shuffled_kvs.resize(numshuffledkvs);
 
     std::copy(kvs.begin(), kvs.begin() + numshuffledkvs, shuffled_kvs.begin());
@@ -90,16 +110,17 @@ std::vector<KeyValue> shuffle_keyvalues(
     return shuffled_kvs;
 }
 
+template <typename KV>
 void test_unordered_map(
-    std::vector<KeyValue> insert_kvs,
-    std::vector<KeyValue> delete_kvs) 
+    std::vector<KV> insert_kvs,
+    std::vector<KV> delete_kvs) 
 {
     Time timer = start_timer();
 
     printf("Timing std::unordered_map...\n");
 
     {
-        std::unordered_map<uint32_t, uint32_t> kvs_map;
+        std::unordered_map<decltype(KV::key), decltype(KV::value)> kvs_map;
         for (auto& kv : insert_kvs) 
         {
             kvs_map[kv.key] = kv.value;
@@ -115,33 +136,230 @@ void test_unordered_map(
     double milliseconds = get_elapsed_time(timer);
     double seconds = milliseconds / 1000.0f;
     printf("Total time for std::unordered_map: %f ms (%f Mkeys/second)\n",
-        milliseconds, kNumKeyValues / seconds / 1000000.0f);
+        milliseconds, insert_kvs.size() / seconds / 1000000.0f);
+}
+
+// Same insert, lookup and delete phases on the multithreaded CPU table, sized
+// like the device table at the end of the run. Returns the final contents of
+// the table, read after the timing, for verification.
+std::vector<KeyValue> test_cpu_hashtable(
+    const std::vector<KeyValue>& insert_kvs,
+    std::vector<KeyValue> lookup_kvs,
+    const std::vector<KeyValue>& delete_kvs,
+    uint32_t capacity)
+{
+    uint32_t num_threads = num_cpu_threads();
+    printf("Timing CPU linear probing table on %u threads...\n", num_threads);
+
+    Time timer = start_timer();
+    CpuHashTable hashtable = create_cpu_hashtable(capacity, num_threads);
+    insert_cpu_hashtable(hashtable, insert_kvs.data(), (uint32_t)insert_kvs.size());
+    lookup_cpu_hashtable(hashtable, lookup_kvs.data(), (uint32_t)lookup_kvs.size());
+    delete_cpu_hashtable(hashtable, delete_kvs.data(), (uint32_t)delete_kvs.size());
+
+    double milliseconds = get_elapsed_time(timer);
+    double seconds = milliseconds / 1000.0f;
+    printf("Total time for CPU linear probing table: %f ms (%f Mkeys/second)\n",
+        milliseconds, insert_kvs.size() / seconds / 1000000.0f);
+
+    return iterate_cpu_hashtable(hashtable);
+}
+
+// Print mean, percentiles and the non-empty bins of a probe length histogram
+void print_probe_histogram(
+    const char* label,
+    const std::vector<uint32_t>& histogram)
+{
+    uint64_t total = 0;
+    uint64_t sum   = 0;
+    for (uint32_t i = 0; i < histogram.size(); i++) {
+        total += histogram[i];
+        sum   += (uint64_t)i * histogram[i];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    uint32_t p50 = 0, p99 = 0, max = 0;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] == 0) {
+            continue;
+        }
+        seen += histogram[i];
+        if (p50 == 0 && seen * 100 >= total * 50) p50 = i;
+        if (p99 == 0 && seen * 100 >= total * 99) p99 = i;
+        max = i;
+    }
+
+    printf("Probe lengths %s: mean %.2f, p50 %u, p99 %u, max %u%s\n", label,
+        (double)sum / total, p50, p99, max, max == histogram.size() - 1 ? "+" : "");
+    for (uint32_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] != 0) {
+            printf("    %2u%s: %u\n", i, i == histogram.size() - 1 ? "+" : " ", histogram[i]);
+        }
+    }
+}
+
+// Create a table of either engine; tomb_limit only applies to linear probing
+template <typename Layout>
+void create_table(
+    HashTable<Layout>& hashtable,
+    uint32_t capacity,
+    float max_load,
+    float tomb_limit,
+    sycl::queue& qht)
+{
+    hashtable = create_hashtable<Layout>(capacity, max_load, tomb_limit, qht);
 }
 
+template <uint32_t BucketSize>
+void create_table(
+    CuckooHashTable<BucketSize>& hashtable,
+    uint32_t capacity,
+    float max_load,
+    float tomb_limit,
+    sycl::queue& qht)
+{
+    hashtable = create_cuckoo_hashtable<BucketSize>(capacity, max_load, qht);
+}
+
+template <typename KV>
 void test_correctness(
-    std::vector<KeyValue>,
-    std::vector<KeyValue>,
+    std::vector<KV>,
+    std::vector<KV>,
+    std::vector<KV>);
+
+void test_workload_correctness(
+    const Workload&,
     std::vector<KeyValue>);
 
-int main(int argc, char* argv[])
+// Preload the table, then replay the mixed batches in order. Every batch is
+// synchronized on its own, so its wall time is its end-to-end latency.
+template <typename Table>
+int run_workload(
+    const WorkloadConfig& config,
+    uint32_t capacity,
+    float max_load,
+    float tomb_limit,
+    bool verify)
 {
-    std::chrono::steady_clock::time_point time_start;
-    std::chrono::steady_clock::time_point time_end;
-    double time_total = 0.0;
+    static_assert(std::is_same<typename Table::KeyValueType, KeyValue>::value, "workloads use 32-bit keys and values");
 
-    try {
+    printf("Generating workload...\n");
+    Workload workload = generate_workload(config);
 
-    // To recreate the same random numbers across runs of the program, set seed to a specific
-    // number instead of a number from random_device
-    std::random_device rd;
-    uint32_t seed = rd();
-    std::mt19937 rnd(seed);  // mersenne_twister_engine
+    sycl::queue qht;
+    Table hashtable = {};
+    create_table(hashtable, capacity, max_load, tomb_limit, qht);
+    uint32_t initial_capacity = hashtable.capacity;
 
-    // printf("Random number generator seed = %u\n", seed);
+    Time timer = start_timer();
+    uint32_t batch_size = workload.config.batchSize;
+    for (size_t i = 0; i < workload.preloadKvs.size(); i += batch_size) {
+        insert_hashtable(
+            hashtable,
+            workload.preloadKvs.data() + i,
+            (uint32_t)std::min<size_t>(batch_size, workload.preloadKvs.size() - i),
+            qht);
+    }
+    sync_hashtable(hashtable, qht);
+    double preload_ms = get_elapsed_time(timer);
+
+    std::vector<double> batch_ms;
+    batch_ms.reserve(workload.batches.size());
+    for (WorkloadBatch& batch : workload.batches) {
+        Time batch_timer = start_timer();
+        switch (batch.op) {
+        case WorkloadOp::Lookup:
+            lookup_hashtable(hashtable, batch.kvs.data(), (uint32_t)batch.kvs.size(), qht);
+            break;
+        case WorkloadOp::Insert:
+            insert_hashtable(hashtable, batch.kvs.data(), (uint32_t)batch.kvs.size(), qht);
+            break;
+        case WorkloadOp::Delete:
+            delete_hashtable(hashtable, batch.kvs.data(), (uint32_t)batch.kvs.size(), qht);
+            break;
+        }
+        sync_hashtable(hashtable, qht);
+        batch_ms.push_back(get_elapsed_time(batch_timer));
+    }
 
-    // double seconds;
-    // for (uint32_t n = 0; n < NUM_LOOPS; ++n) {
-        // printf("Initializing keyvalue pairs with random numbers...\n");
+    std::vector<KeyValue> kvs = iterate_hashtable(hashtable, qht);
+
+    print_workload_report(workload, preload_ms, batch_ms);
+    if (hashtable.numResizes > 0) {
+        printf("hashtable grew from %u to %u slots in %u resizes\n",
+            initial_capacity, hashtable.capacity, hashtable.numResizes);
+    }
+    if (hashtable.numCompactions > 0) {
+        printf("hashtable compacted %u times to reclaim tombstones\n", hashtable.numCompactions);
+    }
+
+    destroy_hashtable(hashtable, qht);
+
+    if (verify) {
+        test_workload_correctness(workload, std::move(kvs));
+        printf("Success\n");
+    }
+    return 0;
+}
+
+// Slot layouts selectable with --layout; All benchmarks each of them in turn
+enum class LayoutChoice { Packed32, Split32, Split64, Split64x16, All };
+
+// Table engines selectable with --engine; the cuckoo engines use packed32 slots
+enum class EngineChoice { Linear, Cuckoo8, Cuckoo16, All };
+
+const char* const kEngineNames[] = { "linear", "cuckoo8", "cuckoo16", "all" };
+
+bool parse_engine(const char* name, EngineChoice* engine)
+{
+    for (uint32_t i = 0; i < sizeof(kEngineNames) / sizeof(kEngineNames[0]); i++) {
+        if (strcmp(name, kEngineNames[i]) == 0) {
+            *engine = (EngineChoice)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* const kLayoutNames[] = { "packed32", "split32", "split64", "split64x16", "all" };
+
+bool parse_layout(const char* name, LayoutChoice* layout)
+{
+    for (uint32_t i = 0; i < sizeof(kLayoutNames) / sizeof(kLayoutNames[0]); i++) {
+        if (strcmp(name, kLayoutNames[i]) == 0) {
+            *layout = (LayoutChoice)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Layout>
+uint32_t bytes_per_slot()
+{
+    return sizeof(typename Layout::Key) + sizeof(typename Layout::Value);
+}
+
+// Insert, look up and delete random keys with one table type; returns the
+// throughput over the whole run in million keys per second
+template <typename Table>
+double run_benchmark(
+    uint32_t seed,
+    uint32_t capacity,
+    uint32_t num_keyvalues,
+    float max_load,
+    float tomb_limit,
+    bool probe_stats,
+    bool verify)
+{
+    using KV = typename Table::KeyValueType;
+
+    std::chrono::steady_clock::time_point time_start;
+    std::chrono::steady_clock::time_point time_end;
+    double time_total = 0.0;
 
 #ifdef DEBUG_TIME
         std::chrono::steady_clock::time_point start_time;
@@ -151,9 +369,10 @@ int main(int argc, char* argv[])
 
         START_TIMER();
 #endif
-        std::vector<KeyValue> insert_kvs = generate_random_keyvalues(rnd, kNumKeyValues);
-        std::vector<KeyValue> lookup_kvs = shuffle_keyvalues(rnd, insert_kvs, kNumKeyValues / 2);
-        std::vector<KeyValue> delete_kvs = shuffle_keyvalues(rnd, insert_kvs, kNumKeyValues / 2);
+        std::mt19937 rnd(seed);  // mersenne_twister_engine
+        std::vector<KV> insert_kvs = generate_random_keyvalues<KV>(rnd, num_keyvalues);
+        std::vector<KV> lookup_kvs = shuffle_keyvalues(rnd, insert_kvs, num_keyvalues / 2);
+        std::vector<KV> delete_kvs = shuffle_keyvalues(rnd, insert_kvs, num_keyvalues / 2);
 
 #ifdef DEBUG_TIME
 STOP_TIMER();
@@ -174,7 +393,10 @@ START_TIMER();
 #endif
         // Allocates device memory for the hashtable and
         // fills every byte with 0xFF (so each key (and value) is set to 0xFFFFFFFF)
-        KeyValue* pHashTable = create_hashtable(qht);
+        // The table doubles (incrementally) whenever an insert would exceed max_load
+        Table hashtable = {};
+        create_table(hashtable, capacity, max_load, tomb_limit, qht);
+        uint32_t initial_capacity = hashtable.capacity;
 #ifdef DEBUG_TIME
 STOP_TIMER();
 PRINT_TIMER("create_hashtable   ");
@@ -187,11 +409,12 @@ START_TIMER();
         for (uint32_t i = 0; i < num_insert_batches; i++) {
 
             insert_hashtable(
-                pHashTable,
+                hashtable,
                 insert_kvs.data() + i * num_inserts_per_batch,
-                num_inserts_per_batch,
+                i + 1 < num_insert_batches ? num_inserts_per_batch : (uint32_t)insert_kvs.size() - i * num_inserts_per_batch,
                 qht);
         }
+        sync_hashtable(hashtable, qht);
 #ifdef DEBUG_TIME
 STOP_TIMER();
 PRINT_TIMER("insert_hashtable   ");
@@ -204,11 +427,12 @@ START_TIMER();
         for (uint32_t i = 0; i < num_lookup_batches; i++) {
 
             lookup_hashtable(
-                pHashTable,
+                hashtable,
                 lookup_kvs.data() + i * num_lookups_per_batch,
-                num_lookups_per_batch,
+                i + 1 < num_lookup_batches ? num_lookups_per_batch : (uint32_t)lookup_kvs.size() - i * num_lookups_per_batch,
                 qht);
         }
+        sync_hashtable(hashtable, qht);
 #ifdef DEBUG_TIME
 STOP_TIMER();
 PRINT_TIMER("lookup_hashtable   ");
@@ -221,19 +445,34 @@ START_TIMER();
         for (uint32_t i = 0; i < num_delete_batches; i++) {
 
             delete_hashtable(
-                pHashTable,
+                hashtable,
                 delete_kvs.data() + i * num_deletes_per_batch,
-                num_deletes_per_batch,
+                i + 1 < num_delete_batches ? num_deletes_per_batch : (uint32_t)delete_kvs.size() - i * num_deletes_per_batch,
                 qht);
         }
+        sync_hashtable(hashtable, qht);
 #ifdef DEBUG_TIME
 STOP_TIMER();
 PRINT_TIMER("delete_hashtable   ");
 
 START_TIMER();
 #endif
+        // Probe lengths of the lookup keys (hits and deleted keys) after the
+        // delete churn, and once more after all tombstones have been reclaimed.
+        // Not included in the reported time.
+        double probe_stats_ms = 0.0;
+        if (probe_stats) {
+            Time probe_timer = start_timer();
+            print_probe_histogram("after deletes",
+                probe_histogram_hashtable(hashtable, lookup_kvs.data(), (uint32_t)lookup_kvs.size(), qht));
+            compact_hashtable(hashtable, qht);
+            print_probe_histogram("after compaction",
+                probe_histogram_hashtable(hashtable, lookup_kvs.data(), (uint32_t)lookup_kvs.size(), qht));
+            probe_stats_ms = get_elapsed_time(probe_timer);
+        }
+
         // Get all the key-values from the hash table
-        std::vector<KeyValue> kvs = iterate_hashtable(pHashTable, qht);
+        std::vector<KV> kvs = iterate_hashtable(hashtable, qht);
 #ifdef DEBUG_TIME
 STOP_TIMER();
 PRINT_TIMER("iterate_hashtable  ");
@@ -244,24 +483,212 @@ PRINT_TIMER("iterate_hashtable  ");
         // double milliseconds = get_elapsed_time(timer);
         // seconds = milliseconds / 1000.0f;
 
-        destroy_hashtable(pHashTable, qht);
+        if (hashtable.numResizes > 0) {
+            printf("hashtable grew from %u to %u slots in %u resizes\n",
+                initial_capacity, hashtable.capacity, hashtable.numResizes);
+        }
+        if (hashtable.numCompactions > 0) {
+            printf("hashtable compacted %u times to reclaim tombstones\n", hashtable.numCompactions);
+        }
+
+        uint32_t final_capacity = hashtable.capacity;
+        destroy_hashtable(hashtable, qht);
 
     TIMER_END()
+    time_total -= probe_stats_ms;
     TIMER_PRINT("hashtable - total time for whole calculation")
-    printf("%f million keys/second\n", kNumKeyValues / (time_total / 1000.0f) / 1000000.0f);
+    double mkeys_per_second = num_keyvalues / (time_total / 1000.0f) / 1000000.0f;
+    printf("%f million keys/second\n", mkeys_per_second);
 
-        bool verify = true;
-        if (argc > 1 && strcmp(argv[1], "--no-verify") == 0) {
-            verify = false;
-        }
         if (verify) {
             test_unordered_map(insert_kvs, delete_kvs);
+            // The CPU baseline packs 32-bit keys and values like PackedSlots
+            if constexpr (std::is_same<KV, KeyValue>::value) {
+                std::vector<KeyValue> cpu_kvs = test_cpu_hashtable(insert_kvs, lookup_kvs, delete_kvs, final_capacity);
+                printf("Verifying CPU linear probing table...\n");
+                test_correctness(insert_kvs, delete_kvs, std::move(cpu_kvs));
+            }
+
+            Time verify_timer = start_timer();
             test_correctness(insert_kvs, delete_kvs, std::move(kvs));
+            printf("Verified in %f ms\n", get_elapsed_time(verify_timer));
             printf("Success\n");
         }
+
+    return mkeys_per_second;
+}
+
+// One benchmarked table: an engine with one of its slot layouts
+struct BenchmarkRun
+{
+    const char*  name;
+    EngineChoice engine;
+    LayoutChoice layout;
+    uint32_t     bytesPerSlot;
+    double (*benchmark)(uint32_t, uint32_t, uint32_t, float, float, bool, bool);
+    int    (*workload)(const WorkloadConfig&, uint32_t, float, float, bool);   // nullptr without 32-bit keys
+};
+
+const BenchmarkRun kBenchmarkRuns[] = {
+    { "packed32",   EngineChoice::Linear,   LayoutChoice::Packed32,   bytes_per_slot<PackedSlots>(),
+      run_benchmark<HashTable<PackedSlots>>,     run_workload<HashTable<PackedSlots>> },
+    { "split32",    EngineChoice::Linear,   LayoutChoice::Split32,    bytes_per_slot<SplitSlots32>(),
+      run_benchmark<HashTable<SplitSlots32>>,    run_workload<HashTable<SplitSlots32>> },
+    { "split64",    EngineChoice::Linear,   LayoutChoice::Split64,    bytes_per_slot<SplitSlots64>(),
+      run_benchmark<HashTable<SplitSlots64>>,    nullptr },
+    { "split64x16", EngineChoice::Linear,   LayoutChoice::Split64x16, bytes_per_slot<SplitSlots64x16>(),
+      run_benchmark<HashTable<SplitSlots64x16>>, nullptr },
+    { "cuckoo8",    EngineChoice::Cuckoo8,  LayoutChoice::Packed32,   bytes_per_slot<PackedSlots>(),
+      run_benchmark<CuckooHashTable<8>>,         run_workload<CuckooHashTable<8>> },
+    { "cuckoo16",   EngineChoice::Cuckoo16, LayoutChoice::Packed32,   bytes_per_slot<PackedSlots>(),
+      run_benchmark<CuckooHashTable<16>>,        run_workload<CuckooHashTable<16>> },
+};
+
+int main(int argc, char* argv[])
+{
+    try {
+
+    bool     verify        = true;
+    uint32_t capacity      = kDefaultHashTableCapacity;
+    uint32_t num_keyvalues = kDefaultNumKeyValues;
+    float    max_load      = kDefaultMaxLoadFactor;
+    float    tomb_limit    = kDefaultTombstoneThreshold;
+    bool     probe_stats   = false;
+    float    load_factor   = 0.0f;
+    LayoutChoice layout    = LayoutChoice::Packed32;
+    EngineChoice engine    = EngineChoice::Linear;
+    WorkloadConfig workload;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-verify") == 0) {
+            verify = false;
+        } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+            capacity = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--num-keys") == 0 && i + 1 < argc) {
+            num_keyvalues = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--max-load-factor") == 0 && i + 1 < argc) {
+            max_load = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--tombstone-threshold") == 0 && i + 1 < argc) {
+            tomb_limit = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--load-factor") == 0 && i + 1 < argc) {
+            load_factor = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--probe-stats") == 0) {
+            probe_stats = true;
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc &&
+                   parse_layout(argv[i + 1], &layout)) {
+            i++;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc &&
+                   parse_engine(argv[i + 1], &engine)) {
+            i++;
+        } else if (strcmp(argv[i], "--workload") == 0 && i + 1 < argc &&
+                   parse_key_distribution(argv[i + 1], &workload.distribution)) {
+            i++;
+        } else if (strcmp(argv[i], "--zipf-theta") == 0 && i + 1 < argc) {
+            workload.zipfTheta = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc &&
+                   parse_workload_mix(argv[i + 1], workload.mix)) {
+            i++;
+        } else if (strcmp(argv[i], "--miss-ratio") == 0 && i + 1 < argc) {
+            workload.missRatio = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc) {
+            workload.batchSize = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            workload.numOps = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--cluster-size") == 0 && i + 1 < argc) {
+            workload.clusterSize = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else {
+            printf("Usage: %s [--no-verify] [--capacity <slots>] [--num-keys <n>] [--max-load-factor <f>]\n"
+                   "          [--load-factor <f>] [--tombstone-threshold <f>] [--probe-stats]\n"
+                   "          [--layout packed32|split32|split64|split64x16|all] [--engine linear|cuckoo8|cuckoo16|all]\n"
+                   "          [--workload uniform|zipf|sequential|clustered] [--zipf-theta <f>]\n"
+                   "          [--mix <lookup>/<insert>[/<delete>]] [--miss-ratio <f>] [--batch-size <n>]\n"
+                   "          [--ops <n>] [--cluster-size <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (capacity == 0 || num_keyvalues == 0 || max_load <= 0.0f || max_load >= 1.0f || tomb_limit < 0.0f ||
+        load_factor < 0.0f || load_factor >= 1.0f) {
+        printf("--capacity and --num-keys must be non-zero, --max-load-factor and --load-factor must be in (0, 1), "
+               "--tombstone-threshold must not be negative\n");
+        return 1;
+    }
+
+    // Fill the initial table to the given load factor, without letting it grow
+    if (load_factor > 0.0f) {
+        uint32_t slots = 1;
+        while (slots < capacity && slots < 0x80000000u) {
+            slots <<= 1;
+        }
+        num_keyvalues = std::max(1u, (uint32_t)((double)slots * load_factor));
+        max_load      = load_factor;
+    }
+
+    std::vector<const BenchmarkRun*> runs;
+    for (const BenchmarkRun& run : kBenchmarkRuns) {
+        if ((engine == EngineChoice::All || engine == run.engine) &&
+            (layout == LayoutChoice::All || layout == run.layout)) {
+            runs.push_back(&run);
+        }
+    }
+    if (runs.empty()) {
+        printf("The cuckoo engines support the packed32 layout only\n");
+        return 1;
+    }
+    if (workload.zipfTheta < 0.0 || workload.missRatio < 0.0f || workload.missRatio > 1.0f ||
+        workload.batchSize == 0 || workload.clusterSize == 0) {
+        printf("--zipf-theta must not be negative, --miss-ratio must be in [0, 1], "
+               "--batch-size and --cluster-size must be non-zero\n");
+        return 1;
+    }
+
+    // To recreate the same random numbers across runs of the program, set seed to a specific
+    // number instead of a number from random_device
+    std::random_device rd;
+    uint32_t seed = rd();
+
+    if (workload.distribution != KeyDistribution::None) {
+        workload.numKeys = num_keyvalues;
+        workload.seed    = seed;
+        for (const BenchmarkRun* run : runs) {
+            if (run->workload == nullptr) {
+                printf("--workload supports the packed32 and split32 layouts only\n");
+                return 1;
+            }
+        }
+        for (const BenchmarkRun* run : runs) {
+            if (runs.size() > 1) {
+                printf("Table %s\n", run->name);
+            }
+            int status = run->workload(workload, capacity, max_load, tomb_limit, verify);
+            if (status != 0) {
+                return status;
+            }
+        }
+        return 0;
+    }
+
+    // printf("Random number generator seed = %u\n", seed);
+
+    // double seconds;
+    // for (uint32_t n = 0; n < NUM_LOOPS; ++n) {
+        // printf("Initializing keyvalue pairs with random numbers...\n");
+
+    std::vector<double> rates;
+    for (const BenchmarkRun* run : runs) {
+        if (runs.size() > 1) {
+            printf("Table %s (%u bytes/slot)\n", run->name, run->bytesPerSlot);
+        }
+        rates.push_back(run->benchmark(seed, capacity, num_keyvalues, max_load, tomb_limit, probe_stats, verify));
+    }
+
+    if (runs.size() > 1) {
+        printf("Table       bytes/slot  Mkeys/s\n");
+        for (uint32_t i = 0; i < runs.size(); i++) {
+            printf("%-10s  %10u  %7.1f\n", runs[i]->name, runs[i]->bytesPerSlot, rates[i]);
+        }
+    }
     // }
     // printf("Total time: %f s\n", seconds);
-    // printf("%f million keys/second\n", kNumKeyValues / seconds / 1000000.0f);
+    // printf("%f million keys/second\n", num_keyvalues / seconds / 1000000.0f);
     
     } catch (std::exception const& e) {
         std::cout << "Exception caught, \'" << e.what() << "\'";
@@ -0,0 +1,78 @@
+/* Modifications Copyright (C) 2023 Intel Corporation
+ *
+ * This Program is subject to the terms of The Unlicense.​
+ * If a copy of the license was not distributed with this file, ​
+ * you can obtain one at https://spdx.org/licenses/Unlicense.html​
+ *​
+ *
+ * SPDX-License-Identifier: Unlicense
+ */
+
+// Host-side helpers shared by the table engines (linearprobing.cpp, cuckoo.cpp)
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+#include <algorithm>
+#include <cstring>
+#include "linearprobing.h"
+
+// nd_range requires the global size to be a multiple of the work-group size
+static inline size_t round_up_global_size(size_t num_items, size_t threadblocksize)
+{
+    return std::max<size_t>(threadblocksize, (num_items + threadblocksize - 1) / threadblocksize * threadblocksize);
+}
+
+static inline uint32_t round_up_pow2(uint32_t n)
+{
+    uint32_t capacity = 1;
+    while (capacity < n && capacity < 0x80000000u) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Copy a batch into the next staging buffer of a table and start its upload.
+// Staging buffers are only (re)allocated when a batch larger than any before
+// arrives.
+template <typename Table, typename KV>
+static StagingBuffer<KV>& stage_batch(Table& ht, const KV* kvs, uint32_t num_kvs, sycl::queue& qht)
+{
+    if (num_kvs > ht.stagingCapacity) {
+        qht.wait();
+        for (StagingBuffer<KV>& sb : ht.staging) {
+            if (sb.pHost != nullptr) {
+                sycl::free(sb.pHost, qht);
+                sycl::free(sb.pDevice, qht);
+            }
+            sb.pHost   = sycl::malloc_host<KV>(num_kvs, qht);
+            sb.pDevice = sycl::malloc_device<KV>(num_kvs, qht);
+            sb.upload  = sycl::event();
+            sb.kernel  = sycl::event();
+        }
+        ht.stagingCapacity = num_kvs;
+    }
+
+    StagingBuffer<KV>& sb = ht.staging[ht.nextStaging];
+    ht.nextStaging = (ht.nextStaging + 1) % kNumStagingBuffers;
+
+    // The previous upload from this buffer has to finish before it is
+    // overwritten, and the kernel that read its device copy before the new
+    // upload lands there
+    sb.upload.wait();
+    std::memcpy(sb.pHost, kvs, sizeof(KV) * num_kvs);
+    sb.upload = qht.memcpy(sb.pDevice, sb.pHost, sizeof(KV) * num_kvs, sb.kernel);
+    return sb;
+}
+
+// Free the staging buffers of a table; the queue must be idle
+template <typename Table>
+static void free_staging(Table& ht, sycl::queue& qht)
+{
+    for (auto& sb : ht.staging) {
+        if (sb.pHost != nullptr) {
+            sycl::free(sb.pHost, qht);
+            sycl::free(sb.pDevice, qht);
+        }
+    }
+}
@@ -25,8 +25,10 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "common.hpp"
 #include "Utilities.h"
@@ -62,6 +64,11 @@
 #define BLOCK_SIZE 64
 #endif
 
+// # of streams the strips of the image are spread over
+#ifndef SOBEL_STREAMS
+#define SOBEL_STREAMS 3
+#endif
+
 using namespace cv;
 using namespace std;
 
@@ -122,8 +129,9 @@ void computeGradient(
                     (gradienty[2][1] * input[index_row_below])        +
                     (gradienty[2][2] * input[index_row_below + 1]);
 
-    // output[index] = sqrtf(powf(gradient_x, 2.f) + powf(gradient_y, 2.f));
-    output[index] = sqrtf(gradient_x * gradient_x + gradient_y * gradient_y);
+    // output holds the interior pixels only, (rows - 2) x (cols - 2)
+    // output[row * (cols - 2) + col] = sqrtf(powf(gradient_x, 2.f) + powf(gradient_y, 2.f));
+    output[row * (cols - 2) + col] = sqrtf(gradient_x * gradient_x + gradient_y * gradient_y);
 }
 
 int main(int argc, const char* argv[])
@@ -178,12 +186,33 @@ int main(int argc, const char* argv[])
 
     int rows = scaledImage.rows;
     int cols = scaledImage.cols;
-    size_t globalsize = rows * cols;
-    Mat gradientimage(rows, cols, CV_8UC1);
+    if (rows < 3 || cols < 3) {
+        LOG_ERROR("Input image must be at least 3x3 pixels");
+    }
+    if (!scaledImage.isContinuous()) {
+        scaledImage = scaledImage.clone();
+    }
 
-    LOG("Launching CUDA kernel with # of iterations: "<< nIterations);
+    // the image is processed in strips of output rows, every strip is uploaded with one halo row above and below
+    int nStripRows = parser.GetIntegerSetting("-strip");
+    if (nStripRows < 1) {
+        LOG_ERROR("# of rows per strip must be at least 1");
+    }
+    int outRows = rows - 2;
+    int outCols = cols - 2;
+    int stripRows = std::min(nStripRows, outRows);
+    int nStrips = (outRows + stripRows - 1) / stripRows;
+    size_t stripInSize = (size_t)(stripRows + 2) * cols;
+    size_t stripOutSize = (size_t)stripRows * outCols;
+    Mat outputimage(outRows, outCols, CV_8UC1);
 
-    int counter(nIterations);
+    bool bOverlap = parser.IsSet("-overlap");
+
+    LOG("Launching CUDA kernel with # of iterations: "<< nIterations);
+    LOG("Processing " << nStrips << " strips of up to " << stripRows << " rows on " << SOBEL_STREAMS << " streams");
+    if (bOverlap) {
+        LOG("Consecutive iterations overlap");
+    }
 
 #ifdef DEBUG_TIME
     std::chrono::steady_clock::time_point start_time;
@@ -196,82 +225,104 @@ int main(int argc, const char* argv[])
 
     CUDA_CHECK( cudaSetDevice(0) );
 
-#ifdef DEBUG_TIME
-    STOP_TIMER();
-    PRINT_TIMER("init     ");
-    std::cout << std::endl;
-#endif
-
-    while(counter > 0) {
-
-#ifdef DEBUG_TIME
-        START_TIMER();
-#endif
-
-        //Allocate the device memory
-        unsigned char *d_input, *d_gradient;
-        CUDA_CHECK( cudaMalloc(&d_input,    globalsize * sizeof(unsigned char)) );
-        CUDA_CHECK( cudaMalloc(&d_gradient, globalsize * sizeof(unsigned char)) );
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        std::cout << "Iteration: " << counter << std::endl;
-        PRINT_TIMER("malloc   ");
-
-        START_TIMER();
-#endif
-
-        //Copy source vectors from host to device
-        CUDA_CHECK( cudaMemcpy(d_input, scaledImage.data, globalsize * sizeof(unsigned char), cudaMemcpyHostToDevice) );
-        CUDA_CHECK( cudaDeviceSynchronize() );
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyH2D");
-
-        START_TIMER();
-#endif
-
-        //Step 3 Gradient strength and direction
-        constexpr int blockDim_x = 64;
-        constexpr int blockDim_y = 2;
-        dim3 block(blockDim_x, blockDim_y);
-        dim3 grid((cols - 2 + blockDim_x - 1) / blockDim_x, (rows - 2 + blockDim_y - 1) / blockDim_y);
-        computeGradient<<<grid, block>>>(d_input, d_gradient, rows, cols);
-        CUDA_CHECK( cudaDeviceSynchronize() );
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("kernel   ");
+    // pinned images let the strip copies run asynchronously to the kernels of the other streams
+    CUDA_CHECK( cudaHostRegister(scaledImage.data, (size_t)rows * cols * sizeof(unsigned char), cudaHostRegisterDefault) );
+    CUDA_CHECK( cudaHostRegister(outputimage.data, (size_t)outRows * outCols * sizeof(unsigned char), cudaHostRegisterDefault) );
+    cudaStream_t streams[SOBEL_STREAMS];
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        CUDA_CHECK( cudaStreamCreate(&streams[s]) );
+    }
 
-        START_TIMER();
-#endif
+    //Allocate the device memory once, one strip buffer pair per stream
+    unsigned char *d_input[SOBEL_STREAMS], *d_gradient[SOBEL_STREAMS];
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        CUDA_CHECK( cudaMalloc(&d_input[s],    stripInSize * sizeof(unsigned char)) );
+        CUDA_CHECK( cudaMalloc(&d_gradient[s], stripOutSize * sizeof(unsigned char)) );
+    }
 
-        //Copy back result from device to host
-        CUDA_CHECK( cudaMemcpy(gradientimage.data, d_gradient, globalsize * sizeof(unsigned char), cudaMemcpyDeviceToHost) );
-        CUDA_CHECK( cudaDeviceSynchronize() );
+    // every strip of every iteration records the start of its upload and the end of its upload, kernel and download
+    std::vector<cudaEvent_t> events((size_t)nIterations * nStrips * 4);
+    for (size_t e = 0; e < events.size(); e++) {
+        CUDA_CHECK( cudaEventCreate(&events[e]) );
+    }
 
 #ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyD2H");
+    STOP_TIMER();
+    PRINT_TIMER("init     ");
+    std::cout << std::endl;
 #endif
 
-        //Free up device allocation
-        CUDA_CHECK( cudaFree(d_input) );
-        CUDA_CHECK( cudaFree(d_gradient) );
-        counter--;
-
-#ifdef DEBUG_TIME
-        std::cout << std::endl;
-#endif
+    constexpr int blockDim_x = 64;
+    constexpr int blockDim_y = 2;
+    dim3 block(blockDim_x, blockDim_y);
+
+    std::chrono::steady_clock::time_point loop_start = std::chrono::steady_clock::now();
+    for (int it = 0; it < nIterations; it++) {
+
+        // strips are dealt round robin to the streams, the work of one stream runs in order so its
+        // buffers are free again when its next strip starts, while the other streams copy or compute.
+        // With -overlap the next iteration is queued right away and its first uploads run during
+        // the last kernels of this one.
+        for (int k = 0; k < nStrips; k++) {
+            size_t strip = (size_t)it * nStrips + k;
+            int s = strip % SOBEL_STREAMS;
+            int row0 = k * stripRows;
+            int h = std::min(stripRows, outRows - row0);
+            cudaEvent_t *ev = &events[strip * 4];
+
+            //Copy the strip with its halo rows from host to device
+            CUDA_CHECK( cudaEventRecord(ev[0], streams[s]) );
+            CUDA_CHECK( cudaMemcpyAsync(d_input[s], scaledImage.data + (size_t)row0 * cols, (size_t)(h + 2) * cols * sizeof(unsigned char), cudaMemcpyHostToDevice, streams[s]) );
+            CUDA_CHECK( cudaEventRecord(ev[1], streams[s]) );
+
+            //Step 3 Gradient strength and direction
+            dim3 grid((outCols + blockDim_x - 1) / blockDim_x, (h + blockDim_y - 1) / blockDim_y);
+            computeGradient<<<grid, block, 0, streams[s]>>>(d_input[s], d_gradient[s], h + 2, cols);
+            CUDA_CHECK( cudaEventRecord(ev[2], streams[s]) );
+
+            //Copy the interior of the strip straight into its rows of the output image
+            CUDA_CHECK( cudaMemcpyAsync(outputimage.data + (size_t)row0 * outCols, d_gradient[s], (size_t)h * outCols * sizeof(unsigned char), cudaMemcpyDeviceToHost, streams[s]) );
+            CUDA_CHECK( cudaEventRecord(ev[3], streams[s]) );
+        }
+        if (!bOverlap) {
+            CUDA_CHECK( cudaDeviceSynchronize() );
+        }
     }
-
-    TIMER_START_()
-    Mat outputimage = cv::Mat::zeros(rows - 2, cols - 2, CV_8UC1);
-    for(int i = 0; i< rows - 2; i++) {
-        for(int j = 0; j< cols - 2; j++) {
-            outputimage.at<uchar>(i, j) = gradientimage.at<uchar>(i + 1, j + 1);
+    CUDA_CHECK( cudaDeviceSynchronize() );
+    double loop_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loop_start).count();
+
+    // device time of each phase summed over the strips of an iteration
+    std::vector<double> h2d_times(nIterations, 0.0), kernel_times(nIterations, 0.0), d2h_times(nIterations, 0.0);
+    for (int it = 0; it < nIterations; it++) {
+        for (int k = 0; k < nStrips; k++) {
+            cudaEvent_t *ev = &events[((size_t)it * nStrips + k) * 4];
+            float ms;
+            CUDA_CHECK( cudaEventElapsedTime(&ms, ev[0], ev[1]) );
+            h2d_times[it] += ms;
+            CUDA_CHECK( cudaEventElapsedTime(&ms, ev[1], ev[2]) );
+            kernel_times[it] += ms;
+            CUDA_CHECK( cudaEventElapsedTime(&ms, ev[2], ev[3]) );
+            d2h_times[it] += ms;
         }
     }
+    LOG("Iterations: " << nIterations << ", " << loop_time << " ms, " << loop_time / std::max(nIterations, 1) << " ms per iteration");
+    print_phase_stats("memcpyH2D", h2d_times);
+    print_phase_stats("kernel   ", kernel_times);
+    print_phase_stats("memcpyD2H", d2h_times);
+
+    //Free up device allocation
+    for (size_t e = 0; e < events.size(); e++) {
+        CUDA_CHECK( cudaEventDestroy(events[e]) );
+    }
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        CUDA_CHECK( cudaFree(d_input[s]) );
+        CUDA_CHECK( cudaFree(d_gradient[s]) );
+        CUDA_CHECK( cudaStreamDestroy(streams[s]) );
+    }
+    CUDA_CHECK( cudaHostUnregister(scaledImage.data) );
+    CUDA_CHECK( cudaHostUnregister(outputimage.data) );
+
+    TIMER_START_()
 
     // write output
     if(parser.IsSet("-o")) {
@@ -25,8 +25,10 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "common.hpp"
 #include "Utilities.h"
@@ -62,6 +64,11 @@
 #define BLOCK_SIZE 64
 #endif
 
+// # of streams the strips of the image are spread over
+#ifndef SOBEL_STREAMS
+#define SOBEL_STREAMS 3
+#endif
+
 using namespace cv;
 using namespace std;
 
@@ -122,8 +129,9 @@ void computeGradient(
                     (gradienty[2][1] * input[index_row_below])        +
                     (gradienty[2][2] * input[index_row_below + 1]);
 
-    // output[index] = sqrtf(powf(gradient_x, 2.f) + powf(gradient_y, 2.f));
-    output[index] = sqrtf(gradient_x * gradient_x + gradient_y * gradient_y);
+    // output holds the interior pixels only, (rows - 2) x (cols - 2)
+    // output[row * (cols - 2) + col] = sqrtf(powf(gradient_x, 2.f) + powf(gradient_y, 2.f));
+    output[row * (cols - 2) + col] = sqrtf(gradient_x * gradient_x + gradient_y * gradient_y);
 }
 
 int main(int argc, const char* argv[])
@@ -178,12 +186,33 @@ int main(int argc, const char* argv[])
 
     int rows = scaledImage.rows;
     int cols = scaledImage.cols;
-    size_t globalsize = rows * cols;
-    Mat gradientimage(rows, cols, CV_8UC1);
+    if (rows < 3 || cols < 3) {
+        LOG_ERROR("Input image must be at least 3x3 pixels");
+    }
+    if (!scaledImage.isContinuous()) {
+        scaledImage = scaledImage.clone();
+    }
 
-    LOG("Launching HIP kernel with # of iterations: "<< nIterations);
+    // the image is processed in strips of output rows, every strip is uploaded with one halo row above and below
+    int nStripRows = parser.GetIntegerSetting("-strip");
+    if (nStripRows < 1) {
+        LOG_ERROR("# of rows per strip must be at least 1");
+    }
+    int outRows = rows - 2;
+    int outCols = cols - 2;
+    int stripRows = std::min(nStripRows, outRows);
+    int nStrips = (outRows + stripRows - 1) / stripRows;
+    size_t stripInSize = (size_t)(stripRows + 2) * cols;
+    size_t stripOutSize = (size_t)stripRows * outCols;
+    Mat outputimage(outRows, outCols, CV_8UC1);
 
-    int counter(nIterations);
+    bool bOverlap = parser.IsSet("-overlap");
+
+    LOG("Launching HIP kernel with # of iterations: "<< nIterations);
+    LOG("Processing " << nStrips << " strips of up to " << stripRows << " rows on " << SOBEL_STREAMS << " streams");
+    if (bOverlap) {
+        LOG("Consecutive iterations overlap");
+    }
 
 #ifdef DEBUG_TIME
     std::chrono::steady_clock::time_point start_time;
@@ -196,82 +225,104 @@ int main(int argc, const char* argv[])
 
     HIP_CHECK( hipSetDevice(0) );
 
-#ifdef DEBUG_TIME
-    STOP_TIMER();
-    PRINT_TIMER("init     ");
-    std::cout << std::endl;
-#endif
-
-    while(counter > 0) {
-
-#ifdef DEBUG_TIME
-        START_TIMER();
-#endif
-
-        //Allocate the device memory
-        unsigned char *d_input, *d_gradient;
-        HIP_CHECK( hipMalloc(&d_input,    globalsize * sizeof(unsigned char)) );
-        HIP_CHECK( hipMalloc(&d_gradient, globalsize * sizeof(unsigned char)) );
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        std::cout << "Iteration: " << counter << std::endl;
-        PRINT_TIMER("malloc   ");
-
-        START_TIMER();
-#endif
-
-        //Copy source vectors from host to device
-        HIP_CHECK( hipMemcpy(d_input, scaledImage.data, globalsize * sizeof(unsigned char), hipMemcpyHostToDevice) );
-        HIP_CHECK( hipDeviceSynchronize() );
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyH2D");
-
-        START_TIMER();
-#endif
-
-        //Step 3 Gradient strength and direction
-        constexpr int blockDim_x = 64;
-        constexpr int blockDim_y = 2;
-        dim3 block(blockDim_x, blockDim_y);
-        dim3 grid((cols - 2 + blockDim_x - 1) / blockDim_x, (rows - 2 + blockDim_y - 1) / blockDim_y);
-        hipLaunchKernelGGL(computeGradient, grid, block, 0, 0, d_input, d_gradient, rows, cols);
-        HIP_CHECK( hipDeviceSynchronize() );
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("kernel   ");
+    // pinned images let the strip copies run asynchronously to the kernels of the other streams
+    HIP_CHECK( hipHostRegister(scaledImage.data, (size_t)rows * cols * sizeof(unsigned char), hipHostRegisterDefault) );
+    HIP_CHECK( hipHostRegister(outputimage.data, (size_t)outRows * outCols * sizeof(unsigned char), hipHostRegisterDefault) );
+    hipStream_t streams[SOBEL_STREAMS];
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        HIP_CHECK( hipStreamCreate(&streams[s]) );
+    }
 
-        START_TIMER();
-#endif
+    //Allocate the device memory once, one strip buffer pair per stream
+    unsigned char *d_input[SOBEL_STREAMS], *d_gradient[SOBEL_STREAMS];
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        HIP_CHECK( hipMalloc(&d_input[s],    stripInSize * sizeof(unsigned char)) );
+        HIP_CHECK( hipMalloc(&d_gradient[s], stripOutSize * sizeof(unsigned char)) );
+    }
 
-        //Copy back result from device to host
-        HIP_CHECK( hipMemcpy(gradientimage.data, d_gradient, globalsize * sizeof(unsigned char), hipMemcpyDeviceToHost) );
-        HIP_CHECK( hipDeviceSynchronize() );
+    // every strip of every iteration records the start of its upload and the end of its upload, kernel and download
+    std::vector<hipEvent_t> events((size_t)nIterations * nStrips * 4);
+    for (size_t e = 0; e < events.size(); e++) {
+        HIP_CHECK( hipEventCreate(&events[e]) );
+    }
 
 #ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyD2H");
+    STOP_TIMER();
+    PRINT_TIMER("init     ");
+    std::cout << std::endl;
 #endif
 
-        //Free up device allocation
-        HIP_CHECK( hipFree(d_input) );
-        HIP_CHECK( hipFree(d_gradient) );
-        counter--;
-
-#ifdef DEBUG_TIME
-        std::cout << std::endl;
-#endif
+    constexpr int blockDim_x = 64;
+    constexpr int blockDim_y = 2;
+    dim3 block(blockDim_x, blockDim_y);
+
+    std::chrono::steady_clock::time_point loop_start = std::chrono::steady_clock::now();
+    for (int it = 0; it < nIterations; it++) {
+
+        // strips are dealt round robin to the streams, the work of one stream runs in order so its
+        // buffers are free again when its next strip starts, while the other streams copy or compute.
+        // With -overlap the next iteration is queued right away and its first uploads run during
+        // the last kernels of this one.
+        for (int k = 0; k < nStrips; k++) {
+            size_t strip = (size_t)it * nStrips + k;
+            int s = strip % SOBEL_STREAMS;
+            int row0 = k * stripRows;
+            int h = std::min(stripRows, outRows - row0);
+            hipEvent_t *ev = &events[strip * 4];
+
+            //Copy the strip with its halo rows from host to device
+            HIP_CHECK( hipEventRecord(ev[0], streams[s]) );
+            HIP_CHECK( hipMemcpyAsync(d_input[s], scaledImage.data + (size_t)row0 * cols, (size_t)(h + 2) * cols * sizeof(unsigned char), hipMemcpyHostToDevice, streams[s]) );
+            HIP_CHECK( hipEventRecord(ev[1], streams[s]) );
+
+            //Step 3 Gradient strength and direction
+            dim3 grid((outCols + blockDim_x - 1) / blockDim_x, (h + blockDim_y - 1) / blockDim_y);
+            hipLaunchKernelGGL(computeGradient, grid, block, 0, streams[s], d_input[s], d_gradient[s], h + 2, cols);
+            HIP_CHECK( hipEventRecord(ev[2], streams[s]) );
+
+            //Copy the interior of the strip straight into its rows of the output image
+            HIP_CHECK( hipMemcpyAsync(outputimage.data + (size_t)row0 * outCols, d_gradient[s], (size_t)h * outCols * sizeof(unsigned char), hipMemcpyDeviceToHost, streams[s]) );
+            HIP_CHECK( hipEventRecord(ev[3], streams[s]) );
+        }
+        if (!bOverlap) {
+            HIP_CHECK( hipDeviceSynchronize() );
+        }
     }
-
-    TIMER_START_()
-    Mat outputimage = cv::Mat::zeros(rows - 2, cols - 2, CV_8UC1);
-    for(int i = 0; i< rows - 2; i++) {
-        for(int j = 0; j< cols - 2; j++) {
-            outputimage.at<uchar>(i, j) = gradientimage.at<uchar>(i + 1, j + 1);
+    HIP_CHECK( hipDeviceSynchronize() );
+    double loop_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loop_start).count();
+
+    // device time of each phase summed over the strips of an iteration
+    std::vector<double> h2d_times(nIterations, 0.0), kernel_times(nIterations, 0.0), d2h_times(nIterations, 0.0);
+    for (int it = 0; it < nIterations; it++) {
+        for (int k = 0; k < nStrips; k++) {
+            hipEvent_t *ev = &events[((size_t)it * nStrips + k) * 4];
+            float ms;
+            HIP_CHECK( hipEventElapsedTime(&ms, ev[0], ev[1]) );
+            h2d_times[it] += ms;
+            HIP_CHECK( hipEventElapsedTime(&ms, ev[1], ev[2]) );
+            kernel_times[it] += ms;
+            HIP_CHECK( hipEventElapsedTime(&ms, ev[2], ev[3]) );
+            d2h_times[it] += ms;
         }
     }
+    LOG("Iterations: " << nIterations << ", " << loop_time << " ms, " << loop_time / std::max(nIterations, 1) << " ms per iteration");
+    print_phase_stats("memcpyH2D", h2d_times);
+    print_phase_stats("kernel   ", kernel_times);
+    print_phase_stats("memcpyD2H", d2h_times);
+
+    //Free up device allocation
+    for (size_t e = 0; e < events.size(); e++) {
+        HIP_CHECK( hipEventDestroy(events[e]) );
+    }
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        HIP_CHECK( hipFree(d_input[s]) );
+        HIP_CHECK( hipFree(d_gradient[s]) );
+        HIP_CHECK( hipStreamDestroy(streams[s]) );
+    }
+    HIP_CHECK( hipHostUnregister(scaledImage.data) );
+    HIP_CHECK( hipHostUnregister(outputimage.data) );
+
+    TIMER_START_()
 
     // write output
     if(parser.IsSet("-o")) {
@@ -25,8 +25,10 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "common.hpp"
 #include "Utilities.h"
@@ -62,6 +64,11 @@
 #define BLOCK_SIZE 64
 #endif
 
+// # of device buffer sets the strips of the image are spread over
+#ifndef SOBEL_STREAMS
+#define SOBEL_STREAMS 3
+#endif
+
 using namespace cv;
 using namespace std;
 
@@ -116,9 +123,10 @@ void computeGradient(
                     (gradienty[2][1] * input[index_row_below])        +
                     (gradienty[2][2] * input[index_row_below + 1]);
 
-    // output[index] = sycl::sqrt(sycl::pow<float>(gradient_x, 2.f) +
+    // output holds the interior pixels only, (rows - 2) x (cols - 2)
+    // output[row * (cols - 2) + col] = sycl::sqrt(sycl::pow<float>(gradient_x, 2.f) +
                             //    sycl::pow<float>(gradient_y, 2.f));
-    output[index] = sycl::sqrt(gradient_x * gradient_x + gradient_y * gradient_y);
+    output[row * (cols - 2) + col] = sycl::sqrt(gradient_x * gradient_x + gradient_y * gradient_y);
 }
 
 int main(int argc, const char* argv[])
@@ -173,12 +181,33 @@ int main(int argc, const char* argv[])
 
     int rows = scaledImage.rows;
     int cols = scaledImage.cols;
-    size_t globalsize = rows * cols;
-    Mat gradientimage(rows, cols, CV_8UC1);
+    if (rows < 3 || cols < 3) {
+        LOG_ERROR("Input image must be at least 3x3 pixels");
+    }
+    if (!scaledImage.isContinuous()) {
+        scaledImage = scaledImage.clone();
+    }
 
-    LOG("Launching SYCL kernel with # of iterations: "<< nIterations);
+    // the image is processed in strips of output rows, every strip is uploaded with one halo row above and below
+    int nStripRows = parser.GetIntegerSetting("-strip");
+    if (nStripRows < 1) {
+        LOG_ERROR("# of rows per strip must be at least 1");
+    }
+    int outRows = rows - 2;
+    int outCols = cols - 2;
+    int stripRows = std::min(nStripRows, outRows);
+    int nStrips = (outRows + stripRows - 1) / stripRows;
+    size_t stripInSize = (size_t)(stripRows + 2) * cols;
+    size_t stripOutSize = (size_t)stripRows * outCols;
+    Mat outputimage(outRows, outCols, CV_8UC1);
 
-    int counter(nIterations);
+    bool bOverlap = parser.IsSet("-overlap");
+
+    LOG("Launching SYCL kernel with # of iterations: "<< nIterations);
+    LOG("Processing " << nStrips << " strips of up to " << stripRows << " rows with " << SOBEL_STREAMS << " buffer sets");
+    if (bOverlap) {
+        LOG("Consecutive iterations overlap");
+    }
 
 #ifdef DEBUG_TIME
     std::chrono::steady_clock::time_point start_time;
@@ -189,7 +218,14 @@ int main(int argc, const char* argv[])
     START_TIMER();
 #endif
 
-    sycl::queue qsf;
+    sycl::queue qsf{sycl::property::queue::enable_profiling{}};
+
+    //Allocate the device memory once, one strip buffer pair per set
+    unsigned char *d_input[SOBEL_STREAMS], *d_gradient[SOBEL_STREAMS];
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        d_input[s]    = sycl::malloc_device<unsigned char>(stripInSize, qsf);
+        d_gradient[s] = sycl::malloc_device<unsigned char>(stripOutSize, qsf);
+    }
 
 #ifdef DEBUG_TIME
     STOP_TIMER();
@@ -197,81 +233,81 @@ int main(int argc, const char* argv[])
     std::cout << std::endl;
 #endif
 
-    while(counter > 0) {
-
-#ifdef DEBUG_TIME
-        START_TIMER();
-#endif
-
-        //Allocate the device memory
-        unsigned char *d_input, *d_gradient;
-        d_input    = sycl::malloc_device<unsigned char>(globalsize, qsf);
-        d_gradient = sycl::malloc_device<unsigned char>(globalsize, qsf);
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("malloc   ");
-
-        START_TIMER();
-#endif
-
-        //Copy source vectors from host to device
-        qsf.memcpy(d_input, scaledImage.data, globalsize * sizeof(unsigned char));
-        qsf.wait();
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyH2D");
-
-        START_TIMER();
-#endif
-
-        //Step 3 Gradient strength and direction
-        constexpr int blockDim_x = 64;
-        constexpr int blockDim_y = 2;
-        sycl::range block(1, blockDim_y, blockDim_x);
-        sycl::range grid(1, (rows - 2 + blockDim_y - 1) / blockDim_y, (cols - 2 + blockDim_x - 1) / blockDim_x);
-        qsf.parallel_for(
-            sycl::nd_range<3>(grid * block, block),
-            [=](sycl::nd_item<3> item) {
-                computeGradient(d_input, d_gradient, rows, cols, item);
-            }
-        );
-        qsf.wait_and_throw();
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("kernel   ");
-
-        START_TIMER();
-#endif
-
-        //Copy back result from device to host
-        qsf.memcpy(gradientimage.data, d_gradient, globalsize * sizeof(unsigned char));
-        qsf.wait();
-
-#ifdef DEBUG_TIME
-        STOP_TIMER();
-        PRINT_TIMER("memcpyD2H");
-#endif
-
-        //Free up device allocation
-        sycl::free(d_input,    qsf);
-        sycl::free(d_gradient, qsf);
-        counter--;
-
-#ifdef DEBUG_TIME
-        std::cout << std::endl;
-#endif
+    constexpr int blockDim_x = 64;
+    constexpr int blockDim_y = 2;
+    sycl::range block(1, blockDim_y, blockDim_x);
+
+    // upload, kernel and download event of every strip of every iteration
+    std::vector<sycl::event> events((size_t)nIterations * nStrips * 3);
+    sycl::event kernel_done[SOBEL_STREAMS], download_done[SOBEL_STREAMS];
+
+    std::chrono::steady_clock::time_point loop_start = std::chrono::steady_clock::now();
+    for (int it = 0; it < nIterations; it++) {
+
+        // strips are dealt round robin to the buffer sets. The upload of a strip waits for the kernel of
+        // the previous strip in its set and the kernel for that strip's download, everything else overlaps.
+        // With -overlap the next iteration is queued right away and its first uploads run during
+        // the last kernels of this one.
+        for (int k = 0; k < nStrips; k++) {
+            size_t strip = (size_t)it * nStrips + k;
+            int s = strip % SOBEL_STREAMS;
+            int row0 = k * stripRows;
+            int h = std::min(stripRows, outRows - row0);
+            unsigned char *input = d_input[s];
+            unsigned char *gradient = d_gradient[s];
+            int strip_rows = h + 2;
+
+            //Copy the strip with its halo rows from host to device
+            sycl::event upload_done = qsf.memcpy(input, scaledImage.data + (size_t)row0 * cols, (size_t)strip_rows * cols * sizeof(unsigned char), kernel_done[s]);
+
+            //Step 3 Gradient strength and direction
+            sycl::range grid(1, (h + blockDim_y - 1) / blockDim_y, (outCols + blockDim_x - 1) / blockDim_x);
+            kernel_done[s] = qsf.submit([&](sycl::handler& cgh) {
+                cgh.depends_on({upload_done, download_done[s]});
+                cgh.parallel_for(
+                    sycl::nd_range<3>(grid * block, block),
+                    [=](sycl::nd_item<3> item) {
+                        computeGradient(input, gradient, strip_rows, cols, item);
+                    }
+                );
+            });
+
+            //Copy the interior of the strip straight into its rows of the output image
+            download_done[s] = qsf.memcpy(outputimage.data + (size_t)row0 * outCols, gradient, (size_t)h * outCols * sizeof(unsigned char), kernel_done[s]);
+
+            events[strip * 3]     = upload_done;
+            events[strip * 3 + 1] = kernel_done[s];
+            events[strip * 3 + 2] = download_done[s];
+        }
+        if (!bOverlap) {
+            qsf.wait_and_throw();
+        }
     }
-
-    TIMER_START_()
-    Mat outputimage = cv::Mat::zeros(rows - 2, cols - 2, CV_8UC1);
-    for(int i = 0; i< rows - 2; i++) {
-        for(int j = 0; j< cols - 2; j++) {
-            outputimage.at<uchar>(i, j) = gradientimage.at<uchar>(i + 1, j + 1);
+    qsf.wait_and_throw();
+    double loop_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loop_start).count();
+
+    // device time of each phase summed over the strips of an iteration
+    std::vector<double> h2d_times(nIterations, 0.0), kernel_times(nIterations, 0.0), d2h_times(nIterations, 0.0);
+    for (int it = 0; it < nIterations; it++) {
+        for (int k = 0; k < nStrips; k++) {
+            sycl::event *ev = &events[((size_t)it * nStrips + k) * 3];
+            h2d_times[it]    += get_kernel_time(ev[0]);
+            kernel_times[it] += get_kernel_time(ev[1]);
+            d2h_times[it]    += get_kernel_time(ev[2]);
         }
     }
+    LOG("Iterations: " << nIterations << ", " << loop_time << " ms, " << loop_time / std::max(nIterations, 1) << " ms per iteration");
+    print_phase_stats("memcpyH2D", h2d_times);
+    print_phase_stats("kernel   ", kernel_times);
+    print_phase_stats("memcpyD2H", d2h_times);
+
+    //Free up device allocation
+    for (int s = 0; s < SOBEL_STREAMS; s++) {
+        sycl::free(d_input[s],    qsf);
+        sycl::free(d_gradient[s], qsf);
+    }
+
+    TIMER_START_()
 
     // write output
     if(parser.IsSet("-o")) {
@@ -22,6 +22,7 @@
  */
 
 #include "common.hpp"
+#include <algorithm>
 #include <fstream>
 #undef CPP_MODULE
 #define CPP_MODULE "COMN"
@@ -335,6 +336,17 @@ void WriteImageAsText(const Mat& outputimage, const std::string& txtFile)
     myfile.close();
 }
 
+void print_phase_stats(const std::string& name, std::vector<double> times)
+{
+    if (times.empty())
+        return;
+
+    std::sort(times.begin(), times.end());
+    size_t n = times.size();
+    double median = (n % 2) ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2.0;
+    std::cout << name << "      : min " << times[0] << " ms, median " << median << " ms, max " << times[n - 1] << " ms\n";
+}
+
 void InitializeCmdLineParser(VelocityBench::CommandLineParser &parser)
 {
     using namespace VelocityBench;
@@ -347,4 +359,6 @@ void InitializeCmdLineParser(VelocityBench::CommandLineParser &parser)
     parser.AddSetting("-tol", "tolerance",  false, "5",      VelocityBench::CommandLineParser::InputType_t::INTEGER,     1);
     parser.AddSetting("-v", "run verification",  false, "1", VelocityBench::CommandLineParser::InputType_t::INTEGER,     0);
     parser.AddSetting("-saveref", "save reference image",  false, "0", VelocityBench::CommandLineParser::InputType_t::INTEGER, 0);
+    parser.AddSetting("-strip", "# of image rows per strip",  false, "1024", VelocityBench::CommandLineParser::InputType_t::INTEGER, 1);
+    parser.AddSetting("-overlap", "overlap consecutive iterations",  false, "0", VelocityBench::CommandLineParser::InputType_t::INTEGER, 0);
 }
@@ -24,6 +24,8 @@
 #include <iostream>
 #include <math.h>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wall"
@@ -48,4 +50,5 @@ Mat preprocess(const Mat& inputImage, int scaleFactor);
 Mat compute_reference_image(const Mat& inputImage);
 bool verify_results(Mat &outputimage, Mat& refimage, int tol);
 void WriteImageAsText(const Mat& outputimage, const std::string& txtFile);
+void print_phase_stats(const std::string& name, std::vector<double> times);
 void InitializeCmdLineParser(VelocityBench::CommandLineParser &parser);
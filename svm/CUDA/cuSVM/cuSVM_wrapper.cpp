@@ -52,6 +52,8 @@ SPDX-License-Identifier: MIT License
 #include <stdio.h>
 #include <stdlib.h>
 #include <cctype>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
@@ -130,6 +132,134 @@ int CuSvmModel::Train(SvmData *_data, struct svm_params * _params, struct svm_tr
     return SUCCESS;
 }
 
+/* One-vs-one multiclass and k-fold cross-validation: one binary sub-problem
+ * per pair of classes and fold, all trained by one SVMTrainBatch call that
+ * shares the kernel rows between them. The vectors of each class are assigned
+ * to the folds round robin, so a vector is held out of every model of its
+ * fold. Each model is kept in libSVM's form, with the lower class of its pair
+ * as the positive one. With folds > 1 the held-out vectors of each fold are
+ * classified by voting over the models of that fold and the cross-validation
+ * accuracy is printed; the models are not kept. Otherwise the models are kept
+ * for StoreModel and Predict. */
+int CuSvmModel::TrainBatch(SvmData *_data, struct svm_params * _params, int folds, unsigned int *numModels) {
+    data = (CuSvmData *) _data;
+    params = _params;
+
+    if (data == NULL || params == NULL || folds < 1) {
+        return FAILURE;
+    }
+
+    unsigned int m = data->GetNumVects();
+    unsigned int numClasses = data->GetNumClasses();
+    float *labels = (float *) data->GetVectorLabelsPointer();
+    int *classLabels = data->GetClassLabelsPointer();
+    if (params->gamma == 0) {
+        params->gamma = 1.0 / data->GetDimVects();
+    }
+
+    std::vector<unsigned int> classOf(m);
+    std::vector<int> foldOf(m);
+    std::vector<int> classSize(numClasses, 0);
+    for (unsigned int i = 0; i < m; i++) {
+        classOf[i] = (unsigned int) (std::lower_bound(classLabels, classLabels + numClasses, (int) labels[i]) - classLabels);
+        foldOf[i] = classSize[classOf[i]]++ % folds;
+    }
+
+    std::vector<std::vector<int> > index;
+    std::vector<std::vector<float> > y;
+    std::vector<int> pairA, pairB, fold;
+    for (int f = 0; f < folds; f++) {
+        for (unsigned int a = 0; a < numClasses; a++) {
+            for (unsigned int b = a + 1; b < numClasses; b++) {
+                index.push_back(std::vector<int>());
+                y.push_back(std::vector<float>());
+                int numB = 0;
+                for (unsigned int i = 0; i < m; i++) {
+                    if ((classOf[i] != a && classOf[i] != b) || (folds > 1 && foldOf[i] == f)) {
+                        continue;
+                    }
+                    index.back().push_back(i);
+                    y.back().push_back(classOf[i] == b ? 1.f : -1.f);
+                    numB += classOf[i] == b;
+                }
+                if (numB == 0 || numB == (int) index.back().size()) {
+                    printf("Classes %d/%d, fold %d: both classes need a training vector (%d folds)\n",
+                        classLabels[b], classLabels[a], f, folds);
+                    return FAILURE;
+                }
+                pairA.push_back(a);
+                pairB.push_back(b);
+                fold.push_back(f);
+            }
+        }
+    }
+
+    int numProblems = (int) index.size();
+    std::vector<int> mp(numProblems);
+    std::vector<int *> indexPtr(numProblems);
+    std::vector<float *> yPtr(numProblems);
+    std::vector<std::vector<float> > alpha(numProblems);
+    std::vector<float *> alphaPtr(numProblems);
+    std::vector<float> beta(numProblems);
+    for (int p = 0; p < numProblems; p++) {
+        mp[p] = (int) index[p].size();
+        indexPtr[p] = index[p].data();
+        yPtr[p] = y[p].data();
+        alpha[p].resize(mp[p]);
+        alphaPtr[p] = alpha[p].data();
+    }
+
+    printf("Starting Training of %d sub-problems (%u classes, %d folds)\n", numProblems, numClasses, folds);
+
+    SVMTrainBatch(numProblems, mp.data(), indexPtr.data(), yPtr.data(), alphaPtr.data(), beta.data(),
+        data->GetDataDensePointer(), (float) params->C, (float) params->gamma, m, data->GetDimVects(),
+        (float) params->eps);
+
+    /* The solver's threshold beta gives dec = sum alpha * y * K + beta > 0 for class b;
+     * libSVM's model of the pair is the negation, with rho = beta. */
+    std::vector<svm_binary_model> models(numProblems);
+    for (int p = 0; p < numProblems; p++) {
+        models[p].positiveClass = pairA[p];
+        models[p].negativeClass = pairB[p];
+        models[p].rho = beta[p];
+        for (int i = 0; i < mp[p]; i++) {
+            if (alpha[p][i] > 0) {
+                models[p].svs.push_back(index[p][i]);
+                models[p].coefs.push_back(-alpha[p][i] * y[p][i]);
+            }
+        }
+        printf("Model %d: classes %d/%d, fold %d: %d vectors, %zu SVs, rho %g\n",
+            p, classLabels[pairB[p]], classLabels[pairA[p]], fold[p], mp[p], models[p].svs.size(), -beta[p]);
+    }
+    if (numProblems == 1) {
+        params->rho = -beta[0];
+    }
+
+    if (folds > 1) {
+        int numPairs = numProblems / folds;
+        unsigned int correct = 0;
+        for (int f = 0; f < folds; f++) {
+            std::vector<unsigned int> heldOut;
+            for (unsigned int i = 0; i < m; i++) {
+                if (foldOf[i] == f) {
+                    heldOut.push_back(i);
+                }
+            }
+            std::vector<int> predicted(heldOut.size());
+            PredictOneVsOne(data, heldOut.data(), (unsigned int) heldOut.size(), models.data() + f * numPairs, numPairs, predicted.data());
+            for (size_t k = 0; k < heldOut.size(); k++) {
+                correct += (float) predicted[k] == labels[heldOut[k]];
+            }
+        }
+        printf("Cross Validation Accuracy = %g%% (%u/%u)\n", 100.0 * correct / m, correct, m);
+    } else {
+        ovoModels.swap(models);
+    }
+
+    *numModels = numProblems;
+    return SUCCESS;
+}
+
 int CuSvmModel::StoreModel(char *model_file_name, SVM_MODEL_FILE_TYPE type) {
     return StoreModelGeneric(model_file_name, type);
 
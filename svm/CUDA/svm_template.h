@@ -54,6 +54,8 @@ SPDX-License-Identifier: MIT License
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <vector>
 
 #if defined WIN32 || defined WIN64
     #define MALLOC_ALIGNED(pointer, ptype, memsize, memalign) pointer=(ptype*)_aligned_malloc(memsize, memalign)
@@ -136,6 +138,10 @@ protected:
 	int load_libsvm_data_dense(FILE * &fid, SVM_DATA_TYPE data_type, svm_memory_dataformat *req_data_format);
 	int load_libsvm_data_sparse(FILE * &fid, SVM_DATA_TYPE data_type, svm_memory_dataformat *req_data_format);
 	int load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data_format);
+	int load_libsvm_data_parallel(const char *filename, bool sparse, svm_memory_dataformat *req_data_format);
+	int load_binary_cache(const struct stat &st_text, const char *cache_name, bool sparse, svm_memory_dataformat *req_data_format);
+	int store_lasvm_binary_data(const char *filename, const struct stat *src = NULL);
+	void make_class_labels(svm_memory_dataformat *req_data_format);
 	int ConvertDataToDense();
 	int ConvertDataToCSR();
 
@@ -161,19 +167,34 @@ public:
 	friend class SvmModel;
 };
 
+/* One binary model of a one-vs-one batch. The support vectors are vectors of the
+ * training data and their coefs are signed towards positiveClass: dec = sum coef * K - rho
+ * > 0 votes for positiveClass. Classes are indices into the class labels of the data. */
+struct svm_binary_model {
+	unsigned int positiveClass;
+	unsigned int negativeClass;
+	std::vector<unsigned int> svs;
+	std::vector<double> coefs;
+	double rho;
+};
+
 class SvmModel {
 private:
 protected:
 	float *alphas;
+	std::vector<svm_binary_model> ovoModels; //one-vs-one models of a multiclass batch, empty for a binary model
 	SvmData *data; //pointer to exiting external SvmData object - it is not own memory
 	struct svm_params * params;
 	bool allocatedByCudaHost;
 
 	int StoreModel_LIBSVM_TXT(char *model_file_name);
+	int StoreModelOneVsOne_LIBSVM_TXT(char *model_file_name);
 	int StoreModelGeneric(char *model_file_name, SVM_MODEL_FILE_TYPE type);
 	int LoadModel_LIBSVM_TXT(char *model_file_name, SVM_DATA_TYPE data_type, struct svm_memory_dataformat *req_data_format);
 	int LoadModelGeneric(char *model_file_name, SVM_MODEL_FILE_TYPE type, SVM_DATA_TYPE data_type, struct svm_memory_dataformat *req_data_format);
 	int CalculateSupperVectorCounts();
+	void PredictOneVsOne(SvmData *samples, const unsigned int *index, unsigned int numSamples,
+		const svm_binary_model *models, unsigned int numModels, int *predicted);
 
 public:
 	SvmModel();
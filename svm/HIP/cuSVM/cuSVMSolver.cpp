@@ -72,6 +72,8 @@ __constant__ float C;
 __constant__ float taumin;
 __constant__ float kernelwidth;
 
+extern int g_cache_size; /* kernel cache limit in MB, svm-train -r */
+
 
 #define NUM_ITERATIONS 100
 
@@ -298,6 +300,25 @@ __global__ void UpdateF(float * F,float *KernelColI,float* KernelColJ, float* d_
 	}
 
 
+}
+
+/* KernelCol[i] = KernelRow[Index[i]]: the kernel row of a sub-problem taken
+ * from a row over the full training set. */
+__global__ void GatherKernelRow(float *KernelCol, const float *KernelRow, const int *Index, int n)
+{
+
+	int totalThreads,ctaStart,tid;
+	totalThreads = gridDim.x*blockDim.x;
+	ctaStart = blockDim.x*blockIdx.x;
+	tid = threadIdx.x;
+	int i;
+
+	for (i = ctaStart + tid; i < n; i += totalThreads) 
+	{  
+		KernelCol[i] = KernelRow[Index[i]];
+	}
+
+
 }
 
 __global__ void RBFFinish(float *KernelCol, const float * KernelDotProd,const float* DotProd,const float* DotProdRow,const int n)
@@ -408,12 +429,101 @@ void DotProdVector(float * x, float* dotprod,int m, int n)
 
 }
 
-void IncrementKernelCache(std::vector<int>& KernelCacheItersSinceUsed,const int &RowsInKernelCache)
+/* Kernel rows kept in the rows (slots) of the device kernel cache, evicted in
+ * least recently used order. The slot of a training vector is found through a
+ * table indexed by the vector and the slots form a doubly linked list from the
+ * most to the least recently used one, so a lookup costs O(1) regardless of
+ * the cache size. */
+class KernelRowCache
 {
-	for(int k=0;k<RowsInKernelCache;k++)
+public:
+	KernelRowCache(int m, int rows) : SlotOfVector(m,-1), VectorInSlot(rows,-1), Prev(rows), Next(rows), Head(0), Tail(rows-1), Hits(0), Misses(0), Evictions(0)
+	{
+		for(int k=0;k<rows;k++)
+		{
+			Prev[k]=k-1;
+			Next[k]=k+1;
+		}
+		Next[rows-1]=-1;
+	}
+
+	/* Slot of the kernel row of vector i, which becomes the most recently used
+	 * one. On a miss the least recently used slot is handed out and the caller
+	 * computes the row into it. */
+	int Get(int i, bool &miss)
 	{
-		KernelCacheItersSinceUsed[k]+=1;
+		int slot=SlotOfVector[i];
+		miss=(slot<0);
+		if (miss)
+		{
+			slot=Tail;
+			if (VectorInSlot[slot]>=0)
+			{
+				SlotOfVector[VectorInSlot[slot]]=-1;
+				Evictions++;
+			}
+			VectorInSlot[slot]=i;
+			SlotOfVector[i]=slot;
+			Misses++;
+		}
+		else
+		{
+			Hits++;
+		}
+		MoveToFront(slot);
+		return slot;
 	}
+
+	void PrintStats(size_t rowBytes) const
+	{
+		unsigned long long lookups=Hits+Misses;
+		printf("Kernel cache: %i rows (%.1f MB), %llu hits, %llu misses (%.2f%% hit rate), %llu evictions\n",
+			(int)VectorInSlot.size(), (double)VectorInSlot.size()*rowBytes/(1024*1024),
+			Hits, Misses, lookups ? 100.0*Hits/lookups : 0.0, Evictions);
+	}
+
+private:
+	void MoveToFront(int slot)
+	{
+		if (slot==Head)
+			return;
+		Next[Prev[slot]]=Next[slot];
+		if (slot==Tail)
+			Tail=Prev[slot];
+		else
+			Prev[Next[slot]]=Prev[slot];
+		Prev[slot]=-1;
+		Next[slot]=Head;
+		Prev[Head]=slot;
+		Head=slot;
+	}
+
+	std::vector<int> SlotOfVector;
+	std::vector<int> VectorInSlot;
+	std::vector<int> Prev;
+	std::vector<int> Next;
+	int Head;
+	int Tail;
+	unsigned long long Hits;
+	unsigned long long Misses;
+	unsigned long long Evictions;
+};
+
+/* Rows of the kernel cache that fit into the given number of free bytes, less
+ * MBtoLeave and the -r limit. Never more than m and at least two, so the row
+ * of BJ cannot evict the row of BI within an iteration. */
+int KernelCacheRows(size_t free_mem, int m)
+{
+	size_t budget=free_mem>(size_t)MBtoLeave*1024*1024 ? free_mem-(size_t)MBtoLeave*1024*1024 : 0;
+	if (g_cache_size>0 && budget>(size_t)g_cache_size*1024*1024)
+		budget=(size_t)g_cache_size*1024*1024;
+
+	size_t rows=budget/(sizeof(float)*m);
+	if (rows>(size_t)m)
+		rows=m;
+	if (rows<2)
+		rows=std::min(2,m);
+	return (int)rows;
 }
 
 inline void UpdateAlphas(float& alphai,float& alphaj,const float& Kij,const float& yi,const float& yj,const float& Fi,const float& Fj,const float& C,const float& h_taumin)
@@ -637,28 +747,20 @@ void SVMTrain(float *mexalpha,float* beta,float*y,float *x ,float _C, float _ker
 	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_index_inter, numBlocks*sizeof(int)));
 
 	size_t free_mem, total;
-	//hipMemGetInfo(&free_mem, &total);
-    	free_mem = INT_MAX;
+	mxCUDA_SAFE_CALL(hipMemGetInfo(&free_mem, &total));
 
-	size_t KernelCacheSize=free_mem-MBtoLeave*1024*1024;
-	int RowsInKernelCache=KernelCacheSize/(sizeof(float)*m);
-
-	/* Do not use all memory available if not needed. */
-	if (RowsInKernelCache > m) {
-		RowsInKernelCache = m;
-		KernelCacheSize = m * sizeof(float) * m;
-	}
+	int RowsInKernelCache=KernelCacheRows(free_mem,m);
+	size_t KernelCacheSize=(size_t)RowsInKernelCache*m*sizeof(float);
 
 	float *d_Kernel_Cache;
 	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_Kernel_Cache, KernelCacheSize));
 
 
-	std::vector<int> KernelCacheIndices(RowsInKernelCache,-1);
-	std::vector<int> KernelCacheItersSinceUsed(RowsInKernelCache,0);
-	std::vector<int>::iterator CachePosI;
-	std::vector<int>::iterator CachePosJ;
+	KernelRowCache KernelCache(m,RowsInKernelCache);
 	int CacheDiffI;
 	int CacheDiffJ;
+	bool MissI;
+	bool MissJ;
 
 	int CheckStoppingCritEvery=255;
 	int iter=0;
@@ -707,23 +809,15 @@ void SVMTrain(float *mexalpha,float* beta,float*y,float *x ,float _C, float _ker
 		}
 
 
-        CachePosI=find(KernelCacheIndices.begin(),KernelCacheIndices.end(),BIIndex);
-		if (CachePosI ==KernelCacheIndices.end())
+		CacheDiffI=KernelCache.Get(BIIndex,MissI);
+		d_KernelI=d_Kernel_Cache+(size_t)CacheDiffI*m;
+		if (MissI)
 		{
-			CacheDiffI=max_element(KernelCacheItersSinceUsed.begin(),KernelCacheItersSinceUsed.end())-KernelCacheItersSinceUsed.begin();
-			d_KernelI=d_Kernel_Cache+CacheDiffI*m;
 			mxCUDA_SAFE_CALL(hipMemcpy(d_KernelInterRow, xT+BIIndex*n, n*sizeof(float),hipMemcpyHostToDevice));
             
             RBFKernel(d_KernelI,BIIndex,d_x,d_KernelInterRow,d_KernelDotProd,d_SelfDotProd, m,n,nbrCtas,threadsPerCta);
             hipDeviceSynchronize();
-			*(KernelCacheIndices.begin()+CacheDiffI)=BIIndex;
-		}
-		else
-		{
-			CacheDiffI=CachePosI-KernelCacheIndices.begin();
-			d_KernelI=d_Kernel_Cache+m*CacheDiffI;
 		}
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffI)=-1;
 
 
 
@@ -759,30 +853,18 @@ void SVMTrain(float *mexalpha,float* beta,float*y,float *x ,float _C, float _ker
 		float deltaalphaj = alphaj - oldalphaj;
 
 
-		CachePosJ=find(KernelCacheIndices.begin(),KernelCacheIndices.end(),BJIndex);
-		if (CachePosJ ==KernelCacheIndices.end())
+		CacheDiffJ=KernelCache.Get(BJIndex,MissJ);
+		d_KernelJ=d_Kernel_Cache+(size_t)CacheDiffJ*m;
+		if (MissJ)
 		{
-			CacheDiffJ=max_element(KernelCacheItersSinceUsed.begin(),KernelCacheItersSinceUsed.end())-KernelCacheItersSinceUsed.begin();
-			d_KernelJ=d_Kernel_Cache+CacheDiffJ*m;
 			mxCUDA_SAFE_CALL(hipMemcpy(d_KernelInterRow, xT+BJIndex*n, n*sizeof(float),hipMemcpyHostToDevice));
             RBFKernel(d_KernelJ,BJIndex,d_x,d_KernelInterRow,d_KernelDotProd, d_SelfDotProd, m,n,nbrCtas,threadsPerCta);
-			*(KernelCacheIndices.begin()+CacheDiffJ)=BJIndex;
-		}
-		else
-		{
-			CacheDiffJ=CachePosJ-KernelCacheIndices.begin();
-			d_KernelJ=d_Kernel_Cache+m*CacheDiffJ;
-
 		}
 
 
 
 		hipLaunchKernelGGL(UpdateF, nbrCtas, threadsPerCta, 0, 0, d_F,d_KernelI,d_KernelJ,d_y,deltaalphai,deltaalphaj,yi,yj,m);
 
-		IncrementKernelCache(KernelCacheItersSinceUsed,RowsInKernelCache);
-
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffI)=0;
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffJ)=0;
 
 
 
@@ -809,6 +891,7 @@ void SVMTrain(float *mexalpha,float* beta,float*y,float *x ,float _C, float _ker
 	printf("Iter:%i\n", iter);
 	printf("M:%i\n", m);
 	printf("N:%i\n", n);
+	KernelCache.PrintStats(sizeof(float)*m);
         printf("Train done. Calulate Vector counts.\n"); 
 
 
@@ -841,5 +924,283 @@ void SVMTrain(float *mexalpha,float* beta,float*y,float *x ,float _C, float _ker
 	mxCUDA_SAFE_CALL(hipDeviceReset());
 	return;
 }
+/* Device state of one sub-problem of SVMTrainBatch. Its vectors are the
+ * training vectors listed in Index; its kernel rows are gathered from the
+ * shared cache, whose rows run over all training vectors. */
+struct SubProblem
+{
+	int m;
+	const int *Index;
+	int *d_Index;
+	float *d_y;
+	float *d_alpha;
+	float *d_F;
+	float *d_KernelI;
+	float *d_KernelJ;
+	int nbrCtas;
+	int threadsPerCta;
+};
+
+extern "C"
+void SVMTrainBatch(int NumProblems, const int *mp, int * const *Index, float * const *y, float **mexalpha, float *beta, float *x, float _C, float _kernelwidth, int m, int n, float StoppingCrit)
+{
+
+	printf("_C %f\n", _C);
+	printf("Sub-problems:%i\n", NumProblems);
+
+	std::chrono::time_point<std::chrono::high_resolution_clock> start_ct1;
+	std::chrono::time_point<std::chrono::high_resolution_clock> stop_ct1;
+
+	start_ct1 = std::chrono::high_resolution_clock::now();
+
+	int numBlocks=64;
+	dim3 ReduceGrid(numBlocks, 1, 1);
+	dim3 ReduceBlock(256, 1, 1);
+
+
+	float h_taumin=0.0001;
+	mxCUDA_SAFE_CALL(hipMemcpyToSymbol(HIP_SYMBOL(taumin), &h_taumin, sizeof(float)));
+
+	_kernelwidth*=-1;
+	mxCUDA_SAFE_CALL(hipMemcpyToSymbol(HIP_SYMBOL(kernelwidth), &_kernelwidth, sizeof(float)));
+
+	mxCUDA_SAFE_CALL(hipMemcpyToSymbol(HIP_SYMBOL(C), &_C, sizeof(float)));
+
+
+	float *SelfDotProd=new float [m];
+	DotProdVector(x, SelfDotProd,m, n);
+
+	int nbrCtas;
+	int elemsPerCta;
+	int threadsPerCta;
+
+	VectorSplay (m, SAXPY_THREAD_MIN, SAXPY_THREAD_MAX, SAXPY_CTAS_MAX, &nbrCtas, &elemsPerCta,&threadsPerCta);
+
+
+	float * d_x;
+	float * d_xT;
+	float *d_KernelDotProd;
+	float *d_SelfDotProd;
+
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_x, m*n*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_xT, m*n*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMemcpy(d_x, x, sizeof(float)*n*m,hipMemcpyHostToDevice));
+	dim3 gridtranspose(ceil((float)m / TRANS_BLOCK_DIM), ceil((float)n / TRANS_BLOCK_DIM), 1);
+	dim3 threadstranspose(TRANS_BLOCK_DIM, TRANS_BLOCK_DIM, 1);
+	hipDeviceSynchronize();
+	hipLaunchKernelGGL(transpose, gridtranspose, threadstranspose, 0, 0, d_xT, d_x, m, n);
+
+	float *xT=new float [n*m];   
+	mxCUDA_SAFE_CALL(hipMemcpy(xT, d_xT, sizeof(float)*m*n,hipMemcpyDeviceToHost));
+	mxCUDA_SAFE_CALL(hipFree(d_xT));
+
+
+	float* d_KernelInterRow;
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_KernelInterRow, n*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_SelfDotProd, m*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_KernelDotProd, m*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMemcpy(d_SelfDotProd, SelfDotProd, sizeof(float)*m,hipMemcpyHostToDevice));
+
+	delete [] SelfDotProd;
+
+
+	std::vector<SubProblem> Problems(NumProblems);
+	for(int p=0;p<NumProblems;p++)
+	{
+		SubProblem &P=Problems[p];
+		P.m=mp[p];
+		P.Index=Index[p];
+		VectorSplay (P.m, SAXPY_THREAD_MIN, SAXPY_THREAD_MAX, SAXPY_CTAS_MAX, &P.nbrCtas, &elemsPerCta,&P.threadsPerCta);
+
+		std::vector<float> h_alpha(P.m,0.f);
+		std::vector<float> h_F(P.m,-1.f);
+
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_Index, P.m*sizeof(int)));
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_y, P.m*sizeof(float)));
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_alpha, P.m*sizeof(float)));
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_F, P.m*sizeof(float)));
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_KernelI, P.m*sizeof(float)));
+		mxCUDA_SAFE_CALL(hipMalloc( (void**) &P.d_KernelJ, P.m*sizeof(float)));
+
+		mxCUDA_SAFE_CALL(hipMemcpy(P.d_Index, Index[p], sizeof(int)*P.m,hipMemcpyHostToDevice));
+		mxCUDA_SAFE_CALL(hipMemcpy(P.d_y, y[p], sizeof(float)*P.m,hipMemcpyHostToDevice));
+		mxCUDA_SAFE_CALL(hipMemcpy(P.d_alpha, h_alpha.data(), sizeof(float)*P.m,hipMemcpyHostToDevice));
+		mxCUDA_SAFE_CALL(hipMemcpy(P.d_F, h_F.data(), sizeof(float)*P.m,hipMemcpyHostToDevice));
+	}
+
+
+	float* value_inter;
+	int* index_inter;
+
+	#ifdef DISABLE_CUDA_PINNED_ALLOC
+	value_inter = new float[numBlocks];
+	index_inter = new int[numBlocks];
+	#else
+	hipMallocHost( (void**)&value_inter, numBlocks*sizeof(float) );
+	hipMallocHost( (void**)&index_inter, numBlocks*sizeof(int) );
+	#endif
+
+
+	float* d_value_inter;
+	int* d_index_inter;
+
+
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_value_inter, numBlocks*sizeof(float)));
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_index_inter, numBlocks*sizeof(int)));
+
+	/* One cache for all sub-problems: a row of vector i over the full
+	 * training set serves every sub-problem that contains i. */
+	size_t free_mem, total;
+	mxCUDA_SAFE_CALL(hipMemGetInfo(&free_mem, &total));
+
+	int RowsInKernelCache=KernelCacheRows(free_mem,m);
+	size_t KernelCacheSize=(size_t)RowsInKernelCache*m*sizeof(float);
+
+	float *d_Kernel_Cache;
+	mxCUDA_SAFE_CALL(hipMalloc( (void**) &d_Kernel_Cache, KernelCacheSize));
+
+
+	KernelRowCache KernelCache(m,RowsInKernelCache);
+	int CacheDiffI;
+	int CacheDiffJ;
+	bool MissI;
+	bool MissJ;
+
+	float BIValue;
+	int BIIndex;
+	float SJValue;
+	float BJSecondOrderValue;
+	int BJIndex;
+	int GlobalI;
+	int GlobalJ;
+	float Kij;
+	float yj;
+	float yi;
+	float alphai;
+	float alphaj;
+	float oldalphai;
+	float oldalphaj;
+	float Fi;
+	float Fj;
+
+	/* The sub-problems advance in lockstep, one SMO step each per iteration,
+	 * so the rows they share are reused while they are still cached. */
+	for(int index = 0; index < NUM_ITERATIONS; index++)
+	{
+		for(int p=0;p<NumProblems;p++)
+		{
+			SubProblem &P=Problems[p];
+
+			hipLaunchKernelGGL(HIP_KERNEL_NAME(FindBI<256>), ReduceGrid, ReduceBlock, 0, 0, P.d_F, P.d_y,P.d_alpha,d_value_inter,d_index_inter, P.m);
+			mxCUDA_SAFE_CALL(hipMemcpy(value_inter, d_value_inter, sizeof(float)*numBlocks,hipMemcpyDeviceToHost));
+			mxCUDA_SAFE_CALL(hipMemcpy(index_inter, d_index_inter, sizeof(int)*numBlocks,hipMemcpyDeviceToHost));
+			CpuMaxInd(BIValue,BIIndex,value_inter,index_inter,numBlocks);
+
+			hipMemcpy(&Fi, P.d_F+BIIndex, sizeof(float),hipMemcpyDeviceToHost);
+
+			if (index == (NUM_ITERATIONS -1))
+			{
+				hipLaunchKernelGGL(HIP_KERNEL_NAME(FindStoppingJ<256>), ReduceGrid, ReduceBlock, 0, 0, P.d_F, P.d_y,P.d_alpha,d_value_inter, P.m);
+				mxCUDA_SAFE_CALL(hipMemcpy(value_inter, d_value_inter, sizeof(float)*numBlocks,hipMemcpyDeviceToHost));
+				CpuMin(SJValue,value_inter,numBlocks);
 
+				beta[p]=(SJValue+BIValue)/2;
+			}
+
+
+			GlobalI=P.Index[BIIndex];
+			CacheDiffI=KernelCache.Get(GlobalI,MissI);
+			if (MissI)
+			{
+				mxCUDA_SAFE_CALL(hipMemcpy(d_KernelInterRow, xT+(size_t)GlobalI*n, n*sizeof(float),hipMemcpyHostToDevice));
+				RBFKernel(d_Kernel_Cache+(size_t)CacheDiffI*m,GlobalI,d_x,d_KernelInterRow,d_KernelDotProd,d_SelfDotProd, m,n,nbrCtas,threadsPerCta);
+			}
+			hipLaunchKernelGGL(GatherKernelRow, P.nbrCtas,P.threadsPerCta, 0, 0, P.d_KernelI,d_Kernel_Cache+(size_t)CacheDiffI*m,P.d_Index,P.m);
+
+
+			hipLaunchKernelGGL(HIP_KERNEL_NAME(FindBJ<256>), ReduceGrid, ReduceBlock, 0, 0, P.d_F, P.d_y,P.d_alpha,P.d_KernelI,d_value_inter,d_index_inter,BIValue, P.m);
+			mxCUDA_SAFE_CALL(hipMemcpy(value_inter, d_value_inter, sizeof(float)*numBlocks,hipMemcpyDeviceToHost));
+			mxCUDA_SAFE_CALL(hipMemcpy(index_inter, d_index_inter, sizeof(int)*numBlocks,hipMemcpyDeviceToHost));
+			CpuMaxInd(BJSecondOrderValue,BJIndex,value_inter,index_inter,numBlocks);
+
+
+			mxCUDA_SAFE_CALL(hipMemcpy(&Kij, P.d_KernelI+BJIndex, sizeof(float),hipMemcpyDeviceToHost));
+
+			mxCUDA_SAFE_CALL(hipMemcpy(&alphai, P.d_alpha+BIIndex, sizeof(float),hipMemcpyDeviceToHost));
+			mxCUDA_SAFE_CALL(hipMemcpy(&alphaj, P.d_alpha+BJIndex, sizeof(float),hipMemcpyDeviceToHost));
+
+			mxCUDA_SAFE_CALL(hipMemcpy(&yi, P.d_y+BIIndex, sizeof(float),hipMemcpyDeviceToHost));
+			mxCUDA_SAFE_CALL(hipMemcpy(&yj, P.d_y+BJIndex, sizeof(float),hipMemcpyDeviceToHost));
+			mxCUDA_SAFE_CALL(hipMemcpy(&Fj, P.d_F+BJIndex, sizeof(float),hipMemcpyDeviceToHost));
+
+
+			oldalphai=alphai;
+			oldalphaj=alphaj;
+
+
+			UpdateAlphas(alphai,alphaj,Kij,yi,yj,Fi,Fj,_C,h_taumin);
+
+
+
+			mxCUDA_SAFE_CALL(hipMemcpy(P.d_alpha+BIIndex, &alphai, sizeof(float),hipMemcpyHostToDevice));
+			mxCUDA_SAFE_CALL(hipMemcpy(P.d_alpha+BJIndex, &alphaj, sizeof(float),hipMemcpyHostToDevice));
+
+			float deltaalphai = alphai - oldalphai;
+			float deltaalphaj = alphaj - oldalphaj;
+
+
+			GlobalJ=P.Index[BJIndex];
+			CacheDiffJ=KernelCache.Get(GlobalJ,MissJ);
+			if (MissJ)
+			{
+				mxCUDA_SAFE_CALL(hipMemcpy(d_KernelInterRow, xT+(size_t)GlobalJ*n, n*sizeof(float),hipMemcpyHostToDevice));
+				RBFKernel(d_Kernel_Cache+(size_t)CacheDiffJ*m,GlobalJ,d_x,d_KernelInterRow,d_KernelDotProd, d_SelfDotProd, m,n,nbrCtas,threadsPerCta);
+			}
+			hipLaunchKernelGGL(GatherKernelRow, P.nbrCtas,P.threadsPerCta, 0, 0, P.d_KernelJ,d_Kernel_Cache+(size_t)CacheDiffJ*m,P.d_Index,P.m);
+
+
+			hipLaunchKernelGGL(UpdateF, P.nbrCtas,P.threadsPerCta, 0, 0, P.d_F,P.d_KernelI,P.d_KernelJ,P.d_y,deltaalphai,deltaalphaj,yi,yj,P.m);
+		}
+	}
 
+
+	for(int p=0;p<NumProblems;p++)
+	{
+		SubProblem &P=Problems[p];
+		mxCUDA_SAFE_CALL(hipMemcpy(mexalpha[p], P.d_alpha, P.m*sizeof(float), hipMemcpyDeviceToHost));
+		mxCUDA_SAFE_CALL(hipFree(P.d_Index));
+		mxCUDA_SAFE_CALL(hipFree(P.d_y));
+		mxCUDA_SAFE_CALL(hipFree(P.d_alpha));
+		mxCUDA_SAFE_CALL(hipFree(P.d_F));
+		mxCUDA_SAFE_CALL(hipFree(P.d_KernelI));
+		mxCUDA_SAFE_CALL(hipFree(P.d_KernelJ));
+	}
+
+	stop_ct1 = std::chrono::high_resolution_clock::now();
+	float duration = std::chrono::duration<float, std::milli>(stop_ct1 - start_ct1).count();
+	printf("Total run time: %f seconds\n", duration/1000.00); 
+
+	printf("Iter:%i\n", NUM_ITERATIONS);
+	printf("M:%i\n", m);
+	printf("N:%i\n", n);
+	KernelCache.PrintStats(sizeof(float)*m);
+
+	delete [] xT;
+
+	#ifdef DISABLE_CUDA_PINNED_ALLOC
+	delete [] value_inter;
+	delete [] index_inter;
+	#else
+	hipHostFree(value_inter);
+	hipHostFree(index_inter);
+	#endif
+
+	mxCUDA_SAFE_CALL(hipFree(d_x));
+	mxCUDA_SAFE_CALL(hipFree(d_KernelInterRow));
+	mxCUDA_SAFE_CALL(hipFree(d_Kernel_Cache));
+	mxCUDA_SAFE_CALL(hipFree(d_value_inter));
+	mxCUDA_SAFE_CALL(hipFree(d_index_inter));
+	mxCUDA_SAFE_CALL(hipFree(d_SelfDotProd));
+	mxCUDA_SAFE_CALL(hipFree(d_KernelDotProd));
+	return;
+}
@@ -86,6 +86,8 @@ float C;
 float taumin;
 float kernelwidth;
 
+extern int g_cache_size; /* kernel cache limit in MB, svm-train -r */
+
 
 #ifdef USE_CUBLAS
 #define CHECK_ERROR(FUNC) checkCudaErrorMsg(FUNC, " " #FUNC)
@@ -443,6 +445,26 @@ void UpdateF(float * F,float *KernelColI,float* KernelColJ, float* d_y,float del
 	}
 
 
+}
+
+/* KernelCol[i] = KernelRow[Index[i]]: the kernel row of a sub-problem taken
+ * from a row over the full training set. */
+void GatherKernelRow(float *KernelCol, const float *KernelRow, const int *Index, int n,
+                     sycl::nd_item<3> item_ct1)
+{
+
+	int totalThreads,ctaStart,tid;
+    totalThreads = item_ct1.get_group_range(2) * item_ct1.get_local_range().get(2);
+    ctaStart = item_ct1.get_local_range().get(2) * item_ct1.get_group(2);
+    tid = item_ct1.get_local_id(2);
+    int i;
+
+	for (i = ctaStart + tid; i < n; i += totalThreads) 
+	{  
+		KernelCol[i] = KernelRow[Index[i]];
+	}
+
+
 }
 
 void RBFFinish(float *KernelCol, const float * KernelDotProd,const float* DotProd,const float* DotProdRow,const int n,
@@ -628,12 +650,101 @@ void DotProdVector(float * x, float* dotprod,int m, int n)
 
 }
 
-void IncrementKernelCache(std::vector<int>& KernelCacheItersSinceUsed,const int &RowsInKernelCache)
+/* Kernel rows kept in the rows (slots) of the device kernel cache, evicted in
+ * least recently used order. The slot of a training vector is found through a
+ * table indexed by the vector and the slots form a doubly linked list from the
+ * most to the least recently used one, so a lookup costs O(1) regardless of
+ * the cache size. */
+class KernelRowCache
 {
-	for(int k=0;k<RowsInKernelCache;k++)
+public:
+	KernelRowCache(int m, int rows) : SlotOfVector(m,-1), VectorInSlot(rows,-1), Prev(rows), Next(rows), Head(0), Tail(rows-1), Hits(0), Misses(0), Evictions(0)
 	{
-		KernelCacheItersSinceUsed[k]+=1;
+		for(int k=0;k<rows;k++)
+		{
+			Prev[k]=k-1;
+			Next[k]=k+1;
+		}
+		Next[rows-1]=-1;
 	}
+
+	/* Slot of the kernel row of vector i, which becomes the most recently used
+	 * one. On a miss the least recently used slot is handed out and the caller
+	 * computes the row into it. */
+	int Get(int i, bool &miss)
+	{
+		int slot=SlotOfVector[i];
+		miss=(slot<0);
+		if (miss)
+		{
+			slot=Tail;
+			if (VectorInSlot[slot]>=0)
+			{
+				SlotOfVector[VectorInSlot[slot]]=-1;
+				Evictions++;
+			}
+			VectorInSlot[slot]=i;
+			SlotOfVector[i]=slot;
+			Misses++;
+		}
+		else
+		{
+			Hits++;
+		}
+		MoveToFront(slot);
+		return slot;
+	}
+
+	void PrintStats(size_t rowBytes) const
+	{
+		unsigned long long lookups=Hits+Misses;
+		printf("Kernel cache: %i rows (%.1f MB), %llu hits, %llu misses (%.2f%% hit rate), %llu evictions\n",
+			(int)VectorInSlot.size(), (double)VectorInSlot.size()*rowBytes/(1024*1024),
+			Hits, Misses, lookups ? 100.0*Hits/lookups : 0.0, Evictions);
+	}
+
+private:
+	void MoveToFront(int slot)
+	{
+		if (slot==Head)
+			return;
+		Next[Prev[slot]]=Next[slot];
+		if (slot==Tail)
+			Tail=Prev[slot];
+		else
+			Prev[Next[slot]]=Prev[slot];
+		Prev[slot]=-1;
+		Next[slot]=Head;
+		Prev[Head]=slot;
+		Head=slot;
+	}
+
+	std::vector<int> SlotOfVector;
+	std::vector<int> VectorInSlot;
+	std::vector<int> Prev;
+	std::vector<int> Next;
+	int Head;
+	int Tail;
+	unsigned long long Hits;
+	unsigned long long Misses;
+	unsigned long long Evictions;
+};
+
+/* Rows of the kernel cache that fit into the given number of free bytes, less
+ * MBtoLeave and the -r limit. Never more than m and at least two, so the row
+ * of BJ cannot evict the row of BI within an iteration. */
+int KernelCacheRows(size_t free_mem, int m)
+{
+	size_t budget=free_mem>(size_t)MBtoLeave*1024*1024 ? free_mem-(size_t)MBtoLeave*1024*1024 : 0;
+	if (g_cache_size>0 && budget>(size_t)g_cache_size*1024*1024)
+		budget=(size_t)g_cache_size*1024*1024;
+
+	size_t rows=budget/(sizeof(float)*m);
+	if (rows>(size_t)m)
+		rows=m;
+	if (rows<2)
+		rows=std::min(2,m);
+	return (int)rows;
 }
 
 inline void UpdateAlphas(float& alphai,float& alphaj,const float& Kij,const float& yi,const float& yj,const float& Fi,const float& Fj,const float& C,const float& h_taumin)
@@ -974,31 +1085,31 @@ _kernelwidth*=-1;
     mxCUDA_SAFE_CALL((d_index_inter = sycl::malloc_device<int>(numBlocks * sizeof(int), q_ct1), 0));
  
 
-    size_t free_mem, total;
- 
-    //cuMemGetInfo(&free_mem, &total);
-    free_mem = INT_MAX;
-    //printf("free mem %i\n", free_mem);
+    // SYCL only reports free memory through the Intel extension, otherwise the
+    // cache may use the global memory not taken by the training vectors
+    size_t free_mem = selected_device.get_info<sycl::info::device::global_mem_size>();
+    if (selected_device.has(sycl::aspect::ext_intel_free_memory))
+        free_mem = selected_device.get_info<sycl::ext::intel::info::device::free_memory>();
+    else
+        free_mem -= std::min(free_mem, (size_t)m * n * sizeof(float));
 
-	size_t KernelCacheSize=free_mem-MBtoLeave*1024*1024;
-	int RowsInKernelCache=KernelCacheSize/(sizeof(float)*m);
+	int RowsInKernelCache=KernelCacheRows(free_mem,m);
 
-	/* Do not use all memory available if not needed. */
-	if (RowsInKernelCache > m) {
-		RowsInKernelCache = m;
-		KernelCacheSize = m * sizeof(float) * m;
-	}
+	/* The cache is a single allocation. */
+	size_t MaxAllocRows=selected_device.get_info<sycl::info::device::max_mem_alloc_size>()/(sizeof(float)*m);
+	if ((size_t)RowsInKernelCache>MaxAllocRows && MaxAllocRows>=2)
+		RowsInKernelCache=(int)MaxAllocRows;
+	size_t KernelCacheSize=(size_t)RowsInKernelCache*m*sizeof(float);
 
 	float *d_Kernel_Cache;
  
     mxCUDA_SAFE_CALL((d_Kernel_Cache = (float *)sycl::malloc_device(KernelCacheSize, q_ct1), 0));
 
-    std::vector<int> KernelCacheIndices(RowsInKernelCache,-1);
-	std::vector<int> KernelCacheItersSinceUsed(RowsInKernelCache,0);
-	std::vector<int>::iterator CachePosI;
-	std::vector<int>::iterator CachePosJ;
+	KernelRowCache KernelCache(m,RowsInKernelCache);
 	int CacheDiffI;
 	int CacheDiffJ;
+	bool MissI;
+	bool MissJ;
 
 	int CheckStoppingCritEvery=255;
 	int iter=0;
@@ -1119,29 +1230,17 @@ _kernelwidth*=-1;
 		}
 
         
-        CachePosI=find(KernelCacheIndices.begin(),KernelCacheIndices.end(),BIIndex);
-		
-        if (CachePosI ==KernelCacheIndices.end())
+		CacheDiffI=KernelCache.Get(BIIndex,MissI);
+		d_KernelI=d_Kernel_Cache+(size_t)CacheDiffI*m;
+		if (MissI)
 		{
-            
-			CacheDiffI=max_element(KernelCacheItersSinceUsed.begin(),KernelCacheItersSinceUsed.end())-KernelCacheItersSinceUsed.begin();
-			
-            d_KernelI=d_Kernel_Cache+CacheDiffI*m;
    
             mxCUDA_SAFE_CALL((q_ct1.memcpy(d_KernelInterRow, xT + BIIndex * n, n * sizeof(float)).wait(), 0));
 
             RBFKernel(d_KernelI,BIIndex,d_x,d_KernelInterRow,d_KernelDotProd,d_SelfDotProd, m,n,nbrCtas,threadsPerCta, q_ct1, elapsed_kernel_time);
             
             
-            *(KernelCacheIndices.begin()+CacheDiffI)=BIIndex;
-		}
-		else
-		{
-            
-			CacheDiffI=CachePosI-KernelCacheIndices.begin();
-			d_KernelI=d_Kernel_Cache+m*CacheDiffI;
 		}
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffI)=-1;
 
         #if KERNEL_USE_PROFILE
             queue_event = q_ct1.submit([&](sycl::handler &cgh) {
@@ -1214,25 +1313,15 @@ _kernelwidth*=-1;
 		float deltaalphaj = alphaj - oldalphaj;
 
 
-		CachePosJ=find(KernelCacheIndices.begin(),KernelCacheIndices.end(),BJIndex);
-		if (CachePosJ ==KernelCacheIndices.end())
+		CacheDiffJ=KernelCache.Get(BJIndex,MissJ);
+		d_KernelJ=d_Kernel_Cache+(size_t)CacheDiffJ*m;
+		if (MissJ)
 		{
-			CacheDiffJ=max_element(KernelCacheItersSinceUsed.begin(),KernelCacheItersSinceUsed.end())-KernelCacheItersSinceUsed.begin();
-			d_KernelJ=d_Kernel_Cache+CacheDiffJ*m;
    
 
             mxCUDA_SAFE_CALL( (q_ct1.memcpy(d_KernelInterRow, xT + BJIndex * n, n * sizeof(float)).wait(), 0));
           
             RBFKernel(d_KernelJ,BJIndex,d_x,d_KernelInterRow,d_KernelDotProd, d_SelfDotProd, m,n,nbrCtas,threadsPerCta, q_ct1, elapsed_kernel_time);
-			*(KernelCacheIndices.begin()+CacheDiffJ)=BJIndex;
-           
-
-		}
-		else
-		{
-			CacheDiffJ=CachePosJ-KernelCacheIndices.begin();
-			d_KernelJ=d_Kernel_Cache+m*CacheDiffJ;
-
 		}
 
         #if KERNEL_USE_PROFILE
@@ -1261,13 +1350,6 @@ _kernelwidth*=-1;
 
 
 
-        IncrementKernelCache(KernelCacheItersSinceUsed,RowsInKernelCache);
-
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffI)=0;
-		*(KernelCacheItersSinceUsed.begin()+CacheDiffJ)=0;
-
-
-
 		iter++;
 
 	}
@@ -1290,6 +1372,7 @@ _kernelwidth*=-1;
     printf("Iter:%i\n", iter);
 	printf("M:%i\n", m);
 	printf("N:%i\n", n);
+	KernelCache.PrintStats(sizeof(float)*m);
 
 
     mexPutVariable("base","cuSVMTrainTimeInMS",mexelapsed);
@@ -1323,3 +1406,421 @@ _kernelwidth*=-1;
    //        << ", line:" << __LINE__ << std::endl;
  //std::exit(1);
 //}
+
+
+/* Device state of one sub-problem of SVMTrainBatch. Its vectors are the
+ * training vectors listed in Index; its kernel rows are gathered from the
+ * shared cache, whose rows run over all training vectors. */
+struct SubProblem
+{
+	int m;
+	const int *Index;
+	int *d_Index;
+	float *d_y;
+	float *d_alpha;
+	float *d_F;
+	float *d_KernelI;
+	float *d_KernelJ;
+	int nbrCtas;
+	int threadsPerCta;
+};
+
+extern "C" void SVMTrainBatch(int NumProblems, const int *mp, int * const *Index, float * const *y,
+                              float **mexalpha, float *beta, float *x, float _C, float _kernelwidth,
+                              int m, int n, float StoppingCrit, int argc, const char *argv[]) {
+
+    printf("_C %f\n", _C);
+    printf("Sub-problems:%i\n", NumProblems);
+    float elapsed_kernel_time= 0;
+
+    std::chrono::time_point<std::chrono::high_resolution_clock> start_ct1;
+    std::chrono::time_point<std::chrono::high_resolution_clock> stop_ct1;
+
+    start_ct1 = std::chrono::high_resolution_clock::now();
+
+
+    sycl::device selected_device = sycl::device(sycl::default_selector());
+    sycl::context context({selected_device});
+
+    #if KERNEL_USE_PROFILE
+       auto propList = sycl::property_list{sycl::property::queue::enable_profiling()};
+       sycl::queue q_ct1(context, selected_device, propList);
+    #else
+       sycl::queue q_ct1(context, selected_device);
+    #endif
+
+
+    int numBlocks=64;
+    sycl::range<3> ReduceGrid(numBlocks, 1, 1);
+    sycl::range<3> ReduceBlock(256, 1, 1);
+
+    float h_taumin=0.0001;
+
+    taumin = h_taumin;
+    C=_C;
+    _kernelwidth*=-1;
+    kernelwidth = _kernelwidth;
+
+
+	float *SelfDotProd=new float [m];
+	DotProdVector(x, SelfDotProd,m, n);
+
+	int nbrCtas;
+	int elemsPerCta;
+	int threadsPerCta;
+
+	VectorSplay (m, SAXPY_THREAD_MIN, SAXPY_THREAD_MAX, SAXPY_CTAS_MAX, &nbrCtas, &elemsPerCta,&threadsPerCta);
+
+
+    float * d_x;
+	float * d_xT;
+	float *d_KernelDotProd;
+    float *d_SelfDotProd;
+
+    mxCUDA_SAFE_CALL((d_x = sycl::malloc_device<float>(m * n * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((d_xT = sycl::malloc_device<float>(m * n * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((q_ct1.memcpy(d_x, x, sizeof(float) * n * m).wait(), 0));
+
+
+    sycl::range<3> gridtranspose(ceil((float)m / TRANS_BLOCK_DIM),
+                              ceil((float)n / TRANS_BLOCK_DIM), 1);
+    sycl::range<3> threadstranspose(TRANS_BLOCK_DIM, TRANS_BLOCK_DIM, 1);
+
+    q_ct1.submit([&](sycl::handler &cgh) {
+
+    sycl::range<2> block_range_ct1(16 /*TRANS_BLOCK_DIM*/,
+                                 17 /*TRANS_BLOCK_DIM+1*/);
+
+    sycl::accessor<float, 2, sycl::access::mode::read_write, sycl::access::target::local> block_acc_ct1(block_range_ct1, cgh);
+
+    auto dpct_global_range = gridtranspose * threadstranspose;
+
+    cgh.parallel_for<class TransposeBatchKernel>(
+     sycl::nd_range<3>(
+          sycl::range<3>(dpct_global_range.get(2), dpct_global_range.get(1),
+                         dpct_global_range.get(0)),
+          sycl::range<3>(threadstranspose.get(2), threadstranspose.get(1),
+                         threadstranspose.get(0))),
+      [=](sycl::nd_item<3> item_ct1) {
+        unsigned int xIndex =   item_ct1.get_group(2) * TRANS_BLOCK_DIM + item_ct1.get_local_id(2);
+        unsigned int yIndex = item_ct1.get_group(1) * TRANS_BLOCK_DIM + item_ct1.get_local_id(1);
+
+        if((xIndex < m) && (yIndex < n))
+	    {
+		    unsigned int index_in = yIndex * m + xIndex;
+            block_acc_ct1[item_ct1.get_local_id(1)][item_ct1.get_local_id(2)] = d_x[index_in];
+        }
+
+        item_ct1.barrier();
+
+        xIndex = item_ct1.get_group(1) * TRANS_BLOCK_DIM + item_ct1.get_local_id(2);
+        yIndex = item_ct1.get_group(2) * TRANS_BLOCK_DIM + item_ct1.get_local_id(1);
+
+        if((xIndex < n) && (yIndex < m))
+	    {
+		    unsigned int index_out = yIndex * n + xIndex;
+            d_xT[index_out] = block_acc_ct1[item_ct1.get_local_id(2)][item_ct1.get_local_id(1)];
+        }
+      });
+    });
+
+    q_ct1.wait_and_throw();
+
+    float *xT=new float [n*m];
+
+    mxCUDA_SAFE_CALL((q_ct1.memcpy(xT, d_xT, sizeof(float) * m * n).wait(), 0));
+    (sycl::free(d_xT, q_ct1), 0);
+
+
+    float* d_KernelInterRow;
+    mxCUDA_SAFE_CALL((d_KernelInterRow = sycl::malloc_device<float>(n * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((d_SelfDotProd = sycl::malloc_device<float>(m * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((d_KernelDotProd = sycl::malloc_device<float>(m * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((q_ct1.memcpy(d_SelfDotProd, SelfDotProd, sizeof(float) * m).wait(), 0));
+
+    delete [] SelfDotProd;
+
+
+	std::vector<SubProblem> Problems(NumProblems);
+	for(int p=0;p<NumProblems;p++)
+	{
+		SubProblem &P=Problems[p];
+		P.m=mp[p];
+		P.Index=Index[p];
+		VectorSplay (P.m, SAXPY_THREAD_MIN, SAXPY_THREAD_MAX, SAXPY_CTAS_MAX, &P.nbrCtas, &elemsPerCta,&P.threadsPerCta);
+
+		std::vector<float> h_alpha(P.m,0.f);
+		std::vector<float> h_F(P.m,-1.f);
+
+        mxCUDA_SAFE_CALL((P.d_Index = sycl::malloc_device<int>(P.m, q_ct1), 0));
+        mxCUDA_SAFE_CALL((P.d_y = sycl::malloc_device<float>(P.m, q_ct1), 0));
+        mxCUDA_SAFE_CALL((P.d_alpha = sycl::malloc_device<float>(P.m, q_ct1), 0));
+        mxCUDA_SAFE_CALL((P.d_F = sycl::malloc_device<float>(P.m, q_ct1), 0));
+        mxCUDA_SAFE_CALL((P.d_KernelI = sycl::malloc_device<float>(P.m, q_ct1), 0));
+        mxCUDA_SAFE_CALL((P.d_KernelJ = sycl::malloc_device<float>(P.m, q_ct1), 0));
+
+        mxCUDA_SAFE_CALL((q_ct1.memcpy(P.d_Index, Index[p], sizeof(int) * P.m).wait(), 0));
+        mxCUDA_SAFE_CALL((q_ct1.memcpy(P.d_y, y[p], sizeof(float) * P.m).wait(), 0));
+        mxCUDA_SAFE_CALL((q_ct1.memcpy(P.d_alpha, h_alpha.data(), sizeof(float) * P.m).wait(), 0));
+        mxCUDA_SAFE_CALL((q_ct1.memcpy(P.d_F, h_F.data(), sizeof(float) * P.m).wait(), 0));
+	}
+
+
+    float* value_inter;
+    int* index_inter;
+
+    value_inter = sycl::malloc_host<float>(numBlocks, q_ct1);
+    index_inter = sycl::malloc_host<int>(numBlocks, q_ct1);
+
+
+    float* d_value_inter;
+    int* d_index_inter;
+
+    mxCUDA_SAFE_CALL((d_value_inter = sycl::malloc_device<float>(numBlocks * sizeof(float), q_ct1), 0));
+    mxCUDA_SAFE_CALL((d_index_inter = sycl::malloc_device<int>(numBlocks * sizeof(int), q_ct1), 0));
+
+
+    /* One cache for all sub-problems: a row of vector i over the full
+     * training set serves every sub-problem that contains i. */
+    size_t free_mem = selected_device.get_info<sycl::info::device::global_mem_size>();
+    if (selected_device.has(sycl::aspect::ext_intel_free_memory))
+        free_mem = selected_device.get_info<sycl::ext::intel::info::device::free_memory>();
+    else
+        free_mem -= std::min(free_mem, (size_t)m * n * sizeof(float));
+
+	int RowsInKernelCache=KernelCacheRows(free_mem,m);
+
+	size_t MaxAllocRows=selected_device.get_info<sycl::info::device::max_mem_alloc_size>()/(sizeof(float)*m);
+	if ((size_t)RowsInKernelCache>MaxAllocRows && MaxAllocRows>=2)
+		RowsInKernelCache=(int)MaxAllocRows;
+	size_t KernelCacheSize=(size_t)RowsInKernelCache*m*sizeof(float);
+
+	float *d_Kernel_Cache;
+
+    mxCUDA_SAFE_CALL((d_Kernel_Cache = (float *)sycl::malloc_device(KernelCacheSize, q_ct1), 0));
+
+	KernelRowCache KernelCache(m,RowsInKernelCache);
+	int CacheDiffI;
+	int CacheDiffJ;
+	bool MissI;
+	bool MissJ;
+
+	float BIValue;
+	int BIIndex;
+	float SJValue;
+	float BJSecondOrderValue;
+	int BJIndex;
+	int GlobalI;
+	int GlobalJ;
+	float Kij;
+	float yj;
+	float yi;
+	float alphai;
+	float alphaj;
+	float oldalphai;
+	float oldalphaj;
+	float Fi;
+	float Fj;
+
+    auto dpct_global_range = ReduceGrid * ReduceBlock;
+    sycl::nd_range<3> ReduceRange(sycl::range<3>(dpct_global_range.get(2),
+                                                 dpct_global_range.get(1),
+                                                 dpct_global_range.get(0)),
+                                  sycl::range<3>(ReduceBlock.get(2), ReduceBlock.get(1),
+                                                 ReduceBlock.get(0)));
+
+	/* The sub-problems advance in lockstep, one SMO step each per iteration,
+	 * so the rows they share are reused while they are still cached. */
+    for(int index = 0; index < NUM_ITERATIONS; index++)
+    {
+		for(int p=0;p<NumProblems;p++)
+		{
+			SubProblem &P=Problems[p];
+			float *d_F=P.d_F;
+			float *d_y=P.d_y;
+			float *d_alpha=P.d_alpha;
+			float *d_KernelI=P.d_KernelI;
+			float *d_KernelJ=P.d_KernelJ;
+			int *d_Index=P.d_Index;
+			int pm=P.m;
+
+            q_ct1.submit([&](sycl::handler &cgh) {
+
+                auto C_ptr_ct1 = C;
+
+                sycl::accessor<float, 1, sycl::access::mode::read_write, sycl::access::target::local> sdata_acc_ct1(sycl::range<1>(256), cgh);
+                sycl::accessor<int, 1, sycl::access::mode::read_write, sycl::access::target::local> ind_acc_ct1(sycl::range<1>(256), cgh);
+
+                cgh.parallel_for<class FindBIBatchKernel>(ReduceRange,
+                            [=](sycl::nd_item<3> item_ct1) {
+                                FindBI<256>(d_F, d_y, d_alpha, d_value_inter, d_index_inter, pm,
+                                 item_ct1, C_ptr_ct1, sdata_acc_ct1.get_pointer(),
+                                 ind_acc_ct1.get_pointer());
+                            });
+            });
+
+            q_ct1.wait_and_throw();
+
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(value_inter, d_value_inter, sizeof(float) * numBlocks).wait(), 0));
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(index_inter, d_index_inter, sizeof(int) * numBlocks).wait(), 0));
+            CpuMaxInd(BIValue,BIIndex,value_inter,index_inter,numBlocks);
+
+            q_ct1.memcpy(&Fi, d_F + BIIndex, sizeof(float)).wait();
+
+			if (index == (NUM_ITERATIONS -1))
+			{
+                q_ct1.submit([&](sycl::handler &cgh) {
+
+                    auto C_ptr_ct1 = C;
+
+                    sycl::accessor<float, 1, sycl::access::mode::read_write, sycl::access::target::local> sdata_acc_ct1(sycl::range<1>(256), cgh);
+
+                    cgh.parallel_for<class FindStoppingJBatchKernel>(ReduceRange,
+                             [=](sycl::nd_item<3> item_ct1) {
+                                FindStoppingJ<256>(d_F, d_y, d_alpha, d_value_inter, pm, item_ct1,
+                                C_ptr_ct1, sdata_acc_ct1.get_pointer());
+                    });
+                });
+
+                q_ct1.wait_and_throw();
+
+                mxCUDA_SAFE_CALL((q_ct1.memcpy(value_inter, d_value_inter, sizeof(float) * numBlocks).wait(), 0));
+				CpuMin(SJValue,value_inter,numBlocks);
+
+				beta[p]=(SJValue+BIValue)/2;
+			}
+
+
+			GlobalI=P.Index[BIIndex];
+			CacheDiffI=KernelCache.Get(GlobalI,MissI);
+			float *d_RowI=d_Kernel_Cache+(size_t)CacheDiffI*m;
+			if (MissI)
+			{
+                mxCUDA_SAFE_CALL((q_ct1.memcpy(d_KernelInterRow, xT + (size_t)GlobalI * n, n * sizeof(float)).wait(), 0));
+                RBFKernel(d_RowI,GlobalI,d_x,d_KernelInterRow,d_KernelDotProd,d_SelfDotProd, m,n,nbrCtas,threadsPerCta, q_ct1, elapsed_kernel_time);
+			}
+
+            q_ct1.submit([&](sycl::handler &cgh) {
+                cgh.parallel_for<class GatherKernelRowIKernel>(sycl::nd_range<3>(sycl::range<3>(1, 1, P.nbrCtas) *
+                                              sycl::range<3>(1, 1, P.threadsPerCta),
+                                          sycl::range<3>(1, 1, P.threadsPerCta)),
+                        [=](sycl::nd_item<3> item_ct1) {
+                         GatherKernelRow(d_KernelI, d_RowI, d_Index, pm, item_ct1);
+                        });
+            });
+
+
+            q_ct1.submit([&](sycl::handler &cgh) {
+
+                auto C_ptr_ct1 = C;
+                auto taumin_ptr_ct1 = taumin;
+
+                sycl::accessor<float, 1, sycl::access::mode::read_write, sycl::access::target::local> sdata_acc_ct1(sycl::range<1>(256), cgh);
+                sycl::accessor<int, 1, sycl::access::mode::read_write, sycl::access::target::local> ind_acc_ct1(sycl::range<1>(256), cgh);
+
+                cgh.parallel_for<class FindBJBatchKernel>(ReduceRange,
+                                [=](sycl::nd_item<3> item_ct1) {
+                                    FindBJ<256>(d_F, d_y, d_alpha, d_KernelI, d_value_inter, d_index_inter,
+                                    BIValue, pm, item_ct1, C_ptr_ct1,taumin_ptr_ct1,
+                                    sdata_acc_ct1.get_pointer(), ind_acc_ct1.get_pointer());
+                                });
+            });
+
+            q_ct1.wait_and_throw();
+
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(value_inter, d_value_inter, sizeof(float) * numBlocks).wait(), 0));
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(index_inter, d_index_inter, sizeof(int) * numBlocks).wait(), 0));
+			CpuMaxInd(BJSecondOrderValue,BJIndex,value_inter,index_inter,numBlocks);
+
+
+            mxCUDA_SAFE_CALL( (q_ct1.memcpy(&Kij, d_KernelI + BJIndex, sizeof(float)).wait(), 0));
+
+            mxCUDA_SAFE_CALL( (q_ct1.memcpy(&alphai, d_alpha + BIIndex, sizeof(float)).wait(), 0));
+            mxCUDA_SAFE_CALL( (q_ct1.memcpy(&alphaj, d_alpha + BJIndex, sizeof(float)).wait(), 0));
+
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(&yi, d_y + BIIndex, sizeof(float)).wait(), 0));
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(&yj, d_y + BJIndex, sizeof(float)).wait(), 0));
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(&Fj, d_F + BJIndex, sizeof(float)).wait(), 0));
+
+
+			oldalphai=alphai;
+			oldalphaj=alphaj;
+
+
+			UpdateAlphas(alphai,alphaj,Kij,yi,yj,Fi,Fj,_C,h_taumin);
+
+
+            mxCUDA_SAFE_CALL((q_ct1.memcpy(d_alpha + BIIndex, &alphai, sizeof(float)).wait(), 0));
+            mxCUDA_SAFE_CALL( (q_ct1.memcpy(d_alpha + BJIndex, &alphaj, sizeof(float)).wait(), 0));
+
+			float deltaalphai = alphai - oldalphai;
+			float deltaalphaj = alphaj - oldalphaj;
+
+
+			GlobalJ=P.Index[BJIndex];
+			CacheDiffJ=KernelCache.Get(GlobalJ,MissJ);
+			float *d_RowJ=d_Kernel_Cache+(size_t)CacheDiffJ*m;
+			if (MissJ)
+			{
+                mxCUDA_SAFE_CALL( (q_ct1.memcpy(d_KernelInterRow, xT + (size_t)GlobalJ * n, n * sizeof(float)).wait(), 0));
+                RBFKernel(d_RowJ,GlobalJ,d_x,d_KernelInterRow,d_KernelDotProd, d_SelfDotProd, m,n,nbrCtas,threadsPerCta, q_ct1, elapsed_kernel_time);
+			}
+
+            q_ct1.submit([&](sycl::handler &cgh) {
+                cgh.parallel_for<class GatherKernelRowJKernel>(sycl::nd_range<3>(sycl::range<3>(1, 1, P.nbrCtas) *
+                                              sycl::range<3>(1, 1, P.threadsPerCta),
+                                          sycl::range<3>(1, 1, P.threadsPerCta)),
+                        [=](sycl::nd_item<3> item_ct1) {
+                         GatherKernelRow(d_KernelJ, d_RowJ, d_Index, pm, item_ct1);
+                        });
+            });
+
+            q_ct1.submit([&](sycl::handler &cgh) {
+                cgh.parallel_for<class UpdateFBatchKernel>(sycl::nd_range<3>(sycl::range<3>(1, 1, P.nbrCtas) *
+                                              sycl::range<3>(1, 1, P.threadsPerCta),
+                                          sycl::range<3>(1, 1, P.threadsPerCta)),
+                        [=](sycl::nd_item<3> item_ct1) {
+                         UpdateF(d_F, d_KernelI, d_KernelJ, d_y, deltaalphai,
+                                 deltaalphaj, yi, yj, pm, item_ct1);
+                        });
+            });
+
+            q_ct1.wait_and_throw();
+		}
+	}
+
+
+	for(int p=0;p<NumProblems;p++)
+	{
+		SubProblem &P=Problems[p];
+        q_ct1.memcpy(mexalpha[p], P.d_alpha, P.m * sizeof(float)).wait();
+        mxCUDA_SAFE_CALL((sycl::free(P.d_Index, q_ct1), 0));
+        mxCUDA_SAFE_CALL((sycl::free(P.d_y, q_ct1), 0));
+        mxCUDA_SAFE_CALL((sycl::free(P.d_alpha, q_ct1), 0));
+        mxCUDA_SAFE_CALL((sycl::free(P.d_F, q_ct1), 0));
+        mxCUDA_SAFE_CALL((sycl::free(P.d_KernelI, q_ct1), 0));
+        mxCUDA_SAFE_CALL((sycl::free(P.d_KernelJ, q_ct1), 0));
+	}
+
+    stop_ct1 = std::chrono::high_resolution_clock::now();
+    float duration = std::chrono::duration<float, std::milli>(stop_ct1 - start_ct1).count();
+    printf("Total run time: %f seconds\n", duration/1000.00);
+
+    printf("Iter:%i\n", NUM_ITERATIONS);
+	printf("M:%i\n", m);
+	printf("N:%i\n", n);
+	KernelCache.PrintStats(sizeof(float)*m);
+
+	delete [] xT;
+
+    sycl::free(value_inter, q_ct1);
+    sycl::free(index_inter, q_ct1);
+
+    mxCUDA_SAFE_CALL((sycl::free(d_x, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_KernelInterRow, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_Kernel_Cache, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_value_inter, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_index_inter, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_SelfDotProd, q_ct1), 0));
+    mxCUDA_SAFE_CALL((sycl::free(d_KernelDotProd, q_ct1), 0));
+}
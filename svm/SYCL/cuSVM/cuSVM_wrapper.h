@@ -75,6 +75,22 @@ extern "C" void SVMTrain(float *mexalpha, float *beta, float *y, float *x,
                          float _C, float _kernelwidth, int m, int n,
                          float StoppingCrit, int argc, const char *argv[]);
 
+/* Train several binary sub-problems of one training set at once */
+/**
+  * NumProblems  Number of sub-problems.
+  * mp           Number of training vectors of each sub-problem.
+  * Index        Per sub-problem: indices of its vectors into x.
+  * y            Per sub-problem: its labels (+1/-1).
+  * mexalpha     Per sub-problem: output alpha values.
+  * beta         Output SVM threshold of each sub-problem.
+  * x            input matrix of all training vectors (transposed).
+  * m            Number of rows of x.
+  * (other parameters as in SVMTrain)
+  */
+extern "C" void SVMTrainBatch(int NumProblems, const int *mp, int * const *Index, float * const *y,
+                              float **mexalpha, float *beta, float *x, float _C, float _kernelwidth,
+                              int m, int n, float StoppingCrit, int argc, const char *argv[]);
+
 
 /*paddedm = (m & 0xFFFFFFE0) + ((m & 0x1F) ? 0x20 : 0);*/
 /*  int ceiled_pm_ni = (paddedm + NecIterations - 1) / NecIterations;
@@ -115,6 +131,7 @@ public:
     //~CuSvmModel();
 
     int Train(SvmData *data, struct svm_params * params, struct svm_trainingInfo *trainingInfo);
+    int TrainBatch(SvmData *data, struct svm_params * params, int folds, unsigned int *numModels);
     int StoreModel(const char *model_file_name, SVM_MODEL_FILE_TYPE type);
     //int Delete();
 };
@@ -68,9 +68,11 @@ SPDX-License-Identifier: MIT License
 using namespace libsvm;
 
 int g_cache_size = 0;
+int g_cv_folds = 0;
 bool g_step_on_cpu = false;
 int g_ws_size = 0;
 std::string g_imp_spec_arg;
+std::string g_test_file;
 
 int help(int argc, const char *argv[], SvmData * &data, SvmModel * &model, struct svm_params * params, SVM_FILE_TYPE *file_type, SVM_DATA_TYPE *data_type, SVM_MODEL_FILE_TYPE *model_file_type);
 
@@ -81,7 +83,7 @@ int main(int argc, const char *argv[]) {
     SVM_FILE_TYPE file_type = LIBSVM_TXT;
     SVM_DATA_TYPE data_type = UNKNOWN;
     SVM_MODEL_FILE_TYPE model_file_type = M_LIBSVM_TXT;
-    MyStopWatch clAll, clLoad, clProc, clStore;
+    MyStopWatch clAll, clLoad, clProc, clPredict, clStore;
     SvmData *data;
     SvmModel *model;
 
@@ -104,18 +106,37 @@ int main(int argc, const char *argv[]) {
 
 
     clProc.start();
-    /* Train model. */
-
-     
-    
-    if(model->Train(data, &params, &trainingInfo) != SUCCESS) {
+    /* Train model. More than two classes or -v train all sub-problems in one batch. */
+    bool batch = g_cv_folds > 1 || data->GetNumClasses() > 2;
+    unsigned int numModels = 1;
+    if(batch) {
+        if(((CuSvmModel *) model)->TrainBatch(data, &params, g_cv_folds > 1 ? g_cv_folds : 1, &numModels) != SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    } else if(model->Train(data, &params, &trainingInfo) != SUCCESS) {
         return EXIT_FAILURE;
     }
     clProc.stop();
     printf("Training done \n");
+    /* Predict the labels of the test set (-P), stored in <model>.predict. */
+    if(g_cv_folds <= 1 && !g_test_file.empty()) {
+        clPredict.start();
+        SvmData *testData = new CuSvmData;
+        std::string results = std::string(argv[2]) + ".predict";
+        if(testData->Load(g_test_file.c_str(), file_type, data_type) != SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        if(model->Predict(testData, results.c_str()) != SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        delete testData;
+        clPredict.stop();
+    }
     clStore.start();
     /* Predict values. */
-    if(model->StoreModel(argv[2], model_file_type) != SUCCESS) {
+    if(g_cv_folds > 1) {
+        printf("Cross validation: no model stored\n");
+    } else if(model->StoreModel(argv[2], model_file_type) != SUCCESS) {
         return EXIT_FAILURE;
     }
 
@@ -130,8 +151,15 @@ int main(int argc, const char *argv[]) {
     /* Print results. */
     printf("\nLoading    elapsed time : %0.4f s\n", clLoad.getTime());
     printf("Processing elapsed time : %0.4f s\n", clProc.getTime());
+    if (!g_test_file.empty()) {
+        printf("Predicting elapsed time : %0.4f s\n", clPredict.getTime());
+    }
     printf("Storing    elapsed time : %0.4f s\n", clStore.getTime());
     printf("Total      elapsed time : %0.4f s\n", clAll.getTime());
+    printf("Models trained          : %u (%0.1f models/hour)\n", numModels, numModels * 3600.0 / clProc.getTime());
+    if (batch) {
+        return EXIT_SUCCESS;
+    }
     if ((params.rho < 0.06) && (params.rho > 0.05)) {
         printf("Result's are correct: %0.4f \n", params.rho);
     } else {
@@ -165,7 +193,20 @@ int help(int argc, const char *argv[], SvmData * &data, SvmModel * &model, struc
     params->nu = 0.5;            /*n*/
     params->p = 0.1;            /*p, regression parameter epsilon*/
     imp = 3;                    /*i*/
-   
+
+    /* Only the kernel cache size (-r, MB), the number of folds (-v) and the test set (-P) are taken from the attributes. */
+    for (i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-r") == 0) {
+            g_cache_size = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-v") == 0) {
+            g_cv_folds = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-P") == 0) {
+            g_test_file = argv[i + 1];
+        }
+    }
+
     printf("Using cuSVM (Carpenter)...\n\n");
     data = new CuSvmData;
     model = new CuSvmModel;
@@ -207,6 +248,8 @@ void print_help() {
         "  b  Read input data in binary format (lasvm dense or sparse format)\n"
         "  w  Working set size (currently only for implementation 16)\n"
         "  r  Cache size in MB\n"
+        "  v  Number of cross-validation folds (trains all folds in one batch)\n"
+        "  P  Test data file: predict its labels with the trained model\n"
         "  x  Implementation specific parameter:\n"
         "     OHD-SVM: Two numbers separated by comma specifying EllR-T\n"
         "              storage format dimensions: sliceSize,threadsPerRow\n"
@@ -59,6 +59,17 @@ SPDX-License-Identifier: MIT License
 #include <fstream>
 #include <algorithm>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <sys/stat.h>
+#if !(defined WIN32 || defined WIN64)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace libsvm;
 
@@ -169,34 +180,44 @@ int SvmData::Load(const char *filename, SVM_FILE_TYPE file_type, SVM_DATA_TYPE d
 
 	Delete();
 
-	float * labels_tmp = NULL;
+	/* Read data from file. */
+	switch(file_type) {
+	case LIBSVM_TXT:
+		{
+			bool sparse = (req_data_format->supported_types & SUPPORTED_FORMAT_CSR) && (data_type == UNKNOWN || data_type == SPARSE);
+			std::string cache_name = std::string(filename) + (sparse ? ".csr.bin" : ".dense.bin");
 
-	if(file_type == LASVM_BINARY) {
-		FILE_SAFE_OPEN(fid, filename, "rb")
-	} else {
-		FILE_SAFE_OPEN(fid, filename, "r")
-	}
+			/* Stat before parsing: a cache must never claim a newer text file than it was parsed from. */
+			struct stat st_text;
+			bool regular = stat(filename, &st_text) == 0 && S_ISREG(st_text.st_mode);
+
+			if(regular && load_binary_cache(st_text, cache_name.c_str(), sparse, req_data_format) == SUCCESS) break;
 
-		/* Read data from file. */
-		switch(file_type) {
-		case LIBSVM_TXT:
-			if((req_data_format->supported_types & SUPPORTED_FORMAT_CSR) && (data_type == UNKNOWN || data_type == SPARSE)) {
+			if(load_libsvm_data_parallel(filename, sparse, req_data_format) == SUCCESS) {
+				store_lasvm_binary_data(cache_name.c_str(), &st_text);
+				break;
+			}
+
+			/* Not a regular file (e.g. a pipe): sequential parsers. */
+			FILE_SAFE_OPEN(fid, filename, "r")
+			if(sparse) {
 				load_libsvm_data_sparse(fid, data_type, req_data_format);
 			} else {
 				load_libsvm_data_dense(fid, data_type, req_data_format);
 			}
-			break;
-		case LASVM_BINARY:
-			load_lasvm_binary_data(fid, req_data_format);
-			break;
-		default:
-			printf("Format of the data file not supported or the setting is wrong\n");
-			return FAILURE;
+			fclose(fid);
+		}
+		break;
+	case LASVM_BINARY:
+		FILE_SAFE_OPEN(fid, filename, "rb")
+		load_lasvm_binary_data(fid, req_data_format);
+		fclose(fid);
+		break;
+	default:
+		printf("Format of the data file not supported or the setting is wrong\n");
+		return FAILURE;
 	}
 
-	/* Close streams. */
-	fclose(fid);
-
 	//if(data_type == SPARSE && (req_data_format->supported_types & SPARSE) == 0) ConvertDataToDense(req_data_format);
 	//if(data_type == DENSE && (req_data_format->supported_types & DENSE) == 0) ConvertDataToCSR(req_data_format);
 
@@ -461,35 +482,7 @@ int SvmData::load_libsvm_data_dense(FILE * &fid, SVM_DATA_TYPE data_type, svm_me
 	this->type = DENSE;
 	transposed = req_data_format->transposed;
 
-	//make class labels
-	int max_idx = -2;
-	for(unsigned int i=0; i < numVects; i++) {
-		if(max_idx < vector_labels[i]) max_idx = vector_labels[i];
-	}
-	class_labels = (int *) malloc(sizeof(int) * (max_idx + 2));
-	for(int i=0; i < max_idx + 2; i++) class_labels[i] = -2;
-	for(unsigned int i=0; i < numVects; i++) {
-		int ci = vector_labels[i];
-		if(ci < -1) REPORT_ERROR("Class index lower than -1");
-		if(class_labels[ci+1] == -2) class_labels[ci+1] = ci;
-	}
-	numClasses = 0;
-	for(int i=0; i < max_idx + 2; i++) {
-		if(class_labels[i] != -2) {
-			class_labels[numClasses] = class_labels[i];
-			numClasses++;
-		}
-	}
-
-	//store if the first label is negative: to LibSVM compatibility of stored model:
-	invertLabels = !(vector_labels[0] == 1);
-
-	//if float labels required:
-	if(req_data_format->labelsInFloat) {
-		labelsInFloat = true;
-		float *p = (float *)vector_labels;
-		for(unsigned int i=0; i < numVects; i++) p[i] = (float) vector_labels[i];
-	}
+	make_class_labels(req_data_format);
 
 	return 0;
 } //SvmData::load_libsvm_data_dense
@@ -749,35 +742,7 @@ int SvmData::load_libsvm_data_sparse(FILE * &fid, SVM_DATA_TYPE data_type, svm_m
 	if(req_data_format->transposed) REPORT_WARNING("Warning: CSR data format cannot be transposed")
 	transposed = false;
 
-	//make class labels
-	int max_idx = -2;
-	for(unsigned int i=0; i < numVects; i++) {
-		if(max_idx < vector_labels[i]) max_idx = vector_labels[i];
-	}
-	class_labels = (int *) malloc(sizeof(int) * (max_idx + 2));
-	for(int i=0; i < max_idx + 2; i++) class_labels[i] = -2;
-	for(unsigned int i=0; i < numVects; i++) {
-		int ci = vector_labels[i];
-		if(ci < -1) REPORT_ERROR("Class index lower than -1");
-		if(class_labels[ci+1] == -2) class_labels[ci+1] = ci;
-	}
-	numClasses = 0;
-	for(int i=0; i < max_idx + 2; i++) {
-		if(class_labels[i] != -2) {
-			class_labels[numClasses] = class_labels[i];
-			numClasses++;
-		}
-	}
-
-	//store if the first label is negative: to LibSVM compatibility of stored model:
-	invertLabels = !(vector_labels[0] == 1);
-
-	//if float labels required:
-	if(req_data_format->labelsInFloat) {
-		labelsInFloat = true;
-		float *p = (float *)vector_labels;
-		for(unsigned int i=0; i < numVects; i++) p[i] = (float) vector_labels[i];
-	}
+	make_class_labels(req_data_format);
 
 	return 0;
 } //load_libsvm_data_sparse
@@ -786,15 +751,13 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 	Delete();
 
 	unsigned int buf[2];
-	if (fread(&buf, sizeof(int), 2, fid) != (sizeof(int) * 2))
+	if (fread(&buf, sizeof(int), 2, fid) != 2)
 		exit(EXIT_FAILURE);
 
 	this->numVects = buf[0];
 	if (this->numVects == 0)
 		exit(EXIT_FAILURE);
-	
-	
-	
+
 	numVects_aligned = ALIGN_UP(numVects, req_data_format->vectAlignment);
 	malloc_general(req_data_format, (void**)&vector_labels, sizeof(float) * numVects_aligned);
 	dimVects = buf[1];
@@ -803,22 +766,22 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 		dimVects_aligned = ALIGN_UP(dimVects, req_data_format->dimAlignment);
 		malloc_general(req_data_format, (void**)&data_dense, sizeof(float) * numVects_aligned * dimVects_aligned);
 		memset(data_dense, 0, sizeof(float) * numVects_aligned * dimVects_aligned);
+		std::vector<float> row(req_data_format->transposed ? dimVects : 0);
 		for(unsigned int i = 0; i < numVects; i++) {
 			int label = 0;
-			if (fread(&label, sizeof(int), 1, fid) != sizeof(int))
+			if (fread(&label, sizeof(int), 1, fid) != 1)
 				exit(EXIT_FAILURE);
 
 			vector_labels[i] = label;
 			if(req_data_format->transposed) {
-				float value;
-				for(unsigned int k = 0; k < dimVects; k++) {
-					if (fread(&value, sizeof(float), 1, fid) != sizeof(float))
-						exit(EXIT_FAILURE);
+				if (fread(row.data(), sizeof(float), dimVects, fid) != dimVects)
+					exit(EXIT_FAILURE);
 
-					data_dense[k*numVects_aligned + i] = value;
+				for(unsigned int k = 0; k < dimVects; k++) {
+					data_dense[k*numVects_aligned + i] = row[k];
 				}
 			} else {
-				if (fread(data_dense + i*dimVects_aligned, sizeof(float), dimVects, fid) != (sizeof(float) * dimVects))
+				if (fread(data_dense + (size_t)i*dimVects_aligned, sizeof(float), dimVects, fid) != dimVects)
 					exit(EXIT_FAILURE);
 
 			}
@@ -836,29 +799,20 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 		data_csr->rowOffsets[0] = 0;
 		for(unsigned int i = 0; i < numVects; i++) {
 			int label = 0;
-			if (fread(&label, sizeof(int), 1, fid) != sizeof(int))
+			if (fread(&label, sizeof(int), 1, fid) != 1)
 				exit(EXIT_FAILURE);
 			vector_labels[i] = label;
 			//count nnz:
 			unsigned int count = 0;
-			if (fread(&count, sizeof(int), 1, fid) != sizeof(int))
+			if (fread(&count, sizeof(int), 1, fid) != 1)
 				exit(EXIT_FAILURE);
 
 			data_csr->nnz += count;
 			data_csr->rowOffsets[i+1] = data_csr->nnz;
 			if (fseek(fid, count * (sizeof(int) + sizeof(float)), SEEK_CUR) != 0)
 				exit(EXIT_FAILURE);
-
-			//float foo_f;
-			//int foo_i[14];
-			//skip values in the first pass, fseek doesn work properly
-			//for(unsigned int foo=0; foo < count; foo++) {
-			//	fread(foo_i, sizeof(int), 14, fid);
-			//}
-			//for(unsigned int foo=0; foo < count; foo++) {
-			//	fread(&foo_f, sizeof(float), 1, fid);
-			//}
 		}
+		for(unsigned int i = numVects + 1; i < numVects_aligned + 1; i++) data_csr->rowOffsets[i] = data_csr->nnz; //fill the padded area
 		malloc_general(req_data_format, (void**)&(data_csr->values), sizeof(float) * data_csr->nnz);
 		malloc_general(req_data_format, (void**)&(data_csr->colInd), sizeof(int) * data_csr->nnz);
 		
@@ -866,24 +820,21 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 			exit(EXIT_FAILURE);
 
 		for(unsigned int i = 0; i < numVects; i++) {
-			int label = 0;
-			if (fread(&label, sizeof(int), 1, fid) != sizeof(int))
-				exit(EXIT_FAILURE);
-			
-			unsigned int count = 0;
+			unsigned int count = data_csr->rowOffsets[i+1] - data_csr->rowOffsets[i];
 
-			if (fread(&count, sizeof(int), 1, fid) != sizeof(int))
+			//label and count were read in the first pass
+			if (fseek(fid, 2*sizeof(int), SEEK_CUR) != 0)
 				exit(EXIT_FAILURE);
 
-			if (fread(data_csr->colInd + data_csr->rowOffsets[i], sizeof(int), count, fid) != sizeof(int))
+			if (fread(data_csr->colInd + data_csr->rowOffsets[i], sizeof(int), count, fid) != count)
 				exit(EXIT_FAILURE);
 
-			if (fread(data_csr->values + data_csr->rowOffsets[i], sizeof(float), count, fid) != sizeof(float))
+			if (fread(data_csr->values + data_csr->rowOffsets[i], sizeof(float), count, fid) != count)
 				exit(EXIT_FAILURE);
-			
-			
-			unsigned int maxDim = 1 + data_csr->colInd[data_csr->rowOffsets[i+1]-1];
-			if(dimVects < maxDim) dimVects = maxDim;
+
+			for(unsigned int k = data_csr->rowOffsets[i]; k < data_csr->rowOffsets[i+1]; k++) {
+				if(dimVects <= data_csr->colInd[k]) dimVects = data_csr->colInd[k] + 1;
+			}
 		}
 		dimVects_aligned = ALIGN_UP(dimVects, req_data_format->dimAlignment);
 		data_csr->numCols = dimVects;
@@ -891,7 +842,320 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 		printf("NNZ: %d\n%% NNZ: %.3lf\nAvg. NNZ per row: %.3lf\n", data_csr->nnz, 100. * data_csr->nnz / (numVects * dimVects), data_csr->nnz / (double)numVects);
 		
 	}
+	allocatedByCudaHost = req_data_format->allocate_pinned || req_data_format->allocate_write_combined;
+
+	make_class_labels(req_data_format);
+
+	return 0;
+} //load_lasvm_binary_data
+
+/* Rows of one newline-aligned slice of a LIBSVM text file in CSR layout. */
+struct LibsvmChunk {
+	char *begin;
+	char *end;
+	std::vector<int> labels;
+	std::vector<unsigned int> rowOffsets;
+	std::vector<unsigned int> colInd;
+	std::vector<float> values;
+	unsigned int numLines;
+	unsigned int errorLine; //first malformed line within the chunk, 0 if none
+	unsigned int dim;
+	size_t firstRow;
+	size_t firstNnz;
+};
+
+/* Every line in [begin, end) has to be terminated by '\n'. */
+static void parse_libsvm_chunk(LibsvmChunk &c) {
+	char *buf = c.begin;
+
+	c.numLines = 0;
+	c.errorLine = 0;
+	c.dim = 0;
+	c.rowOffsets.push_back(0);
+	while (buf < c.end) {
+		c.numLines++;
+		if (*buf == '\n') {
+			/* Empty line. */
+			buf++;
+			continue;
+		}
+		if (*buf != '-' && *buf != '+' && (*buf < '0' || *buf > '9')) {
+			c.errorLine = c.numLines;
+			return;
+		}
+		/* Read alpha. */
+		c.labels.push_back(strtol(buf, &buf, 10));
+		while (*buf != ' ' && *buf != '\n') buf++;
+
+		while (*buf != '\n') {
+			if (*buf == ' ') {
+				buf++;
+				continue;
+			}
+			/* Read index. */
+			unsigned int j = 0;
+			char *idx = buf;
+			while (*buf >= '0' && *buf <= '9') j = 10 * j + (*(buf++) - 0x30);
+			if (buf == idx || j == 0 || *buf != ':' || buf[1] == ' ' || buf[1] == '\n') {
+				c.errorLine = c.numLines;
+				return;
+			}
+			buf++;
+
+			/* Read value. */
+			c.values.push_back(strtof_fast(buf, &buf));
+			c.colInd.push_back(j - 1);
+			if (c.dim < j) c.dim = j;
+		}
+		buf++;
+		c.rowOffsets.push_back((unsigned int) c.colInd.size());
+	}
+}
+
+/* Runs fn(k) for k = 0..n-1 on n threads. */
+template <typename F>
+static void run_parallel(size_t n, F fn) {
+	std::vector<std::thread> threads;
+	for (size_t k = 1; k < n; k++) threads.emplace_back(fn, k);
+	if (n > 0) fn(0);
+	for (size_t k = 0; k < threads.size(); k++) threads[k].join();
+}
+
+/* The file is memory-mapped and cut into one slice per hardware thread at line boundaries.
+ * Each slice is parsed into its own CSR fragment; the fragments are then copied in parallel
+ * into the requested dense or CSR arrays. Returns FAILURE if the file cannot be mapped. */
+int SvmData::load_libsvm_data_parallel(const char *filename, bool sparse, svm_memory_dataformat *req_data_format) {
+#if defined WIN32 || defined WIN64
+	return FAILURE;
+#else
+	struct stat st;
+	int fd;
+	char *data;
+	size_t size;
+
+	Delete();
+
+	if(req_data_format->labelsInFloat && sizeof(int) != sizeof(float)) REPORT_ERROR("4byte-int platform assumed");
+
+	if ((fd = open(filename, O_RDONLY)) < 0) return FAILURE;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return FAILURE;
+	}
+	size = st.st_size;
+	if (size == 0) REPORT_ERROR("Empty input file");
+	data = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return FAILURE;
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	/* Slices start right after a '\n'. A last line without '\n' is parsed from a terminated copy. */
+	char *end = data + size;
+	char *tail = end;
+	std::string last_line;
+	if (end[-1] != '\n') {
+		while (tail > data && tail[-1] != '\n') tail--;
+		last_line.assign(tail, end);
+		last_line += '\n';
+	}
 
+	size_t numChunks = std::max(1u, std::thread::hardware_concurrency());
+	numChunks = std::min(numChunks, size / (1 << 20) + 1); //at least 1MB per slice
+	std::vector<LibsvmChunk> chunks(numChunks + (last_line.empty() ? 0 : 1));
+	for (size_t k = 0; k < numChunks; k++) {
+		char *p = data + size / numChunks * k;
+		while (k > 0 && p < tail && p[-1] != '\n') p++;
+		chunks[k].begin = std::min(p, tail);
+		if (k > 0) chunks[k-1].end = chunks[k].begin;
+	}
+	chunks[numChunks-1].end = tail;
+	if (!last_line.empty()) {
+		chunks[numChunks].begin = &last_line[0];
+		chunks[numChunks].end = &last_line[0] + last_line.size();
+	}
+
+	printf("Parsing input text file (%zu B) in %zu slices.\n", size, numChunks);
+	run_parallel(chunks.size(), [&chunks](size_t k) { parse_libsvm_chunk(chunks[k]); });
+	munmap(data, size);
+
+	/* Merge: global row and nnz offsets of the slices. */
+	size_t nnz = 0;
+	unsigned int lines = 0;
+	numVects = 0;
+	dimVects = 0;
+	for (size_t k = 0; k < chunks.size(); k++) {
+		if (chunks[k].errorLine) exit_input_error(lines + chunks[k].errorLine);
+		lines += chunks[k].numLines;
+		chunks[k].firstRow = numVects;
+		chunks[k].firstNnz = nnz;
+		numVects += (unsigned int) chunks[k].labels.size();
+		nnz += chunks[k].colInd.size();
+		if (dimVects < chunks[k].dim) dimVects = chunks[k].dim;
+	}
+	if (numVects == 0) REPORT_ERROR("No vectors in the input file");
+
+	numVects_aligned = ALIGN_UP(numVects, req_data_format->vectAlignment);
+	dimVects_aligned = ALIGN_UP(dimVects, req_data_format->dimAlignment);
+	malloc_general(req_data_format, (void **) &vector_labels, sizeof(float) * numVects_aligned);
+	allocatedByCudaHost = req_data_format->allocate_pinned || req_data_format->allocate_write_combined;
+
+	if (sparse) {
+		data_csr = new csr;
+		data_csr->nnz = (unsigned int) nnz;
+		data_csr->numRows = numVects;
+		data_csr->numCols = dimVects;
+		malloc_general(req_data_format, (void **) &(data_csr->values), sizeof(float) * nnz);
+		malloc_general(req_data_format, (void **) &(data_csr->colInd), sizeof(int) * nnz);
+		malloc_general(req_data_format, (void **) &(data_csr->rowOffsets), sizeof(int) * (numVects_aligned + 1));
+		for (unsigned int i = numVects; i < numVects_aligned + 1; i++) data_csr->rowOffsets[i] = (unsigned int) nnz; //end and the padded area
+	} else {
+		malloc_general(req_data_format, (void **) &data_dense, sizeof(float) * dimVects_aligned * numVects_aligned);
+		memset(data_dense, 0, sizeof(float) * dimVects_aligned * numVects_aligned);
+	}
+
+	bool trans = req_data_format->transposed;
+	run_parallel(chunks.size(), [&](size_t k) {
+		LibsvmChunk &c = chunks[k];
+		size_t rows = c.labels.size();
+
+		std::copy(c.labels.begin(), c.labels.end(), vector_labels + c.firstRow);
+		if (sparse) {
+			std::copy(c.values.begin(), c.values.end(), data_csr->values + c.firstNnz);
+			std::copy(c.colInd.begin(), c.colInd.end(), data_csr->colInd + c.firstNnz);
+			for (size_t r = 0; r < rows; r++) data_csr->rowOffsets[c.firstRow + r] = (unsigned int) (c.firstNnz + c.rowOffsets[r]);
+		} else {
+			for (size_t r = 0; r < rows; r++) {
+				size_t i = c.firstRow + r;
+				for (unsigned int e = c.rowOffsets[r]; e < c.rowOffsets[r+1]; e++) {
+					if (trans) data_dense[(size_t) c.colInd[e] * numVects_aligned + i] = c.values[e];
+					else data_dense[i * dimVects_aligned + c.colInd[e]] = c.values[e];
+				}
+			}
+		}
+		std::vector<unsigned int>().swap(c.colInd);
+		std::vector<float>().swap(c.values);
+	});
+
+	if (sparse) {
+		printf("NNZ: %d\n%% NNZ: %.3lf\nAvg. NNZ per row: %.3lf\n", data_csr->nnz, 100. * data_csr->nnz / ((double) numVects * dimVects), data_csr->nnz / (double)numVects);
+		this->type = SPARSE;
+		if(req_data_format->transposed) REPORT_WARNING("Warning: CSR data format cannot be transposed")
+		transposed = false;
+	} else {
+		this->type = DENSE;
+		transposed = req_data_format->transposed;
+	}
+
+	make_class_labels(req_data_format);
+
+	return SUCCESS;
+#endif
+} //load_libsvm_data_parallel
+
+/* Trailer of a binary cache: the size and modification time of the text file it was
+ * parsed from. load_lasvm_binary_data() stops after the last row and never reads it. */
+struct BinaryCacheTrailer {
+	char magic[4]; // "SVMC"
+	unsigned int version;
+	long long srcSize;
+	long long srcMtimeSec;
+	long long srcMtimeNsec;
+};
+
+#define BINARY_CACHE_VERSION 1
+
+static void make_cache_trailer(const struct stat &src, BinaryCacheTrailer &trailer) {
+	memset(&trailer, 0, sizeof(trailer));
+	memcpy(trailer.magic, "SVMC", 4);
+	trailer.version = BINARY_CACHE_VERSION;
+	trailer.srcSize = (long long) src.st_size;
+#if defined WIN32 || defined WIN64
+	trailer.srcMtimeSec = (long long) src.st_mtime;
+#else
+	trailer.srcMtimeSec = (long long) src.st_mtim.tv_sec;
+	trailer.srcMtimeNsec = (long long) src.st_mtim.tv_nsec;
+#endif
+}
+
+/* Loads cache_name instead of the text file when its trailer matches the size and
+ * modification time (in ns) of the text file exactly and it holds the requested
+ * representation (dimVects == 0 in the header means CSR). */
+int SvmData::load_binary_cache(const struct stat &st_text, const char *cache_name, bool sparse, svm_memory_dataformat *req_data_format) {
+	struct stat st_cache;
+	FILE *fid;
+	unsigned int header[2];
+	BinaryCacheTrailer trailer, expected;
+
+	if (stat(cache_name, &st_cache) != 0 || (size_t) st_cache.st_size < 2 * sizeof(int) + sizeof(trailer)) return FAILURE;
+	if ((fid = fopen(cache_name, "rb")) == NULL) return FAILURE;
+
+	make_cache_trailer(st_text, expected);
+	if (fseek(fid, -(long) sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, fid) != 1
+		|| memcmp(&trailer, &expected, sizeof(trailer)) != 0 || fseek(fid, 0, SEEK_SET) != 0
+		|| fread(header, sizeof(int), 2, fid) != 2 || header[0] == 0 || (header[1] == 0) != sparse
+		|| (!sparse && (size_t) st_cache.st_size != 2 * sizeof(int) + (size_t) header[0] * (1 + header[1]) * sizeof(float) + sizeof(trailer))
+		|| fseek(fid, 0, SEEK_SET) != 0) {
+		fclose(fid);
+		return FAILURE;
+	}
+
+	printf("Loading binary cache %s.\n", cache_name);
+	load_lasvm_binary_data(fid, req_data_format);
+	fclose(fid);
+
+	return SUCCESS;
+} //load_binary_cache
+
+/* Writes the loaded data in the layout read by load_lasvm_binary_data(), followed by
+ * the trailer of the text file src when given. The file is written under a temporary
+ * name and renamed, so readers never see a partial cache. */
+int SvmData::store_lasvm_binary_data(const char *filename, const struct stat *src) {
+	FILE *fid;
+	std::string tmp_name = std::string(filename) + ".tmp";
+	unsigned int header[2] = {numVects, type == DENSE ? dimVects : 0};
+	bool ok;
+
+	if ((fid = fopen(tmp_name.c_str(), "wb")) == NULL) {
+		REPORT_WARNING("Unable to write the binary cache")
+		return FAILURE;
+	}
+
+	ok = fwrite(header, sizeof(int), 2, fid) == 2;
+	std::vector<float> row(type == DENSE ? dimVects : 0);
+	for (unsigned int i = 0; ok && i < numVects; i++) {
+		int label = labelsInFloat ? (int) ((float *) vector_labels)[i] : vector_labels[i];
+		ok = fwrite(&label, sizeof(int), 1, fid) == 1;
+		if (type == DENSE) {
+			for (unsigned int k = 0; k < dimVects; k++) {
+				row[k] = transposed ? data_dense[(size_t) k * numVects_aligned + i] : data_dense[(size_t) i * dimVects_aligned + k];
+			}
+			ok = ok && fwrite(row.data(), sizeof(float), dimVects, fid) == dimVects;
+		} else {
+			unsigned int start = data_csr->rowOffsets[i],
+				count = data_csr->rowOffsets[i+1] - start;
+			ok = ok && fwrite(&count, sizeof(int), 1, fid) == 1;
+			ok = ok && fwrite(data_csr->colInd + start, sizeof(int), count, fid) == count;
+			ok = ok && fwrite(data_csr->values + start, sizeof(float), count, fid) == count;
+		}
+	}
+	if (src != NULL) {
+		BinaryCacheTrailer trailer;
+		make_cache_trailer(*src, trailer);
+		ok = ok && fwrite(&trailer, sizeof(trailer), 1, fid) == 1;
+	}
+	ok = (fclose(fid) == 0) && ok;
+
+	if (!ok || rename(tmp_name.c_str(), filename) != 0) {
+		remove(tmp_name.c_str());
+		REPORT_WARNING("Unable to write the binary cache")
+		return FAILURE;
+	}
+	printf("Binary cache written to %s.\n", filename);
+
+	return SUCCESS;
+} //store_lasvm_binary_data
+
+void SvmData::make_class_labels(svm_memory_dataformat *req_data_format) {
 	//make class labels
 	int max_idx = -2;
 	for(unsigned int i=0; i < numVects; i++) {
@@ -921,9 +1185,7 @@ int SvmData::load_lasvm_binary_data(FILE * &fid, svm_memory_dataformat *req_data
 		float *p = (float *)vector_labels;
 		for(unsigned int i=0; i < numVects; i++) p[i] = (float) vector_labels[i];
 	}
-
-	return 0;
-} //load_lasvm_binary_data
+} //make_class_labels
 
 ///////////////////////////////////////////////////////////////
 // SvmModel
@@ -949,6 +1211,7 @@ int SvmModel::Delete() {
 	free(alphas);
 //#endif
 	alphas = NULL;
+	ovoModels.clear();
 	return SUCCESS;
 }
 
@@ -965,16 +1228,62 @@ int SvmModel::StoreModelGeneric(const char *model_file_name, SVM_MODEL_FILE_TYPE
 	return SUCCESS;
 }
 
+/* Writes the kernel lines of a libSVM model header. */
+static void store_model_kernel(FILE *fid, struct svm_params *params) {
+	fprintf(fid, "svm_type c_svc\nkernel_type %s\n", kernel_type_table[params->kernel_type]);
+	switch (params->kernel_type) {
+	case POLY:
+		fprintf(fid, "degree %d\n", params->degree);
+		break;
+	case SIGMOID:
+		fprintf(fid, "coef0 %g\n", params->coef0);
+		break;
+	case RBF:
+		fprintf(fid, "gamma %g\n", params->gamma);
+		break;
+	}
+}
+
+/* Writes the nonzero values of vector i of data in libSVM's index:value form. */
+static void store_vector(FILE *fid, SvmData *data, unsigned int i) {
+	if(data->GetDataDensePointer() != NULL) {
+		for (unsigned int j = 0; j < data->GetDimVects(); j++) {
+			float value = data->GetValue(i, j);
+			if (value != 0.0F) {
+				if (value == 1.0F) {
+					fprintf(fid, "%d:1 ", j + 1);
+				} else {
+					fprintf(fid, "%d:%g ", j + 1, value);
+				}
+			}
+		}
+	} else { //CSR data
+		csr *data_csr = data->GetDataSparsePointer();
+		for (unsigned int j = data_csr->rowOffsets[i]; j < data_csr->rowOffsets[i+1]; j++) {
+			float value = data_csr->values[j];
+			if (value == 1.0F) {
+				fprintf(fid, "%d:1 ", data_csr->colInd[j] + 1);
+			} else {
+				fprintf(fid, "%d:%g ", data_csr->colInd[j] + 1, value);
+			}
+		}
+	}
+}
+
+/* Index of the class of vector i in the (ascending) class labels of data. */
+static unsigned int class_index(SvmData *data, unsigned int i) {
+	int *labels = data->GetVectorLabelsPointer();
+	int label = data->GetLabelsInFloat() ? (int) ((float *) labels)[i] : labels[i];
+	int *class_labels = data->GetClassLabelsPointer();
+	return (unsigned int) (std::lower_bound(class_labels, class_labels + data->GetNumClasses(), label) - class_labels);
+}
+
 int SvmModel::StoreModel_LIBSVM_TXT(const char *model_file_name) {
-	//unsigned int i,
-	//	j,
-	//	width,
-	//	height;
-	//float alpha,
-	//	value,
-	//	alpha_mult;
 	FILE *fid;
 
+	if (!ovoModels.empty()) {
+		return StoreModelOneVsOne_LIBSVM_TXT(model_file_name);
+	}
 	if (alphas == NULL || data == NULL || params == NULL) {
 		return FAILURE;
 	}
@@ -985,21 +1294,9 @@ int SvmModel::StoreModel_LIBSVM_TXT(const char *model_file_name) {
 	FILE_SAFE_OPEN(fid, model_file_name, "w");
 
 	unsigned int height = data->GetNumVects();
-	unsigned int width =  data->GetDimVects();
 
 	/* Print header. */
-	fprintf(fid, "svm_type c_svc\nkernel_type %s\n", kernel_type_table[params->kernel_type]);
-	switch (params->kernel_type) {
-	case POLY:
-		fprintf(fid, "degree %d\n", params->degree);
-		break;
-	case SIGMOID:
-		fprintf(fid, "coef0 %g\n", params->coef0);
-		break;
-	case RBF:
-		fprintf(fid, "gamma %g\n", params->gamma);
-		break;
-	}
+	store_model_kernel(fid, params);
 	fprintf(fid, "nr_class %d\ntotal_sv %d\n", data->numClasses, params->nsv_class1 + params->nsv_class2);
 
 	//float alpha_mult = (data->class_labels[0] > data->class_labels[1])? -1.0f : 1.0f;
@@ -1014,36 +1311,13 @@ int SvmModel::StoreModel_LIBSVM_TXT(const char *model_file_name) {
 	}
 
 	//store positive Support Vectors
-	csr *data_csr = data->GetDataSparsePointer();
 	for (unsigned int i = 0; i < height; i++) {
 		if(alphas[i] > 0.0f) {
 			if(data->labelsInFloat && ((float*)data->vector_labels)[i] != (float) data->class_labels[classIds[1]]) continue;
 			if(!data->labelsInFloat && data->vector_labels[i] != data->class_labels[classIds[1]]) continue;
 			float a = alphas[i];
 			fprintf(fid, "%.16g ", a);
-
-			if(data->data_dense != NULL) {
-				for (unsigned int j = 0; j < width; j++) {
-					float value = data->GetValue(i, j);
-					if (value != 0.0F) {
-						if (value == 1.0F) {
-							fprintf(fid, "%d:1 ", j + 1);
-						} else {
-							fprintf(fid, "%d:%g ", j + 1, value);
-						}
-					}
-				}
-			} else { //CSR data
-				for (unsigned int j = data_csr->rowOffsets[i]; j < data_csr->rowOffsets[i+1]; j++) {
-					float value = data_csr->values[j];
-					if (value == 1.0F) {
-						fprintf(fid, "%d:1 ", data_csr->colInd[j] + 1);
-					} else {
-						fprintf(fid, "%d:%g ", data_csr->colInd[j] + 1, value);
-					}
-				}
-			}
-
+			store_vector(fid, data, i);
 			fprintf(fid, "\n");
 		}
 	}
@@ -1055,36 +1329,84 @@ int SvmModel::StoreModel_LIBSVM_TXT(const char *model_file_name) {
 			if(!data->labelsInFloat && data->vector_labels[i] != data->class_labels[classIds[0]]) continue;
 			float a = alphas[i];
 			fprintf(fid, "%.16g ", -a);
+			store_vector(fid, data, i);
+			fprintf(fid, "\n");
+		}
+	}
 
-			if(data->data_dense != NULL) {
-				for (unsigned int j = 0; j < width; j++) {
-					float value = data->GetValue(i, j);
-					if (value != 0.0F) {
-						if (value == 1.0F) {
-							fprintf(fid, "%d:1 ", j + 1);
-						} else {
-							fprintf(fid, "%d:%g ", j + 1, value);
-						}
-					}
-				}
-			} else { //CSR data
-				for (unsigned int j = data_csr->rowOffsets[i]; j < data_csr->rowOffsets[i+1]; j++) {
-					float value = data_csr->values[j];
-					if (value == 1.0F) {
-						fprintf(fid, "%d:1 ", data_csr->colInd[j] + 1);
-					} else {
-						fprintf(fid, "%d:%g ", data_csr->colInd[j] + 1, value);
-					}
-				}
+	fclose(fid);
+	return SUCCESS;
+} //StoreModel
+
+/* Stores the one-vs-one models in libSVM's multiclass layout: one rho per pair of
+ * classes in the order (0,1), (0,2), ..., (1,2), ..., the support vectors grouped by
+ * class, and per support vector the coefs of its numClasses - 1 pairs. The model of
+ * the pair (a,b), a < b, must have a as its positive class. */
+int SvmModel::StoreModelOneVsOne_LIBSVM_TXT(const char *model_file_name) {
+	FILE *fid;
+
+	if (data == NULL || params == NULL) {
+		return FAILURE;
+	}
+
+	unsigned int numClasses = data->GetNumClasses();
+	unsigned int height = data->GetNumVects();
+	std::vector<const svm_binary_model *> pairs((size_t) numClasses * numClasses, NULL);
+	for (size_t p = 0; p < ovoModels.size(); p++) {
+		const svm_binary_model &m = ovoModels[p];
+		if (m.positiveClass >= m.negativeClass || m.negativeClass >= numClasses) return FAILURE;
+		pairs[m.positiveClass * numClasses + m.negativeClass] = &m;
+	}
+
+	/* coef[i * (numClasses - 1) + column]: the column of pair (c, o) for a vector of class c is o - (o > c). */
+	std::vector<double> coef((size_t) height * (numClasses - 1), 0.0);
+	std::vector<char> isSV(height, 0);
+	for (unsigned int a = 0; a < numClasses; a++) {
+		for (unsigned int b = a + 1; b < numClasses; b++) {
+			const svm_binary_model *m = pairs[a * numClasses + b];
+			if (m == NULL) return FAILURE;
+			for (size_t k = 0; k < m->svs.size(); k++) {
+				unsigned int i = m->svs[k];
+				unsigned int other = class_index(data, i) == a ? b - 1 : a;
+				coef[(size_t) i * (numClasses - 1) + other] = m->coefs[k];
+				isSV[i] = 1;
 			}
+		}
+	}
+	std::vector<unsigned int> nsv(numClasses, 0);
+	unsigned int totalSV = 0;
+	for (unsigned int i = 0; i < height; i++) {
+		if (isSV[i]) {
+			nsv[class_index(data, i)]++;
+			totalSV++;
+		}
+	}
 
+	FILE_SAFE_OPEN(fid, model_file_name, "w");
+
+	store_model_kernel(fid, params);
+	fprintf(fid, "nr_class %u\ntotal_sv %u\nrho", numClasses, totalSV);
+	for (unsigned int a = 0; a < numClasses; a++) {
+		for (unsigned int b = a + 1; b < numClasses; b++) fprintf(fid, " %g", pairs[a * numClasses + b]->rho);
+	}
+	fprintf(fid, "\nlabel");
+	for (unsigned int c = 0; c < numClasses; c++) fprintf(fid, " %d", data->class_labels[c]);
+	fprintf(fid, "\nnr_sv");
+	for (unsigned int c = 0; c < numClasses; c++) fprintf(fid, " %u", nsv[c]);
+	fprintf(fid, "\nSV\n");
+
+	for (unsigned int c = 0; c < numClasses; c++) {
+		for (unsigned int i = 0; i < height; i++) {
+			if (!isSV[i] || class_index(data, i) != c) continue;
+			for (unsigned int k = 0; k < numClasses - 1; k++) fprintf(fid, "%.16g ", coef[(size_t) i * (numClasses - 1) + k]);
+			store_vector(fid, data, i);
 			fprintf(fid, "\n");
 		}
 	}
 
 	fclose(fid);
 	return SUCCESS;
-} //StoreModel
+} //StoreModelOneVsOne_LIBSVM_TXT
 
 int SvmModel::LoadModelGeneric(char *model_file_name, SVM_MODEL_FILE_TYPE type, SVM_DATA_TYPE data_type, struct svm_memory_dataformat *req_data_format) {
 
@@ -1205,6 +1527,7 @@ int SvmModel::LoadModel_LIBSVM_TXT(char *model_file_name, SVM_DATA_TYPE data_typ
     }
     else {
         malloc_general(req_data_format, (void **) &data->data_dense, sizeof(float) * data->dimVects_aligned * data->numVects_aligned);
+        data->transposed = req_data_format->transposed;
         memset(data->data_dense, 0, sizeof(float) * data->dimVects_aligned * data->numVects_aligned);
     }
     //read SV
@@ -1262,9 +1585,254 @@ int SvmModel::CalculateSupperVectorCounts() {
 	return SUCCESS;
 }
 
+/* Support vectors packed for batched prediction: blocks of PREDICT_SV_BLOCK vectors,
+ * each stored feature-major (value j of vector s at [j * PREDICT_SV_BLOCK + s]) so
+ * the inner loop runs over the vectors of a block with unit stride. The last block
+ * is padded with zero vectors of zero coefficient. */
+#define PREDICT_SV_BLOCK 64
+#define PREDICT_SAMPLE_TILE 8
+
+struct PackedSVs {
+	unsigned int numSVs;
+	unsigned int numBlocks;
+	unsigned int dim;
+	std::vector<float> store;
+	float *values;
+	std::vector<float> norms;
+	std::vector<double> coefs;
+};
+
+/* Writes vector i of data as a dense row of dim values. */
+static void dense_vector(SvmData *data, unsigned int i, float *row, unsigned int dim) {
+	memset(row, 0, sizeof(float) * dim);
+	if (data->GetDataDensePointer() != NULL) {
+		unsigned int width = std::min(dim, data->GetDimVects());
+		for (unsigned int j = 0; j < width; j++) row[j] = data->GetValue(i, j);
+	} else {
+		csr *data_csr = data->GetDataSparsePointer();
+		for (unsigned int k = data_csr->rowOffsets[i]; k < data_csr->rowOffsets[i+1]; k++) {
+			if (data_csr->colInd[k] < dim) row[data_csr->colInd[k]] = data_csr->values[k];
+		}
+	}
+}
+
+static void pack_support_vectors(SvmData *data, const std::vector<unsigned int> &svs, const std::vector<double> &coefs, PackedSVs &packed) {
+	packed.numSVs = (unsigned int) svs.size();
+	packed.numBlocks = (packed.numSVs + PREDICT_SV_BLOCK - 1) / PREDICT_SV_BLOCK;
+	packed.dim = data->GetDimVects();
+	size_t blockSize = (size_t) packed.dim * PREDICT_SV_BLOCK;
+
+	/* 64 B aligned for the vector loads of the inner loop. */
+	packed.store.assign(packed.numBlocks * blockSize + 16, 0.0f);
+	void *p = packed.store.data();
+	size_t space = packed.store.size() * sizeof(float);
+	packed.values = (float *) std::align(64, packed.numBlocks * blockSize * sizeof(float), p, space);
+
+	packed.norms.assign(packed.numBlocks * PREDICT_SV_BLOCK, 0.0f);
+	packed.coefs.assign(packed.numBlocks * PREDICT_SV_BLOCK, 0.0);
+	std::vector<float> row(packed.dim);
+	for (unsigned int k = 0; k < packed.numSVs; k++) {
+		dense_vector(data, svs[k], row.data(), packed.dim);
+		float *block = packed.values + (k / PREDICT_SV_BLOCK) * blockSize + k % PREDICT_SV_BLOCK;
+		float norm = 0.0f;
+		for (unsigned int j = 0; j < packed.dim; j++) {
+			block[(size_t) j * PREDICT_SV_BLOCK] = row[j];
+			norm += row[j] * row[j];
+		}
+		packed.norms[k] = norm;
+		packed.coefs[k] = coefs[k];
+	}
+}
+
+/* Decision values of PREDICT_SAMPLE_TILE samples (dense rows of packed.dim values,
+ * unused rows zero) as sum_k coef_k * K(sv_k, x) - rho. The dot products of a tile
+ * with one block of support vectors are accumulated like a small matrix product,
+ * the kernel is then evaluated from the dot products and the precomputed norms. */
+static void decision_tile(const PackedSVs &packed, const float *x, const float *xnorms, unsigned int count,
+		struct svm_params *params, double rho, double *dec) {
+	float dot[PREDICT_SAMPLE_TILE][PREDICT_SV_BLOCK];
+	size_t blockSize = (size_t) packed.dim * PREDICT_SV_BLOCK;
+
+	for (unsigned int t = 0; t < count; t++) dec[t] = -rho;
+	for (unsigned int b = 0; b < packed.numBlocks; b++) {
+		const float *block = packed.values + b * blockSize;
+		memset(dot, 0, sizeof(dot));
+		for (unsigned int j = 0; j < packed.dim; j++) {
+			const float *sv = block + (size_t) j * PREDICT_SV_BLOCK;
+			for (unsigned int t = 0; t < PREDICT_SAMPLE_TILE; t++) {
+				float xv = x[(size_t) t * packed.dim + j];
+				for (unsigned int s = 0; s < PREDICT_SV_BLOCK; s++) dot[t][s] += xv * sv[s];
+			}
+		}
+
+		const float *norms = packed.norms.data() + b * PREDICT_SV_BLOCK;
+		const double *coefs = packed.coefs.data() + b * PREDICT_SV_BLOCK;
+		for (unsigned int t = 0; t < count; t++) {
+			double sum = 0;
+			for (unsigned int s = 0; s < PREDICT_SV_BLOCK; s++) {
+				double k;
+				switch (params->kernel_type) {
+				case LINEAR:
+					k = dot[t][s];
+					break;
+				case POLY:
+					k = pow(params->gamma * dot[t][s] + params->coef0, params->degree);
+					break;
+				case SIGMOID:
+					k = tanh(params->gamma * dot[t][s] + params->coef0);
+					break;
+				default: //RBF
+					k = exp(-params->gamma * ((double) xnorms[t] + norms[s] - 2.0 * dot[t][s]));
+				}
+				sum += coefs[s] * k;
+			}
+			dec[t] += sum;
+		}
+	}
+}
+
+/* Decision values of the vectors index[0..numSamples) of samples (all of them if index
+ * is NULL), in tiles of PREDICT_SAMPLE_TILE taken by one thread per hardware thread.
+ * Returns the number of threads. */
+static size_t decision_values(const PackedSVs &packed, SvmData *samples, const unsigned int *index, unsigned int numSamples,
+		struct svm_params *params, double rho, double *dec) {
+	unsigned int testDim = std::max(samples->GetDimVects(), packed.dim);
+	unsigned int numTiles = (numSamples + PREDICT_SAMPLE_TILE - 1) / PREDICT_SAMPLE_TILE;
+	std::atomic<unsigned int> nextTile(0);
+
+	size_t numThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), numTiles));
+	run_parallel(numThreads, [&](size_t) {
+		std::vector<float> row(testDim);
+		std::vector<float> x((size_t) PREDICT_SAMPLE_TILE * packed.dim);
+		float xnorms[PREDICT_SAMPLE_TILE];
+		unsigned int tile;
+		while ((tile = nextTile++) < numTiles) {
+			unsigned int first = tile * PREDICT_SAMPLE_TILE;
+			unsigned int count = std::min((unsigned int) PREDICT_SAMPLE_TILE, numSamples - first);
+			std::fill(x.begin(), x.end(), 0.0f);
+			for (unsigned int t = 0; t < count; t++) {
+				dense_vector(samples, index != NULL ? index[first + t] : first + t, row.data(), testDim);
+				float norm = 0.0f;
+				for (unsigned int j = 0; j < testDim; j++) norm += row[j] * row[j];
+				xnorms[t] = norm;
+				memcpy(x.data() + (size_t) t * packed.dim, row.data(), sizeof(float) * packed.dim);
+			}
+			decision_tile(packed, x.data(), xnorms, count, params, rho, dec + first);
+		}
+	});
+
+	return numThreads;
+}
+
+/* Labels of the vectors index[0..numSamples) of samples (all of them if index is NULL)
+ * by one-vs-one voting over numModels binary models trained on data. Each model votes
+ * for one of its two classes; a tie goes to the lowest class, as in libSVM. */
+void SvmModel::PredictOneVsOne(SvmData *samples, const unsigned int *index, unsigned int numSamples,
+		const svm_binary_model *models, unsigned int numModels, int *predicted) {
+	unsigned int numClasses = data->GetNumClasses();
+	std::vector<unsigned int> votes((size_t) numSamples * numClasses, 0);
+	std::vector<double> dec(numSamples);
+
+	for (unsigned int p = 0; p < numModels; p++) {
+		PackedSVs packed;
+		pack_support_vectors(data, models[p].svs, models[p].coefs, packed);
+		decision_values(packed, samples, index, numSamples, params, models[p].rho, dec.data());
+		for (unsigned int i = 0; i < numSamples; i++) {
+			votes[(size_t) i * numClasses + (dec[i] > 0 ? models[p].positiveClass : models[p].negativeClass)]++;
+		}
+	}
+	for (unsigned int i = 0; i < numSamples; i++) {
+		const unsigned int *v = votes.data() + (size_t) i * numClasses;
+		predicted[i] = data->class_labels[std::max_element(v, v + numClasses) - v];
+	}
+}
+
+/* Predicts the labels of testData and stores them, one per line, in file_out (if not
+ * NULL). A binary model is either the one trained on data (support vectors are the
+ * vectors with alpha > 0) or one loaded by LoadModel_LIBSVM_TXT (data holds only the
+ * support vectors, alphas are signed); a multiclass batch votes with its one-vs-one
+ * models. The decision values and labels are those libSVM's svm_predict gives for the
+ * stored model. */
 int SvmModel::Predict(SvmData *testData, const char * file_out)
 {
-    return FAILURE;
+	if ((alphas == NULL && ovoModels.empty()) || data == NULL || params == NULL || testData == NULL) {
+		return FAILURE;
+	}
+	if (ovoModels.empty() && data->GetNumClasses() != 2) {
+		printf("Prediction supports binary models only (%u classes)\n", data->GetNumClasses());
+		return FAILURE;
+	}
+	if (testData->GetDataDensePointer() == NULL && testData->GetDataSparsePointer() == NULL) {
+		return FAILURE;
+	}
+
+	unsigned int numSamples = testData->GetNumVects();
+	std::vector<int> predicted(numSamples);
+	std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+
+	if (!ovoModels.empty()) {
+		PredictOneVsOne(testData, NULL, numSamples, ovoModels.data(), (unsigned int) ovoModels.size(), predicted.data());
+
+		std::chrono::time_point<std::chrono::high_resolution_clock> stop = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(stop - start).count();
+		printf("Prediction: %u samples, %zu one-vs-one models: %0.4f s (%0.1f samples/s)\n",
+			numSamples, ovoModels.size(), seconds, numSamples / seconds);
+	} else {
+		/* Map the model to libSVM's form: dec > 0 predicts positive. */
+		std::vector<unsigned int> svs;
+		std::vector<double> coefs;
+		int positive, negative;
+		double rho;
+		int *labels = data->GetVectorLabelsPointer();
+		if (labels == NULL) {
+			positive = data->class_labels[1];
+			negative = data->class_labels[0];
+			rho = params->rho;
+			for (unsigned int i = 0; i < data->GetNumVects(); i++) {
+				svs.push_back(i);
+				coefs.push_back(alphas[i]);
+			}
+		} else {
+			unsigned int posId = data->invertLabels ? 0 : 1;
+			positive = data->class_labels[posId];
+			negative = data->class_labels[1 - posId];
+			rho = data->invertLabels ? -params->rho : params->rho;
+			for (unsigned int i = 0; i < data->GetNumVects(); i++) {
+				if (alphas[i] > 0.0f) {
+					bool pos = data->GetLabelsInFloat() ? ((float *) labels)[i] == (float) positive : labels[i] == positive;
+					svs.push_back(i);
+					coefs.push_back(pos ? alphas[i] : -alphas[i]);
+				}
+			}
+		}
+
+		PackedSVs packed;
+		pack_support_vectors(data, svs, coefs, packed);
+
+		std::vector<double> dec(numSamples);
+		size_t numThreads = decision_values(packed, testData, NULL, numSamples, params, rho, dec.data());
+		for (unsigned int i = 0; i < numSamples; i++) predicted[i] = dec[i] > 0 ? positive : negative;
+
+		std::chrono::time_point<std::chrono::high_resolution_clock> stop = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(stop - start).count();
+		printf("Prediction: %u samples, %u SVs, %zu threads: %0.4f s (%0.1f samples/s)\n",
+			numSamples, packed.numSVs, numThreads, seconds, numSamples / seconds);
+	}
+
+	int *testLabels = testData->GetVectorLabelsPointer();
+	if (testLabels != NULL && numSamples > 0) {
+		unsigned int correct = 0;
+		for (unsigned int i = 0; i < numSamples; i++) {
+			if (testData->GetLabelsInFloat() ? ((float *) testLabels)[i] == (float) predicted[i] : testLabels[i] == predicted[i]) correct++;
+		}
+		printf("Accuracy = %g%% (%u/%u) (classification)\n", 100.0 * correct / numSamples, correct, numSamples);
+	}
+
+	if (file_out != NULL && Utils::StoreResults((char *) file_out, predicted.data(), numSamples) != 0) {
+		return FAILURE;
+	}
+
+	return SUCCESS;
 }
 
 int SvmModel::LoadModel(char *model_file_name, SVM_MODEL_FILE_TYPE type, SVM_DATA_TYPE data_type)
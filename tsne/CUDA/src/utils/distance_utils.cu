@@ -38,9 +38,15 @@
  */
 
 #include "include/utils/distance_utils.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <fstream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 void tsnecuda::utils::KNearestNeighbors(
     std::string data_folder,
@@ -89,6 +95,368 @@ void tsnecuda::utils::KNearestNeighbors(
     // std::cout << "...\n";
 }
 
+namespace {
+
+// Points per packed panel of the exact search, and query points per tile
+const int kKnnPanel     = 64;
+const int kKnnQueryTile = 8;
+
+// NN-descent stops after this many iterations or when fewer than
+// kDescentDelta * num_points * K list entries changed in an iteration
+const int   kDescentIterations = 12;
+const float kDescentDelta      = 0.001f;
+const int   kDescentLocks      = 4096;
+
+// Fraction of the new neighbors (and reverse neighbors) joined per iteration
+const float kDescentSample     = 0.5f;
+
+// Smallest neighbor list NN-descent works with, as too short lists recall poorly
+const int   kDescentMinList    = 16;
+
+typedef std::pair<float, int64_t> Neighbor;
+
+// Runs fn(t) for t = 0..num_threads-1, each on its own thread
+template <typename F>
+void RunParallel(const int num_threads, F fn)
+{
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; ++t)
+        threads.emplace_back(fn, t);
+    fn(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+int NumKnnThreads(const int64_t work)
+{
+    const int64_t hw = std::max(1u, std::thread::hardware_concurrency());
+    return (int)std::max((int64_t)1, std::min(hw, work));
+}
+
+inline float SquaredDistance(const float* a, const float* b, const int num_dims)
+{
+    // independent partial sums so the loop maps to SIMD lanes
+    float acc[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    int d = 0;
+    for (; d + 8 <= num_dims; d += 8) {
+        for (int l = 0; l < 8; ++l) {
+            const float t = a[d + l] - b[d + l];
+            acc[l] += t * t;
+        }
+    }
+    for (; d < num_dims; ++d) {
+        const float t = a[d] - b[d];
+        acc[0] += t * t;
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+// Neighbor 0 of a point is the point itself at distance 0, like FAISS returns it;
+// the others follow in ascending order of distance.
+void WriteNeighbors(
+    int64_t* indices,
+    float* distances,
+    const int64_t i,
+    const int num_near_neighbors,
+    std::vector<Neighbor>& list)
+{
+    std::sort(list.begin(), list.end());
+    indices[i * num_near_neighbors]   = i;
+    distances[i * num_near_neighbors] = 0.0f;
+    for (int j = 1; j < num_near_neighbors; ++j) {
+        indices[i * num_near_neighbors + j]   = list[j - 1].second;
+        distances[i * num_near_neighbors + j] = list[j - 1].first;
+    }
+}
+
+// Brute force with ||x - y||^2 = ||x||^2 + ||y||^2 - 2 x.y: the points are packed
+// into panels of kKnnPanel points stored dimension-major, and the dot products of a
+// tile of kKnnQueryTile queries with a panel are accumulated like a small GEMM with
+// the panel points in the (vectorized) inner loop.
+void ExactKNearestNeighbors(
+    const float* points,
+    int64_t* indices,
+    float* distances,
+    const int num_dims,
+    const int num_points,
+    const int num_near_neighbors)
+{
+    const int num_panels  = (num_points + kKnnPanel - 1) / kKnnPanel;
+    const int num_tiles   = (num_points + kKnnQueryTile - 1) / kKnnQueryTile;
+    const int num_others  = num_near_neighbors - 1;
+    const size_t panel_size = (size_t)num_dims * kKnnPanel;
+
+    std::vector<float> panels(num_panels * panel_size, 0.0f);
+    std::vector<float> norms(num_points);
+    const int num_pack_threads = NumKnnThreads(num_panels);
+    RunParallel(num_pack_threads, [&](int t) {
+        for (int p = t; p < num_panels; p += num_pack_threads) {
+            for (int s = 0; s < kKnnPanel && p * kKnnPanel + s < num_points; ++s) {
+                const int64_t i = (int64_t)p * kKnnPanel + s;
+                const float* x = points + i * num_dims;
+                float norm = 0.0f;
+                for (int d = 0; d < num_dims; ++d) {
+                    panels[p * panel_size + (size_t)d * kKnnPanel + s] = x[d];
+                    norm += x[d] * x[d];
+                }
+                norms[i] = norm;
+            }
+        }
+    });
+
+    std::atomic<int> next_tile(0);
+    RunParallel(NumKnnThreads(num_tiles), [&](int) {
+        std::vector<float> queries((size_t)kKnnQueryTile * num_dims);
+        std::vector<Neighbor> heaps[kKnnQueryTile];
+        float dots[kKnnQueryTile][kKnnPanel];
+        int tile;
+        while ((tile = next_tile++) < num_tiles) {
+            const int first = tile * kKnnQueryTile;
+            const int count = std::min(kKnnQueryTile, num_points - first);
+            std::fill(queries.begin(), queries.end(), 0.0f);
+            std::copy(points + (int64_t)first * num_dims, points + (int64_t)(first + count) * num_dims, queries.begin());
+            for (int q = 0; q < count; ++q)
+                heaps[q].clear();
+
+            for (int p = 0; p < num_panels; ++p) {
+                const float* panel = panels.data() + p * panel_size;
+                memset(dots, 0, sizeof(dots));
+                for (int d = 0; d < num_dims; ++d) {
+                    const float* y = panel + (size_t)d * kKnnPanel;
+                    for (int q = 0; q < kKnnQueryTile; ++q) {
+                        const float xv = queries[(size_t)q * num_dims + d];
+                        for (int s = 0; s < kKnnPanel; ++s)
+                            dots[q][s] += xv * y[s];
+                    }
+                }
+
+                const int width = std::min(kKnnPanel, num_points - p * kKnnPanel);
+                for (int q = 0; q < count; ++q) {
+                    std::vector<Neighbor>& heap = heaps[q];
+                    const float xnorm = norms[first + q];
+                    for (int s = 0; s < width; ++s) {
+                        const int64_t j = (int64_t)p * kKnnPanel + s;
+                        if (j == first + q)
+                            continue;
+                        const float dist = std::max(0.0f, xnorm + norms[j] - 2.0f * dots[q][s]);
+                        if ((int)heap.size() < num_others) {
+                            heap.emplace_back(dist, j);
+                            std::push_heap(heap.begin(), heap.end());
+                        } else if (num_others > 0 && dist < heap.front().first) {
+                            std::pop_heap(heap.begin(), heap.end());
+                            heap.back() = Neighbor(dist, j);
+                            std::push_heap(heap.begin(), heap.end());
+                        }
+                    }
+                }
+            }
+
+            for (int q = 0; q < count; ++q)
+                WriteNeighbors(indices, distances, first + q, num_near_neighbors, heaps[q]);
+        }
+    });
+}
+
+// NN-descent (Dong et al., 2011): starting from random neighbor lists, every point
+// compares its neighbors and reverse neighbors with each other ("local join"), as
+// a neighbor of a neighbor is likely to be a neighbor. Only pairs involving an entry
+// that is new since the last iteration are compared, and of those only a sample
+// of kDescentSample * K per point in each iteration.
+void ApproximateKNearestNeighbors(
+    const float* points,
+    int64_t* indices,
+    float* distances,
+    const int num_dims,
+    const int num_points,
+    const int num_near_neighbors,
+    const int64_t random_seed)
+{
+    const int K = std::max(num_near_neighbors - 1, std::min(kDescentMinList, num_points - 1));
+    const int num_threads = NumKnnThreads(num_points);
+
+    // neighbor lists of K entries per point, ascending by distance
+    std::vector<float>   list_dist((size_t)num_points * K);
+    std::vector<int>     list_index((size_t)num_points * K);
+    std::vector<uint8_t> list_new((size_t)num_points * K, 1);
+    std::vector<std::atomic<float>> list_worst(num_points);
+    std::vector<std::mutex> locks(kDescentLocks);
+    const int num_samples = std::max(1, (int)(kDescentSample * K));
+
+    RunParallel(num_threads, [&](int t) {
+        std::vector<Neighbor> list;
+        for (int i = t; i < num_points; i += num_threads) {
+            std::mt19937_64 rng(random_seed + i);
+            std::uniform_int_distribution<int> pick(0, num_points - 2);
+            list.clear();
+            while ((int)list.size() < K) {
+                int j = pick(rng);
+                j += (j >= i);
+                bool present = false;
+                for (const auto& n : list)
+                    present |= (n.second == j);
+                if (!present)
+                    list.emplace_back(SquaredDistance(points + (int64_t)i * num_dims, points + (int64_t)j * num_dims, num_dims), j);
+            }
+            std::sort(list.begin(), list.end());
+            for (int k = 0; k < K; ++k) {
+                list_dist[(size_t)i * K + k]  = list[k].first;
+                list_index[(size_t)i * K + k] = (int)list[k].second;
+            }
+            list_worst[i].store(list[K - 1].first, std::memory_order_relaxed);
+        }
+    });
+
+    // inserts j into the list of i, returns 1 if the list changed
+    auto insert = [&](const int i, const int j, const float dist) -> int {
+        // most candidates are rejected here without taking the lock
+        if (dist >= list_worst[i].load(std::memory_order_relaxed))
+            return 0;
+        std::lock_guard<std::mutex> lock(locks[i % kDescentLocks]);
+        float* dists = list_dist.data() + (size_t)i * K;
+        int* ids = list_index.data() + (size_t)i * K;
+        uint8_t* is_new = list_new.data() + (size_t)i * K;
+        if (dist >= dists[K - 1])
+            return 0;
+        for (int k = 0; k < K; ++k)
+            if (ids[k] == j)
+                return 0;
+        int k = K - 1;
+        for (; k > 0 && dists[k - 1] > dist; --k) {
+            dists[k]  = dists[k - 1];
+            ids[k]    = ids[k - 1];
+            is_new[k] = is_new[k - 1];
+        }
+        dists[k]  = dist;
+        ids[k]    = j;
+        is_new[k] = 1;
+        list_worst[i].store(dists[K - 1], std::memory_order_relaxed);
+        return 1;
+    };
+
+    std::vector<std::vector<int>> new_candidates(num_points);
+    std::vector<std::vector<int>> old_candidates(num_points);
+    std::mt19937_64 rng(random_seed);
+    for (int iteration = 0; iteration < kDescentIterations; ++iteration) {
+        for (int i = 0; i < num_points; ++i) {
+            new_candidates[i].clear();
+            old_candidates[i].clear();
+        }
+        std::vector<int> sampled;
+        for (int i = 0; i < num_points; ++i) {
+            sampled.clear();
+            for (int k = 0; k < K; ++k) {
+                const size_t e = (size_t)i * K + k;
+                if (list_new[e])
+                    sampled.push_back(k);
+                else
+                    old_candidates[i].push_back(list_index[e]);
+            }
+            // new neighbors that are not sampled stay new for the next iteration
+            if ((int)sampled.size() > num_samples) {
+                std::shuffle(sampled.begin(), sampled.end(), rng);
+                sampled.resize(num_samples);
+            }
+            for (int k : sampled) {
+                new_candidates[i].push_back(list_index[(size_t)i * K + k]);
+                list_new[(size_t)i * K + k] = 0;
+            }
+        }
+        // reverse neighbors, at most num_samples of each kind per point
+        std::vector<std::vector<int>> reverse_new(num_points), reverse_old(num_points);
+        for (int i = 0; i < num_points; ++i) {
+            for (int j : new_candidates[i])
+                reverse_new[j].push_back(i);
+            for (int j : old_candidates[i])
+                reverse_old[j].push_back(i);
+        }
+        for (int i = 0; i < num_points; ++i) {
+            for (auto* reverse : {&reverse_new[i], &reverse_old[i]}) {
+                if ((int)reverse->size() > num_samples) {
+                    std::shuffle(reverse->begin(), reverse->end(), rng);
+                    reverse->resize(num_samples);
+                }
+            }
+            new_candidates[i].insert(new_candidates[i].end(), reverse_new[i].begin(), reverse_new[i].end());
+            old_candidates[i].insert(old_candidates[i].end(), reverse_old[i].begin(), reverse_old[i].end());
+            for (auto* candidates : {&new_candidates[i], &old_candidates[i]}) {
+                std::sort(candidates->begin(), candidates->end());
+                candidates->erase(std::unique(candidates->begin(), candidates->end()), candidates->end());
+            }
+        }
+
+        std::atomic<int> next_point(0);
+        std::atomic<int64_t> updates(0);
+        RunParallel(num_threads, [&](int) {
+            int64_t local_updates = 0;
+            int i;
+            while ((i = next_point++) < num_points) {
+                const std::vector<int>& fresh = new_candidates[i];
+                const std::vector<int>& old   = old_candidates[i];
+                for (size_t a = 0; a < fresh.size(); ++a) {
+                    const float* x = points + (int64_t)fresh[a] * num_dims;
+                    for (size_t b = a + 1; b < fresh.size(); ++b) {
+                        const float dist = SquaredDistance(x, points + (int64_t)fresh[b] * num_dims, num_dims);
+                        local_updates += insert(fresh[a], fresh[b], dist) + insert(fresh[b], fresh[a], dist);
+                    }
+                    for (int o : old) {
+                        if (o == fresh[a])
+                            continue;
+                        const float dist = SquaredDistance(x, points + (int64_t)o * num_dims, num_dims);
+                        local_updates += insert(fresh[a], o, dist) + insert(o, fresh[a], dist);
+                    }
+                }
+            }
+            updates += local_updates;
+        });
+
+        std::cout << "NN-descent iteration " << iteration << ": " << updates << " updates" << std::endl;
+        if (updates < kDescentDelta * num_points * K)
+            break;
+    }
+
+    RunParallel(num_threads, [&](int t) {
+        std::vector<Neighbor> list(num_near_neighbors - 1);
+        for (int i = t; i < num_points; i += num_threads) {
+            for (int k = 0; k < num_near_neighbors - 1; ++k)
+                list[k] = Neighbor(list_dist[(size_t)i * K + k], list_index[(size_t)i * K + k]);
+            WriteNeighbors(indices, distances, i, num_near_neighbors, list);
+        }
+    });
+}
+
+} // namespace
+
+void tsnecuda::utils::ComputeKNearestNeighbors(
+    const tsnecuda::KNN_METHOD knn_method,
+    const float* points,
+    int64_t* indices,
+    float* distances,
+    const int num_dims,
+    const int num_points,
+    const int num_near_neighbors,
+    const int64_t random_seed)
+{
+    // NN-descent needs more points than neighbors to sample from
+    const bool exact = knn_method == tsnecuda::KNN_METHOD::EXACT ||
+                       (int64_t)std::max(num_near_neighbors, kDescentMinList) * 4 >= num_points;
+
+    std::cout << "KNN (" << (exact ? "exact" : "NN-descent") << "): " << num_points << " points, "
+              << num_dims << " dims, " << num_near_neighbors << " neighbors" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    if (num_near_neighbors <= 1) {
+        std::vector<Neighbor> none;
+        for (int i = 0; i < num_points; ++i)
+            WriteNeighbors(indices, distances, i, num_near_neighbors, none);
+    } else if (exact) {
+        ExactKNearestNeighbors(points, indices, distances, num_dims, num_points, num_near_neighbors);
+    } else {
+        ApproximateKNearestNeighbors(points, indices, distances, num_dims, num_points, num_near_neighbors, random_seed);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    std::cout << "KNN time: " << std::chrono::duration<double>(stop - start).count() << " s" << std::endl;
+}
+
 // TODO: Add -1 notification here... and how to deal with it if it happens
 // TODO: Maybe think about getting FAISS to return integers (long-term todo)
 __global__
@@ -33,7 +33,12 @@
 
 // Detailed includes
 #include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include "include/fit_tsne.h"
 #include "include/options.h"
 
@@ -57,6 +62,62 @@
 #define IOPT(x) result[STRINGIFY(x)].as<int>()
 #define BOPT(x) result[STRINGIFY(x)].as<bool>()
 
+// Loads at most max_points points for the native KNN search: an IDX3 ubyte file
+// (MNIST, pixels scaled to [0, 1]) or a text file with one point per line.
+static int LoadPoints(const std::string& fname, const int max_points, std::vector<float>& points)
+{
+    std::ifstream file(fname, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + fname);
+    }
+
+    unsigned char header[16];
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (file.gcount() == sizeof(header) && header[0] == 0 && header[1] == 0 && header[2] == 0x08 && header[3] == 0x03) {
+        auto be32 = [&](int offset) {
+            return (int)(((unsigned)header[offset] << 24) | ((unsigned)header[offset + 1] << 16) |
+                         ((unsigned)header[offset + 2] << 8) | (unsigned)header[offset + 3]);
+        };
+        const int num_points = std::min(be32(4), max_points);
+        const int num_dims   = be32(8) * be32(12);
+        std::vector<unsigned char> pixels((size_t)num_points * num_dims);
+        file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
+        if ((size_t)file.gcount() != pixels.size()) {
+            throw std::runtime_error("Truncated IDX file " + fname);
+        }
+        points.resize(pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++) {
+            points[i] = pixels[i] / 255.0f;
+        }
+        return num_dims;
+    }
+
+    file.clear();
+    file.seekg(0);
+    int num_dims = 0;
+    int num_points = 0;
+    std::string line;
+    points.clear();
+    while (num_points < max_points && std::getline(file, line)) {
+        std::istringstream values(line);
+        int dims = 0;
+        float value;
+        while (values >> value) {
+            points.push_back(value);
+            dims++;
+        }
+        if (dims == 0) {
+            continue;
+        }
+        if (num_dims != 0 && dims != num_dims) {
+            throw std::runtime_error("Inconsistent point dimensions in " + fname);
+        }
+        num_dims = dims;
+        num_points++;
+    }
+    return num_dims;
+}
+
 int main(int argc, char** argv)
 {
     std::chrono::steady_clock::time_point time_start;
@@ -86,6 +147,7 @@ int main(int argc, char** argv)
         ("c,connection",        "Address for connection to vis server",                 cxxopts::value<std::string>()->default_value("tcp://localhost:5556"))
         ("q,dim",               "Point Dimensions",                                     cxxopts::value<int>()->default_value("50"))
         ("j,device",            "Device to run on",                                     cxxopts::value<int>()->default_value("0"))
+        ("knn",                 "Neighbor search <file,exact,approx>, file reads the FAISS output", cxxopts::value<std::string>()->default_value("file"))
         ("h,help",              "Print help");
 
     // Parse command line options
@@ -118,6 +180,22 @@ int main(int argc, char** argv)
     opt.num_neighbors           = IOPT(nearest-neighbors);
     opt.initialization          = init_type;
 
+    // Without the precomputed FAISS files the neighbors are searched in the points of -f
+    std::vector<float> points;
+    if (SOPT(knn).compare("file") != 0) {
+        if (SOPT(knn).compare("exact") == 0) {
+            opt.knn_method = tsnecuda::KNN_METHOD::EXACT;
+        } else if (SOPT(knn).compare("approx") == 0) {
+            opt.knn_method = tsnecuda::KNN_METHOD::APPROXIMATE;
+        } else {
+            throw std::runtime_error("Unknown neighbor search " + SOPT(knn));
+        }
+        opt.num_dims   = LoadPoints(SOPT(fname), IOPT(num-points), points);
+        opt.num_points = points.size() / std::max(opt.num_dims, 1);
+        opt.points     = points.data();
+        printf("Loaded %d points with %d dimensions from %s.\n", opt.num_points, opt.num_dims, SOPT(fname).c_str());
+    }
+
     if (BOPT(dump)) {
         opt.enable_dump("dump_ys.txt", 1);
     }
@@ -139,21 +139,40 @@ double tsnecuda::RunTsne(tsnecuda::Options& opt, int& success)
         std::cout << "done.\nKNN Load...\n" << std::flush;
     }
 
-    TIMER_START_()
-    // Compute approximate K Nearest Neighbors and squared distances
-    // TODO: See if we can gain some time here by updating FAISS, and building better indicies
-    // TODO: Add suport for arbitrary metrics on GPU (Introduced by recent FAISS computation)
-    // TODO: Expose Multi-GPU computation (+ Add streaming memory support for GPU optimization)
-    std::string data_folder = "../../data/mnist_faissed/";
-    // std::string data_folder = "../../data/cifar10_faissed/";
-    tsnecuda::utils::KNearestNeighbors(
-        std::move(data_folder), // folder containing input files
-        knn_indices,            // *** output indices   ***
-        knn_distances,          // *** output distances ***
-        high_dim,               // number of pixels per image = 784
-        num_points,             // number of images
-        num_neighbors);
-    TIMER_END_()
+    if (opt.knn_method == tsnecuda::KNN_METHOD::PRECOMPUTED) {
+        TIMER_START_()
+        // Compute approximate K Nearest Neighbors and squared distances
+        // TODO: See if we can gain some time here by updating FAISS, and building better indicies
+        // TODO: Add suport for arbitrary metrics on GPU (Introduced by recent FAISS computation)
+        // TODO: Expose Multi-GPU computation (+ Add streaming memory support for GPU optimization)
+        std::string data_folder = "../../data/mnist_faissed/";
+        // std::string data_folder = "../../data/cifar10_faissed/";
+        tsnecuda::utils::KNearestNeighbors(
+            std::move(data_folder), // folder containing input files
+            knn_indices,            // *** output indices   ***
+            knn_distances,          // *** output distances ***
+            high_dim,               // number of pixels per image = 784
+            num_points,             // number of images
+            num_neighbors);
+        TIMER_END_()
+    } else {
+        // Computed from the points, so this is part of the measured time
+#ifdef DEBUG_TIME
+        START_IL_TIMER();
+#endif
+        tsnecuda::utils::ComputeKNearestNeighbors(
+            opt.knn_method,
+            opt.points,             // input points
+            knn_indices,            // *** output indices   ***
+            knn_distances,          // *** output distances ***
+            high_dim,
+            num_points,
+            num_neighbors,
+            opt.random_seed);
+#ifdef DEBUG_TIME
+        END_IL_TIMER(_time_knn);
+#endif
+    }
 
 #ifdef DEBUG_TIME
     START_IL_TIMER();
@@ -76,6 +76,28 @@ void KNearestNeighbors(
     const int num_points,
     const int num_near_neighbots);
 
+/**
+* @brief Compute the k-nearest neighbors of the given points on the host, without precomputed FAISS files
+*
+* @param knn_method EXACT for a blocked brute force search, APPROXIMATE for NN-descent
+* @param points The points of which you want the k nearest neighbors (N_POINTSxN_DIMS) row-major
+* @param indices The index array that goes with the distance array (N_POINTSxK) row-major. Like FAISS, the first neighbor of a point is the point itself
+* @param distances The squared euclidean distance array (N_POINTSxK) row-major, ascending per point
+* @param num_dims The number of dimensions of the input points
+* @param num_points The number of input points
+* @param num_near_neighbors The number of nearest neighbors to return (K)
+* @param random_seed The seed of the random initial neighbor lists of NN-descent
+*/
+void ComputeKNearestNeighbors(
+    const tsnecuda::KNN_METHOD knn_method,
+    const float* points,
+    int64_t* indices,
+    float* distances,
+    const int num_dims,
+    const int num_points,
+    const int num_near_neighbors,
+    const int64_t random_seed);
+
 void PostprocessNeighborIndices(
     thrust::device_vector<int>& pij_indices,
     thrust::device_vector<int64_t>& knn_indices,
@@ -92,6 +92,13 @@ namespace tsnecuda
         JENSENSHANNON,
     };
 
+    enum KNN_METHOD
+    {
+        PRECOMPUTED,
+        EXACT,
+        APPROXIMATE
+    };
+
     class Options
     {
 
@@ -130,6 +137,7 @@ namespace tsnecuda
 
         // Distances
         faiss::MetricType distance_metric = faiss::METRIC_INNER_PRODUCT;
+        KNN_METHOD knn_method             = KNN_METHOD::PRECOMPUTED;  // PRECOMPUTED reads the FAISS output files
 
         // Initialization
         TSNE_INIT initialization    = TSNE_INIT::GAUSSIAN;
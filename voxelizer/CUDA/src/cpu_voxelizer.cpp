@@ -21,7 +21,10 @@
 // SPDX-License-Identifier: MIT
 
 #include "cpu_voxelizer.h"
-// #include <omp.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define float_error 0.000001
 
@@ -34,10 +37,17 @@ namespace cpu_voxelizer
 		size_t int_location = index / size_t(32);
 		uint32_t bit_pos = size_t(31) - (index % size_t(32)); // we count bit positions RtL, but array indices LtR
 		uint32_t mask = 1 << bit_pos | 0;
-		// #pragma omp critical
-		{
-			voxel_table[int_location] = (voxel_table[int_location] | mask);
-		}
+		voxel_table[int_location] = (voxel_table[int_location] | mask);
+	}
+
+	// Set specific bit in voxel table, for words other threads write as well
+	void setBitAtomic(unsigned int *voxel_table, size_t index)
+	{
+		size_t int_location = index / size_t(32);
+		uint32_t bit_pos = size_t(31) - (index % size_t(32)); // we count bit positions RtL, but array indices LtR
+		uint32_t mask = 1 << bit_pos | 0;
+#pragma omp atomic
+		voxel_table[int_location] |= mask;
 	}
 
 	// Encode morton code using LUT table
@@ -58,212 +68,414 @@ namespace cpu_voxelizer
 		return answer;
 	}
 
+	inline int getNumThreads()
+	{
+#ifdef _OPENMP
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	// Triangle bounding box in voxel grid coordinates
+	inline AABox<glm::ivec3> triangleGridBox(const voxinfo &info, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+	{
+		glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
+		// Triangle bounding box in world coordinates is min(v0,v1,v2) and max(v0,v1,v2)
+		AABox<glm::vec3> t_bbox_world(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+		// Triangle bounding box in voxel grid coordinates is the world bounding box divided by the grid unit vector
+		AABox<glm::ivec3> t_bbox_grid;
+		t_bbox_grid.min = glm::clamp(t_bbox_world.min / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
+		t_bbox_grid.max = glm::clamp(t_bbox_world.max / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
+		return t_bbox_grid;
+	}
+
+	// Voxelize the part of one triangle inside the window of grid voxels. The tests that depend on x
+	// are evaluated for a whole row of the triangle bbox at once, in a branch-free loop the compiler vectorizes.
+	// location_offset is subtracted from every voxel table location. Returns the number of voxels tested.
+	size_t voxelize_triangle(const voxinfo &info, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const AABox<glm::ivec3> &window,
+							 unsigned int *voxel_table, uint64_t location_offset, bool morton_order, bool atomic, std::vector<unsigned char> &row_hits)
+	{
+		// Common variables used in the voxelization process
+		glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
+		glm::vec3 c(0.0f, 0.0f, 0.0f); // critical point
+
+		// COMPUTE COMMON TRIANGLE PROPERTIES
+		// Edge vectors
+		glm::vec3 e0 = v1 - v0;
+		glm::vec3 e1 = v2 - v1;
+		glm::vec3 e2 = v0 - v2;
+		// Normal vector pointing up from the triangle
+		glm::vec3 n = glm::normalize(glm::cross(e0, e1));
+
+		// COMPUTE TRIANGLE BBOX IN GRID
+		AABox<glm::ivec3> t_bbox_grid = triangleGridBox(info, v0, v1, v2);
+		t_bbox_grid.min = glm::max(t_bbox_grid.min, window.min);
+		t_bbox_grid.max = glm::min(t_bbox_grid.max, window.max);
+		if (t_bbox_grid.min.x > t_bbox_grid.max.x || t_bbox_grid.min.y > t_bbox_grid.max.y || t_bbox_grid.min.z > t_bbox_grid.max.z)
+		{
+			return 0;
+		}
+
+		// PREPARE PLANE TEST PROPERTIES
+		if (n.x > 0.0f)
+		{
+			c.x = info.unit.x;
+		}
+		if (n.y > 0.0f)
+		{
+			c.y = info.unit.y;
+		}
+		if (n.z > 0.0f)
+		{
+			c.z = info.unit.z;
+		}
+		float d1 = glm::dot(n, (c - v0));
+		float d2 = glm::dot(n, ((delta_p - c) - v0));
+
+		// PREPARE PROJECTION TEST PROPERTIES
+		// XY plane
+		glm::vec2 n_xy_e0(-1.0f * e0.y, e0.x);
+		glm::vec2 n_xy_e1(-1.0f * e1.y, e1.x);
+		glm::vec2 n_xy_e2(-1.0f * e2.y, e2.x);
+		if (n.z < 0.0f)
+		{
+			n_xy_e0 = -n_xy_e0;
+			n_xy_e1 = -n_xy_e1;
+			n_xy_e2 = -n_xy_e2;
+		}
+		float d_xy_e0 = (-1.0f * glm::dot(n_xy_e0, glm::vec2(v0.x, v0.y))) + glm::max(0.0f, info.unit.x * n_xy_e0[0]) + glm::max(0.0f, info.unit.y * n_xy_e0[1]);
+		float d_xy_e1 = (-1.0f * glm::dot(n_xy_e1, glm::vec2(v1.x, v1.y))) + glm::max(0.0f, info.unit.x * n_xy_e1[0]) + glm::max(0.0f, info.unit.y * n_xy_e1[1]);
+		float d_xy_e2 = (-1.0f * glm::dot(n_xy_e2, glm::vec2(v2.x, v2.y))) + glm::max(0.0f, info.unit.x * n_xy_e2[0]) + glm::max(0.0f, info.unit.y * n_xy_e2[1]);
+		// YZ plane
+		glm::vec2 n_yz_e0(-1.0f * e0.z, e0.y);
+		glm::vec2 n_yz_e1(-1.0f * e1.z, e1.y);
+		glm::vec2 n_yz_e2(-1.0f * e2.z, e2.y);
+		if (n.x < 0.0f)
+		{
+			n_yz_e0 = -n_yz_e0;
+			n_yz_e1 = -n_yz_e1;
+			n_yz_e2 = -n_yz_e2;
+		}
+		float d_yz_e0 = (-1.0f * glm::dot(n_yz_e0, glm::vec2(v0.y, v0.z))) + glm::max(0.0f, info.unit.y * n_yz_e0[0]) + glm::max(0.0f, info.unit.z * n_yz_e0[1]);
+		float d_yz_e1 = (-1.0f * glm::dot(n_yz_e1, glm::vec2(v1.y, v1.z))) + glm::max(0.0f, info.unit.y * n_yz_e1[0]) + glm::max(0.0f, info.unit.z * n_yz_e1[1]);
+		float d_yz_e2 = (-1.0f * glm::dot(n_yz_e2, glm::vec2(v2.y, v2.z))) + glm::max(0.0f, info.unit.y * n_yz_e2[0]) + glm::max(0.0f, info.unit.z * n_yz_e2[1]);
+		// ZX plane
+		glm::vec2 n_zx_e0(-1.0f * e0.x, e0.z);
+		glm::vec2 n_zx_e1(-1.0f * e1.x, e1.z);
+		glm::vec2 n_zx_e2(-1.0f * e2.x, e2.z);
+		if (n.y < 0.0f)
+		{
+			n_zx_e0 = -n_zx_e0;
+			n_zx_e1 = -n_zx_e1;
+			n_zx_e2 = -n_zx_e2;
+		}
+		float d_xz_e0 = (-1.0f * glm::dot(n_zx_e0, glm::vec2(v0.z, v0.x))) + glm::max(0.0f, info.unit.x * n_zx_e0[0]) + glm::max(0.0f, info.unit.z * n_zx_e0[1]);
+		float d_xz_e1 = (-1.0f * glm::dot(n_zx_e1, glm::vec2(v1.z, v1.x))) + glm::max(0.0f, info.unit.x * n_zx_e1[0]) + glm::max(0.0f, info.unit.z * n_zx_e1[1]);
+		float d_xz_e2 = (-1.0f * glm::dot(n_zx_e2, glm::vec2(v2.z, v2.x))) + glm::max(0.0f, info.unit.x * n_zx_e2[0]) + glm::max(0.0f, info.unit.z * n_zx_e2[1]);
+
+		const int xmin = t_bbox_grid.min.x;
+		const int nx = t_bbox_grid.max.x - xmin + 1;
+		if (row_hits.size() < size_t(nx))
+			row_hits.resize(nx);
+		unsigned char *hits = row_hits.data();
+		size_t n_tested = 0;
+
+		// test possible grid boxes for overlap
+		for (int z = t_bbox_grid.min.z; z <= t_bbox_grid.max.z; z++)
+		{
+			for (int y = t_bbox_grid.min.y; y <= t_bbox_grid.max.y; y++)
+			{
+				float py = y * info.unit.y;
+				float pz = z * info.unit.z;
+
+				// PROJECTION TESTS
+				// YZ does not depend on x: accept or reject the whole row
+				glm::vec2 p_yz(py, pz);
+				if ((glm::dot(n_yz_e0, p_yz) + d_yz_e0) < 0.0f)
+				{
+					continue;
+				}
+				if ((glm::dot(n_yz_e1, p_yz) + d_yz_e1) < 0.0f)
+				{
+					continue;
+				}
+				if ((glm::dot(n_yz_e2, p_yz) + d_yz_e2) < 0.0f)
+				{
+					continue;
+				}
+				n_tested += nx;
+
+				// the parts of the dot products that are constant along the row, summed in the same order as glm::dot
+				const float n_py = n.y * py, n_pz = n.z * pz;
+				const float xy_e0 = n_xy_e0.y * py, xy_e1 = n_xy_e1.y * py, xy_e2 = n_xy_e2.y * py;
+				const float zx_e0 = n_zx_e0.x * pz, zx_e1 = n_zx_e1.x * pz, zx_e2 = n_zx_e2.x * pz;
+
+				// TRIANGLE PLANE THROUGH BOX TEST and XY, XZ PROJECTION TESTS
+				int any = 0;
+#pragma omp simd reduction(| : any)
+				for (int i = 0; i < nx; i++)
+				{
+					float px = (xmin + i) * info.unit.x;
+					float nDOTp = (n.x * px + n_py) + n_pz;
+					bool hit = !(((nDOTp + d1) * (nDOTp + d2)) > 0.0f);
+					hit &= !(((n_xy_e0.x * px + xy_e0) + d_xy_e0) < 0.0f);
+					hit &= !(((n_xy_e1.x * px + xy_e1) + d_xy_e1) < 0.0f);
+					hit &= !(((n_xy_e2.x * px + xy_e2) + d_xy_e2) < 0.0f);
+					hit &= !(((zx_e0 + n_zx_e0.y * px) + d_xz_e0) < 0.0f);
+					hit &= !(((zx_e1 + n_zx_e1.y * px) + d_xz_e1) < 0.0f);
+					hit &= !(((zx_e2 + n_zx_e2.y * px) + d_xz_e2) < 0.0f);
+					hits[i] = hit;
+					any |= hit;
+				}
+				if (!any)
+				{
+					continue;
+				}
+
+				for (int i = 0; i < nx; i++)
+				{
+					if (!hits[i])
+					{
+						continue;
+					}
+					int x = xmin + i;
+					size_t location;
+					if (morton_order)
+					{
+						location = mortonEncode_LUT(x, y, z);
+					}
+					else
+					{
+						location = static_cast<size_t>(x) + (static_cast<size_t>(y) * static_cast<size_t>(info.gridsize.y)) + (static_cast<size_t>(z) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z));
+					}
+					location -= location_offset;
+					if (atomic)
+					{
+						setBitAtomic(voxel_table, location);
+					}
+					else
+					{
+						setBit(voxel_table, location);
+					}
+				}
+			}
+		}
+		return n_tested;
+	}
+
 	// Mesh voxelization method
+	//
+	// The triangles are binned into slabs of grid layers along z by their bounding box, and the threads
+	// voxelize one slab at a time, each triangle clipped to the slab. Without morton order a slab covers
+	// whole words of the voxel table when its size is a multiple of 32 bits, so every word has one writer;
+	// otherwise the bits are set with atomic OR.
 	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh *themesh, unsigned int *voxel_table, bool morton_order)
 	{
 		Timer cpu_voxelization_timer;
 		cpu_voxelization_timer.start();
-		//// Common variables used in the voxelization process
-		// glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
-		// glm::vec3 c(0.0f, 0.0f, 0.0f); // critical point
-		// glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
 
 		// PREPASS
-		// Move all vertices to origin (can be done in parallel)
+		// Move all vertices to origin
 		trimesh::vec3 move_min = glm_to_trimesh<trimesh::vec3>(info.bbox.min);
-		// #pragma omp parallel for
+#pragma omp parallel for
 		for (int64_t i = 0; i < themesh->vertices.size(); i++)
 		{
-			// if (i == 0) { printf("[Info] Using %d threads \n", omp_get_num_threads()); }
 			themesh->vertices[i] = themesh->vertices[i] - move_min;
 		}
 
-#ifdef _DEBUG
-		size_t debug_n_triangles = 0;
-		size_t debug_n_voxels_tested = 0;
-		size_t debug_n_voxels_marked = 0;
-#endif
-
-		// #pragma omp parallel for
+		// BIN TRIANGLES INTO SLABS
+		const int n_threads = getNumThreads();
+		const int slab_height = glm::max(1, int((info.gridsize.z + 8 * n_threads - 1) / (8 * n_threads)));
+		const int n_slabs = (info.gridsize.z + slab_height - 1) / slab_height;
+		const size_t slab_bits = static_cast<size_t>(slab_height) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
+		const bool atomic = n_threads > 1 && (morton_order || (slab_bits % 32) != 0);
 
+		std::vector<int> tri_zmin(info.n_triangles), tri_zmax(info.n_triangles);
+#pragma omp parallel for
 		for (int64_t i = 0; i < info.n_triangles; i++)
 		{
-			// Common variables used in the voxelization process
-			glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
-			glm::vec3 c(0.0f, 0.0f, 0.0f);													   // critical point
-			glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
-#ifdef _DEBUG
-			debug_n_triangles++;
-#endif
-			// COMPUTE COMMON TRIANGLE PROPERTIES
-			// Move vertices to origin using bbox
 			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
 			glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]);
 			glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]);
+			AABox<glm::ivec3> t_bbox_grid = triangleGridBox(info, v0, v1, v2);
+			tri_zmin[i] = t_bbox_grid.min.z;
+			tri_zmax[i] = t_bbox_grid.max.z;
+		}
 
-			// Edge vectors
-			glm::vec3 e0 = v1 - v0;
-			glm::vec3 e1 = v2 - v1;
-			glm::vec3 e2 = v0 - v2;
-			// Normal vector pointing up from the triangle
-			glm::vec3 n = glm::normalize(glm::cross(e0, e1));
-
-			// COMPUTE TRIANGLE BBOX IN GRID
-			// Triangle bounding box in world coordinates is min(v0,v1,v2) and max(v0,v1,v2)
-			AABox<glm::vec3> t_bbox_world(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
-			// Triangle bounding box in voxel grid coordinates is the world bounding box divided by the grid unit vector
-			AABox<glm::ivec3> t_bbox_grid;
-			t_bbox_grid.min = glm::clamp(t_bbox_world.min / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-			t_bbox_grid.max = glm::clamp(t_bbox_world.max / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-
-			// PREPARE PLANE TEST PROPERTIES
-			if (n.x > 0.0f)
-			{
-				c.x = info.unit.x;
-			}
-			if (n.y > 0.0f)
-			{
-				c.y = info.unit.y;
-			}
-			if (n.z > 0.0f)
-			{
-				c.z = info.unit.z;
-			}
-			float d1 = glm::dot(n, (c - v0));
-			float d2 = glm::dot(n, ((delta_p - c) - v0));
-
-			// PREPARE PROJECTION TEST PROPERTIES
-			// XY plane
-			glm::vec2 n_xy_e0(-1.0f * e0.y, e0.x);
-			glm::vec2 n_xy_e1(-1.0f * e1.y, e1.x);
-			glm::vec2 n_xy_e2(-1.0f * e2.y, e2.x);
-			if (n.z < 0.0f)
-			{
-				n_xy_e0 = -n_xy_e0;
-				n_xy_e1 = -n_xy_e1;
-				n_xy_e2 = -n_xy_e2;
-			}
-			float d_xy_e0 = (-1.0f * glm::dot(n_xy_e0, glm::vec2(v0.x, v0.y))) + glm::max(0.0f, info.unit.x * n_xy_e0[0]) + glm::max(0.0f, info.unit.y * n_xy_e0[1]);
-			float d_xy_e1 = (-1.0f * glm::dot(n_xy_e1, glm::vec2(v1.x, v1.y))) + glm::max(0.0f, info.unit.x * n_xy_e1[0]) + glm::max(0.0f, info.unit.y * n_xy_e1[1]);
-			float d_xy_e2 = (-1.0f * glm::dot(n_xy_e2, glm::vec2(v2.x, v2.y))) + glm::max(0.0f, info.unit.x * n_xy_e2[0]) + glm::max(0.0f, info.unit.y * n_xy_e2[1]);
-			// YZ plane
-			glm::vec2 n_yz_e0(-1.0f * e0.z, e0.y);
-			glm::vec2 n_yz_e1(-1.0f * e1.z, e1.y);
-			glm::vec2 n_yz_e2(-1.0f * e2.z, e2.y);
-			if (n.x < 0.0f)
+		std::vector<size_t> slab_start(n_slabs + 1, 0);
+		for (int64_t i = 0; i < info.n_triangles; i++)
+		{
+			for (int s = tri_zmin[i] / slab_height; s <= tri_zmax[i] / slab_height; s++)
 			{
-				n_yz_e0 = -n_yz_e0;
-				n_yz_e1 = -n_yz_e1;
-				n_yz_e2 = -n_yz_e2;
+				slab_start[s + 1]++;
 			}
-			float d_yz_e0 = (-1.0f * glm::dot(n_yz_e0, glm::vec2(v0.y, v0.z))) + glm::max(0.0f, info.unit.y * n_yz_e0[0]) + glm::max(0.0f, info.unit.z * n_yz_e0[1]);
-			float d_yz_e1 = (-1.0f * glm::dot(n_yz_e1, glm::vec2(v1.y, v1.z))) + glm::max(0.0f, info.unit.y * n_yz_e1[0]) + glm::max(0.0f, info.unit.z * n_yz_e1[1]);
-			float d_yz_e2 = (-1.0f * glm::dot(n_yz_e2, glm::vec2(v2.y, v2.z))) + glm::max(0.0f, info.unit.y * n_yz_e2[0]) + glm::max(0.0f, info.unit.z * n_yz_e2[1]);
-			// ZX plane
-			glm::vec2 n_zx_e0(-1.0f * e0.x, e0.z);
-			glm::vec2 n_zx_e1(-1.0f * e1.x, e1.z);
-			glm::vec2 n_zx_e2(-1.0f * e2.x, e2.z);
-			if (n.y < 0.0f)
+		}
+		for (int s = 0; s < n_slabs; s++)
+		{
+			slab_start[s + 1] += slab_start[s];
+		}
+		std::vector<int> slab_triangles(slab_start[n_slabs]);
+		std::vector<size_t> slab_fill(slab_start.begin(), slab_start.end() - 1);
+		for (int64_t i = 0; i < info.n_triangles; i++)
+		{
+			for (int s = tri_zmin[i] / slab_height; s <= tri_zmax[i] / slab_height; s++)
 			{
-				n_zx_e0 = -n_zx_e0;
-				n_zx_e1 = -n_zx_e1;
-				n_zx_e2 = -n_zx_e2;
+				slab_triangles[slab_fill[s]++] = int(i);
 			}
-			float d_xz_e0 = (-1.0f * glm::dot(n_zx_e0, glm::vec2(v0.z, v0.x))) + glm::max(0.0f, info.unit.x * n_zx_e0[0]) + glm::max(0.0f, info.unit.z * n_zx_e0[1]);
-			float d_xz_e1 = (-1.0f * glm::dot(n_zx_e1, glm::vec2(v1.z, v1.x))) + glm::max(0.0f, info.unit.x * n_zx_e1[0]) + glm::max(0.0f, info.unit.z * n_zx_e1[1]);
-			float d_xz_e2 = (-1.0f * glm::dot(n_zx_e2, glm::vec2(v2.z, v2.x))) + glm::max(0.0f, info.unit.x * n_zx_e2[0]) + glm::max(0.0f, info.unit.z * n_zx_e2[1]);
+		}
 
-			// test possible grid boxes for overlap
-			for (int z = t_bbox_grid.min.z; z <= t_bbox_grid.max.z; z++)
+		size_t n_voxels_tested = 0;
+#pragma omp parallel reduction(+ : n_voxels_tested)
+		{
+			std::vector<unsigned char> row_hits;
+#pragma omp for schedule(dynamic)
+			for (int s = 0; s < n_slabs; s++)
 			{
-				for (int y = t_bbox_grid.min.y; y <= t_bbox_grid.max.y; y++)
+				AABox<glm::ivec3> slab(glm::ivec3(0, 0, s * slab_height), glm::ivec3(info.gridsize.x - 1, info.gridsize.y - 1, s * slab_height + slab_height - 1));
+				for (size_t k = slab_start[s]; k < slab_start[s + 1]; k++)
 				{
-					for (int x = t_bbox_grid.min.x; x <= t_bbox_grid.max.x; x++)
-					{
-						// size_t location = x + (y*info.gridsize) + (z*info.gridsize*info.gridsize);
-						// if (checkBit(voxel_table, location)){ continue; }
+					int i = slab_triangles[k];
+					// COMPUTE COMMON TRIANGLE PROPERTIES
+					// Move vertices to origin using bbox
+					glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
+					glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]);
+					glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]);
+					n_voxels_tested += voxelize_triangle(info, v0, v1, v2, slab, voxel_table, 0, morton_order, atomic, row_hits);
+				}
+			}
+		}
+		cpu_voxelization_timer.stop();
+		double seconds = cpu_voxelization_timer.elapsed_time_milliseconds / 1000.0;
+		size_t n_voxels = static_cast<size_t>(info.gridsize.x) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
+		fprintf(stdout, "[Perf] CPU voxelization time: %.1f ms \n", cpu_voxelization_timer.elapsed_time_milliseconds);
+		fprintf(stdout, "[Perf] CPU voxelization throughput: %.2f Mtriangles/s, %.1f Mvoxels/s (%d threads, %d slabs) \n",
+				info.n_triangles / seconds / 1e6, n_voxels / seconds / 1e6, n_threads, n_slabs);
 #ifdef _DEBUG
-						debug_n_voxels_tested++;
+		printf("[Debug] Processed %llu triangles on the CPU \n", (size_t)info.n_triangles);
+		printf("[Debug] Tested %llu voxels for overlap on CPU \n", n_voxels_tested);
 #endif
+	}
 
-						// TRIANGLE PLANE THROUGH BOX TEST
-						glm::vec3 p(x * info.unit.x, y * info.unit.y, z * info.unit.z);
-						float nDOTp = glm::dot(n, p);
-						if (((nDOTp + d1) * (nDOTp + d2)) > 0.0f)
-						{
-							continue;
-						}
+	// Mesh voxelization straight into the bricks of a sparse voxel grid
+	//
+	// The grid is cut into cubic tiles of up to 256^3 voxels. In morton order a tile is a contiguous range
+	// of the voxel table, so each thread voxelizes one tile at a time into a small table of its own and keeps
+	// the non-empty bricks. Only tiles that triangles touch are visited, in morton order, so the bricks come
+	// out sorted and the memory used grows with the surface instead of the volume of the grid.
+	// The grid has to be a cube with a power of 2 size of at least 8.
+	void cpu_voxelize_mesh_sparse(voxinfo info, trimesh::TriMesh *themesh, SparseVoxels &sparse)
+	{
+		Timer cpu_voxelization_timer;
+		cpu_voxelization_timer.start();
 
-						// PROJECTION TESTS
-						// XY
-						glm::vec2 p_xy(p.x, p.y);
-						if ((glm::dot(n_xy_e0, p_xy) + d_xy_e0) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_xy_e1, p_xy) + d_xy_e1) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_xy_e2, p_xy) + d_xy_e2) < 0.0f)
-						{
-							continue;
-						}
+		// PREPASS
+		// Move all vertices to origin
+		trimesh::vec3 move_min = glm_to_trimesh<trimesh::vec3>(info.bbox.min);
+#pragma omp parallel for
+		for (int64_t i = 0; i < themesh->vertices.size(); i++)
+		{
+			themesh->vertices[i] = themesh->vertices[i] - move_min;
+		}
 
-						// YZ
-						glm::vec2 p_yz(p.y, p.z);
-						if ((glm::dot(n_yz_e0, p_yz) + d_yz_e0) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_yz_e1, p_yz) + d_yz_e1) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_yz_e2, p_yz) + d_yz_e2) < 0.0f)
-						{
-							continue;
-						}
+		// BIN TRIANGLES INTO TILES
+		const int tile_size = glm::min(int(info.gridsize.x), 256);
+		const int n_tiles_axis = info.gridsize.x / tile_size;
+		const size_t n_tiles = static_cast<size_t>(n_tiles_axis) * n_tiles_axis * n_tiles_axis;
+		const size_t tile_bits = static_cast<size_t>(tile_size) * tile_size * tile_size;
+		std::vector<AABox<glm::ivec3>> tri_tiles(info.n_triangles);
+#pragma omp parallel for
+		for (int64_t i = 0; i < info.n_triangles; i++)
+		{
+			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
+			glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]);
+			glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]);
+			AABox<glm::ivec3> t_bbox_grid = triangleGridBox(info, v0, v1, v2);
+			tri_tiles[i] = AABox<glm::ivec3>(t_bbox_grid.min / tile_size, t_bbox_grid.max / tile_size);
+		}
 
-						// XZ
-						glm::vec2 p_zx(p.z, p.x);
-						if ((glm::dot(n_zx_e0, p_zx) + d_xz_e0) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_zx_e1, p_zx) + d_xz_e1) < 0.0f)
-						{
-							continue;
-						}
-						if ((glm::dot(n_zx_e2, p_zx) + d_xz_e2) < 0.0f)
-						{
-							continue;
-						}
-#ifdef _DEBUG
-						debug_n_voxels_marked += 1;
-#endif
-						if (morton_order)
-						{
-							size_t location = mortonEncode_LUT(x, y, z);
-							setBit(voxel_table, location);
-						}
-						else
-						{
-							size_t location = static_cast<size_t>(x) + (static_cast<size_t>(y) * static_cast<size_t>(info.gridsize.y)) + (static_cast<size_t>(z) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z));
-							// std:: cout << "Voxel found at " << x << " " << y << " " << z << std::endl;
-							setBit(voxel_table, location);
-						}
-						continue;
-					}
+		// tiles are numbered by the morton code of their position
+		std::vector<size_t> tile_start(n_tiles + 1, 0);
+		for (int64_t i = 0; i < info.n_triangles; i++)
+		{
+			for (int z = tri_tiles[i].min.z; z <= tri_tiles[i].max.z; z++)
+				for (int y = tri_tiles[i].min.y; y <= tri_tiles[i].max.y; y++)
+					for (int x = tri_tiles[i].min.x; x <= tri_tiles[i].max.x; x++)
+						tile_start[mortonEncode_LUT(x, y, z) + 1]++;
+		}
+		std::vector<uint64_t> tiles; // the tiles that have triangles
+		for (size_t t = 0; t < n_tiles; t++)
+		{
+			if (tile_start[t + 1])
+			{
+				tiles.push_back(t);
+			}
+			tile_start[t + 1] += tile_start[t];
+		}
+		std::vector<int> tile_triangles(tile_start[n_tiles]);
+		std::vector<size_t> tile_fill(tile_start.begin(), tile_start.end() - 1);
+		for (int64_t i = 0; i < info.n_triangles; i++)
+		{
+			for (int z = tri_tiles[i].min.z; z <= tri_tiles[i].max.z; z++)
+				for (int y = tri_tiles[i].min.y; y <= tri_tiles[i].max.y; y++)
+					for (int x = tri_tiles[i].min.x; x <= tri_tiles[i].max.x; x++)
+						tile_triangles[tile_fill[mortonEncode_LUT(x, y, z)]++] = int(i);
+		}
+
+		// VOXELIZE TILE BY TILE
+		std::vector<SparseVoxels> tile_bricks(tiles.size());
+		size_t n_voxels_tested = 0;
+#pragma omp parallel reduction(+ : n_voxels_tested)
+		{
+			std::vector<unsigned char> row_hits;
+			std::vector<unsigned int> tile_table(tile_bits / 32);
+#pragma omp for schedule(dynamic)
+			for (int64_t k = 0; k < int64_t(tiles.size()); k++)
+			{
+				const uint64_t t = tiles[k];
+				// the tile position from its morton code
+				glm::ivec3 tile_min(0, 0, 0);
+				for (int b = 0; (t >> (3 * b)) != 0; b++)
+				{
+					tile_min.x |= int((t >> (3 * b)) & 1) << b;
+					tile_min.y |= int((t >> (3 * b + 1)) & 1) << b;
+					tile_min.z |= int((t >> (3 * b + 2)) & 1) << b;
 				}
+				tile_min *= tile_size;
+				AABox<glm::ivec3> window(tile_min, tile_min + glm::ivec3(tile_size - 1));
+
+				std::fill(tile_table.begin(), tile_table.end(), 0u);
+				for (size_t j = tile_start[t]; j < tile_start[t + 1]; j++)
+				{
+					int i = tile_triangles[j];
+					glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
+					glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]);
+					glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]);
+					n_voxels_tested += voxelize_triangle(info, v0, v1, v2, window, tile_table.data(), t * tile_bits, true, false, row_hits);
+				}
+				sparse_add_bricks(tile_bricks[k], tile_table.data(), tile_bits, t * tile_bits);
 			}
 		}
+
+		sparse.gridsize = info.gridsize;
+		sparse.bbox = info.bbox;
+		sparse.keys.clear();
+		sparse.bricks.clear();
+		for (size_t k = 0; k < tiles.size(); k++)
+		{
+			sparse.keys.insert(sparse.keys.end(), tile_bricks[k].keys.begin(), tile_bricks[k].keys.end());
+			sparse.bricks.insert(sparse.bricks.end(), tile_bricks[k].bricks.begin(), tile_bricks[k].bricks.end());
+		}
+
 		cpu_voxelization_timer.stop();
+		double seconds = cpu_voxelization_timer.elapsed_time_milliseconds / 1000.0;
+		size_t n_voxels = static_cast<size_t>(info.gridsize.x) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
 		fprintf(stdout, "[Perf] CPU voxelization time: %.1f ms \n", cpu_voxelization_timer.elapsed_time_milliseconds);
+		fprintf(stdout, "[Perf] CPU voxelization throughput: %.2f Mtriangles/s, %.1f Mvoxels/s (%d threads, %zu of %zu tiles) \n",
+				info.n_triangles / seconds / 1e6, n_voxels / seconds / 1e6, getNumThreads(), tiles.size(), n_tiles);
 #ifdef _DEBUG
-		printf("[Debug] Processed %llu triangles on the CPU \n", debug_n_triangles);
-		printf("[Debug] Tested %llu voxels for overlap on CPU \n", debug_n_voxels_tested);
-		printf("[Debug] Marked %llu voxels as filled (includes duplicates!) on CPU \n", debug_n_voxels_marked);
+		printf("[Debug] Processed %llu triangles on the CPU \n", (size_t)info.n_triangles);
+		printf("[Debug] Tested %llu voxels for overlap on CPU \n", n_voxels_tested);
 #endif
 	}
 
@@ -273,9 +485,44 @@ namespace cpu_voxelizer
 		size_t int_location = index / size_t(32);
 		unsigned int bit_pos = size_t(31) - (index % size_t(32)); // we count bit positions RtL, but array indices LtR
 		unsigned int mask = 1 << bit_pos;
-		// #pragma omp critical
+		voxel_table[int_location] = (voxel_table[int_location] ^ mask);
+	}
+
+	// use Xor for voxels whose corresponding bits have to flipped, for words other threads write as well
+	void setBitXorAtomic(unsigned int *voxel_table, size_t index)
+	{
+		size_t int_location = index / size_t(32);
+		unsigned int bit_pos = size_t(31) - (index % size_t(32)); // we count bit positions RtL, but array indices LtR
+		unsigned int mask = 1 << bit_pos;
+#pragma omp atomic
+		voxel_table[int_location] ^= mask;
+	}
+
+	// flip the bits first..last with one Xor per word
+	void flipBitRange(unsigned int *voxel_table, size_t first, size_t last, bool atomic)
+	{
+		size_t first_int = first / size_t(32);
+		size_t last_int = last / size_t(32);
+		for (size_t k = first_int; k <= last_int; k++)
 		{
-			voxel_table[int_location] = (voxel_table[int_location] ^ mask);
+			unsigned int mask = 0xFFFFFFFFu;
+			if (k == first_int)
+			{
+				mask &= 0xFFFFFFFFu >> (first % size_t(32)); // we count bit positions RtL, but array indices LtR
+			}
+			if (k == last_int)
+			{
+				mask &= 0xFFFFFFFFu << (size_t(31) - (last % size_t(32)));
+			}
+			if (atomic)
+			{
+#pragma omp atomic
+				voxel_table[k] ^= mask;
+			}
+			else
+			{
+				voxel_table[k] = (voxel_table[k] ^ mask);
+			}
 		}
 	}
 
@@ -334,16 +581,18 @@ namespace cpu_voxelizer
 		cpu_voxelization_timer.start();
 
 		// PREPASS
-		// Move all vertices to origin (can be done in parallel)
+		// Move all vertices to origin
 		trimesh::vec3 move_min = glm_to_trimesh<trimesh::vec3>(info.bbox.min);
-		// #pragma omp parallel for
+#pragma omp parallel for
 		for (int64_t i = 0; i < themesh->vertices.size(); i++)
 		{
-			// if (i == 0) { printf("[Info] Using %d threads \n", omp_get_num_threads()); }
 			themesh->vertices[i] = themesh->vertices[i] - move_min;
 		}
 
-		// #pragma omp parallel for
+		// The flips of different triangles commute, so the triangles are processed in parallel with atomic Xor.
+		// Without morton order the voxels x = 0..xmax of a column are consecutive bits and flipped a word at a time.
+		const bool atomic = getNumThreads() > 1;
+#pragma omp parallel for schedule(dynamic, 64)
 		for (int64_t i = 0; i < info.n_triangles; i++)
 		{
 			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
@@ -390,26 +639,40 @@ namespace cpu_voxelizer
 					int checknum = check_point_triangle(v0_yz, v1_yz, v2_yz, point);
 					if ((checknum == 1 && TopLeftEdge(v0_yz, v1_yz)) || (checknum == 2 && TopLeftEdge(v1_yz, v2_yz)) || (checknum == 3 && TopLeftEdge(v2_yz, v0_yz)) || (checknum == 0))
 					{
-						unsigned int xmax = int(get_x_coordinate(n, v0, point) / info.unit.x - 0.5);
-						for (int x = 0; x <= xmax; x++)
+						int xmax = int(get_x_coordinate(n, v0, point) / info.unit.x - 0.5);
+						if (xmax < 0)
+						{
+							continue;
+						}
+						if (morton_order)
 						{
-							if (morton_order)
+							for (int x = 0; x <= xmax; x++)
 							{
 								size_t location = mortonEncode_LUT(x, y, z);
-								setBitXor(voxel_table, location);
+								if (atomic)
+								{
+									setBitXorAtomic(voxel_table, location);
+								}
+								else
+								{
+									setBitXor(voxel_table, location);
+								}
 							}
-							else
-							{
-								size_t location = static_cast<size_t>(x) + (static_cast<size_t>(y) * static_cast<size_t>(info.gridsize.y)) + (static_cast<size_t>(z) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z));
-								setBitXor(voxel_table, location);
-							}
-							continue;
+						}
+						else
+						{
+							size_t location = (static_cast<size_t>(y) * static_cast<size_t>(info.gridsize.y)) + (static_cast<size_t>(z) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z));
+							flipBitRange(voxel_table, location, location + static_cast<size_t>(xmax), atomic);
 						}
 					}
 				}
 			}
 		}
 		cpu_voxelization_timer.stop();
+		double seconds = cpu_voxelization_timer.elapsed_time_milliseconds / 1000.0;
+		size_t n_voxels = static_cast<size_t>(info.gridsize.x) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
 		fprintf(stdout, "[Perf] CPU voxelization time: %.1f ms \n", cpu_voxelization_timer.elapsed_time_milliseconds);
+		fprintf(stdout, "[Perf] CPU voxelization throughput: %.2f Mtriangles/s, %.1f Mvoxels/s (%d threads) \n",
+				info.n_triangles / seconds / 1e6, n_voxels / seconds / 1e6, getNumThreads());
 	}
 }
\ No newline at end of file
@@ -323,6 +323,7 @@ void voxelize(const voxinfo &v, float *triangle_data, unsigned int *vtable, bool
 	checkCudaErrors(cudaEventSynchronize(stop_vox));
 	checkCudaErrors(cudaEventElapsedTime(&elapsedTime, start_vox, stop_vox));
 	printf("[Perf] Voxelization GPU time: %.1f ms\n", elapsedTime);
+	printf("[Perf] Voxelization GPU throughput: %.2f Mtriangles/s, %.1f Mvoxels/s\n", v.n_triangles / (elapsedTime * 1e3), ((double)v.gridsize.x * v.gridsize.y * v.gridsize.z) / (elapsedTime * 1e3));
 
 	// If we're not using UNIFIED memory, copy the voxel table back and free all
 	if (useThrustPath)
@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <cmath> 
 #include "util.h"
+#include "util_io.h"
 #include "timer.h"
 #include "morton_LUTs.h"
 
@@ -13,4 +14,5 @@
 namespace cpu_voxelizer {
 	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order);
 	void cpu_voxelize_mesh_solid(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order);
+	void cpu_voxelize_mesh_sparse(voxinfo info, trimesh::TriMesh* themesh, SparseVoxels& sparse);
 }
\ No newline at end of file
@@ -9,9 +9,13 @@ float *meshToGPU_thrust(const trimesh::TriMesh *mesh)
 {
 	Timer t;
 	t.start(); // TIMER START
-	// create vectors on heap
-	trianglethrust_host = new thrust::host_vector<glm::vec3>;
-	trianglethrust_device = new thrust::device_vector<glm::vec3>;
+	// create vectors on heap, the meshes of a batch reuse them
+	if (trianglethrust_host == NULL)
+	{
+		trianglethrust_host = new thrust::host_vector<glm::vec3>;
+		trianglethrust_device = new thrust::device_vector<glm::vec3>;
+	}
+	trianglethrust_host->clear();
 	// fill host vector
 	fprintf(stdout, "[Mesh] Copying %zu triangles to Thrust host vector \n", mesh->faces.size());
 	for (size_t i = 0; i < mesh->faces.size(); i++)
@@ -29,6 +29,10 @@
 #include <string>
 #include <cstdio>
 #include <cmath>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <vector>
 // Trimesh for model importing
 #include "TriMesh.h"
 // Util
@@ -58,13 +62,15 @@ enum class OutputFormat
 	output_binvox = 0,
 	output_morton = 1,
 	output_obj_points = 2,
-	output_obj_cubes = 3
+	output_obj_cubes = 3,
+	output_sparse = 4
 };
-char *OutputFormats[] = {"binvox file", "morton encoded blob", "obj file (pointcloud)", "obj file (cubes)"};
+char *OutputFormats[] = {"binvox file", "morton encoded blob", "obj file (pointcloud)", "obj file (cubes)", "sparse voxel file (bricks)"};
 
 // Default options
 string filename = "";
 string filename_base = "";
+string batch_manifest = "";
 OutputFormat outputformat = OutputFormat::output_binvox;
 unsigned int gridsize = 256;
 int iterations = 1;
@@ -87,31 +93,35 @@ void printHelp()
 	fprintf(stdout, "\n## HELP  \n");
 	cout << "Program options: " << endl
 		 << endl;
-	cout << " -f <path to model file: .ply, .obj, .3ds> (required)" << endl;
+	cout << " -f <path to model file: .ply, .obj, .3ds, or a .svo sparse voxel file to convert> (required, unless -batch is given)" << endl;
 	cout << " -s <voxelization grid size, power of 2: 8 -> 512, 1024, ... (default: 256)>" << endl;
 	cout << " -i <number of iterations (default: 1)>" << endl;
-	cout << " -o <output format: binvox, obj, obj_points or morton (default: binvox)>" << endl;
+	cout << " -o <output format: binvox, obj, obj_points, morton or sparse (default: binvox)>" << endl;
 	cout << " -thrust : Force using CUDA Thrust Library (possible speedup / throughput improvement)" << endl;
-	cout << " -cpu : Force CPU-based voxelization (slow, but works if no compatible GPU can be found)" << endl;
-	cout << " -solid : Force solid voxelization (experimental, needs watertight model)" << endl
+	cout << " -cpu : Force CPU-based voxelization (works if no compatible GPU can be found, uses OMP_NUM_THREADS threads when built with OpenMP)" << endl;
+	cout << " -solid : Force solid voxelization (experimental, needs watertight model)" << endl;
+	cout << " -batch <path to manifest: one model file per line, optionally followed by grid sizes> : Voxelize all models of the manifest in one run" << endl
 		 << endl;
 	printExample();
 	cout << endl;
 }
 
 // METHOD 1: Helper function to transfer triangles to automatically managed CUDA memory ( > CUDA 7.x)
-float *meshToGPU_managed(const trimesh::TriMesh *mesh)
+float *meshToGPU_managed(const trimesh::TriMesh *mesh, float *device_triangles = NULL)
 {
 	Timer t;
 	t.start();
 	size_t n_floats = sizeof(float) * 9 * (mesh->faces.size());
-	float *device_triangles;
-	fprintf(stdout, "[Mesh] Allocating %s of managed UNIFIED memory for triangle data \n", (readableSize(n_floats)).c_str());
-	auto start_gpu_time = std::chrono::steady_clock::now();
-	device_triangles = (float *)sycl::malloc_shared(
-		n_floats, sycl_device_queue); // managed memory
-	auto stop_gpu_time = std::chrono::steady_clock::now();
-	total_gpu_time += std::chrono::duration<float, std::milli>(stop_gpu_time - start_gpu_time).count();
+	// a buffer of at least n_floats bytes can be passed in to reuse it
+	if (device_triangles == NULL)
+	{
+		fprintf(stdout, "[Mesh] Allocating %s of managed UNIFIED memory for triangle data \n", (readableSize(n_floats)).c_str());
+		auto start_gpu_time = std::chrono::steady_clock::now();
+		device_triangles = (float *)sycl::malloc_shared(
+			n_floats, sycl_device_queue); // managed memory
+		auto stop_gpu_time = std::chrono::steady_clock::now();
+		total_gpu_time += std::chrono::duration<float, std::milli>(stop_gpu_time - start_gpu_time).count();
+	}
 
 	fprintf(stdout, "[Mesh] Copy %llu triangles to managed UNIFIED memory \n", (size_t)(mesh->faces.size()));
 	for (size_t i = 0; i < mesh->faces.size(); i++)
@@ -179,6 +189,16 @@ void parseProgramParameters(int argc, char *argv[])
 			}
 			i++;
 		}
+		else if (string(argv[i]) == "-batch")
+		{
+			batch_manifest = argv[i + 1];
+			if (!file_exists(batch_manifest))
+			{
+				fprintf(stdout, "[Err] File does not exist / cannot access: %s \n", batch_manifest.c_str());
+				exit(1);
+			}
+			i++;
+		}
 		else if (string(argv[i]) == "-s")
 		{
 			gridsize = atoi(argv[i + 1]);
@@ -214,9 +234,13 @@ void parseProgramParameters(int argc, char *argv[])
 			{
 				outputformat = OutputFormat::output_obj_points;
 			}
+			else if (output == "sparse")
+			{
+				outputformat = OutputFormat::output_sparse;
+			}
 			else
 			{
-				fprintf(stdout, "[Err] Unrecognized output format: %s, valid options are binvox (default), morton, obj or obj_points \n", output.c_str());
+				fprintf(stdout, "[Err] Unrecognized output format: %s, valid options are binvox (default), morton, obj, obj_points or sparse \n", output.c_str());
 				exit(1);
 			}
 		}
@@ -233,13 +257,25 @@ void parseProgramParameters(int argc, char *argv[])
 			solidVoxelization = true;
 		}
 	}
-	if (!filegiven)
+	if (!filegiven && batch_manifest.empty())
 	{
-		fprintf(stdout, "[Err] You didn't specify a file using -f (path). This is required. Exiting. \n");
+		fprintf(stdout, "[Err] You didn't specify a file using -f (path) or a manifest using -batch (path). This is required. Exiting. \n");
 		printExample();
 		exit(1);
 	}
-	fprintf(stdout, "[Info] Filename: %s \n", filename.c_str());
+	if (outputformat == OutputFormat::output_sparse && (gridsize < 8 || (gridsize & (gridsize - 1)) != 0))
+	{
+		fprintf(stdout, "[Err] Sparse output needs a power of 2 grid size of at least 8. Exiting. \n");
+		exit(1);
+	}
+	if (batch_manifest.empty())
+	{
+		fprintf(stdout, "[Info] Filename: %s \n", filename.c_str());
+	}
+	else
+	{
+		fprintf(stdout, "[Info] Batch manifest: %s \n", batch_manifest.c_str());
+	}
 	fprintf(stdout, "[Info] Grid size: %i \n", gridsize);
 	fprintf(stdout, "[Info] Iterations: %i (default : 1)\n", iterations);
 	fprintf(stdout, "[Info] Output format: %s \n", OutputFormats[int(outputformat)]);
@@ -248,6 +284,364 @@ void parseProgramParameters(int argc, char *argv[])
 	fprintf(stdout, "[Info] Using Solid Voxelization: %s (default: No)\n", solidVoxelization ? "Yes" : "No");
 }
 
+// Write the voxel table in the chosen output format
+void writeOutput(unsigned int *vtable, size_t vtable_size, const voxinfo &voxelization_info, SparseVoxels &sparse, const string &output_filename)
+{
+	if (outputformat == OutputFormat::output_morton)
+	{
+		write_binary(vtable, vtable_size, output_filename);
+	}
+	else if (outputformat == OutputFormat::output_binvox)
+	{
+		write_binvox(vtable, voxelization_info, output_filename);
+	}
+	else if (outputformat == OutputFormat::output_obj_points)
+	{
+		write_obj_pointcloud(vtable, voxelization_info, output_filename);
+	}
+	else if (outputformat == OutputFormat::output_obj_cubes)
+	{
+		write_obj_cubes(vtable, voxelization_info, output_filename);
+	}
+	else if (outputformat == OutputFormat::output_sparse)
+	{
+		// the CPU voxelizer fills the bricks directly, the others leave a morton ordered table
+		if (vtable)
+		{
+			sparse_from_morton(vtable, voxelization_info, sparse);
+		}
+		fprintf(stdout, "[Sparse] %zu bricks: %s instead of %s for the dense voxel table \n", sparse.keys.size(), readableSize(sparse.size()).c_str(), readableSize(vtable_size).c_str());
+		write_sparse(sparse, output_filename);
+	}
+}
+
+// BATCH MODE
+//
+// The manifest lists one model file per line, optionally followed by the grid sizes to voxelize it at
+// (default: -s). Empty lines and lines starting with # are skipped. A loader thread reads the next model
+// while the current one is voxelized and written, and the voxel table and triangle buffer are kept from
+// model to model, they are only reallocated when they have to grow.
+struct BatchItem
+{
+	string filename;
+	vector<unsigned int> gridsizes;
+};
+
+struct BatchBuffers
+{
+	float *triangles = NULL; // managed memory for the triangles of the GPU path
+	size_t triangles_size = 0;
+	unsigned int *vtable = NULL; // voxel table in the memory the voxelization path needs
+	size_t vtable_size = 0;
+};
+
+bool readManifest(const string &manifest, vector<BatchItem> &items)
+{
+	ifstream input(manifest.c_str());
+	if (!input)
+	{
+		fprintf(stdout, "[Err] Cannot read batch manifest %s \n", manifest.c_str());
+		return false;
+	}
+	string line;
+	int line_number = 0;
+	while (getline(input, line))
+	{
+		line_number++;
+		istringstream fields(line);
+		BatchItem item;
+		if (!(fields >> item.filename) || item.filename[0] == '#')
+		{
+			continue;
+		}
+		int size;
+		bool valid = true;
+		while (valid && fields >> size)
+		{
+			valid = size > 0 && (outputformat != OutputFormat::output_sparse || (size >= 8 && (size & (size - 1)) == 0));
+			item.gridsizes.push_back(size);
+		}
+		if (!valid || !fields.eof())
+		{
+			fprintf(stdout, "[Err] Invalid grid size in line %d of %s \n", line_number, manifest.c_str());
+			return false;
+		}
+		if (item.gridsizes.empty())
+		{
+			item.gridsizes.push_back(gridsize);
+		}
+		items.push_back(item);
+	}
+	return true;
+}
+
+// Read a model and prepare it for voxelization, runs on the loader thread
+trimesh::TriMesh *loadMesh(const string mesh_filename)
+{
+	trimesh::TriMesh *mesh = trimesh::TriMesh::read(mesh_filename.c_str());
+	if (mesh)
+	{
+		mesh->need_faces();
+		mesh->need_bbox();
+	}
+	return mesh;
+}
+
+void freeBatchTable(BatchBuffers &buffers, bool gpu)
+{
+	if (buffers.vtable == NULL)
+	{
+		return;
+	}
+	if (!gpu)
+	{
+		free(buffers.vtable);
+	}
+	else
+	{
+		sycl::free(buffers.vtable, sycl_device_queue);
+	}
+	buffers.vtable = NULL;
+	buffers.vtable_size = 0;
+}
+
+// Zero-filled voxel table of vtable_size bytes
+unsigned int *batchTable(BatchBuffers &buffers, size_t vtable_size, bool gpu)
+{
+	if (vtable_size > buffers.vtable_size)
+	{
+		freeBatchTable(buffers, gpu);
+		fprintf(stdout, "[Voxel Grid] Allocating %s for Voxel Grid (kept for the rest of the batch)\n", readableSize(vtable_size).c_str());
+		if (!gpu)
+		{
+			buffers.vtable = (unsigned int *)malloc(vtable_size);
+		}
+		else if (!useThrustPath)
+		{
+			buffers.vtable = (unsigned int *)sycl::malloc_shared(vtable_size, sycl_device_queue);
+		}
+		else
+		{
+			buffers.vtable = (unsigned int *)sycl::malloc_host(vtable_size, sycl_device_queue);
+		}
+		buffers.vtable_size = vtable_size;
+	}
+	// the thrust path copies the whole table back from the device
+	if (!gpu)
+	{
+		memset(buffers.vtable, 0, vtable_size);
+	}
+	else if (!useThrustPath)
+	{
+		auto start_gpu_time = std::chrono::steady_clock::now();
+		sycl_device_queue.memset(buffers.vtable, 0, vtable_size).wait();
+		auto stop_gpu_time = std::chrono::steady_clock::now();
+		total_gpu_time += std::chrono::duration<float, std::milli>(stop_gpu_time - start_gpu_time).count();
+	}
+	return buffers.vtable;
+}
+
+// Managed memory for the triangles of a mesh
+float *batchTriangles(BatchBuffers &buffers, const trimesh::TriMesh *mesh)
+{
+	size_t n_floats = sizeof(float) * 9 * (mesh->faces.size());
+	if (n_floats > buffers.triangles_size)
+	{
+		if (buffers.triangles)
+		{
+			sycl::free(buffers.triangles, sycl_device_queue);
+		}
+		fprintf(stdout, "[Mesh] Allocating %s of managed UNIFIED memory for triangle data \n", (readableSize(n_floats)).c_str());
+		auto start_gpu_time = std::chrono::steady_clock::now();
+		buffers.triangles = (float *)sycl::malloc_shared(n_floats, sycl_device_queue);
+		auto stop_gpu_time = std::chrono::steady_clock::now();
+		total_gpu_time += std::chrono::duration<float, std::milli>(stop_gpu_time - start_gpu_time).count();
+		buffers.triangles_size = n_floats;
+	}
+	return buffers.triangles;
+}
+
+int runBatch()
+{
+	vector<BatchItem> items;
+	if (!readManifest(batch_manifest, items))
+	{
+		return 1;
+	}
+	fprintf(stdout, "[Batch] %zu models in %s \n", items.size(), batch_manifest.c_str());
+	if (items.empty())
+	{
+		return 0;
+	}
+
+	// CUDA initialization
+	bool cuda_ok = false;
+	if (!forceCPU)
+	{
+		fprintf(stdout, "\n## oneAPI INIT \n");
+		cuda_ok = initCuda(sycl_device_queue);
+		if (!cuda_ok)
+			fprintf(stdout, "[Info] GPU not found\n");
+	}
+	const bool gpu = cuda_ok && !forceCPU;
+	// sparse output is built from a morton ordered table
+	const bool morton_code = (outputformat == OutputFormat::output_morton || outputformat == OutputFormat::output_sparse);
+
+	BatchBuffers buffers;
+	int n_models = 0, n_skipped = 0, n_voxelizations = 0;
+	float loadWaitTime = 0.0f;
+	auto batch_start = std::chrono::steady_clock::now();
+	future<trimesh::TriMesh *> next_mesh = async(launch::async, loadMesh, items[0].filename);
+	for (size_t n = 0; n < items.size(); n++)
+	{
+		const BatchItem &item = items[n];
+		fprintf(stdout, "\n## BATCH MODEL %zu / %zu \n", n + 1, items.size());
+		fprintf(stdout, "[I/O] Reading mesh from %s \n", item.filename.c_str());
+		auto wait_start = std::chrono::steady_clock::now();
+		trimesh::TriMesh *themesh = next_mesh.get();
+		loadWaitTime += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+		if (n + 1 < items.size())
+		{
+			next_mesh = async(launch::async, loadMesh, items[n + 1].filename);
+		}
+		if (themesh == NULL || themesh->faces.empty())
+		{
+			fprintf(stdout, "[Err] No triangles read from %s, skipping it \n", item.filename.c_str());
+			delete themesh;
+			n_skipped++;
+			continue;
+		}
+		fprintf(stdout, "[Mesh] Number of triangles: %zu \n", themesh->faces.size());
+		fprintf(stdout, "[Mesh] Number of vertices: %zu \n", themesh->vertices.size());
+		AABox<sycl::float3> bbox_mesh_cubed = createMeshBBCube<sycl::float3>(AABox<sycl::float3>(trimesh_to_sycl(themesh->bbox.min), trimesh_to_sycl(themesh->bbox.max)));
+
+		float *device_triangles = NULL;
+		if (gpu)
+		{
+			device_triangles = useThrustPath ? meshToGPU_thrust(themesh) : meshToGPU_managed(themesh, batchTriangles(buffers, themesh));
+		}
+		// the CPU voxelizer moves the vertices to the origin of the grid, the other grid sizes need the originals
+		vector<trimesh::point> vertices;
+		if (!gpu && item.gridsizes.size() > 1)
+		{
+			vertices = themesh->vertices;
+		}
+
+		for (size_t g = 0; g < item.gridsizes.size(); g++)
+		{
+			voxinfo voxelization_info(bbox_mesh_cubed, sycl::uint3(item.gridsizes[g], item.gridsizes[g], item.gridsizes[g]), themesh->faces.size());
+			voxelization_info.print();
+			size_t vtable_size = static_cast<size_t>(ceil(static_cast<size_t>(voxelization_info.gridsize.x()) * static_cast<size_t>(voxelization_info.gridsize.y()) * static_cast<size_t>(voxelization_info.gridsize.z()) / 32.0f) * 4);
+			unsigned int *vtable = NULL;
+			SparseVoxels sparse;
+			if (gpu)
+			{
+				fprintf(stdout, "\n## GPU VOXELISATION \n");
+				vtable = batchTable(buffers, vtable_size, gpu);
+				if (solidVoxelization)
+				{
+					voxelize_solid(voxelization_info, device_triangles, vtable, useThrustPath, morton_code);
+				}
+				else
+				{
+					voxelize(voxelization_info, device_triangles, vtable, useThrustPath, morton_code);
+				}
+			}
+			else
+			{
+				fprintf(stdout, "\n## CPU VOXELISATION \n");
+				if (g > 0)
+				{
+					themesh->vertices = vertices;
+				}
+				if (outputformat == OutputFormat::output_sparse && !solidVoxelization)
+				{
+					cpu_voxelizer::cpu_voxelize_mesh_sparse(voxelization_info, themesh, sparse);
+				}
+				else
+				{
+					vtable = batchTable(buffers, vtable_size, gpu);
+					if (!solidVoxelization)
+					{
+						cpu_voxelizer::cpu_voxelize_mesh(voxelization_info, themesh, vtable, morton_code);
+					}
+					else
+					{
+						cpu_voxelizer::cpu_voxelize_mesh_solid(voxelization_info, themesh, vtable, morton_code);
+					}
+				}
+			}
+
+			fprintf(stdout, "\n## FILE OUTPUT \n");
+			string output_filename = item.filename + "_SYCL";
+			// morton blobs have no grid size in their file name
+			if (outputformat == OutputFormat::output_morton && item.gridsizes.size() > 1)
+			{
+				output_filename += "_" + to_string(item.gridsizes[g]);
+			}
+			writeOutput(vtable, vtable_size, voxelization_info, sparse, output_filename);
+			n_voxelizations++;
+		}
+		delete themesh;
+		n_models++;
+	}
+	float batchTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - batch_start).count();
+
+	freeBatchTable(buffers, gpu);
+	if (buffers.triangles)
+	{
+		sycl::free(buffers.triangles, sycl_device_queue);
+	}
+	if (gpu && useThrustPath)
+	{
+		cleanup_thrust();
+	}
+
+	fprintf(stdout, "\n## BATCH STATS \n");
+	fprintf(stdout, "[Batch] %d models, %d voxelizations, %d models skipped \n", n_models, n_voxelizations, n_skipped);
+	fprintf(stdout, "[Perf] Batch time: %.2f s, waited %.1f ms for the loader thread \n", batchTime, loadWaitTime);
+	fprintf(stdout, "[Perf] Batch throughput: %.2f meshes/s, %.2f voxelizations/s \n", n_models / batchTime, n_voxelizations / batchTime);
+	if (gpu)
+	{
+		printf("Avg GPU time : %.1f ms\n", total_gpu_time / (n_voxelizations ? n_voxelizations : 1));
+	}
+	return n_skipped ? 1 : 0;
+}
+
+// Convert a sparse voxel file (-f *.svo) to the chosen output format
+int convertSparse()
+{
+	fprintf(stdout, "\n## READ SPARSE VOXELS \n");
+	SparseVoxels sparse;
+	if (!read_sparse(sparse, filename))
+	{
+		return 1;
+	}
+	voxinfo voxelization_info(sparse.bbox, sparse.gridsize, 0);
+	voxelization_info.print();
+	fprintf(stdout, "\n## FILE OUTPUT \n");
+	string output_filename = filename + "_SYCL";
+	if (outputformat == OutputFormat::output_sparse)
+	{
+		writeOutput(NULL, 0, voxelization_info, sparse, output_filename);
+		return 0;
+	}
+	size_t vtable_size = static_cast<size_t>(ceil(static_cast<size_t>(voxelization_info.gridsize.x()) * static_cast<size_t>(voxelization_info.gridsize.y()) * static_cast<size_t>(voxelization_info.gridsize.z()) / 32.0f) * 4);
+	unsigned int *vtable = (unsigned int *)calloc(1, vtable_size);
+	sparse_to_table(sparse, vtable, (outputformat == OutputFormat::output_morton));
+	// spot-check the point queries of the sparse grid against the dense table
+	size_t n_wrong = sparse_check_table(sparse, vtable, (outputformat == OutputFormat::output_morton), 256);
+	if (n_wrong)
+	{
+		fprintf(stdout, "[Err] %zu voxels of the sparse grid differ from the voxel table \n", n_wrong);
+		free(vtable);
+		return 1;
+	}
+	writeOutput(vtable, vtable_size, voxelization_info, sparse, output_filename);
+	free(vtable);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -264,6 +658,14 @@ int main(int argc, char *argv[])
 	parseProgramParameters(argc, argv);
 	fflush(stdout);
 	trimesh::TriMesh::set_verbose(false);
+	if (!batch_manifest.empty())
+	{
+		return runBatch();
+	}
+	if (filename.size() > 4 && filename.substr(filename.size() - 4) == ".svo")
+	{
+		return convertSparse();
+	}
 
 	// READ THE MESH
 	fprintf(stdout, "\n## READ MESH \n");
@@ -289,7 +691,10 @@ int main(int argc, char *argv[])
 	voxinfo voxelization_info(bbox_mesh_cubed, sycl::uint3(gridsize, gridsize, gridsize), themesh->faces.size());
 	voxelization_info.print();
 	// Compute space needed to hold voxel table (1 voxel / bit)
-	unsigned int *vtable; // Both voxelization paths (GPU and CPU) need this
+	unsigned int *vtable = NULL; // Both voxelization paths (GPU and CPU) need this, except CPU voxelization to sparse output
+	SparseVoxels sparse;
+	// sparse output is built from a morton ordered table
+	const bool morton_code = (outputformat == OutputFormat::output_morton || outputformat == OutputFormat::output_sparse);
 	size_t vtable_size = static_cast<size_t>(ceil(static_cast<size_t>(voxelization_info.gridsize.x()) * static_cast<size_t>(voxelization_info.gridsize.y()) * static_cast<size_t>(voxelization_info.gridsize.z()) / 32.0f) * 4);
 
 	// CUDA initialization
@@ -343,11 +748,11 @@ int main(int argc, char *argv[])
 			fprintf(stdout, "\n## GPU VOXELISATION \n");
 			if (solidVoxelization)
 			{
-				voxelize_solid(voxelization_info, device_triangles, vtable, useThrustPath, (outputformat == OutputFormat::output_morton));
+				voxelize_solid(voxelization_info, device_triangles, vtable, useThrustPath, morton_code);
 			}
 			else
 			{
-				voxelize(voxelization_info, device_triangles, vtable, useThrustPath, (outputformat == OutputFormat::output_morton));
+				voxelize(voxelization_info, device_triangles, vtable, useThrustPath, morton_code);
 			}
 		}
 		else
@@ -362,15 +767,20 @@ int main(int argc, char *argv[])
 			{
 				fprintf(stdout, "[Info] Doing CPU voxelization (forced using command-line switch -cpu)\n");
 			}
+			if (outputformat == OutputFormat::output_sparse && !solidVoxelization)
+			{
+				cpu_voxelizer::cpu_voxelize_mesh_sparse(voxelization_info, themesh, sparse);
+				continue;
+			}
 			// allocate zero-filled array
 			vtable = (unsigned int *)calloc(1, vtable_size);
 			if (!solidVoxelization)
 			{
-				cpu_voxelizer::cpu_voxelize_mesh(voxelization_info, themesh, vtable, (outputformat == OutputFormat::output_morton));
+				cpu_voxelizer::cpu_voxelize_mesh(voxelization_info, themesh, vtable, morton_code);
 			}
 			else
 			{
-				cpu_voxelizer::cpu_voxelize_mesh_solid(voxelization_info, themesh, vtable, (outputformat == OutputFormat::output_morton));
+				cpu_voxelizer::cpu_voxelize_mesh_solid(voxelization_info, themesh, vtable, morton_code);
 			}
 		}
 	}
@@ -385,22 +795,7 @@ int main(int argc, char *argv[])
 	string output_filename = filename + "_SYCL";
 
 	auto ioWrite_start = std::chrono::steady_clock::now();
-	if (outputformat == OutputFormat::output_morton)
-	{
-		write_binary(vtable, vtable_size, output_filename);
-	}
-	else if (outputformat == OutputFormat::output_binvox)
-	{
-		write_binvox(vtable, voxelization_info, output_filename);
-	}
-	else if (outputformat == OutputFormat::output_obj_points)
-	{
-		write_obj_pointcloud(vtable, voxelization_info, output_filename);
-	}
-	else if (outputformat == OutputFormat::output_obj_cubes)
-	{
-		write_obj_cubes(vtable, voxelization_info, output_filename);
-	}
+	writeOutput(vtable, vtable_size, voxelization_info, sparse, output_filename);
 	auto ioWrite_end = std::chrono::steady_clock::now();
 	float ioWriteTime = std::chrono::duration<float, std::micro>(ioWrite_end - ioWrite_start).count();
 
@@ -32,9 +32,13 @@ float *meshToGPU_thrust(const trimesh::TriMesh *mesh)
 {
 	Timer t;
 	t.start(); // TIMER START
-			   // create vectors on heap
-	trianglethrust_host = new std::vector<sycl::float3>;
-	trianglethrust_device = new infra::device_vector<sycl::float3>;
+	// create vectors on heap, the meshes of a batch reuse them
+	if (trianglethrust_host == NULL)
+	{
+		trianglethrust_host = new std::vector<sycl::float3>;
+		trianglethrust_device = new infra::device_vector<sycl::float3>;
+	}
+	trianglethrust_host->clear();
 	// fill host vector
 	fprintf(stdout, "[Mesh] Copying %zu triangles to Thrust host vector \n", mesh->faces.size());
 	for (size_t i = 0; i < mesh->faces.size(); i++)
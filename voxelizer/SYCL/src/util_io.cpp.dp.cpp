@@ -24,8 +24,16 @@
 #include "util.h"
 #include "util_io.h"
 #include "TriMesh_algo.h"
+#include "morton_LUTs.h"
 #include <cmath>
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace std;
 
 // helper function to get file length (in number of ASCII characters)
@@ -55,26 +63,154 @@ void read_binary(void *data, const size_t length, const std::string base_filenam
 	return;
 }
 
-// Helper function to write single vertex normal to OBJ file
-static void write_vertex_normal(ofstream &output, const sycl::int3 &v)
+// The writers walk the grid x-major, but the voxel table packs 32 voxels along x into a word (first voxel in
+// the most significant bit). They work on chunks of 32 x columns: for every z the 32x32 blocks of (x, y) bits
+// are transposed, so each word of the chunk holds 32 consecutive y voxels of one x column. The chunks are
+// processed in parallel, a batch at a time, and written in order.
+
+// Transpose a 32x32 bit matrix in place (row i in word i, column 0 in the most significant bit)
+static void transpose32(unsigned int *A)
 {
-	output << "vn " << v.x() << " " << v.y() << " " << v.z() << endl;
+	unsigned int m = 0x0000FFFF;
+	for (int j = 16; j != 0; j = j >> 1, m = m ^ (m << j))
+	{
+		for (int k = 0; k < 32; k = (k + j + 1) & ~j)
+		{
+			unsigned int t = (A[k] ^ (A[k + j] >> j)) & m;
+			A[k] = A[k] ^ t;
+			A[k + j] = A[k + j] ^ (t << j);
+		}
+	}
+}
+
+// Read the 32 bits of the voxel table starting at bit 'location'
+static inline unsigned int read_bits32(const unsigned int *vtable, const size_t location, const size_t n_words)
+{
+	const size_t int_location = location / size_t(32);
+	const unsigned int shift = location % size_t(32);
+	if (shift == 0)
+	{
+		return vtable[int_location];
+	}
+	unsigned int next = (int_location + 1 < n_words) ? (vtable[int_location + 1] >> (32 - shift)) : 0;
+	return (vtable[int_location] << shift) | next;
+}
+
+// Fill cols with the y words of the x columns x0 .. x0+31, column c at cols[(c * gz + z) * ny_words + y / 32]
+static void gather_columns(const unsigned int *vtable, const sycl::uint3 gridsize, const size_t x0, std::vector<unsigned int> &cols)
+{
+	const size_t gx = gridsize.x(), gy = gridsize.y(), gz = gridsize.z();
+	const size_t n_words = (gx * gy * gz + 31) / 32;
+	const size_t ny_words = (gy + 31) / 32;
+	cols.resize(32 * gz * ny_words);
+	unsigned int block[32];
+	for (size_t z = 0; z < gz; z++)
+	{
+		for (size_t yw = 0; yw < ny_words; yw++)
+		{
+			for (size_t r = 0; r < 32; r++)
+			{
+				size_t y = yw * 32 + r;
+				block[r] = (y < gy) ? read_bits32(vtable, x0 + (y * gx) + (z * gx * gy), n_words) : 0;
+			}
+			transpose32(block);
+			for (size_t c = 0; c < 32; c++)
+			{
+				cols[(c * gz + z) * ny_words + yw] = block[c];
+			}
+		}
+	}
+}
+
+static inline int getNumThreads()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+// Print the 25/50/75% marks passed after 'done' of 'total' x columns
+static void print_progress(const size_t done, const size_t total, int &quarter)
+{
+	while (quarter < 3 && done * 4 >= size_t(quarter + 1) * total)
+	{
+		quarter++;
+		fprintf(stdout, "%d%%...", quarter * 25);
+	}
+}
+
+// Call encode(chunk, x0, n_columns, cols) for all chunks of x columns, several of them in parallel,
+// and write(chunk) for each of them in order
+template <typename Chunk, typename Encode, typename Write>
+static void process_chunks(const unsigned int *vtable, const sycl::uint3 gridsize, Encode encode, Write write, bool progress)
+{
+	const size_t gx = gridsize.x();
+	const int n_chunks = int((gx + 31) / 32);
+	const int batch = 2 * getNumThreads();
+	std::vector<Chunk> chunks(batch);
+	int quarter = 0;
+	for (int first = 0; first < n_chunks; first += batch)
+	{
+		const int n = std::min(batch, n_chunks - first);
+#pragma omp parallel
+		{
+			std::vector<unsigned int> cols;
+#pragma omp for schedule(dynamic)
+			for (int i = 0; i < n; i++)
+			{
+				size_t x0 = size_t(first + i) * 32;
+				gather_columns(vtable, gridsize, x0, cols);
+				encode(chunks[i], x0, std::min(size_t(32), gx - x0), cols);
+			}
+		}
+		for (int i = 0; i < n; i++)
+		{
+			write(chunks[i]);
+		}
+		if (progress)
+		{
+			print_progress(std::min(size_t(first + n) * 32, gx), gx, quarter);
+		}
+	}
+}
+
+static inline void append_uint(std::string &text, size_t value)
+{
+	char digits[24];
+	int n = 0;
+	do
+	{
+		digits[n++] = char('0' + value % 10);
+		value /= 10;
+	} while (value);
+	while (n)
+	{
+		text.push_back(digits[--n]);
+	}
 }
 
-// Helper function to write single vertex to OBJ file
-static void write_vertex(ofstream &output, const sycl::int3 &v)
+// Helper function to write single vertex normal to OBJ file
+static void write_vertex_normal(ofstream &output, const sycl::int3 &v)
 {
-	output << "v " << v.x() << " " << v.y() << " " << v.z() << endl;
+	output << "vn " << v.x() << " " << v.y() << " " << v.z() << endl;
 }
 
-// Helper function to write single vertex
-static void write_face(ofstream &output, const sycl::int3 &v)
+// Helper function to write single vertex to OBJ text
+static void append_vertex(std::string &text, const size_t x, const size_t y, const size_t z)
 {
-	output << "f " << v.x() << " " << v.y() << " " << v.z() << endl;
+	text += "v ";
+	append_uint(text, x);
+	text += ' ';
+	append_uint(text, y);
+	text += ' ';
+	append_uint(text, z);
+	text += '\n';
 }
 
 // Helper function to write full cube (using relative vertex positions in the OBJ file - support for this should be widespread by now)
-void write_cube(const size_t &x, const size_t &y, const size_t &z, ofstream &output)
+static void append_cube(std::string &text, const size_t x, const size_t y, const size_t z)
 {
 	//	   2-------1
 	//	  /|      /|
@@ -83,43 +219,55 @@ void write_cube(const size_t &x, const size_t &y, const size_t &z, ofstream &out
 	//	|  4----|--3
 	//	| /     | /
 	//	5-------6
-	// Create vertices
-	sycl::int3 v1(x + 1, y + 1, z + 1);
-	sycl::int3 v2(x, y + 1, z + 1);
-	sycl::int3 v3(x + 1, y, z + 1);
-	sycl::int3 v4(x, y, z + 1);
-	sycl::int3 v5(x, y, z);
-	sycl::int3 v6(x + 1, y, z);
-	sycl::int3 v7(x, y + 1, z);
-	sycl::int3 v8(x + 1, y + 1, z);
-	// write them in reverse order, so relative position is -i for v_i
-	write_vertex(output, v8);
-	write_vertex(output, v7);
-	write_vertex(output, v6);
-	write_vertex(output, v5);
-	write_vertex(output, v4);
-	write_vertex(output, v3);
-	write_vertex(output, v2);
-	write_vertex(output, v1);
-	// create faces
-	// back
-	write_face(output, sycl::int3(-1, -3, -4));
-	write_face(output, sycl::int3(-1, -4, -2));
-	// bottom
-	write_face(output, sycl::int3(-4, -3, -6));
-	write_face(output, sycl::int3(-4, -6, -5));
-	// right
-	write_face(output, sycl::int3(-3, -1, -8));
-	write_face(output, sycl::int3(-3, -8, -6));
-	// top
-	write_face(output, sycl::int3(-1, -2, -7));
-	write_face(output, sycl::int3(-1, -7, -8));
-	// left
-	write_face(output, sycl::int3(-2, -4, -5));
-	write_face(output, sycl::int3(-2, -5, -7));
-	// front
-	write_face(output, sycl::int3(-5, -6, -8));
-	write_face(output, sycl::int3(-5, -8, -7));
+	// write the vertices in reverse order, so relative position is -i for v_i
+	append_vertex(text, x + 1, y + 1, z); // v8
+	append_vertex(text, x, y + 1, z); // v7
+	append_vertex(text, x + 1, y, z); // v6
+	append_vertex(text, x, y, z); // v5
+	append_vertex(text, x, y, z + 1); // v4
+	append_vertex(text, x + 1, y, z + 1); // v3
+	append_vertex(text, x, y + 1, z + 1); // v2
+	append_vertex(text, x + 1, y + 1, z + 1); // v1
+	// faces: back, bottom, right, top, left, front
+	text +=
+		"f -1 -3 -4\nf -1 -4 -2\n"
+		"f -4 -3 -6\nf -4 -6 -5\n"
+		"f -3 -1 -8\nf -3 -8 -6\n"
+		"f -1 -2 -7\nf -1 -7 -8\n"
+		"f -2 -4 -5\nf -2 -5 -7\n"
+		"f -5 -6 -8\nf -5 -8 -7\n";
+}
+
+// Call voxel(x, y, z) for the set voxels of a chunk in x, y, z order
+template <typename Voxel>
+static void for_each_voxel(const std::vector<unsigned int> &cols, const sycl::uint3 gridsize, const size_t x0, const size_t n_columns, Voxel voxel)
+{
+	const size_t gz = gridsize.z();
+	const size_t ny_words = (size_t(gridsize.y()) + 31) / 32;
+	for (size_t c = 0; c < n_columns; c++)
+	{
+		for (size_t yw = 0; yw < ny_words; yw++)
+		{
+			// rows of this y word that have any voxel set
+			unsigned int rows = 0;
+			for (size_t z = 0; z < gz; z++)
+			{
+				rows |= cols[(c * gz + z) * ny_words + yw];
+			}
+			while (rows)
+			{
+				int r = __builtin_clz(rows);
+				rows &= ~(0x80000000u >> r);
+				for (size_t z = 0; z < gz; z++)
+				{
+					if (cols[(c * gz + z) * ny_words + yw] & (0x80000000u >> r))
+					{
+						voxel(x0 + c, yw * 32 + r, z);
+					}
+				}
+			}
+		}
+	}
 }
 
 void write_obj_cubes(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename)
@@ -128,7 +276,7 @@ void write_obj_cubes(const unsigned int *vtable, const voxinfo v_info, const std
 #ifndef SILENT
 	fprintf(stdout, "[I/O] Writing data in obj voxels format to file %s \n", filename_output.c_str());
 #endif
-	ofstream output(filename_output.c_str(), ios::out);
+	ofstream output(filename_output.c_str(), ios::out | ios::binary);
 
 	// Write vertex normals once
 	// write_vertex_normal(output, sycl::int3(0, 0, -1)); // forward = 1
@@ -139,41 +287,18 @@ void write_obj_cubes(const unsigned int *vtable, const voxinfo v_info, const std
 	// write_vertex_normal(output, sycl::int3(0, 1, 0)); // top = 6
 
 	// Write stats
-	size_t voxels_seen = 0;
-	const size_t write_stats_25 = (size_t(v_info.gridsize.x()) * size_t(v_info.gridsize.y()) * size_t(v_info.gridsize.z())) / 4.0f;
 	fprintf(stdout, "[I/O] Writing to file: 0%%...");
 
-	// size_t voxels_written = 0;
 	assert(output);
-	for (size_t x = 0; x < v_info.gridsize.x(); x++)
-	{
-		for (size_t y = 0; y < v_info.gridsize.y(); y++)
+	process_chunks<std::string>(vtable, v_info.gridsize,
+		[&](std::string &text, size_t x0, size_t n_columns, const std::vector<unsigned int> &cols)
 		{
-			for (size_t z = 0; z < v_info.gridsize.z(); z++)
-			{
-				voxels_seen++;
-				if (voxels_seen == write_stats_25)
-				{
-					fprintf(stdout, "25%%...");
-				}
-				else if (voxels_seen == write_stats_25 * size_t(2))
-				{
-					fprintf(stdout, "50%%...");
-				}
-				else if (voxels_seen == write_stats_25 * size_t(3))
-				{
-					fprintf(stdout, "75%%...");
-				}
-				if (checkVoxel(x, y, z, v_info.gridsize, vtable))
-				{
-					// voxels_written += 1;
-					write_cube(x, y, z, output);
-				}
-			}
-		}
-	}
+			text.clear();
+			for_each_voxel(cols, v_info.gridsize, x0, n_columns, [&](size_t x, size_t y, size_t z) { append_cube(text, x, y, z); });
+		},
+		[&](const std::string &text) { output.write(text.data(), text.size()); }, true);
 	fprintf(stdout, "100%% \n");
-	// std::cout << "written " << voxels_written << std::endl;
+	output.close();
 
 	fprintf(stdout, "[I/O] Reordering / Optimizing mesh with Trimesh2 \n");
 	// Load the file using TriMesh2
@@ -185,8 +310,6 @@ void write_obj_cubes(const unsigned int *vtable, const voxinfo v_info, const std
 	// temp_mesh->need_normals();
 	fprintf(stdout, "[I/O] Writing final mesh to file %s \n", filename_output.c_str());
 	temp_mesh->write(filename_output.c_str());
-
-	output.close();
 }
 
 void write_obj_pointcloud(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename)
@@ -195,46 +318,25 @@ void write_obj_pointcloud(const unsigned int *vtable, const voxinfo v_info, cons
 #ifndef SILENT
 	fprintf(stdout, "[I/O] Writing data in obj point cloud format to %s \n", filename_output.c_str());
 #endif
-	ofstream output(filename_output.c_str(), ios::out);
+	ofstream output(filename_output.c_str(), ios::out | ios::binary);
 
 	// Write stats
-	size_t voxels_seen = 0;
-	const size_t write_stats_25 = (size_t(v_info.gridsize.x()) * size_t(v_info.gridsize.y()) * size_t(v_info.gridsize.z())) / 4.0f;
 	fprintf(stdout, "[I/O] Writing to file: 0%%...");
 
-	// write stats
-	size_t voxels_written = 0;
-
 	assert(output);
-	for (size_t x = 0; x < v_info.gridsize.x(); x++)
-	{
-		for (size_t y = 0; y < v_info.gridsize.y(); y++)
+	process_chunks<std::string>(vtable, v_info.gridsize,
+		[&](std::string &text, size_t x0, size_t n_columns, const std::vector<unsigned int> &cols)
 		{
-			for (size_t z = 0; z < v_info.gridsize.z(); z++)
+			text.clear();
+			for_each_voxel(cols, v_info.gridsize, x0, n_columns, [&](size_t x, size_t y, size_t z)
 			{
-				voxels_seen++;
-				if (voxels_seen == write_stats_25)
-				{
-					fprintf(stdout, "25%%...");
-				}
-				else if (voxels_seen == write_stats_25 * size_t(2))
-				{
-					fprintf(stdout, "50%%...");
-				}
-				else if (voxels_seen == write_stats_25 * size_t(3))
-				{
-					fprintf(stdout, "75%%...");
-				}
-				if (checkVoxel(x, y, z, v_info.gridsize, vtable))
-				{
-					voxels_written += 1;
-					output << "v " << (x + 0.5) << " " << (y + 0.5) << " " << (z + 0.5) << endl; // +0.5 to put vertex in the middle of the voxel
-				}
-			}
-		}
-	}
+				char line[96];
+				int n = snprintf(line, sizeof(line), "v %g %g %g\n", x + 0.5, y + 0.5, z + 0.5); // +0.5 to put vertex in the middle of the voxel
+				text.append(line, n);
+			});
+		},
+		[&](const std::string &text) { output.write(text.data(), text.size()); }, true);
 	fprintf(stdout, "100%% \n");
-	// std::cout << "written " << voxels_written << std::endl;
 	output.close();
 }
 
@@ -249,6 +351,85 @@ void write_binary(void *data, size_t bytes, const std::string base_filename)
 	output.close();
 }
 
+// Run-length encoded binvox data of a chunk. The first and the last run are kept apart, because they may
+// continue in the neighbouring chunks.
+struct BinvoxChunk
+{
+	unsigned char first_value, last_value;
+	size_t first_run, last_run;
+	bool single_run; // the chunk is one run, first and last are the same
+	std::vector<unsigned char> data; // (value, count) pairs between the first and the last run
+};
+
+// Binvox counts are single bytes: longer runs are split into runs of 255
+static void append_run(std::vector<unsigned char> &data, const unsigned char value, size_t run)
+{
+	while (run > 255)
+	{
+		data.push_back(value);
+		data.push_back(255);
+		run -= 255;
+	}
+	data.push_back(value);
+	data.push_back((unsigned char)run);
+}
+
+// Encode the voxels of a chunk in binvox order (x, then z, then y), a y word at a time
+static void encode_binvox_chunk(BinvoxChunk &chunk, const std::vector<unsigned int> &cols, const sycl::uint3 gridsize, const size_t n_columns)
+{
+	const size_t gy = gridsize.y(), gz = gridsize.z();
+	const size_t ny_words = (gy + 31) / 32;
+	unsigned int value = cols[0] >> 31;
+	size_t run = 0;
+	bool have_first = false;
+	chunk.data.clear();
+	for (size_t c = 0; c < n_columns; c++)
+	{
+		for (size_t z = 0; z < gz; z++)
+		{
+			for (size_t yw = 0; yw < ny_words; yw++)
+			{
+				unsigned int word = cols[(c * gz + z) * ny_words + yw];
+				size_t n_bits = std::min(size_t(32), gy - yw * 32);
+				while (n_bits)
+				{
+					// leading zeros of diff are the voxels that continue the current run
+					unsigned int diff = value ? ~word : word;
+					size_t same = diff ? __builtin_clz(diff) : 32;
+					if (same >= n_bits)
+					{
+						run += n_bits;
+						break;
+					}
+					run += same;
+					if (have_first)
+					{
+						append_run(chunk.data, value, run);
+					}
+					else
+					{
+						chunk.first_value = value;
+						chunk.first_run = run;
+						have_first = true;
+					}
+					value ^= 1;
+					run = 0;
+					word <<= same;
+					n_bits -= same;
+				}
+			}
+		}
+	}
+	chunk.last_value = value;
+	chunk.last_run = run;
+	chunk.single_run = !have_first;
+	if (chunk.single_run)
+	{
+		chunk.first_value = value;
+		chunk.first_run = run;
+	}
+}
+
 void write_binvox(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename)
 {
 	// Open file
@@ -270,37 +451,319 @@ void write_binvox(const unsigned int *vtable, const voxinfo v_info, const std::s
 	output << "data" << endl;
 
 	// Write BINARY Data (and compress it a bit using run-length encoding)
-	char currentvalue, current_seen;
-	for (size_t x = 0; x < v_info.gridsize.x(); x++)
-	{
-		for (size_t z = 0; z < v_info.gridsize.z(); z++)
+	// The chunks are encoded in parallel; a run that crosses a chunk border is carried over to the next chunk
+	unsigned char carry_value = 0;
+	size_t carry_run = 0;
+	std::vector<unsigned char> carry_data;
+	process_chunks<BinvoxChunk>(vtable, v_info.gridsize,
+		[&](BinvoxChunk &chunk, size_t x0, size_t n_columns, const std::vector<unsigned int> &cols)
+		{
+			encode_binvox_chunk(chunk, cols, v_info.gridsize, n_columns);
+		},
+		[&](const BinvoxChunk &chunk)
 		{
-			for (size_t y = 0; y < v_info.gridsize.y(); y++)
+			if (carry_run && chunk.first_value == carry_value)
 			{
-				if (x == 0 && y == 0 && z == 0)
-				{ // special case: first voxel
-					currentvalue = checkVoxel(0, 0, 0, v_info.gridsize, vtable);
-					output.write((char *)&currentvalue, 1);
-					current_seen = 1;
-					continue;
-				}
-				char nextvalue = checkVoxel(x, y, z, v_info.gridsize, vtable);
-				if (nextvalue != currentvalue || current_seen == (char)255)
+				carry_run += chunk.first_run;
+			}
+			else
+			{
+				if (carry_run)
 				{
-					output.write((char *)&current_seen, 1);
-					current_seen = 1;
-					currentvalue = nextvalue;
-					output.write((char *)&currentvalue, 1);
+					carry_data.clear();
+					append_run(carry_data, carry_value, carry_run);
+					output.write((char *)carry_data.data(), carry_data.size());
 				}
-				else
+				carry_value = chunk.first_value;
+				carry_run = chunk.first_run;
+			}
+			if (!chunk.single_run)
+			{
+				carry_data.clear();
+				append_run(carry_data, carry_value, carry_run);
+				output.write((char *)carry_data.data(), carry_data.size());
+				output.write((char *)chunk.data.data(), chunk.data.size());
+				carry_value = chunk.last_value;
+				carry_run = chunk.last_run;
+			}
+		}, false);
+
+	// Write rest
+	carry_data.clear();
+	append_run(carry_data, carry_value, carry_run);
+	output.write((char *)carry_data.data(), carry_data.size());
+	output.close();
+}
+
+// Encode morton code using LUT table
+static uint64_t morton_encode(unsigned int x, unsigned int y, unsigned int z)
+{
+	uint64_t answer = 0;
+	answer = host_morton256_z[(z >> 16) & 0xFF] | host_morton256_y[(y >> 16) & 0xFF] | host_morton256_x[(x >> 16) & 0xFF];
+	answer = answer << 48 | host_morton256_z[(z >> 8) & 0xFF] | host_morton256_y[(y >> 8) & 0xFF] | host_morton256_x[(x >> 8) & 0xFF];
+	answer = answer << 24 | host_morton256_z[(z) & 0xFF] | host_morton256_y[(y) & 0xFF] | host_morton256_x[(x) & 0xFF];
+	return answer;
+}
+
+static void morton_decode(uint64_t code, size_t &x, size_t &y, size_t &z)
+{
+	x = y = z = 0;
+	for (int b = 0; code; b++, code >>= 3)
+	{
+		x |= size_t(code & 1) << b;
+		y |= size_t((code >> 1) & 1) << b;
+		z |= size_t((code >> 2) & 1) << b;
+	}
+}
+
+bool SparseVoxels::checkVoxel(size_t x, size_t y, size_t z) const
+{
+	uint64_t key = morton_encode(x >> 3, y >> 3, z >> 3);
+	std::vector<uint64_t>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+	if (it == keys.end() || *it != key)
+	{
+		return false;
+	}
+	const unsigned int *brick = &bricks[(it - keys.begin()) * SPARSE_BRICK_WORDS];
+	uint64_t location = morton_encode(x & 7, y & 7, z & 7);
+	return (brick[location / 32] >> (31 - location % 32)) & 1;
+}
+
+// Append the non-empty bricks of a morton ordered table whose first bit is at location_offset
+void sparse_add_bricks(SparseVoxels &sparse, const unsigned int *mtable, const size_t n_bits, const uint64_t location_offset)
+{
+	const size_t n_bricks = n_bits / 512;
+	for (size_t b = 0; b < n_bricks; b++)
+	{
+		const unsigned int *brick = mtable + b * SPARSE_BRICK_WORDS;
+		unsigned int any = 0;
+		for (int w = 0; w < SPARSE_BRICK_WORDS; w++)
+		{
+			any |= brick[w];
+		}
+		if (any)
+		{
+			sparse.keys.push_back(location_offset / 512 + b);
+			sparse.bricks.insert(sparse.bricks.end(), brick, brick + SPARSE_BRICK_WORDS);
+		}
+	}
+}
+
+// Collect the bricks of a morton ordered voxel table, several parts of the table in parallel
+void sparse_from_morton(const unsigned int *vtable, const voxinfo v_info, SparseVoxels &sparse)
+{
+	const size_t n_bits = size_t(v_info.gridsize.x()) * size_t(v_info.gridsize.y()) * size_t(v_info.gridsize.z());
+	const size_t part_bits = size_t(1) << 24;
+	const int64_t n_parts = int64_t((n_bits + part_bits - 1) / part_bits);
+	std::vector<SparseVoxels> parts(n_parts);
+#pragma omp parallel for schedule(dynamic)
+	for (int64_t p = 0; p < n_parts; p++)
+	{
+		size_t first = size_t(p) * part_bits;
+		sparse_add_bricks(parts[p], vtable + first / 32, std::min(part_bits, n_bits - first), first);
+	}
+	sparse.gridsize = v_info.gridsize;
+	sparse.bbox = v_info.bbox;
+	sparse.keys.clear();
+	sparse.bricks.clear();
+	for (int64_t p = 0; p < n_parts; p++)
+	{
+		sparse.keys.insert(sparse.keys.end(), parts[p].keys.begin(), parts[p].keys.end());
+		sparse.bricks.insert(sparse.bricks.end(), parts[p].bricks.begin(), parts[p].bricks.end());
+	}
+}
+
+// Fill a zeroed dense voxel table, in morton or linear order, with the bricks
+void sparse_to_table(const SparseVoxels &sparse, unsigned int *vtable, bool morton_order)
+{
+	const size_t gx = sparse.gridsize.x(), gy = sparse.gridsize.y();
+	const int64_t n_bricks = int64_t(sparse.keys.size());
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int64_t b = 0; b < n_bricks; b++)
+	{
+		const unsigned int *brick = &sparse.bricks[b * SPARSE_BRICK_WORDS];
+		if (morton_order)
+		{
+			std::copy(brick, brick + SPARSE_BRICK_WORDS, vtable + sparse.keys[b] * SPARSE_BRICK_WORDS);
+			continue;
+		}
+		size_t bx, by, bz;
+		morton_decode(sparse.keys[b], bx, by, bz);
+		for (unsigned int i = 0; i < 512; i++)
+		{
+			if (!((brick[i / 32] >> (31 - i % 32)) & 1))
+			{
+				continue;
+			}
+			size_t x, y, z;
+			morton_decode(i, x, y, z);
+			size_t location = (bx * 8 + x) + ((by * 8 + y) * gx) + ((bz * 8 + z) * gx * gy);
+			unsigned int mask = 0x80000000u >> (location % 32);
+			// bricks that are neighbours along x share words of the linear table
+#pragma omp atomic
+			vtable[location / 32] |= mask;
+		}
+	}
+}
+
+// Compare every voxel of up to max_bricks evenly spaced bricks, queried through SparseVoxels::checkVoxel,
+// with a dense table filled by sparse_to_table. Returns the number of voxels that differ.
+size_t sparse_check_table(const SparseVoxels &sparse, const unsigned int *vtable, bool morton_order, size_t max_bricks)
+{
+	const size_t n_bricks = sparse.keys.size();
+	const size_t step = std::max(size_t(1), n_bricks / std::max(size_t(1), max_bricks));
+	size_t n_wrong = 0;
+	for (size_t b = 0; b < n_bricks; b += step)
+	{
+		size_t bx, by, bz;
+		morton_decode(sparse.keys[b], bx, by, bz);
+		for (size_t z = bz * 8; z < std::min(bz * 8 + 8, size_t(sparse.gridsize.z())); z++)
+		{
+			for (size_t y = by * 8; y < std::min(by * 8 + 8, size_t(sparse.gridsize.y())); y++)
+			{
+				for (size_t x = bx * 8; x < std::min(bx * 8 + 8, size_t(sparse.gridsize.x())); x++)
 				{
-					current_seen++;
+					bool dense;
+					if (morton_order)
+					{
+						uint64_t location = morton_encode(x, y, z);
+						dense = (vtable[location / 32] >> (31 - location % 32)) & 1;
+					}
+					else
+					{
+						dense = checkVoxel(x, y, z, sparse.gridsize, vtable);
+					}
+					n_wrong += dense != sparse.checkVoxel(x, y, z);
 				}
 			}
 		}
 	}
+	return n_wrong;
+}
 
-	// Write rest
-	output.write((char *)&current_seen, 1);
+// Sparse voxel file: header, the octree above the bricks and the bricks
+//
+// Level 0 of the octree is the whole grid, level 'levels' are the bricks. For every node of levels
+// 0 .. levels-1 that has bricks below it, a byte with one bit per non-empty child (child i = morton digit i)
+// is stored, level by level and in morton order within a level. The keys of the bricks follow from the
+// masks. The bricks come last, SPARSE_BRICK_WORDS words each, in key order.
+struct SparseFileHeader
+{
+	char magic[4]; // "VXSB"
+	uint32_t version;
+	uint32_t gridsize[3];
+	float bbox_min[3], bbox_max[3];
+	uint32_t levels;
+	uint64_t n_bricks;
+};
+
+#define SPARSE_FILE_VERSION 1
+
+void write_sparse(const SparseVoxels &sparse, const std::string base_filename)
+{
+	string filename_output = base_filename + string("_") + to_string(sparse.gridsize.x()) + string(".svo");
+	SparseFileHeader header;
+	memcpy(header.magic, "VXSB", 4);
+	header.version = SPARSE_FILE_VERSION;
+	for (int k = 0; k < 3; k++)
+	{
+		header.gridsize[k] = sparse.gridsize[k];
+		header.bbox_min[k] = sparse.bbox.min[k];
+		header.bbox_max[k] = sparse.bbox.max[k];
+	}
+	header.levels = 0;
+	while ((size_t(8) << header.levels) < sparse.gridsize.x())
+	{
+		header.levels++;
+	}
+	header.n_bricks = sparse.keys.size();
+
+	// child masks, level by level: the nodes of a level are the distinct key prefixes
+	std::vector<unsigned char> masks;
+	for (uint32_t level = 0; level < header.levels && !sparse.keys.empty(); level++)
+	{
+		const int shift = 3 * (header.levels - level);
+		uint64_t node = sparse.keys[0] >> shift;
+		unsigned char mask = 0;
+		for (size_t b = 0; b < sparse.keys.size(); b++)
+		{
+			if ((sparse.keys[b] >> shift) != node)
+			{
+				masks.push_back(mask);
+				node = sparse.keys[b] >> shift;
+				mask = 0;
+			}
+			mask |= 1 << ((sparse.keys[b] >> (shift - 3)) & 7);
+		}
+		masks.push_back(mask);
+	}
+#ifndef SILENT
+	fprintf(stdout, "[I/O] Writing data in sparse voxel format to %s (%zu bricks, %s) \n", filename_output.c_str(), sparse.keys.size(),
+		readableSize(sizeof(header) + masks.size() + sparse.bricks.size() * sizeof(unsigned int)).c_str());
+#endif
+	ofstream output(filename_output.c_str(), ios::out | ios::binary);
+	assert(output);
+	output.write((char *)&header, sizeof(header));
+	output.write((char *)masks.data(), masks.size());
+	output.write((char *)sparse.bricks.data(), sparse.bricks.size() * sizeof(unsigned int));
 	output.close();
-}
\ No newline at end of file
+}
+
+bool read_sparse(SparseVoxels &sparse, const std::string filename)
+{
+	std::ifstream input(filename.c_str(), ios_base::in | ios_base::binary);
+	if (!input)
+	{
+		fprintf(stdout, "[Err] Cannot open sparse voxel file %s \n", filename.c_str());
+		return false;
+	}
+	SparseFileHeader header;
+	if (!input.read((char *)&header, sizeof(header)) || memcmp(header.magic, "VXSB", 4) || header.version != SPARSE_FILE_VERSION
+		|| header.levels > 20 || header.gridsize[0] != (8u << header.levels))
+	{
+		fprintf(stdout, "[Err] %s is not a sparse voxel file \n", filename.c_str());
+		return false;
+	}
+#ifndef SILENT
+	fprintf(stdout, "[I/O] Reading %llu bricks of sparse voxel data from file %s \n", (unsigned long long)header.n_bricks, filename.c_str());
+#endif
+	sparse.gridsize = sycl::uint3(header.gridsize[0], header.gridsize[1], header.gridsize[2]);
+	sparse.bbox = AABox<sycl::float3>(sycl::float3(header.bbox_min[0], header.bbox_min[1], header.bbox_min[2]),
+		sycl::float3(header.bbox_max[0], header.bbox_max[1], header.bbox_max[2]));
+
+	// expand the child masks level by level into the keys of the nodes below
+	sparse.keys.assign(1, 0);
+	if (header.n_bricks == 0)
+	{
+		sparse.keys.clear();
+	}
+	std::vector<uint64_t> children;
+	std::vector<unsigned char> masks;
+	for (uint32_t level = 0; level < header.levels && !sparse.keys.empty(); level++)
+	{
+		masks.resize(sparse.keys.size());
+		if (!input.read((char *)masks.data(), masks.size()))
+		{
+			break;
+		}
+		children.clear();
+		for (size_t n = 0; n < sparse.keys.size(); n++)
+		{
+			for (int c = 0; c < 8; c++)
+			{
+				if (masks[n] & (1 << c))
+				{
+					children.push_back(sparse.keys[n] * 8 + c);
+				}
+			}
+		}
+		sparse.keys.swap(children);
+	}
+	sparse.bricks.resize(sparse.keys.size() * SPARSE_BRICK_WORDS);
+	if (!input || sparse.keys.size() != header.n_bricks || !input.read((char *)sparse.bricks.data(), sparse.bricks.size() * sizeof(unsigned int)))
+	{
+		fprintf(stdout, "[Err] Corrupted sparse voxel file %s \n", filename.c_str());
+		return false;
+	}
+	return true;
+}
@@ -3,6 +3,8 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <stdint.h>
 #include "util.h"
 
 size_t get_file_length(const std::string base_filename);
@@ -11,3 +13,26 @@ void write_binary(void *data, const size_t bytes, const std::string base_filenam
 void write_binvox(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename);
 void write_obj_pointcloud(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename);
 void write_obj_cubes(const unsigned int *vtable, const voxinfo v_info, const std::string base_filename);
+
+// Sparse voxel grid: the non-empty 8x8x8 bricks of a morton ordered voxel table, sorted by morton code.
+// A brick is 512 consecutive bits of the morton table, so its key is the morton code of the brick position
+// (voxel position / 8) and its bits keep the order of the morton table.
+#define SPARSE_BRICK_WORDS 16
+
+struct SparseVoxels
+{
+	sycl::uint3 gridsize;
+	AABox<sycl::float3> bbox;
+	std::vector<uint64_t> keys;
+	std::vector<unsigned int> bricks; // SPARSE_BRICK_WORDS words per key
+
+	bool checkVoxel(size_t x, size_t y, size_t z) const;
+	size_t size() const { return keys.size() * (sizeof(uint64_t) + SPARSE_BRICK_WORDS * sizeof(unsigned int)); }
+};
+
+void sparse_add_bricks(SparseVoxels &sparse, const unsigned int *mtable, const size_t n_bits, const uint64_t location_offset);
+void sparse_from_morton(const unsigned int *vtable, const voxinfo v_info, SparseVoxels &sparse);
+void sparse_to_table(const SparseVoxels &sparse, unsigned int *vtable, bool morton_order);
+size_t sparse_check_table(const SparseVoxels &sparse, const unsigned int *vtable, bool morton_order, size_t max_bricks);
+void write_sparse(const SparseVoxels &sparse, const std::string base_filename);
+bool read_sparse(SparseVoxels &sparse, const std::string filename);